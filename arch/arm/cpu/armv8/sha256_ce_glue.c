@@ -7,15 +7,31 @@
 
 #include <common.h>
 #include <u-boot/sha256.h>
+#include <u-boot/sha_impl.h>
+#include <asm/system.h>
 
 extern void sha256_armv8_ce_process(uint32_t state[8], uint8_t const *src,
 				    uint32_t blocks);
 
-void sha256_process(sha256_context *ctx, const unsigned char *data,
-		    unsigned int blocks)
+/* Not all ARMv8.0 cores have the SHA-256 instructions */
+static bool sha256_ce_probe(void)
 {
-	if (!blocks)
-		return;
+	uint64_t reg;
 
-	sha256_armv8_ce_process(ctx->state, data, blocks);
+	__asm__ volatile("mrs %0, ID_AA64ISAR0_EL1\n" : "=r" (reg));
+	return !!(reg & ID_AA64ISAR0_EL1_SHA2);
 }
+
+static void sha256_ce_process(void *state, const uint8_t *data,
+			      unsigned int blocks)
+{
+	sha256_armv8_ce_process(state, data, blocks);
+}
+
+U_BOOT_SHA_IMPL(sha256_armv8_ce) = {
+	.name		= "armv8-ce",
+	.algo		= SHA_IMPL_SHA256,
+	.priority	= 100,
+	.probe		= sha256_ce_probe,
+	.process	= sha256_ce_process,
+};
@@ -23,6 +23,8 @@ DECLARE_GLOBAL_DATA_PTR;
 
 /* Enable access to PCI memory with map_sysmem() */
 static bool enable_pci_map;
+static void (*mmio_hook)(void *ctx, void *addr);
+static void *mmio_hook_ctx;
 
 #ifdef CONFIG_PCI
 /* Last device that was mapped into memory, and length of mapping */
@@ -271,6 +273,9 @@ void sandbox_write(void *addr, unsigned int val, enum sandboxio_size_t size)
 		*(u64 *)addr = val;
 		break;
 	}
+
+	if (mmio_hook)
+		mmio_hook(mmio_hook_ctx, addr);
 }
 
 void sandbox_set_enable_memio(bool enable)
@@ -280,6 +285,12 @@ void sandbox_set_enable_memio(bool enable)
 	state->allow_memio = enable;
 }
 
+void sandbox_set_mmio_hook(void (*hook)(void *ctx, void *addr), void *ctx)
+{
+	mmio_hook = hook;
+	mmio_hook_ctx = ctx;
+}
+
 void sandbox_set_enable_pci_map(int enable)
 {
 	enable_pci_map = enable;
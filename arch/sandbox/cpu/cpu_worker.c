@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Secondary-core workers for sandbox, run as host threads
+ */
+
+#include <cpu_worker.h>
+#include <dm.h>
+#include <os.h>
+#include <asm/test.h>
+
+/* Pretend to be a four-core SoC */
+static int sandbox_cpu_workers = 3;
+
+void sandbox_cpu_worker_set_count(int count)
+{
+	sandbox_cpu_workers = count;
+}
+
+int arch_cpu_worker_count(void)
+{
+	return sandbox_cpu_workers;
+}
+
+static void sandbox_cpu_worker_thread(void *arg)
+{
+	cpu_worker_main((long)arg);
+}
+
+int arch_cpu_worker_start(int worker)
+{
+	return os_thread_create(sandbox_cpu_worker_thread, (void *)(long)worker);
+}
+
+void arch_cpu_worker_wait(const u32 *addr, u32 val)
+{
+	os_futex_wait(addr, val);
+}
+
+void arch_cpu_worker_wake(const u32 *addr)
+{
+	os_futex_wake(addr);
+}
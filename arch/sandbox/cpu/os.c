@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <getopt.h>
+#include <limits.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -23,9 +24,11 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <linux/compiler_attributes.h>
+#include <linux/futex.h>
 #include <linux/types.h>
 
 #include <asm/fuzzing_engine.h>
@@ -1106,6 +1109,56 @@ void os_relaunch(char *argv[])
 	os_exit(1);
 }
 
+struct os_thread {
+	void (*func)(void *arg);
+	void *arg;
+};
+
+static void *os_thread_start(void *ptr)
+{
+	struct os_thread thread = *(struct os_thread *)ptr;
+
+	os_free(ptr);
+	thread.func(thread.arg);
+
+	return NULL;
+}
+
+int os_thread_create(void (*func)(void *arg), void *arg)
+{
+	struct os_thread *thread;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int ret;
+
+	thread = os_malloc(sizeof(*thread));
+	if (!thread)
+		return -ENOMEM;
+	thread->func = func;
+	thread->arg = arg;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&tid, &attr, os_thread_start, thread);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		os_free(thread);
+		return -ret;
+	}
+
+	return 0;
+}
+
+void os_futex_wait(const uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void os_futex_wake(const uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
 
 #ifdef CONFIG_FUZZ
 static void *fuzzer_thread(void * ptr)
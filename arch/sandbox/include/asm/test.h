@@ -281,6 +281,19 @@ uint sandbox_pci_read_bar(u32 barval, int type, uint size);
  */
 void sandbox_set_enable_memio(bool enable);
 
+/**
+ * sandbox_set_mmio_hook() - Watch writes made with writel() and friends
+ *
+ * An emulator whose registers are plain memory can use this to act on writes
+ * to them, such as doorbells. Only one hook can be set at a time. Writes are
+ * only made, and seen, while sandbox_set_enable_memio() has enabled them.
+ *
+ * @hook: Called after each write with @ctx and the address written, or NULL
+ *	to stop watching
+ * @ctx: Context to pass to @hook
+ */
+void sandbox_set_mmio_hook(void (*hook)(void *ctx, void *addr), void *ctx);
+
 /**
  * sandbox_cros_ec_set_test_flags() - Set behaviour for testing purposes
  *
@@ -357,4 +370,37 @@ bool sandbox_sf_bootdev_enabled(void);
  */
 void sandbox_sf_set_enable_bootdevs(bool enable);
 
+/**
+ * sandbox_cpu_worker_set_count() - Set the number of secondary-core workers
+ *
+ * Workers which are already running stay idle if the count is lowered
+ *
+ * @count: Number of workers, 0 to run all jobs on the calling core
+ */
+void sandbox_cpu_worker_set_count(int count);
+
+/**
+ * struct sandbox_nvme_stats - I/O seen by the sandbox NVMe controller
+ *
+ * @io_cmds: Number of read and write commands executed
+ * @max_blocks: Most blocks transferred by a single command
+ * @max_queued: Most commands completed at once without the host having
+ *	taken their completions yet, i.e. the most it had in flight
+ */
+struct sandbox_nvme_stats {
+	int io_cmds;
+	int max_blocks;
+	int max_queued;
+};
+
+/**
+ * sandbox_nvme_get_stats() - Get the I/O seen by the sandbox NVMe controller
+ *
+ * The counters may be cleared by the caller
+ *
+ * @dev: NVMe device (UCLASS_NVME)
+ * Return: I/O counters of the controller
+ */
+struct sandbox_nvme_stats *sandbox_nvme_get_stats(struct udevice *dev);
+
 #endif
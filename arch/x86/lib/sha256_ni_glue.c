@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * SHA-256 block function using the x86 SHA extensions
+ */
+
+#include <u-boot/sha_impl.h>
+#include <asm/control_regs.h>
+#include <asm/cpu.h>
+#include <asm/processor-flags.h>
+#include <linux/bitops.h>
+
+#define CPUID7_EBX_SHA		BIT(29)
+#define CPUID1_ECX_SSSE3	BIT(9)
+
+void sha256_x86_ni_process(uint32_t state[8], const uint8_t *data,
+			   unsigned int blocks);
+
+static bool sha256_ni_probe(void)
+{
+	/* The SSE registers cannot be used until the OS enables them */
+	if (!(read_cr4() & X86_CR4_OSFXSR))
+		return false;
+	if (cpuid_eax(0) < 7)
+		return false;
+	if (!(cpuid_ext(7, 0).ebx & CPUID7_EBX_SHA))
+		return false;
+
+	return cpuid_ecx(1) & CPUID1_ECX_SSSE3;
+}
+
+static void sha256_ni_process(void *state, const uint8_t *data,
+			      unsigned int blocks)
+{
+	sha256_x86_ni_process(state, data, blocks);
+}
+
+U_BOOT_SHA_IMPL(sha256_x86_ni) = {
+	.name		= "x86-sha-ni",
+	.algo		= SHA_IMPL_SHA256,
+	.priority	= 100,
+	.probe		= sha256_ni_probe,
+	.process	= sha256_ni_process,
+};
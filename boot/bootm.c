@@ -6,6 +6,7 @@
 
 #ifndef USE_HOSTCC
 #include <common.h>
+#include <blk.h>
 #include <bootm.h>
 #include <bootstage.h>
 #include <cli.h>
@@ -729,6 +730,9 @@ ulong bootm_disable_interrupts(void)
 {
 	ulong iflag;
 
+	/* Write back anything held by the block cache while devices work */
+	blkcache_flush(-1, 0);
+
 	/*
 	 * We have reached the point of no return: we are going to
 	 * overwrite all exception vector code, so we cannot easily
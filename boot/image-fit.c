@@ -27,6 +27,7 @@
 #include <malloc.h>
 #include <memalign.h>
 #include <asm/global_data.h>
+#include <cyclic.h>
 #ifdef CONFIG_DM_HASH
 #include <dm.h>
 #include <u-boot/hash.h>
@@ -1294,14 +1295,37 @@ int calculate_hash(const void *data, int data_len, const char *name,
 	return 0;
 }
 
+/* Compare a calculated hash with the value in hash node @noffset */
+static int fit_image_check_hash_value(const void *fit, int noffset,
+				      const uint8_t *value, int value_len,
+				      char **err_msgp)
+{
+	uint8_t *fit_value;
+	int fit_value_len;
+
+	if (fit_image_hash_get_value(fit, noffset, &fit_value,
+				     &fit_value_len)) {
+		*err_msgp = "Can't get hash value property";
+		return -1;
+	}
+
+	if (value_len != fit_value_len) {
+		*err_msgp = "Bad hash value len";
+		return -1;
+	} else if (memcmp(value, fit_value, value_len) != 0) {
+		*err_msgp = "Bad hash value";
+		return -1;
+	}
+
+	return 0;
+}
+
 static int fit_image_check_hash(const void *fit, int noffset, const void *data,
 				size_t size, char **err_msgp)
 {
 	ALLOC_CACHE_ALIGN_BUFFER(uint8_t, value, FIT_MAX_HASH_LEN);
 	int value_len;
 	const char *algo;
-	uint8_t *fit_value;
-	int fit_value_len;
 	int ignore;
 
 	*err_msgp = NULL;
@@ -1320,26 +1344,13 @@ static int fit_image_check_hash(const void *fit, int noffset, const void *data,
 		}
 	}
 
-	if (fit_image_hash_get_value(fit, noffset, &fit_value,
-				     &fit_value_len)) {
-		*err_msgp = "Can't get hash value property";
-		return -1;
-	}
-
 	if (calculate_hash(data, size, algo, value, &value_len)) {
 		*err_msgp = "Unsupported hash algorithm";
 		return -1;
 	}
 
-	if (value_len != fit_value_len) {
-		*err_msgp = "Bad hash value len";
-		return -1;
-	} else if (memcmp(value, fit_value, value_len) != 0) {
-		*err_msgp = "Bad hash value";
-		return -1;
-	}
-
-	return 0;
+	return fit_image_check_hash_value(fit, noffset, value, value_len,
+					  err_msgp);
 }
 
 int fit_image_verify_with_data(const void *fit, int image_noffset,
@@ -1407,6 +1418,176 @@ error:
 	return 0;
 }
 
+int fit_image_hash_stream_start(struct fit_hash_stream *hs, const void *fit,
+				int image_noffset, const void *key_blob,
+				size_t size)
+{
+	struct hash_algo *algo;
+	const char *algo_name;
+	int noffset, key_node;
+	int ignore;
+	int ret;
+
+	memset(hs, '\0', sizeof(*hs));
+	hs->fit = fit;
+	hs->image_noffset = image_noffset;
+	hs->remaining = size;
+
+	/* calculate_hash() uses the hash uclass instead */
+	if (!tools_build() && IS_ENABLED(CONFIG_DM_HASH))
+		return -EOPNOTSUPP;
+
+	/* Signatures are checked over the whole of the data at once */
+	if (FIT_IMAGE_ENABLE_VERIFY) {
+		key_node = fdt_subnode_offset(key_blob, 0, FIT_SIG_NODENAME);
+		fdt_for_each_subnode(noffset, key_blob, key_node) {
+			const char *required;
+
+			required = fdt_getprop(key_blob, noffset,
+					       FIT_KEY_REQUIRED, NULL);
+			if (required && !strcmp(required, "image"))
+				return -EOPNOTSUPP;
+		}
+	}
+
+	fdt_for_each_subnode(noffset, fit, image_noffset) {
+		const char *name = fit_get_name(fit, noffset, NULL);
+		struct fit_hash_stream_node *hash;
+
+		if (FIT_IMAGE_ENABLE_VERIFY &&
+		    !strncmp(name, FIT_SIG_NODENAME, strlen(FIT_SIG_NODENAME))) {
+			ret = -EOPNOTSUPP;
+			goto err;
+		}
+		if (strncmp(name, FIT_HASH_NODENAME, strlen(FIT_HASH_NODENAME)))
+			continue;
+
+		if (hs->count == FIT_HASH_STREAM_MAX ||
+		    fit_image_hash_get_algo(fit, noffset, &algo_name)) {
+			ret = -EOPNOTSUPP;
+			goto err;
+		}
+		hash = &hs->hash[hs->count++];
+		hash->noffset = noffset;
+		if (!tools_build()) {
+			fit_image_hash_get_ignore(fit, noffset, &ignore);
+			if (ignore)
+				continue;
+		}
+		if (hash_progressive_lookup_algo(algo_name, &algo)) {
+			ret = -EOPNOTSUPP;
+			goto err;
+		}
+		if (algo->hash_init(algo, &hash->ctx)) {
+			hash->ctx = NULL;
+			ret = -ENOMEM;
+			goto err;
+		}
+		hash->algo = algo;
+	}
+	if (noffset == -FDT_ERR_TRUNCATED || noffset == -FDT_ERR_BADSTRUCTURE) {
+		ret = -EOPNOTSUPP;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	fit_image_hash_stream_abort(hs);
+
+	return ret;
+}
+
+void fit_image_hash_stream_update(struct fit_hash_stream *hs, const void *data,
+				  size_t len)
+{
+	int i;
+
+	if (len > hs->remaining) {
+		hs->err = true;
+		return;
+	}
+	hs->remaining -= len;
+
+	for (i = 0; i < hs->count; i++) {
+		struct hash_algo *algo = hs->hash[i].algo;
+
+		if (!hs->hash[i].ctx)
+			continue;
+		if (algo->hash_update(algo, hs->hash[i].ctx, data, len,
+				      !hs->remaining)) {
+			/* The context has been freed */
+			hs->hash[i].ctx = NULL;
+			hs->err = true;
+		}
+	}
+}
+
+int fit_image_hash_stream_verify(struct fit_hash_stream *hs)
+{
+	ALLOC_CACHE_ALIGN_BUFFER(uint8_t, value, FIT_MAX_HASH_LEN);
+	const void *fit = hs->fit;
+	char *err_msg = "";
+	int noffset = 0;
+	int i;
+
+	for (i = 0; i < hs->count; i++) {
+		struct hash_algo *algo = hs->hash[i].algo;
+		const char *algo_name;
+		int ret;
+
+		noffset = hs->hash[i].noffset;
+		fit_image_hash_get_algo(fit, noffset, &algo_name);
+		printf("%s", algo_name);
+		if (!algo) {
+			printf("-skipped ");
+			continue;
+		}
+
+		if (hs->err || hs->remaining) {
+			err_msg = "Can't calculate hash";
+			goto error;
+		}
+		ret = algo->hash_finish(algo, hs->hash[i].ctx, value,
+					FIT_MAX_HASH_LEN);
+		hs->hash[i].ctx = NULL;
+		if (ret) {
+			err_msg = "Can't calculate hash";
+			goto error;
+		}
+		if (fit_image_check_hash_value(fit, noffset, value,
+					       algo->digest_size, &err_msg))
+			goto error;
+		puts("+ ");
+	}
+
+	return 1;
+
+error:
+	fit_image_hash_stream_abort(hs);
+	printf(" error!\n%s for '%s' hash node in '%s' image node\n",
+	       err_msg, fit_get_name(fit, noffset, NULL),
+	       fit_get_name(fit, hs->image_noffset, NULL));
+
+	return 0;
+}
+
+void fit_image_hash_stream_abort(struct fit_hash_stream *hs)
+{
+	ALLOC_CACHE_ALIGN_BUFFER(uint8_t, value, FIT_MAX_HASH_LEN);
+	int i;
+
+	/* Finishing is the only way to free a context */
+	for (i = 0; i < hs->count; i++) {
+		struct hash_algo *algo = hs->hash[i].algo;
+
+		if (hs->hash[i].ctx)
+			algo->hash_finish(algo, hs->hash[i].ctx, value,
+					  FIT_MAX_HASH_LEN);
+		hs->hash[i].ctx = NULL;
+	}
+}
+
 /**
  * fit_image_verify - verify data integrity
  * @fit: pointer to the FIT format image header
@@ -1972,18 +2153,61 @@ int fit_get_data_conf_prop(const void *fit, const char *prop_name,
 	return fit_get_data_tail(fit, noffset, data, size);
 }
 
+static int fit_image_check_integrity(const void *fit, int rd_noffset)
+{
+	puts("   Verifying Hash Integrity ... ");
+	if (!fit_image_verify(fit, rd_noffset)) {
+		puts("Bad Data Hash\n");
+		return -EACCES;
+	}
+	puts("OK\n");
+
+	return 0;
+}
+
 static int fit_image_select(const void *fit, int rd_noffset, int verify)
 {
 	fit_image_print(fit, rd_noffset, "   ");
 
-	if (verify) {
-		puts("   Verifying Hash Integrity ... ");
-		if (!fit_image_verify(fit, rd_noffset)) {
-			puts("Bad Data Hash\n");
+	if (verify)
+		return fit_image_check_integrity(fit, rd_noffset);
+
+	return 0;
+}
+
+/*
+ * Copy an image's data to its load address, checking its hashes on the way so
+ * that the data is only gone over once. If the hashes cannot be worked out
+ * piece by piece, the data is checked first and then copied.
+ */
+static int fit_image_copy_verified(const void *fit, int rd_noffset, void *dst,
+				   const void *src, size_t len)
+{
+	struct fit_hash_stream hs;
+	size_t off, n;
+
+	if (fit_image_hash_stream_start(&hs, fit, rd_noffset, gd_fdt_blob(),
+					len)) {
+		if (fit_image_check_integrity(fit, rd_noffset))
 			return -EACCES;
-		}
-		puts("OK\n");
+		memcpy(dst, src, len);
+		return 0;
+	}
+
+	puts("   Verifying Hash Integrity ... ");
+	for (off = 0; off < len; off += n) {
+		n = len - off < CHUNKSZ ? len - off : CHUNKSZ;
+		memcpy(dst + off, src + off, n);
+		fit_image_hash_stream_update(&hs, dst + off, n);
+#if !defined(USE_HOSTCC) && (defined(CONFIG_HW_WATCHDOG) || defined(CONFIG_WATCHDOG))
+		schedule();
+#endif
 	}
+	if (!fit_image_hash_stream_verify(&hs)) {
+		puts("Bad Data Hash\n");
+		return -EACCES;
+	}
+	puts("OK\n");
 
 	return 0;
 }
@@ -2069,6 +2293,7 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 	ulong load, load_end, data, len;
 	uint8_t os, comp;
 	const char *prop_name;
+	bool verify_later;
 	int ret;
 
 	fit = map_sysmem(addr, 0);
@@ -2142,7 +2367,18 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 
 	printf("   Trying '%s' %s subimage\n", fit_uname, prop_name);
 
-	ret = fit_image_select(fit, noffset, images->verify);
+	/*
+	 * The hashes of data which is copied as it is can be checked during
+	 * the copy. This cannot be done if the data is first decrypted or
+	 * post-processed.
+	 */
+	verify_later = images->verify &&
+		       !(IS_ENABLED(CONFIG_FIT_CIPHER) &&
+			 fdt_subnode_offset(fit, noffset,
+					    FIT_CIPHER_NODENAME) >= 0) &&
+		       !(!tools_build() &&
+			 IS_ENABLED(CONFIG_FIT_IMAGE_POST_PROCESS));
+	ret = fit_image_select(fit, noffset, images->verify && !verify_later);
 	if (ret) {
 		bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
 		return ret;
@@ -2268,6 +2504,15 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 	      image_type == IH_TYPE_KERNEL_NOLOAD ||
 	      image_type == IH_TYPE_RAMDISK)) {
 		ulong max_decomp_len = len * 20;
+
+		if (verify_later) {
+			ret = fit_image_check_integrity(fit, noffset);
+			if (ret) {
+				bootstage_error(bootstage_id +
+						BOOTSTAGE_SUB_HASH);
+				return ret;
+			}
+		}
 		if (load == data) {
 			loadbuf = malloc(max_decomp_len);
 			load = map_to_sysmem(loadbuf);
@@ -2283,7 +2528,23 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 		len = load_end - load;
 	} else if (load != data) {
 		loadbuf = map_sysmem(load, len);
-		memcpy(loadbuf, buf, len);
+		if (verify_later) {
+			ret = fit_image_copy_verified(fit, noffset, loadbuf,
+						      buf, len);
+			if (ret) {
+				bootstage_error(bootstage_id +
+						BOOTSTAGE_SUB_HASH);
+				return ret;
+			}
+		} else {
+			memcpy(loadbuf, buf, len);
+		}
+	} else if (verify_later) {
+		ret = fit_image_check_integrity(fit, noffset);
+		if (ret) {
+			bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
+			return ret;
+		}
 	}
 
 	if (image_type == IH_TYPE_RAMDISK && comp != IH_COMP_NONE)
@@ -539,6 +539,132 @@ int image_decomp(int comp, ulong load, ulong image_start, int type,
 	return 0;
 }
 
+int image_decomp_stream_start(struct image_decomp_stream *ds, int comp,
+			      void *load_buf, ulong unc_len)
+{
+	void *priv;
+
+	memset(ds, '\0', sizeof(*ds));
+	ds->comp = comp;
+	ds->load_buf = load_buf;
+	ds->unc_len = unc_len;
+
+	switch (comp) {
+	case IH_COMP_NONE:
+		return 0;
+	case IH_COMP_GZIP:
+		if (tools_build() || !CONFIG_IS_ENABLED(GZIP))
+			return -ENOSYS;
+		priv = gunzip_stream_start(load_buf, unc_len);
+		break;
+	case IH_COMP_LZMA:
+		if (tools_build() || !CONFIG_IS_ENABLED(LZMA))
+			return -ENOSYS;
+		priv = lzmaStreamStart(load_buf, unc_len);
+		break;
+	case IH_COMP_LZ4:
+		if (tools_build() || !CONFIG_IS_ENABLED(LZ4))
+			return -ENOSYS;
+		priv = ulz4fn_stream_start(load_buf, unc_len);
+		break;
+	case IH_COMP_ZSTD:
+		if (tools_build() || !CONFIG_IS_ENABLED(ZSTD))
+			return -ENOSYS;
+		priv = zstd_stream_start(load_buf, unc_len);
+		break;
+	default:
+		return -ENOSYS;
+	}
+	if (!priv)
+		return -ENOMEM;
+	ds->priv = priv;
+
+	return 0;
+}
+
+int image_decomp_stream_feed(struct image_decomp_stream *ds, const void *buf,
+			     ulong len)
+{
+	int ret = -ENOSYS;
+
+	if (ds->done)
+		return 0;
+
+	switch (ds->comp) {
+	case IH_COMP_NONE:
+		ret = 0;
+		if (len > ds->unc_len - ds->len) {
+			ret = -ENOSPC;
+			break;
+		}
+		memcpy(ds->load_buf + ds->len, buf, len);
+		ds->len += len;
+		break;
+	case IH_COMP_GZIP:
+		if (!tools_build() && CONFIG_IS_ENABLED(GZIP))
+			ret = gunzip_stream_feed(ds->priv, buf, len, &ds->len);
+		break;
+	case IH_COMP_LZMA:
+		if (!tools_build() && CONFIG_IS_ENABLED(LZMA)) {
+			SizeT size;
+
+			ret = lzmaStreamFeed(ds->priv, buf, len, &size);
+			ds->len = size;
+		}
+		break;
+	case IH_COMP_LZ4:
+		if (!tools_build() && CONFIG_IS_ENABLED(LZ4)) {
+			size_t size;
+
+			ret = ulz4fn_stream_feed(ds->priv, buf, len, &size);
+			ds->len = size;
+		}
+		break;
+	case IH_COMP_ZSTD:
+		if (!tools_build() && CONFIG_IS_ENABLED(ZSTD)) {
+			size_t size;
+
+			ret = zstd_stream_feed(ds->priv, buf, len, &size);
+			ds->len = size;
+		}
+		break;
+	}
+	if (ret < 0)
+		return ret;
+	if (ret)
+		ds->done = true;
+
+	return 0;
+}
+
+int image_decomp_stream_end(struct image_decomp_stream *ds)
+{
+	switch (ds->comp) {
+	case IH_COMP_NONE:
+		ds->done = true;
+		break;
+	case IH_COMP_GZIP:
+		if (!tools_build() && CONFIG_IS_ENABLED(GZIP))
+			gunzip_stream_end(ds->priv);
+		break;
+	case IH_COMP_LZMA:
+		if (!tools_build() && CONFIG_IS_ENABLED(LZMA))
+			lzmaStreamEnd(ds->priv);
+		break;
+	case IH_COMP_LZ4:
+		if (!tools_build() && CONFIG_IS_ENABLED(LZ4))
+			ulz4fn_stream_end(ds->priv);
+		break;
+	case IH_COMP_ZSTD:
+		if (!tools_build() && CONFIG_IS_ENABLED(ZSTD))
+			zstd_stream_end(ds->priv);
+		break;
+	}
+	ds->priv = NULL;
+
+	return ds->done ? 0 : -EINVAL;
+}
+
 const table_entry_t *get_table_entry(const table_entry_t *table, int id)
 {
 	for (; table->id >= 0; ++table) {
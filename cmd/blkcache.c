@@ -4,25 +4,56 @@
  * Author: Eric Nelson<eric@nelint.com>
  *
  */
+#include <blk.h>
 #include <command.h>
 #include <config.h>
 #include <common.h>
 #include <malloc.h>
 #include <part.h>
 
+static const char *const mode_name[] = {
+	[BLKCACHE_WRITETHROUGH]	= "writethrough",
+	[BLKCACHE_WRITEBACK]	= "writeback",
+};
+
 static int blkc_show(struct cmd_tbl *cmdtp, int flag,
 		     int argc, char *const argv[])
 {
+	struct block_cache_dev_stats dstats;
 	struct block_cache_stats stats;
+	const char *name;
+	int i;
+
+	/* blkcache_stats() resets the device counters, so show them first */
+	for (i = 0; !blkcache_dev_stats(i, &dstats); i++) {
+		name = blk_get_uclass_name(dstats.iftype);
+		printf("%s %d: hits %u, misses %u, evictions %u, dirty %u\n",
+		       name ? name : "?", dstats.devnum, dstats.hits,
+		       dstats.misses, dstats.evictions, dstats.dirty);
+		printf("    read-ahead: window %u/%u, reads %u, ",
+		       dstats.ra_window, dstats.ra_max, dstats.ra_reads);
+		printf("used %u, wasted %u\n", dstats.ra_used,
+		       dstats.ra_wasted);
+	}
+
 	blkcache_stats(&stats);
 
 	printf("hits: %u\n"
 	       "misses: %u\n"
-	       "entries: %u\n"
+	       "evictions: %u\n"
+	       "write-backs: %u\n"
+	       "read-ahead reads: %u\n"
+	       "read-ahead used: %u\n"
+	       "read-ahead wasted: %u\n"
+	       "blocks cached: %u\n"
+	       "dirty blocks: %u\n"
 	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
-	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	       "max cache entries: %u\n"
+	       "mode: %s\n",
+	       stats.hits, stats.misses, stats.evictions, stats.writebacks,
+	       stats.ra_reads, stats.ra_used, stats.ra_wasted, stats.entries,
+	       stats.dirty, stats.max_blocks_per_entry, stats.max_entries,
+	       mode_name[blkcache_get_mode()]);
 	return 0;
 }
 
@@ -41,9 +72,67 @@ static int blkc_configure(struct cmd_tbl *cmdtp, int flag,
 	return 0;
 }
 
+static int blkc_mode(struct cmd_tbl *cmdtp, int flag,
+		     int argc, char *const argv[])
+{
+	int i;
+
+	if (argc < 2) {
+		printf("%s\n", mode_name[blkcache_get_mode()]);
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mode_name); i++) {
+		if (!strcmp(argv[1], mode_name[i])) {
+			if (blkcache_set_mode(i))
+				return CMD_RET_FAILURE;
+			return 0;
+		}
+	}
+
+	return CMD_RET_USAGE;
+}
+
+static int blkc_flush(struct cmd_tbl *cmdtp, int flag,
+		      int argc, char *const argv[])
+{
+	if (blkcache_flush(-1, 0))
+		return CMD_RET_FAILURE;
+
+	return 0;
+}
+
+static int blkc_readahead(struct cmd_tbl *cmdtp, int flag,
+			  int argc, char *const argv[])
+{
+	struct blk_desc *desc;
+	uint blocks;
+
+	if (argc == 2) {
+		blocks = simple_strtoul(argv[1], 0, 0);
+		blkcache_set_readahead(-1, 0, blocks);
+		return 0;
+	}
+	if (argc != 4)
+		return CMD_RET_USAGE;
+
+	desc = blk_get_dev(argv[1], simple_strtoul(argv[2], 0, 0));
+	if (!desc) {
+		printf("No device %s %s\n", argv[1], argv[2]);
+		return CMD_RET_FAILURE;
+	}
+	blocks = simple_strtoul(argv[3], 0, 0);
+	blkcache_set_readahead(desc->uclass_id, desc->devnum, blocks);
+
+	return 0;
+}
+
 static struct cmd_tbl cmd_blkc_sub[] = {
 	U_BOOT_CMD_MKENT(show, 0, 0, blkc_show, "", ""),
 	U_BOOT_CMD_MKENT(configure, 3, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(mode, 2, 0, blkc_mode, "", ""),
+	U_BOOT_CMD_MKENT(flush, 1, 0, blkc_flush, "", ""),
+	U_BOOT_CMD_MKENT(readahead, 4, 0, blkc_readahead, "", ""),
 };
 
 static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
@@ -67,9 +156,13 @@ static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
 }
 
 U_BOOT_CMD(
-	blkcache, 4, 0, do_blkcache,
+	blkcache, 5, 0, do_blkcache,
 	"block cache diagnostics and control",
 	"show - show and reset statistics\n"
 	"blkcache configure <blocks> <entries> "
 	"- set max blocks per entry and max cache entries\n"
+	"blkcache mode [writethrough|writeback] - show or set write mode\n"
+	"blkcache flush - write dirty blocks to the devices\n"
+	"blkcache readahead [<interface> <dev>] <blocks> "
+	"- set max read-ahead window\n"
 );
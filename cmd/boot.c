@@ -7,6 +7,7 @@
 /*
  * Misc boot support
  */
+#include <blk.h>
 #include <common.h>
 #include <command.h>
 #include <net.h>
@@ -56,16 +57,33 @@ U_BOOT_CMD(
 
 #endif
 
+/* Write back blocks held dirty in the block cache before they are lost */
+static int do_reset_flush(struct cmd_tbl *cmdtp, int flag, int argc,
+			  char *const argv[])
+{
+	blkcache_flush(-1, 0);
+
+	return do_reset(cmdtp, flag, argc, argv);
+}
+
 U_BOOT_CMD(
-	reset, 2, 0,	do_reset,
+	reset, 2, 0,	do_reset_flush,
 	"Perform RESET of the CPU",
 	"- cold boot without level specifier\n"
 	"reset -w - warm reset if implemented"
 );
 
 #ifdef CONFIG_CMD_POWEROFF
+static int do_poweroff_flush(struct cmd_tbl *cmdtp, int flag, int argc,
+			     char *const argv[])
+{
+	blkcache_flush(-1, 0);
+
+	return do_poweroff(cmdtp, flag, argc, argv);
+}
+
 U_BOOT_CMD(
-	poweroff, 1, 0,	do_poweroff,
+	poweroff, 1, 0,	do_poweroff_flush,
 	"Perform POWEROFF of the device",
 	""
 );
@@ -111,3 +111,19 @@ U_BOOT_CMD(
 	fstypes, 1, 1, do_fstypes_wrapper,
 	"List supported filesystem types", ""
 );
+
+#if IS_ENABLED(CONFIG_FS_MOUNT_CACHE)
+static int do_fs_umount(struct cmd_tbl *cmdtp, int flag, int argc,
+			char *const argv[])
+{
+	fs_umount();
+
+	return CMD_RET_SUCCESS;
+}
+
+U_BOOT_LONGHELP(fs,
+	"umount - close the filesystems kept mounted between commands");
+
+U_BOOT_CMD_WITH_SUBCMDS(fs, "filesystem mounts", fs_help_text,
+	U_BOOT_SUBCMD_MKENT(umount, 1, 1, do_fs_umount));
+#endif
@@ -12,7 +12,14 @@
 #include <common.h>
 #include <command.h>
 #include <hash.h>
+#include <malloc.h>
+#include <time.h>
+#include <u-boot/sha256.h>
+#include <u-boot/sha512.h>
+#include <u-boot/sha_impl.h>
 #include <linux/ctype.h>
+#include <linux/math64.h>
+#include <linux/sizes.h>
 
 #if IS_ENABLED(CONFIG_HASH_VERIFY)
 #define HARGS 6
@@ -20,12 +27,79 @@
 #define HARGS 5
 #endif
 
+/* Time one SHA implementation, returning its speed in KiB/s */
+static ulong hash_speed_one(enum sha_impl_algo algo, const uchar *buf,
+			    uint size)
+{
+	uchar out[SHA512_SUM_LEN];
+	ulong start, us;
+
+	start = timer_get_us();
+	if (IS_ENABLED(CONFIG_SHA256) && algo == SHA_IMPL_SHA256)
+		sha256_csum_wd(buf, size, out, CHUNKSZ_SHA256);
+	else if (IS_ENABLED(CONFIG_SHA512) && algo == SHA_IMPL_SHA512)
+		sha512_csum_wd(buf, size, out, CHUNKSZ_SHA512);
+	us = max(timer_get_us() - start, 1UL);
+
+	return div_u64((u64)size * 1000000, us) >> 10;
+}
+
+static int do_hash_speed(int argc, char *const argv[])
+{
+	struct sha_impl *start = ll_entry_start(struct sha_impl, sha_impl);
+	const int count = ll_entry_count(struct sha_impl, sha_impl);
+	uint size = SZ_1M;
+	struct sha_impl *impl;
+	uchar *buf;
+	int algo;
+
+	if (argc > 1)
+		size = hextoul(argv[1], NULL);
+	if (!size)
+		return CMD_RET_USAGE;
+	buf = malloc(size);
+	if (!buf) {
+		printf("Cannot allocate %#x bytes\n", size);
+		return CMD_RET_FAILURE;
+	}
+	memset(buf, 0xa5, size);
+
+	for (algo = 0; algo < SHA_IMPL_COUNT; algo++) {
+		const struct sha_impl *best = sha_impl_get(algo);
+
+		if ((algo == SHA_IMPL_SHA256 && !IS_ENABLED(CONFIG_SHA256)) ||
+		    (algo == SHA_IMPL_SHA512 && !IS_ENABLED(CONFIG_SHA512)))
+			continue;
+		for (impl = start; impl != start + count; impl++) {
+			if (impl->algo != algo)
+				continue;
+			printf("%-8s %-16s ", sha_impl_algo_name(algo),
+			       impl->name);
+			if (sha_impl_set(algo, impl->name)) {
+				printf("unsupported\n");
+				continue;
+			}
+			printf("%8lu KiB/s%s\n",
+			       hash_speed_one(algo, buf, size),
+			       impl == best ? " (default)" : "");
+		}
+		sha_impl_set(algo, NULL);
+	}
+	free(buf);
+
+	return 0;
+}
+
 static int do_hash(struct cmd_tbl *cmdtp, int flag, int argc,
 		   char *const argv[])
 {
 	char *s;
 	int flags = HASH_FLAG_ENV;
 
+	if (IS_ENABLED(CONFIG_CMD_HASH_SPEED) && argc >= 2 &&
+	    !strcmp(argv[1], "speed"))
+		return do_hash_speed(argc - 1, argv + 1);
+
 	if (argc < (HARGS - 1))
 		return CMD_RET_USAGE;
 
@@ -54,4 +128,9 @@ U_BOOT_CMD(
 		"    - verify message digest of memory area to immediate value, \n"
 		"      env var or *address"
 #endif
+#if IS_ENABLED(CONFIG_CMD_HASH_SPEED)
+	"\nhash speed [size]\n"
+		"    - measure each SHA implementation on size bytes (hex,\n"
+		"      default 0x100000)"
+#endif
 );
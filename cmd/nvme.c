@@ -7,11 +7,52 @@
 #include <common.h>
 #include <blk.h>
 #include <command.h>
+#include <display_options.h>
 #include <dm.h>
+#include <mapmem.h>
 #include <nvme.h>
+#include <time.h>
+#include <linux/math64.h>
 
 static int nvme_curr_dev;
 
+static int nvme_bench(ulong addr, lbaint_t blk, lbaint_t cnt)
+{
+	struct udevice *udev;
+	struct blk_desc *desc;
+	ulong start, time;
+	void *vaddr;
+	u64 bytes;
+	long n;
+	int ret;
+
+	ret = blk_get_device(UCLASS_NVME, nvme_curr_dev, &udev);
+	if (ret < 0)
+		return CMD_RET_FAILURE;
+	desc = dev_get_uclass_plat(udev);
+
+	vaddr = map_sysmem(addr, cnt * desc->blksz);
+	start = get_timer(0);
+	n = blk_read(udev, blk, cnt, vaddr);
+	time = get_timer(start);
+	unmap_sysmem(vaddr);
+	if (n != cnt) {
+		printf("Read failed after %ld blocks\n", n < 0 ? 0 : n);
+		return CMD_RET_FAILURE;
+	}
+
+	bytes = (u64)cnt * desc->blksz;
+	printf("%llu bytes read in %lu ms", bytes, time);
+	if (time > 0) {
+		puts(" (");
+		print_size(div_u64(bytes, time) * 1000, "/s");
+		puts(")");
+	}
+	puts("\n");
+
+	return 0;
+}
+
 static int do_nvme(struct cmd_tbl *cmdtp, int flag, int argc,
 		   char *const argv[])
 {
@@ -39,6 +80,10 @@ static int do_nvme(struct cmd_tbl *cmdtp, int flag, int argc,
 		}
 	}
 
+	if (argc == 5 && !strcmp(argv[1], "bench"))
+		return nvme_bench(hextoul(argv[2], NULL), hextoul(argv[3], NULL),
+				  hextoul(argv[4], NULL));
+
 	return blk_common_cmd(argc, argv, UCLASS_NVME, &nvme_curr_dev);
 }
 
@@ -53,5 +98,7 @@ U_BOOT_CMD(
 	"nvme read addr blk# cnt - read `cnt' blocks starting at block\n"
 	"     `blk#' to memory address `addr'\n"
 	"nvme write addr blk# cnt - write `cnt' blocks starting at block\n"
-	"     `blk#' from memory address `addr'"
+	"     `blk#' from memory address `addr'\n"
+	"nvme bench addr blk# cnt - time reading `cnt' blocks starting at\n"
+	"     block `blk#' to memory address `addr'"
 );
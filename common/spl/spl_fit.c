@@ -18,9 +18,15 @@
 #include <asm/io.h>
 #include <linux/libfdt.h>
 #include <linux/printk.h>
+#include <linux/sizes.h>
 
 DECLARE_GLOBAL_DATA_PTR;
 
+/* Size of the pieces compressed external data is read and decompressed in */
+#define SPL_FIT_STREAM_CHUNK	SZ_64K
+/* Size of the pieces other external data is read and hashed in */
+#define SPL_FIT_HASH_CHUNK	SZ_256K
+
 struct spl_fit_info {
 	const void *fit;	/* Pointer to a valid FIT blob */
 	size_t ext_data_offset;	/* Offset to FIT external data (end of FIT) */
@@ -187,6 +193,131 @@ static int get_aligned_image_size(struct spl_load_info *info, int data_size,
 	return ALIGN(data_size, spl_get_bl_len(info));
 }
 
+/*
+ * Compressed external data can be decompressed while it is being read, unless
+ * it must be complete first to post-process it or to check it. Unchecked data
+ * must never reach the decompressor, which writes to the load address.
+ */
+static bool spl_fit_can_stream(uint8_t image_comp)
+{
+	if (CONFIG_IS_ENABLED(FIT_SIGNATURE) ||
+	    CONFIG_IS_ENABLED(FIT_IMAGE_POST_PROCESS))
+		return false;
+
+	return (IS_ENABLED(CONFIG_SPL_GZIP) && image_comp == IH_COMP_GZIP) ||
+	       (IS_ENABLED(CONFIG_SPL_LZMA) && image_comp == IH_COMP_LZMA);
+}
+
+/**
+ * load_simple_fit_stream(): read and decompress external data in pieces
+ * @info:	points to information about the device to load data from
+ * @offset:	offset of the compressed data on the device
+ * @len:	size of the compressed data
+ * @image_comp:	compression of the data (IH_COMP_...)
+ * @load_ptr:	where to decompress the data to
+ * @lengthp:	returns the size of the decompressed data
+ *
+ * Each piece is decompressed before the next one is read, so the compressed
+ * data never needs to be held in memory at once.
+ *
+ * Return:	0 on success, -ENOMEM if there is not enough memory to
+ *		decompress this way, or another negative error number.
+ */
+static int load_simple_fit_stream(struct spl_load_info *info, ulong offset,
+				  ulong len, uint8_t image_comp, void *load_ptr,
+				  size_t *lengthp)
+{
+	struct image_decomp_stream ds;
+	int bl_len = spl_get_bl_len(info);
+	ulong chunk = ALIGN(SPL_FIT_STREAM_CHUNK, bl_len);
+	ulong pos = ALIGN_DOWN(offset, bl_len);
+	ulong skip = offset - pos;
+	ulong end = offset + len;
+	ulong size, avail;
+	void *buf;
+	int ret;
+
+	buf = malloc_cache_aligned(chunk);
+	if (!buf)
+		return -ENOMEM;
+	ret = image_decomp_stream_start(&ds, image_comp, load_ptr,
+					CONFIG_SYS_BOOTM_LEN);
+	if (ret) {
+		free(buf);
+		return ret;
+	}
+
+	while (pos < end && !ds.done) {
+		size = min(chunk, ALIGN(end - pos, bl_len));
+		avail = min(size, end - pos);
+		if (info->read(info, pos, size, buf) < avail) {
+			ret = -EIO;
+			break;
+		}
+
+		ret = image_decomp_stream_feed(&ds, buf + skip, avail - skip);
+		if (ret) {
+			if (ret != -ENOMEM)
+				puts("Uncompressing error\n");
+			break;
+		}
+		pos += size;
+		skip = 0;
+	}
+
+	free(buf);
+	if (image_decomp_stream_end(&ds) && !ret) {
+		puts("Uncompressing error\n");
+		ret = -EIO;
+	}
+	if (ret)
+		return ret;
+
+	debug("Streamed data: dst=%p, offset=%lx, size=%lx\n", load_ptr,
+	      offset, len);
+	*lengthp = ds.len;
+
+	return 0;
+}
+
+/**
+ * load_simple_fit_hashed(): read external data in pieces, hashing each one
+ * @info:	points to information about the device to load data from
+ * @pos:	offset to read from on the device, aligned to the block length
+ * @size:	number of bytes to read, aligned to the block length
+ * @buf:	where to read the data to
+ * @overhead:	offset of the image data in @buf
+ * @length:	size of the image data
+ * @hs:		hashes to add the image data to
+ *
+ * Each piece is hashed as soon as it has been read, so the data does not have
+ * to be gone over again afterwards to check it.
+ *
+ * Return:	0 on success or -EIO
+ */
+static int load_simple_fit_hashed(struct spl_load_info *info, ulong pos,
+				  ulong size, void *buf, ulong overhead,
+				  ulong length, struct fit_hash_stream *hs)
+{
+	ulong chunk = ALIGN(SPL_FIT_HASH_CHUNK, spl_get_bl_len(info));
+	ulong end = overhead + length;
+	ulong off, n, from, to;
+
+	for (off = 0; off < size; off += n) {
+		n = min(chunk, size - off);
+		if (info->read(info, pos + off, n, buf + off) <
+		    min(n, end - off))
+			return -EIO;
+
+		from = max(off, overhead);
+		to = min(off + n, end);
+		if (from < to)
+			fit_image_hash_stream_update(hs, buf + from, to - from);
+	}
+
+	return 0;
+}
+
 /**
  * load_simple_fit(): load the image described in a certain FIT node
  * @info:	points to information about the device to load data from
@@ -217,6 +348,8 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 	const void *data;
 	const void *fit = ctx->fit;
 	bool external_data = false;
+	struct fit_hash_stream hash_stream, *hs = NULL;
+	int ret;
 
 	if (IS_ENABLED(CONFIG_SPL_FPGA) ||
 	    (IS_ENABLED(CONFIG_SPL_OS_BOOT) && spl_decompression_enabled())) {
@@ -261,6 +394,24 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 			return 0;
 		}
 
+		/* Check the hashes as the data arrives, where possible */
+		if (CONFIG_IS_ENABLED(FIT_SIGNATURE) &&
+		    !fit_image_hash_stream_start(&hash_stream, fit, node,
+						 gd_fdt_blob(), len))
+			hs = &hash_stream;
+
+		if (spl_fit_can_stream(image_comp)) {
+			load_ptr = map_sysmem(load_addr, 0);
+			ret = load_simple_fit_stream(info, fit_offset + offset,
+						     len, image_comp, load_ptr,
+						     &length);
+			if (!ret)
+				goto loaded;
+			/* Without the memory to stream, load it all first */
+			if (ret != -ENOMEM)
+				return ret;
+		}
+
 		if (spl_decompression_enabled() &&
 		    (image_comp == IH_COMP_GZIP || image_comp == IH_COMP_LZMA))
 			src_ptr = map_sysmem(ALIGN(CONFIG_SYS_LOAD_ADDR, ARCH_DMA_MINALIGN), len);
@@ -271,11 +422,20 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 		overhead = get_aligned_image_overhead(info, offset);
 		size = get_aligned_image_size(info, length, offset);
 
-		if (info->read(info,
-			       fit_offset +
-			       get_aligned_image_offset(info, offset), size,
-			       src_ptr) < length)
+		if (hs) {
+			ret = load_simple_fit_hashed(info, fit_offset +
+					get_aligned_image_offset(info, offset),
+					size, src_ptr, overhead, length, hs);
+			if (ret) {
+				fit_image_hash_stream_abort(hs);
+				return ret;
+			}
+		} else if (info->read(info,
+				      fit_offset +
+				      get_aligned_image_offset(info, offset),
+				      size, src_ptr) < length) {
 			return -EIO;
+		}
 
 		debug("External data: dst=%p, offset=%x, size=%lx\n",
 		      src_ptr, offset, (unsigned long)length);
@@ -294,9 +454,13 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 	if (CONFIG_IS_ENABLED(FIT_SIGNATURE)) {
 		printf("## Checking hash(es) for Image %s ... ",
 		       fit_get_name(fit, node, NULL));
-		if (!fit_image_verify_with_data(fit, node, gd_fdt_blob(), src,
-						length))
+		if (hs) {
+			if (!fit_image_hash_stream_verify(hs))
+				return -EPERM;
+		} else if (!fit_image_verify_with_data(fit, node, gd_fdt_blob(),
+						       src, length)) {
 			return -EPERM;
+		}
 		puts("OK\n");
 	}
 
@@ -325,6 +489,7 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 		memcpy(load_ptr, src, length);
 	}
 
+loaded:
 	if (image_info) {
 		ulong entry_point;
 
@@ -9,9 +9,11 @@
 #include <common.h>
 #include <blk.h>
 #include <dm.h>
+#include <fs.h>
 #include <log.h>
 #include <malloc.h>
 #include <part.h>
+#include <time.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
 #include <dm/uclass-internal.h>
@@ -327,6 +329,9 @@ int blk_select_hwpart(struct udevice *dev, int hwpart)
 	if (!ops->select_hwpart)
 		return 0;
 
+	/* dirty blocks belong to the current hardware partition */
+	blk_flush(dev);
+
 	return ops->select_hwpart(dev, hwpart);
 }
 
@@ -428,19 +433,13 @@ static int blk_buffer_aligned(struct bounce_buffer *state)
 	return 1;	/* Default, any buffer is OK */
 }
 
-long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+static long blk_read_dev(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			 void *buf)
 {
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
 	const struct blk_ops *ops = blk_get_ops(dev);
 	ulong blks_read;
 
-	if (!ops->read)
-		return -ENOSYS;
-
-	if (blkcache_read(desc->uclass_id, desc->devnum,
-			  start, blkcnt, desc->blksz, buf))
-		return blkcnt;
-
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
 		int ret;
@@ -459,6 +458,39 @@ long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
 		blks_read = ops->read(dev, start, blkcnt, buf);
 	}
 
+	return blks_read;
+}
+
+long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	lbaint_t window;
+	ulong blks_read;
+	void *rabuf;
+
+	if (!ops->read)
+		return -ENOSYS;
+
+	if (blkcache_read(desc->uclass_id, desc->devnum,
+			  start, blkcnt, desc->blksz, buf))
+		return blkcnt;
+
+	window = blkcache_readahead(desc->uclass_id, desc->devnum, start,
+				    blkcnt, desc->blksz, desc->lba, &rabuf);
+	if (window) {
+		blks_read = blk_read_dev(dev, start, blkcnt + window, rabuf);
+		if (blks_read == blkcnt + window) {
+			blkcache_fill_readahead(desc->uclass_id, desc->devnum,
+						start, blkcnt, window,
+						desc->blksz, rabuf);
+			memcpy(buf, rabuf, blkcnt * desc->blksz);
+			return blkcnt;
+		}
+		/* fall back to reading just what was asked for */
+	}
+
+	blks_read = blk_read_dev(dev, start, blkcnt, buf);
 	if (blks_read == blkcnt)
 		blkcache_fill(desc->uclass_id, desc->devnum, start, blkcnt,
 			      desc->blksz, buf);
@@ -466,8 +498,8 @@ long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
 	return blks_read;
 }
 
-long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
-	       const void *buf)
+long blk_write_uncached(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			const void *buf)
 {
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
 	const struct blk_ops *ops = blk_get_ops(dev);
@@ -476,8 +508,6 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 	if (!ops->write)
 		return -ENOSYS;
 
-	blkcache_invalidate(desc->uclass_id, desc->devnum);
-
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
 		int ret;
@@ -500,6 +530,38 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 	return blks_written;
 }
 
+long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+	       const void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	long blks_written;
+
+	if (!ops->write)
+		return -ENOSYS;
+
+	fs_invalidate_dev(desc);
+	if (blkcache_write(desc->uclass_id, desc->devnum, start, blkcnt,
+			   desc->blksz, buf))
+		return blkcnt;
+
+	blks_written = blk_write_uncached(dev, start, blkcnt, buf);
+	if (blks_written == blkcnt)
+		blkcache_update(desc->uclass_id, desc->devnum, start, blkcnt,
+				desc->blksz, buf);
+	else
+		blkcache_invalidate(desc->uclass_id, desc->devnum);
+
+	return blks_written;
+}
+
+int blk_flush(struct udevice *dev)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+
+	return blkcache_flush(desc->uclass_id, desc->devnum);
+}
+
 long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
 {
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
@@ -508,11 +570,159 @@ long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
 	if (!ops->erase)
 		return -ENOSYS;
 
+	fs_invalidate_dev(desc);
+	blkcache_flush(desc->uclass_id, desc->devnum);
 	blkcache_invalidate(desc->uclass_id, desc->devnum);
 
 	return ops->erase(dev, start, blkcnt);
 }
 
+/* Timeout for a device making no progress with its requests */
+#define BLK_REQ_TIMEOUT_MS	10000
+
+static void blk_req_sync(struct udevice *dev, struct blk_req *req)
+{
+	lbaint_t start = req->start;
+	long done = 0, ret;
+	int i;
+
+	for (i = 0; i < req->nr_sg; i++) {
+		struct blk_sg *sg = &req->sg[i];
+
+		if (req->op == BLK_REQ_WRITE)
+			ret = blk_write(dev, start, sg->blkcnt, sg->buf);
+		else
+			ret = blk_read(dev, start, sg->blkcnt, sg->buf);
+		if (ret < 0) {
+			done = ret;
+			break;
+		}
+		done += ret;
+		if (ret != sg->blkcnt)
+			break;
+		start += ret;
+	}
+	req->result = done;
+	req->done = true;
+}
+
+int blk_submit(struct udevice *dev, struct blk_req **reqs, int count)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		reqs[i]->done = false;
+		reqs[i]->result = 0;
+	}
+
+	if (!ops->submit || (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb)) {
+		for (i = 0; i < count; i++)
+			blk_req_sync(dev, reqs[i]);
+		return count;
+	}
+
+	/* the device must see dirty blocks, and the cache its writes */
+	if (blkcache_flush(desc->uclass_id, desc->devnum))
+		return -EIO;
+	for (i = 0; i < count; i++) {
+		if (reqs[i]->op == BLK_REQ_WRITE) {
+			fs_invalidate_dev(desc);
+			blkcache_invalidate(desc->uclass_id, desc->devnum);
+			break;
+		}
+	}
+
+	return ops->submit(dev, reqs, count);
+}
+
+int blk_poll(struct udevice *dev)
+{
+	const struct blk_ops *ops = blk_get_ops(dev);
+
+	if (!ops->poll)
+		return 0;
+
+	return ops->poll(dev);
+}
+
+void blk_cancel(struct udevice *dev)
+{
+	const struct blk_ops *ops = blk_get_ops(dev);
+	ulong start;
+
+	if (ops->cancel) {
+		ops->cancel(dev);
+		return;
+	}
+
+	start = get_timer(0);
+	while (blk_poll(dev) > 0 && get_timer(start) <= BLK_REQ_TIMEOUT_MS)
+		;
+}
+
+/*
+ * After an error, wait for the requests which are in flight to complete, so
+ * that they stop using the caller's memory, and cancel those which do not
+ */
+static void blk_drain(struct udevice *dev)
+{
+	ulong start = get_timer(0);
+	int ret;
+
+	do {
+		ret = blk_poll(dev);
+	} while (ret > 0 && get_timer(start) <= BLK_REQ_TIMEOUT_MS);
+	if (ret)
+		blk_cancel(dev);
+}
+
+int blk_submit_all(struct udevice *dev, struct blk_req **reqs, int count)
+{
+	int queued, pending, ret, i;
+	ulong start;
+
+	start = get_timer(0);
+	for (queued = 0, pending = -1; queued < count || pending;) {
+		if (queued < count) {
+			ret = blk_submit(dev, reqs + queued, count - queued);
+			if (ret < 0) {
+				blk_drain(dev);
+				return log_msg_ret("sub", ret);
+			}
+			if (ret)
+				start = get_timer(0);
+			queued += ret;
+		}
+		ret = blk_poll(dev);
+		if (ret < 0) {
+			blk_drain(dev);
+			return log_msg_ret("pol", ret);
+		}
+		if (ret != pending)
+			start = get_timer(0);
+		pending = ret;
+		if (get_timer(start) > BLK_REQ_TIMEOUT_MS) {
+			blk_cancel(dev);
+			return log_msg_ret("tim", -ETIMEDOUT);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		struct blk_req *req = reqs[i];
+		lbaint_t blkcnt = 0;
+		int j;
+
+		for (j = 0; j < req->nr_sg; j++)
+			blkcnt += req->sg[j].blkcnt;
+		if (req->result != blkcnt)
+			return -EIO;
+	}
+
+	return 0;
+}
+
 ulong blk_dread(struct blk_desc *desc, lbaint_t start, lbaint_t blkcnt,
 		void *buffer)
 {
@@ -851,9 +1061,21 @@ static int blk_post_probe(struct udevice *dev)
 	return 0;
 }
 
+static int blk_pre_remove(struct udevice *dev)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+
+	blk_flush(dev);
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	fs_invalidate_dev(desc);
+
+	return 0;
+}
+
 UCLASS_DRIVER(blk) = {
 	.id		= UCLASS_BLK,
 	.name		= "blk",
 	.post_probe	= blk_post_probe,
+	.pre_remove	= blk_pre_remove,
 	.per_device_plat_auto	= sizeof(struct blk_desc),
 };
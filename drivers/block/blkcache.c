@@ -6,70 +6,439 @@
  */
 #include <common.h>
 #include <blk.h>
+#include <dm.h>
 #include <log.h>
 #include <malloc.h>
+#include <memalign.h>
 #include <part.h>
+#include <sort.h>
 #include <asm/global_data.h>
 #include <linux/ctype.h>
+#include <linux/kernel.h>
 #include <linux/list.h>
 
-struct block_cache_node {
-	struct list_head lh;
+/*
+ * The cache is a set-associative array of single-block slots. A block is
+ * identified by (iftype, devnum, lba) and hashed to a set of BLKCACHE_WAYS
+ * slots, within which the least recently used slot is evicted.
+ *
+ * Slot metadata and data live in two slabs allocated on first use, so
+ * filling and evicting never goes back to malloc(). The data slab is sized
+ * for the largest block size seen; a device with larger blocks causes the
+ * slabs to be reallocated.
+ *
+ * Writes update cached blocks after they reach the device. In write-back
+ * mode small writes only go to the cache and the blocks are marked dirty.
+ * Dirty blocks are written back, sorted and merged into runs, when the
+ * device is flushed or when one of its dirty blocks is evicted.
+ *
+ * When a device is read sequentially, a miss reads ahead past the end of
+ * the request into the cache. The read-ahead window starts at
+ * BLKCACHE_RA_MIN blocks and doubles on each sequential miss, up to the
+ * per-device maximum. Any other miss closes the window again.
+ */
+#define BLKCACHE_WAYS		8
+
+/* Maximum number of blocks in a single write-back request */
+#define BLKCACHE_FLUSH_BLOCKS	32
+
+/* Initial size of the read-ahead window, in blocks */
+#define BLKCACHE_RA_MIN		8
+
+/* Multiplier for hashing device numbers into the set index */
+#define BLKCACHE_HASH_MULT	0x9e3779b9
+
+struct block_cache_slot {
 	int iftype;
 	int devnum;
-	lbaint_t start;
-	lbaint_t blkcnt;
-	unsigned long blksz;
-	char *cache;
+	lbaint_t lba;
+	unsigned long blksz;	/* 0 if slot is empty */
+	ulong stamp;		/* last access time, for LRU */
+	bool dirty;		/* not yet written to the device */
+	bool readahead;		/* read ahead and not yet used */
+};
+
+struct block_cache_dev {
+	struct list_head lh;
+	struct block_cache_dev_stats stats;
+	lbaint_t ra_next;	/* block following the last read */
+	bool ra_seq;		/* last read followed the one before */
 };
 
-static LIST_HEAD(block_cache);
+static struct block_cache_slot *slots;
+static struct block_cache_slot **flush_list;
+static char *slab;
+static char *flush_buf;
+static char *ra_buf;
+static ulong ra_buf_size;
+static unsigned long slot_size;
+static uint nsets, nways;
+static ulong cache_clock;
+static enum blkcache_mode cache_mode;
+static uint ra_default = CONFIG_BLOCK_CACHE_READAHEAD;
+
+static LIST_HEAD(block_cache_devs);
 
 static struct block_cache_stats _stats = {
 	.max_blocks_per_entry = 8,
 	.max_entries = 32
 };
 
-static struct block_cache_node *cache_find(int iftype, int devnum,
-					   lbaint_t start, lbaint_t blkcnt,
-					   unsigned long blksz)
-{
-	struct block_cache_node *node;
-
-	list_for_each_entry(node, &block_cache, lh)
-		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum) &&
-		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
-			if (block_cache.next != &node->lh) {
-				/* maintain MRU ordering */
-				list_del(&node->lh);
-				list_add(&node->lh, &block_cache);
+static struct block_cache_dev *cache_dev(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (bdev->stats.iftype == iftype &&
+		    bdev->stats.devnum == devnum) {
+			if (block_cache_devs.next != &bdev->lh) {
+				/* keep the busiest device at the front */
+				list_del(&bdev->lh);
+				list_add(&bdev->lh, &block_cache_devs);
 			}
-			return node;
+			return bdev;
 		}
+	}
+
+	bdev = calloc(1, sizeof(*bdev));
+	if (!bdev)
+		return NULL;
+	bdev->stats.iftype = iftype;
+	bdev->stats.devnum = devnum;
+	bdev->stats.ra_max = ra_default;
+	bdev->ra_next = ~(lbaint_t)0;
+	list_add(&bdev->lh, &block_cache_devs);
+
+	return bdev;
+}
+
+static void cache_count(int iftype, int devnum, bool hit)
+{
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum);
+
+	if (hit) {
+		++_stats.hits;
+		if (bdev)
+			++bdev->stats.hits;
+	} else {
+		++_stats.misses;
+		if (bdev)
+			++bdev->stats.misses;
+	}
+}
+
+static void cache_free_slabs(void)
+{
+	struct block_cache_dev *bdev;
+
+	free(ra_buf);
+	free(flush_buf);
+	free(flush_list);
+	free(slab);
+	free(slots);
+	ra_buf = NULL;
+	ra_buf_size = 0;
+	flush_buf = NULL;
+	flush_list = NULL;
+	slab = NULL;
+	slots = NULL;
+	slot_size = 0;
+	_stats.entries = 0;
+	_stats.dirty = 0;
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		bdev->stats.dirty = 0;
+}
+
+static int cache_alloc_slabs(unsigned long blksz)
+{
+	uint nslots = _stats.max_blocks_per_entry * _stats.max_entries;
+
+	if (slots && blksz <= slot_size)
+		return 0;
+
+	/* blocks have grown, start again with bigger slots */
+	if (blkcache_flush(-1, 0))
+		return -EIO;
+	cache_free_slabs();
+
+	nways = min_t(uint, nslots, BLKCACHE_WAYS);
+	nsets = nslots / nways;
+	nslots = nsets * nways;
+	slots = calloc(nslots, sizeof(*slots));
+	flush_list = calloc(nslots, sizeof(*flush_list));
+	slab = malloc(nslots * blksz);
+	flush_buf = malloc(BLKCACHE_FLUSH_BLOCKS * blksz);
+	if (!slots || !flush_list || !slab || !flush_buf) {
+		cache_free_slabs();
+		return -ENOMEM;
+	}
+	slot_size = blksz;
+	debug("slabs: %u sets of %u ways, %lu bytes per block\n", nsets,
+	      nways, blksz);
+
 	return 0;
 }
 
+static inline char *slot_data(struct block_cache_slot *slot)
+{
+	return slab + (slot - slots) * slot_size;
+}
+
+static struct block_cache_slot *cache_set(int iftype, int devnum,
+					  lbaint_t lba)
+{
+	u32 key;
+
+	/*
+	 * Consecutive blocks of a device land in consecutive sets, so a
+	 * multi-block request spreads over the cache rather than competing
+	 * for the ways of a single set.
+	 */
+	key = lower_32_bits(lba) +
+	      (upper_32_bits(lba) ^ (iftype << 8 | devnum)) *
+	      BLKCACHE_HASH_MULT;
+
+	return &slots[(key % nsets) * nways];
+}
+
+static struct block_cache_slot *cache_find(int iftype, int devnum,
+					   lbaint_t lba, unsigned long blksz)
+{
+	struct block_cache_slot *slot = cache_set(iftype, devnum, lba);
+	uint i;
+
+	for (i = 0; i < nways; i++, slot++) {
+		if (slot->blksz == blksz && slot->lba == lba &&
+		    slot->devnum == devnum && slot->iftype == iftype) {
+			slot->stamp = ++cache_clock;
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+/* Account for a block read ahead, once it is used or dropped */
+static void cache_ra_done(struct block_cache_slot *slot, bool used)
+{
+	struct block_cache_dev *bdev;
+
+	if (!slot->readahead)
+		return;
+	slot->readahead = false;
+	bdev = cache_dev(slot->iftype, slot->devnum);
+	if (used) {
+		++_stats.ra_used;
+		if (bdev)
+			++bdev->stats.ra_used;
+	} else {
+		++_stats.ra_wasted;
+		if (bdev)
+			++bdev->stats.ra_wasted;
+	}
+}
+
+static void cache_clean(struct block_cache_slot *slot,
+			struct block_cache_dev *bdev)
+{
+	if (!slot->dirty)
+		return;
+	slot->dirty = false;
+	--_stats.dirty;
+	if (bdev)
+		--bdev->stats.dirty;
+}
+
+static int cache_cmp_lba(const void *a, const void *b)
+{
+	const struct block_cache_slot *sa = *(struct block_cache_slot **)a;
+	const struct block_cache_slot *sb = *(struct block_cache_slot **)b;
+
+	if (sa->lba == sb->lba)
+		return 0;
+
+	return sa->lba < sb->lba ? -1 : 1;
+}
+
+/* Write back the dirty blocks of a device, merging adjacent blocks */
+static int cache_flush_dev(struct block_cache_dev *bdev)
+{
+	struct block_cache_slot *slot;
+	struct udevice *dev;
+	unsigned long blksz;
+	uint i, j, count, run;
+	int ret = 0;
+
+	if (!bdev->stats.dirty)
+		return 0;
+
+	for (i = 0, count = 0, slot = slots; i < nsets * nways; i++, slot++) {
+		if (slot->blksz && slot->dirty &&
+		    slot->iftype == bdev->stats.iftype &&
+		    slot->devnum == bdev->stats.devnum)
+			flush_list[count++] = slot;
+	}
+	qsort(flush_list, count, sizeof(*flush_list), cache_cmp_lba);
+
+	if (blk_get_device(bdev->stats.iftype, bdev->stats.devnum, &dev)) {
+		log_err("Cannot find device to write back %u blocks\n",
+			count);
+		ret = -ENODEV;
+	}
+
+	for (i = 0; i < count; i += run) {
+		blksz = flush_list[i]->blksz;
+		for (run = 0; i + run < count && run < BLKCACHE_FLUSH_BLOCKS;
+		     run++) {
+			slot = flush_list[i + run];
+			if (slot->lba != flush_list[i]->lba + run)
+				break;
+			memcpy(flush_buf + run * blksz, slot_data(slot), blksz);
+		}
+
+		debug("write back: start " LBAF ", count %u\n",
+		      flush_list[i]->lba, run);
+		if (!ret) {
+			++_stats.writebacks;
+			if (blk_write_uncached(dev, flush_list[i]->lba, run,
+					       flush_buf) != run) {
+				log_err("Failed to write back block " LBAFU
+					"\n", flush_list[i]->lba);
+				ret = -EIO;
+			}
+		}
+
+		/* on error the blocks are dropped, there is no way to retry */
+		for (j = 0; j < run; j++) {
+			slot = flush_list[i + j];
+			cache_clean(slot, bdev);
+			if (ret) {
+				cache_ra_done(slot, false);
+				slot->blksz = 0;
+				--_stats.entries;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static struct block_cache_slot *cache_victim(int iftype, int devnum,
+					     lbaint_t lba)
+{
+	struct block_cache_slot *slot = cache_set(iftype, devnum, lba);
+	struct block_cache_slot *victim = slot;
+	struct block_cache_dev *bdev;
+	uint i;
+
+	for (i = 0; i < nways; i++, slot++) {
+		if (!slot->blksz)
+			return slot;
+		if (slot->stamp < victim->stamp)
+			victim = slot;
+	}
+
+	debug("drop: start " LBAF "\n", victim->lba);
+	++_stats.evictions;
+	bdev = cache_dev(victim->iftype, victim->devnum);
+	if (bdev)
+		++bdev->stats.evictions;
+	if (victim->dirty && bdev) {
+		/* take the rest of the device's dirty blocks along */
+		cache_flush_dev(bdev);
+		if (!victim->blksz)
+			return victim;
+	}
+	cache_clean(victim, bdev);
+	cache_ra_done(victim, false);
+	victim->blksz = 0;
+	_stats.entries--;
+
+	return victim;
+}
+
+/* Check whether any of a range of blocks is dirty in the cache */
+static bool cache_dirty_in(struct block_cache_dev *bdev, lbaint_t start,
+			   lbaint_t blkcnt)
+{
+	struct block_cache_slot *slot;
+	uint i;
+
+	if (!bdev || !bdev->stats.dirty)
+		return false;
+
+	for (i = 0, slot = slots; i < nsets * nways; i++, slot++) {
+		if (slot->dirty && slot->iftype == bdev->stats.iftype &&
+		    slot->devnum == bdev->stats.devnum &&
+		    slot->lba >= start && slot->lba - start < blkcnt)
+			return true;
+	}
+
+	return false;
+}
+
+static struct block_cache_slot *cache_insert(int iftype, int devnum,
+					     lbaint_t lba, unsigned long blksz)
+{
+	struct block_cache_slot *slot;
+
+	slot = cache_find(iftype, devnum, lba, blksz);
+	if (slot)
+		return slot;
+
+	slot = cache_victim(iftype, devnum, lba);
+	slot->iftype = iftype;
+	slot->devnum = devnum;
+	slot->lba = lba;
+	slot->blksz = blksz;
+	slot->stamp = ++cache_clock;
+	slot->dirty = false;
+	slot->readahead = false;
+	_stats.entries++;
+
+	return slot;
+}
+
 int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer)
 {
-	struct block_cache_node *node = cache_find(iftype, devnum, start,
-						   blkcnt, blksz);
-	if (node) {
-		const char *src = node->cache + (start - node->start) * blksz;
-		memcpy(buffer, src, blksz * blkcnt);
-		debug("hit: start " LBAF ", count " LBAFU "\n",
-		      start, blkcnt);
-		++_stats.hits;
-		return 1;
+	struct block_cache_slot *slot;
+	struct block_cache_dev *bdev;
+	char *dst = buffer;
+	lbaint_t i;
+
+	bdev = cache_dev(iftype, devnum);
+	if (bdev) {
+		bdev->ra_seq = start == bdev->ra_next;
+		bdev->ra_next = start + blkcnt;
 	}
 
+	if (!slots || blkcnt > _stats.max_blocks_per_entry)
+		goto miss;
+
+	for (i = 0; i < blkcnt; i++, dst += blksz) {
+		slot = cache_find(iftype, devnum, start + i, blksz);
+		if (!slot)
+			goto miss;
+		memcpy(dst, slot_data(slot), blksz);
+		cache_ra_done(slot, true);
+	}
+
+	debug("hit: start " LBAF ", count " LBAFU "\n",
+	      start, blkcnt);
+	cache_count(iftype, devnum, true);
+	return 1;
+
+miss:
 	debug("miss: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
-	++_stats.misses;
+	cache_count(iftype, devnum, false);
+
+	/* the device must not return stale copies of dirty blocks */
+	if (slots && cache_dirty_in(bdev, start, blkcnt))
+		cache_flush_dev(bdev);
+
 	return 0;
 }
 
@@ -77,68 +446,242 @@ void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
-	lbaint_t bytes;
-	struct block_cache_node *node;
+	struct block_cache_slot *slot;
+	const char *src = buffer;
+	lbaint_t i;
 
 	/* don't cache big stuff */
 	if (blkcnt > _stats.max_blocks_per_entry)
 		return;
 
-	if (_stats.max_entries == 0)
+	if (_stats.max_entries == 0 || _stats.max_blocks_per_entry == 0)
 		return;
 
-	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
-		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
-		list_del(&node->lh);
-		_stats.entries--;
-		debug("drop: start " LBAF ", count " LBAFU "\n",
-		      node->start, node->blkcnt);
-		if (node->blkcnt * node->blksz < bytes) {
-			free(node->cache);
-			node->cache = 0;
+	if (cache_alloc_slabs(blksz))
+		return;
+
+	debug("fill: start " LBAF ", count " LBAFU "\n",
+	      start, blkcnt);
+
+	for (i = 0; i < blkcnt; i++, src += blksz) {
+		slot = cache_insert(iftype, devnum, start + i, blksz);
+		if (!slot->dirty)
+			memcpy(slot_data(slot), src, blksz);
+	}
+}
+
+lbaint_t blkcache_readahead(int iftype, int devnum,
+			    lbaint_t start, lbaint_t blkcnt,
+			    unsigned long blksz, lbaint_t lba, void **bufp)
+{
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum);
+	lbaint_t window;
+	ulong size;
+
+	if (!bdev || !bdev->stats.ra_max)
+		return 0;
+
+	if (!bdev->ra_seq || blkcnt > _stats.max_blocks_per_entry ||
+	    start + blkcnt >= lba) {
+		bdev->stats.ra_window = 0;
+		return 0;
+	}
+
+	if (_stats.max_entries == 0 || _stats.max_blocks_per_entry == 0)
+		return 0;
+
+	if (cache_alloc_slabs(blksz))
+		return 0;
+
+	/* keep the window small enough not to flush the whole cache */
+	window = bdev->stats.ra_window ? bdev->stats.ra_window * 2 :
+		 BLKCACHE_RA_MIN;
+	window = min_t(lbaint_t, window, bdev->stats.ra_max);
+	window = min_t(lbaint_t, window, nsets * nways / 4);
+	window = min(window, lba - start - blkcnt);
+	if (!window)
+		return 0;
+
+	size = (blkcnt + window) * blksz;
+	if (size > ra_buf_size) {
+		free(ra_buf);
+		ra_buf = malloc_cache_aligned(size);
+		ra_buf_size = ra_buf ? size : 0;
+		if (!ra_buf)
+			return 0;
+	}
+
+	debug("read ahead: start " LBAF ", count " LBAFU "\n",
+	      start + blkcnt, window);
+	bdev->stats.ra_window = window;
+	++bdev->stats.ra_reads;
+	++_stats.ra_reads;
+	*bufp = ra_buf;
+
+	return window;
+}
+
+void blkcache_fill_readahead(int iftype, int devnum,
+			     lbaint_t start, lbaint_t blkcnt, lbaint_t window,
+			     unsigned long blksz, void const *buffer)
+{
+	struct block_cache_slot *slot;
+	const char *src = buffer;
+	lbaint_t i;
+
+	if (!slots || blksz > slot_size)
+		return;
+
+	blkcache_fill(iftype, devnum, start, blkcnt, blksz, src);
+
+	src += blkcnt * blksz;
+	for (i = blkcnt; i < blkcnt + window; i++, src += blksz) {
+		slot = cache_find(iftype, devnum, start + i, blksz);
+		if (slot)
+			continue;
+		slot = cache_insert(iftype, devnum, start + i, blksz);
+		memcpy(slot_data(slot), src, blksz);
+		slot->readahead = true;
+	}
+}
+
+void blkcache_set_readahead(int iftype, int devnum, uint blocks)
+{
+	struct block_cache_dev *bdev;
+
+	if (iftype == -1) {
+		ra_default = blocks;
+		list_for_each_entry(bdev, &block_cache_devs, lh)
+			bdev->stats.ra_max = blocks;
+		return;
+	}
+
+	bdev = cache_dev(iftype, devnum);
+	if (bdev)
+		bdev->stats.ra_max = blocks;
+}
+
+int blkcache_write(int iftype, int devnum,
+		   lbaint_t start, lbaint_t blkcnt,
+		   unsigned long blksz, void const *buffer)
+{
+	struct block_cache_slot *slot;
+	struct block_cache_dev *bdev;
+	const char *src = buffer;
+	lbaint_t i;
+
+	if (cache_mode != BLKCACHE_WRITEBACK ||
+	    blkcnt > _stats.max_blocks_per_entry)
+		return 0;
+
+	if (_stats.max_entries == 0 || _stats.max_blocks_per_entry == 0)
+		return 0;
+
+	if (cache_alloc_slabs(blksz))
+		return 0;
+
+	bdev = cache_dev(iftype, devnum);
+	if (!bdev)
+		return 0;
+
+	debug("write: start " LBAF ", count " LBAFU "\n",
+	      start, blkcnt);
+
+	for (i = 0; i < blkcnt; i++, src += blksz) {
+		slot = cache_insert(iftype, devnum, start + i, blksz);
+		memcpy(slot_data(slot), src, blksz);
+		cache_ra_done(slot, false);
+		if (!slot->dirty) {
+			slot->dirty = true;
+			++_stats.dirty;
+			++bdev->stats.dirty;
 		}
-	} else {
-		node = malloc(sizeof(*node));
-		if (!node)
-			return;
-		node->cache = 0;
 	}
 
-	if (!node->cache) {
-		node->cache = malloc(bytes);
-		if (!node->cache) {
-			free(node);
+	return 1;
+}
+
+void blkcache_update(int iftype, int devnum,
+		     lbaint_t start, lbaint_t blkcnt,
+		     unsigned long blksz, void const *buffer)
+{
+	struct block_cache_slot *slot;
+	struct block_cache_dev *bdev;
+	const char *src = buffer;
+	lbaint_t i;
+	uint n;
+
+	if (blkcnt <= _stats.max_blocks_per_entry) {
+		/* small writes are likely to be read back, so cache them */
+		if (_stats.max_entries == 0 || _stats.max_blocks_per_entry == 0)
+			return;
+		if (cache_alloc_slabs(blksz))
 			return;
+		bdev = cache_dev(iftype, devnum);
+		for (i = 0; i < blkcnt; i++, src += blksz) {
+			slot = cache_insert(iftype, devnum, start + i, blksz);
+			memcpy(slot_data(slot), src, blksz);
+			cache_clean(slot, bdev);
+			cache_ra_done(slot, false);
 		}
+		return;
 	}
 
-	debug("fill: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
+	if (!slots)
+		return;
 
-	node->iftype = iftype;
-	node->devnum = devnum;
-	node->start = start;
-	node->blkcnt = blkcnt;
-	node->blksz = blksz;
-	memcpy(node->cache, buffer, bytes);
-	list_add(&node->lh, &block_cache);
-	_stats.entries++;
+	/* only refresh the blocks already cached */
+	bdev = cache_dev(iftype, devnum);
+	for (n = 0, slot = slots; n < nsets * nways; n++, slot++) {
+		if (slot->blksz && slot->iftype == iftype &&
+		    slot->devnum == devnum && slot->lba >= start &&
+		    slot->lba - start < blkcnt) {
+			memcpy(slot_data(slot),
+			       src + (slot->lba - start) * blksz, blksz);
+			cache_clean(slot, bdev);
+			cache_ra_done(slot, false);
+		}
+	}
+}
+
+int blkcache_flush(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+	int ret = 0;
+
+	if (!slots)
+		return 0;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (iftype == -1 ||
+		    (bdev->stats.iftype == iftype &&
+		     bdev->stats.devnum == devnum)) {
+			if (cache_flush_dev(bdev))
+				ret = -EIO;
+		}
+	}
+
+	return ret;
 }
 
 void blkcache_invalidate(int iftype, int devnum)
 {
-	struct list_head *entry, *n;
-	struct block_cache_node *node;
+	struct block_cache_slot *slot;
+	uint i;
 
-	list_for_each_safe(entry, n, &block_cache) {
-		node = (struct block_cache_node *)entry;
+	if (!slots)
+		return;
+
+	for (i = 0, slot = slots; i < nsets * nways; i++, slot++) {
+		if (!slot->blksz)
+			continue;
 		if (iftype == -1 ||
-		    (node->iftype == iftype && node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
+		    (slot->iftype == iftype && slot->devnum == devnum)) {
+			if (slot->dirty)
+				cache_clean(slot, cache_dev(slot->iftype,
+							    slot->devnum));
+			cache_ra_done(slot, false);
+			slot->blksz = 0;
 			--_stats.entries;
 		}
 	}
@@ -146,26 +689,87 @@ void blkcache_invalidate(int iftype, int devnum)
 
 void blkcache_configure(unsigned blocks, unsigned entries)
 {
-	/* invalidate cache if there is a change */
+	/* drop the slabs if there is a change, they are resized on next fill */
 	if ((blocks != _stats.max_blocks_per_entry) ||
-	    (entries != _stats.max_entries))
-		blkcache_invalidate(-1, 0);
+	    (entries != _stats.max_entries)) {
+		blkcache_flush(-1, 0);
+		cache_free_slabs();
+	}
 
 	_stats.max_blocks_per_entry = blocks;
 	_stats.max_entries = entries;
 
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.evictions = 0;
+	_stats.writebacks = 0;
+	_stats.ra_reads = 0;
+	_stats.ra_used = 0;
+	_stats.ra_wasted = 0;
+}
+
+int blkcache_set_mode(enum blkcache_mode mode)
+{
+	int ret = 0;
+
+	if (mode == BLKCACHE_WRITETHROUGH)
+		ret = blkcache_flush(-1, 0);
+	cache_mode = mode;
+
+	return ret;
+}
+
+enum blkcache_mode blkcache_get_mode(void)
+{
+	return cache_mode;
 }
 
 void blkcache_stats(struct block_cache_stats *stats)
 {
+	struct block_cache_dev *bdev;
+
 	memcpy(stats, &_stats, sizeof(*stats));
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.evictions = 0;
+	_stats.writebacks = 0;
+	_stats.ra_reads = 0;
+	_stats.ra_used = 0;
+	_stats.ra_wasted = 0;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		bdev->stats.hits = 0;
+		bdev->stats.misses = 0;
+		bdev->stats.evictions = 0;
+		bdev->stats.ra_reads = 0;
+		bdev->stats.ra_used = 0;
+		bdev->stats.ra_wasted = 0;
+	}
+}
+
+int blkcache_dev_stats(int idx, struct block_cache_dev_stats *stats)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (!idx--) {
+			memcpy(stats, &bdev->stats, sizeof(*stats));
+			return 0;
+		}
+	}
+
+	return -ENOENT;
 }
 
 void blkcache_free(void)
 {
-	blkcache_invalidate(-1, 0);
+	struct block_cache_dev *bdev, *n;
+
+	cache_free_slabs();
+	list_for_each_entry_safe(bdev, n, &block_cache_devs, lh) {
+		list_del(&bdev->lh);
+		free(bdev);
+	}
+	cache_mode = BLKCACHE_WRITETHROUGH;
+	ra_default = CONFIG_BLOCK_CACHE_READAHEAD;
 }
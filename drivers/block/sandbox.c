@@ -56,13 +56,99 @@ static unsigned long host_block_write(struct udevice *dev,
 	return -EIO;
 }
 
+/* Requests queued at once, kept small so that tests can fill the queue */
+#define HOST_QUEUE_DEPTH	4
+
+/**
+ * struct host_blk_priv - private data for a host block device
+ *
+ * @queue: Requests submitted and not yet completed, starting at @head
+ * @head: Index of the oldest request in @queue
+ * @count: Number of requests in @queue
+ */
+struct host_blk_priv {
+	struct blk_req *queue[HOST_QUEUE_DEPTH];
+	int head;
+	int count;
+};
+
+static int host_block_submit(struct udevice *dev, struct blk_req **reqs,
+			     int count)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+	int i;
+
+	for (i = 0; i < count && priv->count < HOST_QUEUE_DEPTH; i++) {
+		priv->queue[(priv->head + priv->count) % HOST_QUEUE_DEPTH] =
+			reqs[i];
+		priv->count++;
+	}
+
+	return i;
+}
+
+/* Complete one request per call, like a device working in the background */
+static int host_block_poll(struct udevice *dev)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+	struct blk_req *req;
+	lbaint_t start;
+	ulong ret;
+	int i;
+
+	if (!priv->count)
+		return 0;
+
+	req = priv->queue[priv->head];
+	priv->head = (priv->head + 1) % HOST_QUEUE_DEPTH;
+	priv->count--;
+
+	req->result = 0;
+	for (i = 0, start = req->start; i < req->nr_sg; i++) {
+		struct blk_sg *sg = &req->sg[i];
+
+		if (req->op == BLK_REQ_WRITE)
+			ret = host_block_write(dev, start, sg->blkcnt, sg->buf);
+		else
+			ret = host_block_read(dev, start, sg->blkcnt, sg->buf);
+		if (IS_ERR_VALUE(ret)) {
+			req->result = ret;
+			break;
+		}
+		req->result += ret;
+		start += ret;
+		if (ret != sg->blkcnt)
+			break;
+	}
+	req->done = true;
+
+	return priv->count;
+}
+
+static void host_block_cancel(struct udevice *dev)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+	struct blk_req *req;
+
+	for (; priv->count; priv->count--) {
+		req = priv->queue[priv->head];
+		priv->head = (priv->head + 1) % HOST_QUEUE_DEPTH;
+		req->result = -ECANCELED;
+		req->done = true;
+	}
+}
+
 static const struct blk_ops sandbox_host_blk_ops = {
 	.read	= host_block_read,
 	.write	= host_block_write,
+	.submit	= host_block_submit,
+	.poll	= host_block_poll,
+	.cancel	= host_block_cancel,
 };
 
 U_BOOT_DRIVER(sandbox_host_blk) = {
 	.name		= "sandbox_host_blk",
 	.id		= UCLASS_BLK,
 	.ops		= &sandbox_host_blk_ops,
+	.priv_auto	= sizeof(struct host_blk_priv),
 };
@@ -9,6 +9,7 @@
 
 #include <common.h>
 #include <bootdev.h>
+#include <fs.h>
 #include <log.h>
 #include <mmc.h>
 #include <dm.h>
@@ -480,8 +481,10 @@ static int mmc_select_hwpart(struct udevice *bdev, int hwpart)
 		return -EMEDIUMTYPE;
 
 	ret = mmc_switch_part(mmc, hwpart);
-	if (!ret)
+	if (!ret) {
 		blkcache_invalidate(desc->uclass_id, desc->devnum);
+		fs_invalidate_dev(desc);
+	}
 
 	return ret;
 }
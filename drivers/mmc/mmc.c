@@ -15,6 +15,7 @@
 #include <log.h>
 #include <dm/device-internal.h>
 #include <errno.h>
+#include <fs.h>
 #include <mmc.h>
 #include <part.h>
 #include <linux/bitops.h>
@@ -2689,6 +2690,8 @@ static int mmc_startup(struct mmc *mmc)
 	bdesc->blksz = mmc->read_bl_len;
 	bdesc->log2blksz = LOG2(bdesc->blksz);
 	bdesc->lba = lldiv(mmc->capacity, mmc->read_bl_len);
+	/* The card may have been swapped, forget filesystems found on it */
+	fs_invalidate_dev(bdesc);
 #if !defined(CONFIG_SPL_BUILD) || \
 		(defined(CONFIG_SPL_LIBCOMMON_SUPPORT) && \
 		!CONFIG_IS_ENABLED(USE_TINY_PRINTF))
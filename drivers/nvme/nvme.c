@@ -18,7 +18,7 @@
 #include <linux/compat.h>
 #include "nvme.h"
 
-#define NVME_Q_DEPTH		2
+#define NVME_Q_DEPTH		CONFIG_NVME_QUEUE_DEPTH
 #define NVME_AQ_DEPTH		2
 #define NVME_SQ_SIZE(depth)	(depth * sizeof(struct nvme_command))
 #define NVME_CQ_SIZE(depth)	(depth * sizeof(struct nvme_completion))
@@ -26,7 +26,7 @@
 				      ARCH_DMA_MINALIGN)
 #define ADMIN_TIMEOUT		60
 #define IO_TIMEOUT		30
-#define MAX_PRP_POOL		512
+#define NVME_MAX_XFER_SHIFT	20
 
 static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 {
@@ -45,7 +45,7 @@ static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 	return -ETIME;
 }
 
-static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
+static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp_list, u64 *prp2,
 			   int total_len, u64 dma_addr)
 {
 	u32 page_size = dev->page_size;
@@ -74,36 +74,26 @@ static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
 	nprps = DIV_ROUND_UP(length, page_size);
 	num_pages = DIV_ROUND_UP(nprps - 1, prps_per_page - 1);
 
-	if (nprps > dev->prp_entry_num) {
-		free(dev->prp_pool);
-		/*
-		 * Always increase in increments of pages.  It doesn't waste
-		 * much memory and reduces the number of allocations.
-		 */
-		dev->prp_pool = memalign(page_size, num_pages * page_size);
-		if (!dev->prp_pool) {
-			printf("Error: malloc prp_pool fail\n");
-			return -ENOMEM;
-		}
-		dev->prp_entry_num = num_pages * (prps_per_page - 1) + 1;
-	}
+	/* Commands are never larger than a PRP list from the pool can cover */
+	if (nprps > dev->prp_entry_num)
+		return -EINVAL;
 
-	prp_pool = dev->prp_pool;
+	prp_pool = prp_list;
 	i = 0;
 	while (nprps) {
 		if ((i == (prps_per_page - 1)) && nprps > 1) {
 			*(prp_pool + i) = cpu_to_le64((ulong)prp_pool +
 					page_size);
 			i = 0;
-			prp_pool += page_size;
+			prp_pool += prps_per_page;
 		}
 		*(prp_pool + i++) = cpu_to_le64(dma_addr);
 		dma_addr += page_size;
 		nprps--;
 	}
-	*prp2 = (ulong)dev->prp_pool;
+	*prp2 = (ulong)prp_list;
 
-	flush_dcache_range((ulong)dev->prp_pool, (ulong)dev->prp_pool +
+	flush_dcache_range((ulong)prp_list, (ulong)prp_list +
 			   num_pages * page_size);
 
 	return 0;
@@ -668,6 +658,50 @@ static int nvme_get_info_from_identify(struct nvme_dev *dev)
 	return 0;
 }
 
+/*
+ * Set up the command slots for the I/O queue, each with its own PRP list
+ * from a pool allocated once, so that commands can be built while others
+ * are still in flight
+ */
+static int nvme_alloc_io_slots(struct nvme_dev *dev)
+{
+	struct nvme_ops *ops = (struct nvme_ops *)dev->udev->driver->ops;
+	u32 prps_per_page = dev->page_size >> 3;
+	u32 shift, nprps, num_pages;
+	int i;
+
+	/* Controller-specific submission handles one command at a time */
+	if (ops && ops->submit_cmd)
+		dev->io_depth = 1;
+	else
+		dev->io_depth = dev->q_depth - 1;
+
+	shift = NVME_MAX_XFER_SHIFT;
+	if (dev->max_transfer_shift)
+		shift = min_t(u32, shift, dev->max_transfer_shift);
+	dev->io_max_xfer = 1 << shift;
+
+	nprps = max_t(u32, dev->io_max_xfer / dev->page_size, 2);
+	num_pages = DIV_ROUND_UP(nprps - 1, prps_per_page - 1);
+	dev->prp_entry_num = num_pages * (prps_per_page - 1) + 1;
+
+	dev->slots = calloc(dev->io_depth, sizeof(*dev->slots));
+	if (!dev->slots)
+		return -ENOMEM;
+	dev->prp_pool = memalign(dev->page_size,
+				 dev->io_depth * num_pages * dev->page_size);
+	if (!dev->prp_pool) {
+		free(dev->slots);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < dev->io_depth; i++)
+		dev->slots[i].prp_list = (void *)dev->prp_pool +
+			i * num_pages * dev->page_size;
+
+	return 0;
+}
+
 int nvme_get_namespace_id(struct udevice *udev, u32 *ns_id, u8 *eui64)
 {
 	struct nvme_ns *ns = dev_get_priv(udev);
@@ -742,65 +776,319 @@ static int nvme_blk_probe(struct udevice *udev)
 	return 0;
 }
 
-static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
-			 lbaint_t blkcnt, void *buffer, bool read)
+static struct nvme_io_slot *nvme_get_slot(struct nvme_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->io_depth; i++) {
+		if (!dev->slots[i].busy)
+			return &dev->slots[i];
+	}
+
+	return NULL;
+}
+
+static bool nvme_req_busy(struct nvme_dev *dev, struct blk_req *req)
+{
+	int i;
+
+	for (i = 0; i < dev->io_depth; i++) {
+		if (dev->slots[i].busy && dev->slots[i].req == req)
+			return true;
+	}
+
+	return false;
+}
+
+/* Mark a request done once all its commands are issued and complete */
+static void nvme_req_check_done(struct nvme_ns *ns, struct blk_req *req)
+{
+	if (req == ns->partial || nvme_req_busy(ns->dev, req))
+		return;
+
+	req->done = true;
+	ns->inflight--;
+}
+
+/**
+ * nvme_queue_rw() - start a read or write command for part of a request
+ *
+ * @ns:		Namespace to access
+ * @slot:	Free slot to use for the command
+ * @req:	Request the command belongs to
+ * @slba:	First block to transfer
+ * @blkcnt:	Number of blocks to transfer
+ * @buf:	Memory to transfer to or from
+ * Return: 0 if OK, -ve on error
+ */
+static int nvme_queue_rw(struct nvme_ns *ns, struct nvme_io_slot *slot,
+			 struct blk_req *req, u64 slba, u32 blkcnt, void *buf)
 {
-	struct nvme_ns *ns = dev_get_priv(udev);
 	struct nvme_dev *dev = ns->dev;
-	struct nvme_command c;
-	struct blk_desc *desc = dev_get_uclass_plat(udev);
-	int status;
+	struct nvme_command *c = &slot->cmd;
+	ulong len = (ulong)blkcnt << ns->lba_shift;
 	u64 prp2;
-	u64 total_len = blkcnt << desc->log2blksz;
-	u64 temp_len = total_len;
-	uintptr_t temp_buffer = (uintptr_t)buffer;
-
-	u64 slba = blknr;
-	u16 lbas = 1 << (dev->max_transfer_shift - ns->lba_shift);
-	u64 total_lbas = blkcnt;
-
-	flush_dcache_range((unsigned long)buffer,
-			   (unsigned long)buffer + total_len);
-
-	c.rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
-	c.rw.flags = 0;
-	c.rw.nsid = cpu_to_le32(ns->ns_id);
-	c.rw.control = 0;
-	c.rw.dsmgmt = 0;
-	c.rw.reftag = 0;
-	c.rw.apptag = 0;
-	c.rw.appmask = 0;
-	c.rw.metadata = 0;
-
-	while (total_lbas) {
-		if (total_lbas < lbas) {
-			lbas = (u16)total_lbas;
-			total_lbas = 0;
+	int ret;
+
+	ret = nvme_setup_prps(dev, slot->prp_list, &prp2, len, (ulong)buf);
+	if (ret)
+		return ret;
+
+	flush_dcache_range((ulong)buf, (ulong)buf + len);
+
+	memset(c, 0, sizeof(*c));
+	c->rw.opcode = req->op == BLK_REQ_READ ? nvme_cmd_read :
+		nvme_cmd_write;
+	c->rw.command_id = cpu_to_le16(slot - dev->slots);
+	c->rw.nsid = cpu_to_le32(ns->ns_id);
+	c->rw.slba = cpu_to_le64(slba);
+	c->rw.length = cpu_to_le16(blkcnt - 1);
+	c->rw.prp1 = cpu_to_le64((ulong)buf);
+	c->rw.prp2 = cpu_to_le64(prp2);
+
+	slot->ns = ns;
+	slot->req = req;
+	slot->buf = buf;
+	slot->blkcnt = blkcnt;
+	slot->busy = true;
+	nvme_submit_cmd(dev->queues[NVME_IO_Q], c);
+
+	return 0;
+}
+
+/**
+ * nvme_issue() - issue commands for the request being started
+ *
+ * The request is split into commands no larger than the maximum transfer
+ * size, which are submitted back-to-back until the request is fully issued
+ * or no command slots are left. In the latter case this carries on from the
+ * same place when called again.
+ *
+ * @ns:	Namespace to issue commands for
+ */
+static void nvme_issue(struct nvme_ns *ns)
+{
+	struct nvme_dev *dev = ns->dev;
+	struct blk_req *req = ns->partial;
+	u32 max_lbas = dev->io_max_xfer >> ns->lba_shift;
+
+	if (!req)
+		return;
+
+	while (ns->partial_sg < req->nr_sg && req->result >= 0) {
+		struct blk_sg *sg = &req->sg[ns->partial_sg];
+		struct nvme_io_slot *slot;
+		u32 blkcnt;
+		int ret;
+
+		if (ns->partial_off == sg->blkcnt) {
+			ns->partial_sg++;
+			ns->partial_off = 0;
+			continue;
+		}
+
+		slot = nvme_get_slot(dev);
+		if (!slot)
+			return;
+
+		blkcnt = min_t(u64, sg->blkcnt - ns->partial_off, max_lbas);
+		ret = nvme_queue_rw(ns, slot, req, ns->partial_lba, blkcnt,
+				    sg->buf + (ns->partial_off << ns->lba_shift));
+		if (ret) {
+			req->result = ret;
+			break;
+		}
+		ns->partial_off += blkcnt;
+		ns->partial_lba += blkcnt;
+	}
+
+	ns->partial = NULL;
+	nvme_req_check_done(ns, req);
+}
+
+/**
+ * nvme_reap_io() - complete the I/O commands which the controller finished
+ *
+ * @dev:	NVMe device to check
+ * Return: number of commands completed
+ */
+static int nvme_reap_io(struct nvme_dev *dev)
+{
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	struct nvme_ops *ops = (struct nvme_ops *)dev->udev->driver->ops;
+	u16 head = nvmeq->cq_head;
+	u16 phase = nvmeq->cq_phase;
+	int count = 0;
+
+	for (;;) {
+		struct nvme_io_slot *slot;
+		struct blk_req *req;
+		u16 status, cid;
+
+		status = nvme_read_completion_status(nvmeq, head);
+		if ((status & 0x01) != phase)
+			break;
+		cid = readw(&nvmeq->cqes[head].command_id);
+
+		if (++head == nvmeq->q_depth) {
+			head = 0;
+			phase = !phase;
+		}
+		count++;
+
+		if (cid >= dev->io_depth || !dev->slots[cid].busy) {
+			printf("ERROR: unexpected completion, cid = %d\n", cid);
+			continue;
+		}
+		slot = &dev->slots[cid];
+		if (ops && ops->complete_cmd)
+			ops->complete_cmd(nvmeq, &slot->cmd);
+		slot->busy = false;
+
+		req = slot->req;
+		slot->req = NULL;
+		if (status >> 1) {
+			printf("ERROR: status = %x, slba = %llx\n", status >> 1,
+			       le64_to_cpu(slot->cmd.rw.slba));
+			if (req)
+				req->result = -EIO;
 		} else {
-			total_lbas -= lbas;
+			if (slot->cmd.rw.opcode == nvme_cmd_read)
+				invalidate_dcache_range((ulong)slot->buf,
+					(ulong)slot->buf +
+					((ulong)slot->blkcnt << slot->ns->lba_shift));
+			if (req && req->result >= 0)
+				req->result += slot->blkcnt;
 		}
+		if (req)
+			nvme_req_check_done(slot->ns, req);
+	}
 
-		if (nvme_setup_prps(dev, &prp2,
-				    lbas << ns->lba_shift, temp_buffer))
-			return -EIO;
-		c.rw.slba = cpu_to_le64(slba);
-		slba += lbas;
-		c.rw.length = cpu_to_le16(lbas - 1);
-		c.rw.prp1 = cpu_to_le64(temp_buffer);
-		c.rw.prp2 = cpu_to_le64(prp2);
-		status = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q],
-				&c, NULL, IO_TIMEOUT);
-		if (status)
+	if (count) {
+		writel(head, nvmeq->q_db + dev->db_stride);
+		nvmeq->cq_head = head;
+		nvmeq->cq_phase = phase;
+	}
+
+	return count;
+}
+
+static int nvme_blk_submit(struct udevice *udev, struct blk_req **reqs,
+			   int count)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct blk_req *req = reqs[i];
+
+		if (ns->partial || !nvme_get_slot(ns->dev))
 			break;
-		temp_len -= (u32)lbas << ns->lba_shift;
-		temp_buffer += lbas << ns->lba_shift;
+
+		req->result = 0;
+		ns->partial = req;
+		ns->partial_sg = 0;
+		ns->partial_off = 0;
+		ns->partial_lba = req->start;
+		ns->inflight++;
+		nvme_issue(ns);
+	}
+
+	return i;
+}
+
+static int nvme_blk_poll(struct udevice *udev)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+
+	nvme_reap_io(ns->dev);
+	nvme_issue(ns);
+
+	return ns->inflight;
+}
+
+/*
+ * Give up on the requests in flight. Their commands keep their slots until
+ * the controller completes them, but the completions are then ignored.
+ */
+static void nvme_blk_cancel(struct udevice *udev)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	struct blk_req *req;
+	int i;
+
+	for (i = 0; i < dev->io_depth; i++) {
+		req = dev->slots[i].req;
+		if (dev->slots[i].busy && dev->slots[i].ns == ns && req) {
+			req->result = -ECANCELED;
+			req->done = true;
+			dev->slots[i].req = NULL;
+		}
+	}
+	if (ns->partial) {
+		ns->partial->result = -ECANCELED;
+		ns->partial->done = true;
+		ns->partial = NULL;
+	}
+	ns->inflight = 0;
+}
+
+/* Stop tracking a request, so that late completions are ignored */
+static void nvme_abandon(struct nvme_ns *ns, struct blk_req *req)
+{
+	struct nvme_dev *dev = ns->dev;
+	int i;
+
+	for (i = 0; i < dev->io_depth; i++) {
+		if (dev->slots[i].req == req)
+			dev->slots[i].req = NULL;
+	}
+	if (ns->partial == req)
+		ns->partial = NULL;
+	ns->inflight--;
+}
+
+static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
+			 lbaint_t blkcnt, void *buffer, bool read)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct blk_sg sg = {
+		.buf	= buffer,
+		.blkcnt	= blkcnt,
+	};
+	struct blk_req req = {
+		.op	= read ? BLK_REQ_READ : BLK_REQ_WRITE,
+		.start	= blknr,
+		.sg	= &sg,
+		.nr_sg	= 1,
+	};
+	struct blk_req *reqp = &req;
+	ulong timeout_us = IO_TIMEOUT * 100000;
+	ulong start_time = timer_get_us();
+	bool taken = false;
+
+	while (!req.done) {
+		if (!taken && nvme_blk_submit(udev, &reqp, 1) == 1) {
+			taken = true;
+			start_time = timer_get_us();
+		}
+		if (nvme_reap_io(ns->dev)) {
+			nvme_issue(ns);
+			start_time = timer_get_us();
+		} else if (timer_get_us() - start_time >= timeout_us) {
+			log_debug("I/O timed out at block %llx\n",
+				  (u64)blknr);
+			if (taken)
+				nvme_abandon(ns, &req);
+			return -EIO;
+		}
 	}
 
-	if (read)
-		invalidate_dcache_range((unsigned long)buffer,
-					(unsigned long)buffer + total_len);
+	if (req.result < 0)
+		return -EIO;
 
-	return (total_len - temp_len) >> desc->log2blksz;
+	return req.result;
 }
 
 static ulong nvme_blk_read(struct udevice *udev, lbaint_t blknr,
@@ -818,6 +1106,9 @@ static ulong nvme_blk_write(struct udevice *udev, lbaint_t blknr,
 static const struct blk_ops nvme_blk_ops = {
 	.read	= nvme_blk_read,
 	.write	= nvme_blk_write,
+	.submit	= nvme_blk_submit,
+	.poll	= nvme_blk_poll,
+	.cancel	= nvme_blk_cancel,
 };
 
 U_BOOT_DRIVER(nvme_blk) = {
@@ -861,15 +1152,6 @@ int nvme_init(struct udevice *udev)
 		goto free_queue;
 	}
 
-	/* Allocate after the page size is known */
-	ndev->prp_pool = memalign(ndev->page_size, MAX_PRP_POOL);
-	if (!ndev->prp_pool) {
-		ret = -ENOMEM;
-		printf("Error: %s: Out of memory!\n", udev->name);
-		goto free_nvme;
-	}
-	ndev->prp_entry_num = MAX_PRP_POOL >> 3;
-
 	ret = nvme_setup_io_queues(ndev);
 	if (ret) {
 		log_debug("Unable to setup I/O queues(err=%dE)\n", ret);
@@ -878,6 +1160,12 @@ int nvme_init(struct udevice *udev)
 
 	nvme_get_info_from_identify(ndev);
 
+	ret = nvme_alloc_io_slots(ndev);
+	if (ret) {
+		printf("Error: %s: Out of memory!\n", udev->name);
+		goto free_queue;
+	}
+
 	/* Create a blk device for each namespace */
 
 	id = memalign(ndev->page_size, sizeof(struct nvme_id_ns));
@@ -621,6 +621,10 @@ struct nvme_dev {
 	u64 *prp_pool;
 	u32 prp_entry_num;
 	u32 nn;
+	/* I/O command slots, one per command which may be in flight */
+	struct nvme_io_slot *slots;
+	int io_depth;
+	u32 io_max_xfer;
 };
 
 /* Admin queue and a single I/O queue. */
@@ -650,6 +654,29 @@ struct nvme_queue {
 	unsigned long cmdid_data[];
 };
 
+/**
+ * struct nvme_io_slot - a command in flight on the I/O queue
+ *
+ * The command ID of the command is the index of the slot.
+ *
+ * @cmd: Command submitted
+ * @ns: Namespace the command is for
+ * @req: Request the command belongs to, or NULL if the request was given up
+ * @buf: Start of the memory being transferred
+ * @blkcnt: Number of blocks being transferred
+ * @prp_list: PRP list for the command, from the device's PRP pool
+ * @busy: true if the command has been submitted and not yet completed
+ */
+struct nvme_io_slot {
+	struct nvme_command cmd;
+	struct nvme_ns *ns;
+	struct blk_req *req;
+	void *buf;
+	u32 blkcnt;
+	u64 *prp_list;
+	bool busy;
+};
+
 /*
  * An NVM Express namespace is equivalent to a SCSI LUN.
  * Each namespace is operated as an independent "device".
@@ -662,6 +689,12 @@ struct nvme_ns {
 	int devnum;
 	int lba_shift;
 	u8 flbas;
+	/* Requests taken and not yet done, and where to resume issuing */
+	int inflight;
+	struct blk_req *partial;
+	int partial_sg;
+	u64 partial_off;
+	u64 partial_lba;
 };
 
 struct nvme_ops {
@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * NVMe controller emulation for sandbox, for testing purpose only
+ *
+ * The registers are plain memory. The controller runs the commands in a
+ * submission queue as soon as its doorbell is written, and leaves any which
+ * find the completion queue full until the host takes some completions.
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <malloc.h>
+#include <memalign.h>
+#include <asm/io.h>
+#include <asm/test.h>
+#include "nvme.h"
+
+#define SB_NVME_PAGE_SIZE	4096
+#define SB_NVME_PRPS_PER_PAGE	(SB_NVME_PAGE_SIZE / sizeof(u64))
+#define SB_NVME_QUEUE_SIZE	64
+#define SB_NVME_LBA_SHIFT	9
+#define SB_NVME_BLOCKS		4096
+/* Transfers are limited to 2^3 pages, so large ones take several commands */
+#define SB_NVME_MDTS		3
+
+/**
+ * struct sb_nvme_queue - a queue pair, as the controller sees it
+ *
+ * @sq: Submission queue, NULL if not created
+ * @cq: Completion queue, NULL if not created
+ * @size: Number of entries in each queue
+ * @sq_head: Next command to run
+ * @sq_tail: Where the host puts its next command
+ * @cq_head: Next completion for the host to take
+ * @cq_tail: Where the next completion goes
+ * @phase: Phase tag for the completions being posted
+ */
+struct sb_nvme_queue {
+	struct nvme_command *sq;
+	struct nvme_completion *cq;
+	u16 size;
+	u16 sq_head;
+	u16 sq_tail;
+	u16 cq_head;
+	u16 cq_tail;
+	u8 phase;
+};
+
+/**
+ * struct sandbox_nvme_priv - private data for the controller
+ *
+ * @ndev: NVMe device, used by nvme_init(); must be first
+ * @bar: Registers, followed by the doorbells
+ * @queues: Admin and I/O queue pairs
+ * @disk: Contents of the single namespace
+ * @stats: I/O seen so far
+ */
+struct sandbox_nvme_priv {
+	struct nvme_dev ndev;
+	struct nvme_bar *bar;
+	struct sb_nvme_queue queues[NVME_Q_NUM];
+	u8 *disk;
+	struct sandbox_nvme_stats stats;
+};
+
+static int sb_nvme_identify(struct nvme_command *cmd)
+{
+	void *buf = (void *)(ulong)le64_to_cpu(cmd->identify.prp1);
+
+	if (le32_to_cpu(cmd->identify.cns) == 1) {
+		struct nvme_id_ctrl *ctrl = buf;
+
+		memset(ctrl, '\0', sizeof(*ctrl));
+		memcpy(ctrl->sn, "SANDBOX0001", 11);
+		memcpy(ctrl->mn, "sandbox-nvme", 12);
+		memcpy(ctrl->fr, "1.0", 3);
+		ctrl->mdts = SB_NVME_MDTS;
+		ctrl->nn = cpu_to_le32(1);
+	} else {
+		struct nvme_id_ns *id = buf;
+
+		/* Only namespace 1 is active */
+		memset(id, '\0', sizeof(*id));
+		if (le32_to_cpu(cmd->identify.nsid) == 1) {
+			id->nsze = cpu_to_le64(SB_NVME_BLOCKS);
+			id->lbaf[0].ds = SB_NVME_LBA_SHIFT;
+		}
+	}
+
+	return NVME_SC_SUCCESS;
+}
+
+static int sb_nvme_admin(struct sandbox_nvme_priv *priv,
+			 struct nvme_command *cmd, u32 *result)
+{
+	struct sb_nvme_queue *q;
+	u16 qid;
+
+	switch (cmd->common.opcode) {
+	case nvme_admin_identify:
+		return sb_nvme_identify(cmd);
+	case nvme_admin_set_features:
+		/* One I/O queue pair is all there is */
+		if (le32_to_cpu(cmd->features.fid) != NVME_FEAT_NUM_QUEUES)
+			return NVME_SC_INVALID_FIELD;
+		*result = 0;
+		return NVME_SC_SUCCESS;
+	case nvme_admin_create_cq:
+		qid = le16_to_cpu(cmd->create_cq.cqid);
+		if (qid != NVME_IO_Q)
+			return NVME_SC_QID_INVALID;
+		q = &priv->queues[qid];
+		q->cq = (void *)(ulong)le64_to_cpu(cmd->create_cq.prp1);
+		q->size = le16_to_cpu(cmd->create_cq.qsize) + 1;
+		q->cq_head = 0;
+		q->cq_tail = 0;
+		q->phase = 1;
+		return NVME_SC_SUCCESS;
+	case nvme_admin_create_sq:
+		qid = le16_to_cpu(cmd->create_sq.sqid);
+		q = &priv->queues[qid];
+		if (qid != NVME_IO_Q || !q->cq ||
+		    le16_to_cpu(cmd->create_sq.qsize) + 1 != q->size)
+			return NVME_SC_QID_INVALID;
+		q->sq = (void *)(ulong)le64_to_cpu(cmd->create_sq.prp1);
+		q->sq_head = 0;
+		q->sq_tail = 0;
+		return NVME_SC_SUCCESS;
+	default:
+		return NVME_SC_INVALID_OPCODE;
+	}
+}
+
+static void sb_nvme_copy(struct sandbox_nvme_priv *priv, bool read,
+			 ulong pos, u64 addr, ulong len)
+{
+	void *buf = (void *)(ulong)addr;
+
+	if (read)
+		memcpy(buf, priv->disk + pos, len);
+	else
+		memcpy(priv->disk + pos, buf, len);
+}
+
+/* Run a read or write, following its PRP entries to the host's memory */
+static int sb_nvme_rw(struct sandbox_nvme_priv *priv, struct nvme_command *cmd)
+{
+	bool read = cmd->rw.opcode == nvme_cmd_read;
+	u64 slba = le64_to_cpu(cmd->rw.slba);
+	u32 blocks = le16_to_cpu(cmd->rw.length) + 1;
+	ulong pos = slba << SB_NVME_LBA_SHIFT;
+	ulong len = (ulong)blocks << SB_NVME_LBA_SHIFT;
+	u64 prp1 = le64_to_cpu(cmd->rw.prp1);
+	u64 prp2 = le64_to_cpu(cmd->rw.prp2);
+	ulong done, n;
+	u64 *list;
+	int i;
+
+	if (cmd->rw.opcode != nvme_cmd_read && cmd->rw.opcode != nvme_cmd_write)
+		return NVME_SC_INVALID_OPCODE;
+	if (le32_to_cpu(cmd->rw.nsid) != 1)
+		return NVME_SC_INVALID_NS;
+	if (slba + blocks > SB_NVME_BLOCKS)
+		return NVME_SC_LBA_RANGE;
+	if (len > SB_NVME_PAGE_SIZE << SB_NVME_MDTS)
+		return NVME_SC_INVALID_FIELD;
+
+	priv->stats.io_cmds++;
+	priv->stats.max_blocks = max_t(int, priv->stats.max_blocks, blocks);
+
+	/* PRP1 may start inside a page, every other entry is a whole page */
+	n = SB_NVME_PAGE_SIZE - (ulong)(prp1 & (SB_NVME_PAGE_SIZE - 1));
+	n = min(len, n);
+	sb_nvme_copy(priv, read, pos, prp1, n);
+	done = n;
+	if (done == len)
+		return NVME_SC_SUCCESS;
+
+	/* PRP2 is the second page, or a list of them if there are more */
+	if (len - done <= SB_NVME_PAGE_SIZE) {
+		if (prp2 & (SB_NVME_PAGE_SIZE - 1))
+			return NVME_SC_INVALID_FIELD;
+		sb_nvme_copy(priv, read, pos + done, prp2, len - done);
+		return NVME_SC_SUCCESS;
+	}
+
+	list = (u64 *)(ulong)prp2;
+	for (i = 0; done < len; done += n) {
+		u64 addr;
+
+		/* The last entry of a full list page points to the next one */
+		if (i == SB_NVME_PRPS_PER_PAGE - 1 &&
+		    len - done > SB_NVME_PAGE_SIZE) {
+			list = (u64 *)(ulong)le64_to_cpu(list[i]);
+			i = 0;
+		}
+		addr = le64_to_cpu(list[i++]);
+		if (addr & (SB_NVME_PAGE_SIZE - 1))
+			return NVME_SC_INVALID_FIELD;
+		n = min(len - done, (ulong)SB_NVME_PAGE_SIZE);
+		sb_nvme_copy(priv, read, pos + done, addr, n);
+	}
+
+	return NVME_SC_SUCCESS;
+}
+
+/* Run the commands in a submission queue while there is room to complete */
+static void sb_nvme_process(struct sandbox_nvme_priv *priv, int qid)
+{
+	struct sb_nvme_queue *q = &priv->queues[qid];
+	int queued;
+
+	while (q->sq_head != q->sq_tail &&
+	       (q->cq_tail + 1) % q->size != q->cq_head) {
+		struct nvme_command *cmd = &q->sq[q->sq_head];
+		struct nvme_completion *cqe = &q->cq[q->cq_tail];
+		u32 result = 0;
+		int status;
+
+		q->sq_head = (q->sq_head + 1) % q->size;
+		if (qid == NVME_ADMIN_Q)
+			status = sb_nvme_admin(priv, cmd, &result);
+		else
+			status = sb_nvme_rw(priv, cmd);
+
+		memset(cqe, '\0', sizeof(*cqe));
+		cqe->result = cpu_to_le32(result);
+		cqe->sq_head = cpu_to_le16(q->sq_head);
+		cqe->sq_id = cpu_to_le16(qid);
+		cqe->command_id = cmd->common.command_id;
+		cqe->status = cpu_to_le16(status << 1 | q->phase);
+		if (++q->cq_tail == q->size) {
+			q->cq_tail = 0;
+			q->phase = !q->phase;
+		}
+	}
+
+	if (qid == NVME_IO_Q) {
+		queued = (q->cq_tail + q->size - q->cq_head) % q->size;
+		priv->stats.max_queued = max(priv->stats.max_queued, queued);
+	}
+}
+
+static void sb_nvme_set_cc(struct sandbox_nvme_priv *priv)
+{
+	struct nvme_bar *bar = priv->bar;
+	struct sb_nvme_queue *q = &priv->queues[NVME_ADMIN_Q];
+
+	if ((bar->cc & NVME_CC_SHN_MASK) == NVME_CC_SHN_NORMAL)
+		bar->csts = (bar->csts & ~NVME_CSTS_SHST_MASK) |
+			NVME_CSTS_SHST_CMPLT;
+
+	if (!(bar->cc & NVME_CC_ENABLE)) {
+		memset(priv->queues, '\0', sizeof(priv->queues));
+		bar->csts &= ~NVME_CSTS_RDY;
+	} else if (!(bar->csts & NVME_CSTS_RDY)) {
+		/* Pick up the admin queues when enabled */
+		q->sq = (void *)(ulong)bar->asq;
+		q->cq = (void *)(ulong)bar->acq;
+		q->size = (bar->aqa & 0xfff) + 1;
+		q->phase = 1;
+		bar->csts |= NVME_CSTS_RDY;
+	}
+}
+
+static void sb_nvme_mmio(void *ctx, void *addr)
+{
+	struct sandbox_nvme_priv *priv = ctx;
+	u32 *dbs = (void *)priv->bar + SB_NVME_PAGE_SIZE;
+	struct sb_nvme_queue *q;
+	ulong idx;
+
+	if (addr == &priv->bar->cc) {
+		sb_nvme_set_cc(priv);
+		return;
+	}
+
+	/* Doorbells alternate between submission tail and completion head */
+	idx = ((ulong)addr - (ulong)dbs) / sizeof(u32);
+	if ((ulong)addr < (ulong)dbs || idx >= 2 * NVME_Q_NUM)
+		return;
+	q = &priv->queues[idx / 2];
+	if (!q->sq || !q->cq)
+		return;
+	if (idx & 1)
+		q->cq_head = dbs[idx] % q->size;
+	else
+		q->sq_tail = dbs[idx] % q->size;
+	sb_nvme_process(priv, idx / 2);
+}
+
+struct sandbox_nvme_stats *sandbox_nvme_get_stats(struct udevice *dev)
+{
+	struct sandbox_nvme_priv *priv = dev_get_priv(dev);
+
+	return &priv->stats;
+}
+
+static int sandbox_nvme_probe(struct udevice *dev)
+{
+	struct sandbox_nvme_priv *priv = dev_get_priv(dev);
+	struct nvme_dev *ndev = &priv->ndev;
+	int ret;
+
+	priv->bar = memalign(SB_NVME_PAGE_SIZE, 2 * SB_NVME_PAGE_SIZE);
+	priv->disk = calloc(SB_NVME_BLOCKS, 1 << SB_NVME_LBA_SHIFT);
+	if (!priv->bar || !priv->disk) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	memset(priv->bar, '\0', 2 * SB_NVME_PAGE_SIZE);
+	/* Queue size, a 500ms timeout and the NVM command set */
+	priv->bar->cap = (SB_NVME_QUEUE_SIZE - 1) | 1 << 24 | 1ULL << 37;
+	priv->bar->vs = NVME_VS(1, 3);
+
+	strcpy(ndev->vendor, "sandbox");
+	ndev->instance = trailing_strtol(dev->name);
+	ndev->bar = priv->bar;
+	sandbox_set_mmio_hook(sb_nvme_mmio, priv);
+
+	ret = nvme_init(dev);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	sandbox_set_mmio_hook(NULL, NULL);
+	free(priv->disk);
+	free(priv->bar);
+
+	return ret;
+}
+
+static int sandbox_nvme_remove(struct udevice *dev)
+{
+	struct sandbox_nvme_priv *priv = dev_get_priv(dev);
+
+	sandbox_set_mmio_hook(NULL, NULL);
+	free(priv->disk);
+	free(priv->bar);
+
+	return 0;
+}
+
+U_BOOT_DRIVER(sandbox_nvme) = {
+	.name	= "sandbox_nvme",
+	.id	= UCLASS_NVME,
+	.probe	= sandbox_nvme_probe,
+	.remove	= sandbox_nvme_remove,
+	.priv_auto	= sizeof(struct sandbox_nvme_priv),
+};
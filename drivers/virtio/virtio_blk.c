@@ -9,71 +9,250 @@
 #include <common.h>
 #include <blk.h>
 #include <dm.h>
+#include <malloc.h>
 #include <part.h>
 #include <virtio_types.h>
 #include <virtio.h>
 #include <virtio_ring.h>
 #include "virtio_blk.h"
 
+/* Most memory segments in a single request */
+#define VIRTIO_BLK_MAX_SEGS	16
+
+/**
+ * struct virtio_blk_req - a request on the virtqueue
+ *
+ * @out_hdr: Request header, read by the device
+ * @status: Request status, written by the device
+ * @req: Block request being carried out, or NULL if this is free
+ * @cancelled: @req was cancelled and is only kept to mark this busy until
+ *	the device is finished with it
+ */
+struct virtio_blk_req {
+	struct virtio_blk_outhdr out_hdr;
+	u8 status;
+	struct blk_req *req;
+	bool cancelled;
+};
+
+/**
+ * struct virtio_blk_priv - private data for a virtio block device
+ *
+ * @vq: Request virtqueue
+ * @reqs: Requests, one for each descriptor in the virtqueue
+ * @nr_reqs: Number of entries in @reqs
+ * @inflight: Number of requests added and not yet completed
+ */
 struct virtio_blk_priv {
 	struct virtqueue *vq;
+	struct virtio_blk_req *reqs;
+	int nr_reqs;
+	int inflight;
 };
 
-static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
-			       lbaint_t blkcnt, void *buffer, u32 type)
+/*
+ * Indirect descriptors let a request take one slot in the virtqueue rather
+ * than three, and the event index lets the device skip notifications while
+ * it is still working on earlier requests
+ */
+static const u32 feature[] = {
+	VIRTIO_RING_F_INDIRECT_DESC,
+	VIRTIO_RING_F_EVENT_IDX,
+};
+
+static lbaint_t virtio_blk_req_blocks(struct blk_req *req)
+{
+	lbaint_t blkcnt = 0;
+	int i;
+
+	for (i = 0; i < req->nr_sg; i++)
+		blkcnt += req->sg[i].blkcnt;
+
+	return blkcnt;
+}
+
+/* Add a request to the virtqueue, without notifying the device */
+static int virtio_blk_add(struct udevice *dev, struct blk_req *req)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_sg sg[VIRTIO_BLK_MAX_SEGS + 2];
+	struct virtio_sg *sgs[VIRTIO_BLK_MAX_SEGS + 2];
 	unsigned int num_out = 0, num_in = 0;
-	struct virtio_sg *sgs[3];
-	u8 status;
-	int ret;
+	struct virtio_blk_req *vreq = NULL;
+	u32 type;
+	int i, ret;
 
-	struct virtio_blk_outhdr out_hdr = {
-		.type = cpu_to_virtio32(dev, type),
-		.sector = cpu_to_virtio64(dev, sector),
-	};
-	struct virtio_sg hdr_sg = { &out_hdr, sizeof(out_hdr) };
-	struct virtio_sg data_sg = { buffer, blkcnt * 512 };
-	struct virtio_sg status_sg = { &status, sizeof(status) };
+	if (req->nr_sg > VIRTIO_BLK_MAX_SEGS)
+		return -E2BIG;
 
-	sgs[num_out++] = &hdr_sg;
+	for (i = 0; i < priv->nr_reqs; i++) {
+		if (!priv->reqs[i].req) {
+			vreq = &priv->reqs[i];
+			break;
+		}
+	}
+	if (!vreq)
+		return -ENOSPC;
 
-	if (type & VIRTIO_BLK_T_OUT)
-		sgs[num_out++] = &data_sg;
-	else
-		sgs[num_out + num_in++] = &data_sg;
+	type = req->op == BLK_REQ_WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	vreq->out_hdr.type = cpu_to_virtio32(dev, type);
+	vreq->out_hdr.ioprio = 0;
+	vreq->out_hdr.sector = cpu_to_virtio64(dev, req->start);
+	vreq->status = VIRTIO_BLK_S_IOERR;
+
+	sg[0].addr = &vreq->out_hdr;
+	sg[0].length = sizeof(vreq->out_hdr);
+	sgs[num_out++] = &sg[0];
+	for (i = 0; i < req->nr_sg; i++) {
+		struct virtio_sg *data_sg = &sg[1 + i];
 
-	sgs[num_out + num_in++] = &status_sg;
-	log_debug("dev=%s, active=%d, priv=%p, priv->vq=%p\n", dev->name,
-		  device_active(dev), priv, priv->vq);
+		data_sg->addr = req->sg[i].buf;
+		data_sg->length = req->sg[i].blkcnt * 512;
+		if (type & VIRTIO_BLK_T_OUT)
+			sgs[num_out++] = data_sg;
+		else
+			sgs[num_out + num_in++] = data_sg;
+	}
+	sg[1 + i].addr = &vreq->status;
+	sg[1 + i].length = sizeof(vreq->status);
+	sgs[num_out + num_in++] = &sg[1 + i];
 
 	ret = virtqueue_add(priv->vq, sgs, num_out, num_in);
 	if (ret)
 		return ret;
 
-	virtqueue_kick(priv->vq);
+	vreq->req = req;
+	priv->inflight++;
+
+	return 0;
+}
+
+/* Complete all the requests which the device has finished with */
+static void virtio_blk_reap(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_req *vreq;
+
+	/* The first buffer of each request is its header */
+	while ((vreq = virtqueue_get_buf(priv->vq, NULL))) {
+		struct blk_req *req = vreq->req;
+
+		vreq->req = NULL;
+		if (vreq->cancelled) {
+			vreq->cancelled = false;
+			continue;
+		}
+		if (vreq->status == VIRTIO_BLK_S_OK)
+			req->result = virtio_blk_req_blocks(req);
+		else
+			req->result = -EIO;
+		req->done = true;
+		priv->inflight--;
+	}
+}
+
+/*
+ * Give up on the requests in flight. Their descriptors stay in use until
+ * the device returns them, but they are then dropped.
+ */
+static void virtio_blk_cancel(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_req *vreq;
+	int i;
+
+	for (i = 0; i < priv->nr_reqs; i++) {
+		vreq = &priv->reqs[i];
+		if (!vreq->req || vreq->cancelled)
+			continue;
+		vreq->req->result = -ECANCELED;
+		vreq->req->done = true;
+		vreq->cancelled = true;
+	}
+	priv->inflight = 0;
+}
+
+static int virtio_blk_submit(struct udevice *dev, struct blk_req **reqs,
+			     int count)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int i, ret;
+
+	for (i = 0; i < count; i++) {
+		struct blk_req *req = reqs[i];
+
+		if (!virtio_blk_req_blocks(req)) {
+			req->result = 0;
+			req->done = true;
+			continue;
+		}
+		ret = virtio_blk_add(dev, req);
+		if (ret == -ENOSPC)
+			break;
+		if (ret) {
+			req->result = ret;
+			req->done = true;
+		}
+	}
+
+	/* Tell the device about the whole batch at once */
+	if (i)
+		virtqueue_kick(priv->vq);
+
+	return i;
+}
+
+static int virtio_blk_poll(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+
+	virtio_blk_reap(dev);
+
+	return priv->inflight;
+}
+
+static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
+			       lbaint_t blkcnt, void *buffer,
+			       enum blk_req_op op)
+{
+	struct blk_sg sg = {
+		.buf	= buffer,
+		.blkcnt	= blkcnt,
+	};
+	struct blk_req req = {
+		.op	= op,
+		.start	= sector,
+		.sg	= &sg,
+		.nr_sg	= 1,
+	};
+	struct blk_req *reqp = &req;
+
+	log_debug("dev=%s, active=%d\n", dev->name, device_active(dev));
+
+	/* Wait for room if other requests fill the virtqueue */
+	while (!virtio_blk_submit(dev, &reqp, 1))
+		virtio_blk_reap(dev);
 
 	log_debug("wait...");
-	while (!virtqueue_get_buf(priv->vq, NULL))
-		;
+	while (!req.done)
+		virtio_blk_reap(dev);
 	log_debug("done\n");
 
-	return status == VIRTIO_BLK_S_OK ? blkcnt : -EIO;
+	return req.result < 0 ? -EIO : req.result;
 }
 
 static ulong virtio_blk_read(struct udevice *dev, lbaint_t start,
 			     lbaint_t blkcnt, void *buffer)
 {
 	log_debug("read %s\n", dev->name);
-	return virtio_blk_do_req(dev, start, blkcnt, buffer,
-				 VIRTIO_BLK_T_IN);
+	return virtio_blk_do_req(dev, start, blkcnt, buffer, BLK_REQ_READ);
 }
 
 static ulong virtio_blk_write(struct udevice *dev, lbaint_t start,
 			      lbaint_t blkcnt, const void *buffer)
 {
 	return virtio_blk_do_req(dev, start, blkcnt, (void *)buffer,
-				 VIRTIO_BLK_T_OUT);
+				 BLK_REQ_WRITE);
 }
 
 static int virtio_blk_bind(struct udevice *dev)
@@ -105,7 +284,8 @@ static int virtio_blk_bind(struct udevice *dev)
 	desc->bdev = dev;
 
 	/* Indicate what driver features we support */
-	virtio_driver_features_init(uc_priv, NULL, 0, NULL, 0);
+	virtio_driver_features_init(uc_priv, feature, ARRAY_SIZE(feature),
+				    NULL, 0);
 
 	return 0;
 }
@@ -121,6 +301,11 @@ static int virtio_blk_probe(struct udevice *dev)
 	if (ret)
 		return ret;
 
+	priv->nr_reqs = virtqueue_get_vring_size(priv->vq);
+	priv->reqs = calloc(priv->nr_reqs, sizeof(*priv->reqs));
+	if (!priv->reqs)
+		return -ENOMEM;
+
 	desc->blksz = 512;
 	desc->log2blksz = 9;
 	virtio_cread(dev, struct virtio_blk_config, capacity, &cap);
@@ -129,9 +314,25 @@ static int virtio_blk_probe(struct udevice *dev)
 	return 0;
 }
 
+static int virtio_blk_remove(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	/* Stop the device before freeing what its descriptors point to */
+	ret = virtio_reset(dev);
+	free(priv->reqs);
+	priv->reqs = NULL;
+
+	return ret;
+}
+
 static const struct blk_ops virtio_blk_ops = {
 	.read	= virtio_blk_read,
 	.write	= virtio_blk_write,
+	.submit	= virtio_blk_submit,
+	.poll	= virtio_blk_poll,
+	.cancel	= virtio_blk_cancel,
 };
 
 U_BOOT_DRIVER(virtio_blk) = {
@@ -140,7 +341,7 @@ U_BOOT_DRIVER(virtio_blk) = {
 	.ops	= &virtio_blk_ops,
 	.bind	= virtio_blk_bind,
 	.probe	= virtio_blk_probe,
-	.remove	= virtio_reset,
+	.remove	= virtio_blk_remove,
 	.priv_auto	= sizeof(struct virtio_blk_priv),
 	.flags	= DM_FLAG_ACTIVE_DMA,
 };
@@ -98,6 +98,42 @@ static void virtqueue_detach_desc(struct virtqueue *vq, unsigned int idx)
 	desc->addr = cpu_to_virtio64(vq->vdev, (u64)(uintptr_t)bb->user_buffer);
 }
 
+/* Put the scatterlists in the indirect table of the free head descriptor */
+static void virtqueue_add_indirect(struct virtqueue *vq,
+				   struct virtio_sg *sgs[],
+				   unsigned int out_sgs, unsigned int in_sgs)
+{
+	unsigned int total = out_sgs + in_sgs;
+	unsigned int head = vq->free_head;
+	struct vring_desc_shadow *desc_shadow = &vq->vring_desc_shadow[head];
+	struct vring_desc *table, *desc = &vq->vring.desc[head];
+	unsigned int n;
+
+	table = &vq->indirect_desc[head * VIRTQUEUE_INDIRECT_NUM];
+	for (n = 0; n < total; n++) {
+		u16 flags = n + 1 < total ? VRING_DESC_F_NEXT : 0;
+
+		if (n >= out_sgs)
+			flags |= VRING_DESC_F_WRITE;
+		table[n].addr = cpu_to_virtio64(vq->vdev,
+						(u64)(uintptr_t)sgs[n]->addr);
+		table[n].len = cpu_to_virtio32(vq->vdev, sgs[n]->length);
+		table[n].flags = cpu_to_virtio16(vq->vdev, flags);
+		table[n].next = cpu_to_virtio16(vq->vdev, n + 1);
+	}
+
+	desc_shadow->addr = (u64)(uintptr_t)table;
+	desc_shadow->len = total * sizeof(struct vring_desc);
+	desc_shadow->flags = VRING_DESC_F_INDIRECT;
+
+	desc->addr = cpu_to_virtio64(vq->vdev, desc_shadow->addr);
+	desc->len = cpu_to_virtio32(vq->vdev, desc_shadow->len);
+	desc->flags = cpu_to_virtio16(vq->vdev, desc_shadow->flags);
+
+	vq->num_free--;
+	vq->free_head = desc_shadow->next;
+}
+
 int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		  unsigned int out_sgs, unsigned int in_sgs)
 {
@@ -113,6 +149,12 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 	desc = vq->vring.desc;
 	i = head;
 
+	if (vq->indirect && descs_used > 1 &&
+	    descs_used <= VIRTQUEUE_INDIRECT_NUM && vq->num_free) {
+		virtqueue_add_indirect(vq, sgs, out_sgs, in_sgs);
+		goto add_head;
+	}
+
 	if (vq->num_free < descs_used) {
 		debug("Can't add buf len %i - avail = %i\n",
 		      descs_used, vq->num_free);
@@ -144,6 +186,7 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 	/* Update free pointer */
 	vq->free_head = i;
 
+add_head:
 	/* Mark the descriptor as the head of a chain. */
 	vq->vring_desc_shadow[head].chain_head = true;
 
@@ -281,6 +324,13 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		virtio_store_mb(&vring_used_event(&vq->vring),
 				cpu_to_virtio16(vq->vdev, vq->last_used_idx));
 
+	/* Hand back the first buffer, not the table or a bounce buffer */
+	if (vq->vring_desc_shadow[i].flags & VRING_DESC_F_INDIRECT)
+		return (void *)(uintptr_t)virtio64_to_cpu(vq->vdev,
+			vq->indirect_desc[i * VIRTQUEUE_INDIRECT_NUM].addr);
+	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && vq->vring.bouncebufs)
+		return vq->vring.bouncebufs[i].user_buffer;
+
 	return (void *)(uintptr_t)vq->vring_desc_shadow[i].addr;
 }
 
@@ -317,6 +367,21 @@ static struct virtqueue *__vring_new_virtqueue(unsigned int index,
 
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
+	/*
+	 * Indirect tables are not bounced, so only use them when the device
+	 * can access our memory directly
+	 */
+	vq->indirect_desc = NULL;
+	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
+		       !vring.bouncebufs;
+	if (vq->indirect) {
+		vq->indirect_desc = memalign(sizeof(struct vring_desc),
+					     vring.num * VIRTQUEUE_INDIRECT_NUM *
+					     sizeof(struct vring_desc));
+		if (!vq->indirect_desc)
+			vq->indirect = false;
+	}
+
 	/* Tell other side not to bother us */
 	vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
 	if (!vq->event)
@@ -398,6 +463,7 @@ void vring_del_virtqueue(struct virtqueue *vq)
 	virtio_free_pages(vq->vdev, vq->vring.desc,
 			  DIV_ROUND_UP(vq->vring.size, PAGE_SIZE));
 	free(vq->vring_desc_shadow);
+	free(vq->indirect_desc);
 	list_del(&vq->list);
 	free(vq->vring.bouncebufs);
 	free(vq);
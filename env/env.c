@@ -4,6 +4,7 @@
  * Written by Simon Glass <sjg@chromium.org>
  */
 
+#include <blk.h>
 #include <common.h>
 #include <env.h>
 #include <env_internal.h>
@@ -271,6 +272,9 @@ int env_save(void)
 		}
 
 		ret = drv->save();
+		/* Filesystem drivers may leave the blocks dirty in the cache */
+		if (!ret)
+			ret = blkcache_flush(-1, 0);
 		if (ret)
 			printf("Failed (%d)\n", ret);
 		else
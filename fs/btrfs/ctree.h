@@ -39,6 +39,8 @@
 
 struct btrfs_mapping_tree {
 	struct cache_tree cache_tree;
+	/* chunk found by the last lookup, tried first by the next one */
+	struct cache_extent *last;
 };
 
 static inline unsigned long btrfs_chunk_item_size(int num_stripes)
@@ -534,7 +534,7 @@ struct extent_buffer* read_tree_block(struct btrfs_fs_info *fs_info, u64 bytenr,
 	 * We failed to read this tree block, it be should deleted right now
 	 * to avoid stale cache populate the cache.
 	 */
-	free_extent_buffer(eb);
+	free_extent_buffer_nocache(eb);
 	return ERR_PTR(ret);
 }
 
@@ -903,6 +903,7 @@ FREE_EXTENT_CACHE_BASED_TREE(mapping_cache, free_map_lookup);
 
 void btrfs_cleanup_all_caches(struct btrfs_fs_info *fs_info)
 {
+	fs_info->mapping_tree.last = NULL;
 	free_mapping_cache_tree(&fs_info->mapping_tree.cache_tree);
 	extent_io_tree_cleanup(&fs_info->extent_cache);
 }
@@ -18,6 +18,7 @@ void extent_io_tree_init(struct extent_io_tree *tree)
 {
 	cache_tree_init(&tree->state);
 	cache_tree_init(&tree->cache);
+	INIT_LIST_HEAD(&tree->lru);
 	tree->cache_size = 0;
 }
 
@@ -54,6 +55,17 @@ static void free_extent_state_func(struct cache_extent *cache)
 static void free_extent_buffer_final(struct extent_buffer *eb);
 void extent_io_tree_cleanup(struct extent_io_tree *tree)
 {
+	struct extent_buffer *eb;
+
+	while (!list_empty(&tree->lru)) {
+		eb = list_first_entry(&tree->lru, struct extent_buffer, lru);
+		if (eb->refs) {
+			error("extent buffer leak: start %llu len %u",
+			      eb->start, eb->len);
+			eb->refs = 0;
+		}
+		free_extent_buffer_final(eb);
+	}
 	cache_tree_free_extents(&tree->state, free_extent_state_func);
 }
 
@@ -582,6 +594,7 @@ static struct extent_buffer *__alloc_extent_buffer(struct btrfs_fs_info *info,
 	eb->cache_node.start = bytenr;
 	eb->cache_node.size = blocksize;
 	eb->fs_info = info;
+	INIT_LIST_HEAD(&eb->lru);
 	memset_extent_buffer(eb, 0, 0, blocksize);
 
 	return eb;
@@ -611,6 +624,7 @@ static void free_extent_buffer_final(struct extent_buffer *eb)
 		BUG_ON(tree->cache_size < eb->len);
 		tree->cache_size -= eb->len;
 	}
+	list_del_init(&eb->lru);
 	free(eb->data);
 	free(eb);
 }
@@ -634,6 +648,11 @@ static void free_extent_buffer_internal(struct extent_buffer *eb, bool free_now)
 }
 
 void free_extent_buffer(struct extent_buffer *eb)
+{
+	free_extent_buffer_internal(eb, 0);
+}
+
+void free_extent_buffer_nocache(struct extent_buffer *eb)
 {
 	free_extent_buffer_internal(eb, 1);
 }
@@ -667,6 +686,19 @@ struct extent_buffer *find_first_extent_buffer(struct extent_io_tree *tree,
 	return eb;
 }
 
+/* Drop the least recently used unreferenced ebs until the cache fits again */
+static void trim_extent_buffer_cache(struct extent_io_tree *tree)
+{
+	struct extent_buffer *eb, *tmp;
+
+	list_for_each_entry_safe(eb, tmp, &tree->lru, lru) {
+		if (tree->cache_size <= BTRFS_EB_CACHE_MAX * 9 / 10)
+			break;
+		if (eb->refs == 0)
+			free_extent_buffer_final(eb);
+	}
+}
+
 struct extent_buffer *alloc_extent_buffer(struct btrfs_fs_info *fs_info,
 					  u64 bytenr, u32 blocksize)
 {
@@ -679,23 +711,31 @@ struct extent_buffer *alloc_extent_buffer(struct btrfs_fs_info *fs_info,
 	    cache->size == blocksize) {
 		eb = container_of(cache, struct extent_buffer, cache_node);
 		eb->refs++;
+		list_move_tail(&eb->lru, &tree->lru);
 	} else {
 		int ret;
 
 		if (cache) {
 			eb = container_of(cache, struct extent_buffer,
 					  cache_node);
-			free_extent_buffer(eb);
+			if (eb->refs)
+				free_extent_buffer_nocache(eb);
+			else
+				free_extent_buffer_final(eb);
 		}
 		eb = __alloc_extent_buffer(fs_info, bytenr, blocksize);
 		if (!eb)
 			return NULL;
 		ret = insert_cache_extent(&tree->cache, &eb->cache_node);
 		if (ret) {
+			free(eb->data);
 			free(eb);
 			return NULL;
 		}
+		list_add_tail(&eb->lru, &tree->lru);
 		tree->cache_size += blocksize;
+		if (tree->cache_size > BTRFS_EB_CACHE_MAX)
+			trim_extent_buffer_cache(tree);
 	}
 	return eb;
 }
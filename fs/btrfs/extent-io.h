@@ -6,9 +6,9 @@
  * Modification includes:
  * - extent_buffer:data
  *   Use pointer to provide better alignment.
- * - Remove max_cache_size related interfaces
- *   Includes free_extent_buffer_nocache()
- *   As we don't cache eb in U-Boot.
+ * - Use a fixed max_cache_size
+ *   Unused ebs are kept in a LRU list, bounded by BTRFS_EB_CACHE_MAX, so that
+ *   tree blocks are not read again for every lookup.
  * - Include headers
  *
  * Write related functions are kept as we still need to modify dummy extent
@@ -21,6 +21,7 @@
 #include <linux/list.h>
 #include <linux/err.h>
 #include <linux/bitops.h>
+#include <linux/sizes.h>
 #include <fs_internal.h>
 #include "extent-cache.h"
 
@@ -63,9 +64,13 @@ static inline int le_test_bit(int nr, const u8 *addr)
 
 struct btrfs_fs_info;
 
+/* Most bytes of tree blocks kept in the extent buffer cache */
+#define BTRFS_EB_CACHE_MAX	SZ_2M
+
 struct extent_io_tree {
 	struct cache_tree state;
 	struct cache_tree cache;
+	struct list_head lru;
 	u64 cache_size;
 };
 
@@ -85,6 +90,7 @@ struct extent_buffer {
 	int refs;
 	u32 flags;
 	struct btrfs_fs_info *fs_info;
+	struct list_head lru;
 	char *data;
 };
 
@@ -136,6 +142,7 @@ struct extent_buffer *btrfs_clone_extent_buffer(struct extent_buffer *src);
 struct extent_buffer *alloc_dummy_extent_buffer(struct btrfs_fs_info *fs_info,
 						u64 bytenr, u32 blocksize);
 void free_extent_buffer(struct extent_buffer *eb);
+void free_extent_buffer_nocache(struct extent_buffer *eb);
 int read_extent_from_disk(struct blk_desc *desc, struct disk_partition *part,
 			  u64 physical, struct extent_buffer *eb,
 			  unsigned long offset, unsigned long len);
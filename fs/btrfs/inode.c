@@ -12,6 +12,9 @@
 #include "disk-io.h"
 #include "volumes.h"
 
+/* Most compressed bytes read at once for extents which are adjacent on disk */
+#define BTRFS_COMPRESSED_BATCH_MAX	SZ_1M
+
 /*
  * Read the content of symlink inode @ino of @root, into @target.
  * NOTE: @target will not be \0 termiated, caller should handle it properly.
@@ -619,6 +622,130 @@ check_next:
 	return 1;
 }
 
+/*
+ * Check if the file extent at @slot of @leaf is a compressed extent of @ino
+ * which starts at @cur and is wanted whole, that is up to @end at most.
+ */
+static bool is_whole_compressed_extent(struct extent_buffer *leaf, int slot,
+				       u64 ino, u64 cur, u64 end)
+{
+	struct btrfs_file_extent_item *fi;
+	struct btrfs_key key;
+
+	btrfs_item_key_to_cpu(leaf, &key, slot);
+	if (key.objectid != ino || key.type != BTRFS_EXTENT_DATA_KEY ||
+	    key.offset != cur)
+		return false;
+
+	fi = btrfs_item_ptr(leaf, slot, struct btrfs_file_extent_item);
+	return btrfs_file_extent_type(leaf, fi) == BTRFS_FILE_EXTENT_REG &&
+	       btrfs_file_extent_compression(leaf, fi) != BTRFS_COMPRESS_NONE &&
+	       btrfs_file_extent_disk_bytenr(leaf, fi) &&
+	       !btrfs_file_extent_offset(leaf, fi) &&
+	       btrfs_file_extent_num_bytes(leaf, fi) ==
+			btrfs_file_extent_ram_bytes(leaf, fi) &&
+	       cur + btrfs_file_extent_num_bytes(leaf, fi) <= end;
+}
+
+/*
+ * Read the compressed extents of @ino from the leaf of @path, starting at its
+ * current slot and file offset @cur, for as long as each extent is wanted
+ * whole and its data follows the previous one on disk.
+ *
+ * The data of all those extents is read with a single read, then each extent
+ * is decompressed straight into @dest, which matches file offset @cur.
+ *
+ * Return the number of bytes read, 0 if the extent at @cur does not qualify.
+ * Return <0 for error.
+ */
+static int read_compressed_extents(struct btrfs_path *path, u64 ino, u64 cur,
+				   u64 end, char *dest)
+{
+	struct extent_buffer *leaf = path->nodes[0];
+	struct btrfs_fs_info *fs_info = leaf->fs_info;
+	struct btrfs_file_extent_item *fi;
+	u32 nritems = btrfs_header_nritems(leaf);
+	int slot = path->slots[0];
+	u64 disk_start = 0;
+	u64 disk_end = 0;
+	u64 pos = cur;
+	u64 bytenr;
+	u64 csize;
+	u64 read;
+	u32 dsize;
+	char *cbuf;
+	bool finished = false;
+	int num_copies = 1;
+	int nr = 0;
+	int ret;
+	int i;
+
+	for (i = slot; i < nritems; i++) {
+		if (!is_whole_compressed_extent(leaf, i, ino, pos, end))
+			break;
+
+		fi = btrfs_item_ptr(leaf, i, struct btrfs_file_extent_item);
+		bytenr = btrfs_file_extent_disk_bytenr(leaf, fi);
+		csize = btrfs_file_extent_disk_num_bytes(leaf, fi);
+		if (!nr) {
+			disk_start = bytenr;
+			num_copies = btrfs_num_copies(fs_info, bytenr, csize);
+		} else if (bytenr != disk_end ||
+			   bytenr + csize - disk_start >
+					BTRFS_COMPRESSED_BATCH_MAX ||
+			   btrfs_num_copies(fs_info, bytenr, csize) !=
+					num_copies) {
+			break;
+		}
+		disk_end = bytenr + csize;
+		pos += btrfs_file_extent_num_bytes(leaf, fi);
+		nr++;
+	}
+	if (!nr)
+		return 0;
+
+	cbuf = malloc_cache_aligned(disk_end - disk_start);
+	if (!cbuf)
+		return -ENOMEM;
+
+	for (i = 1; i <= num_copies; i++) {
+		read = disk_end - disk_start;
+		ret = read_extent_data(fs_info, cbuf, disk_start, &read, i);
+		if (ret < 0 || read != disk_end - disk_start)
+			continue;
+		finished = true;
+		break;
+	}
+	if (!finished) {
+		ret = -EIO;
+		goto out;
+	}
+
+	pos = cur;
+	for (i = slot; i < slot + nr; i++) {
+		fi = btrfs_item_ptr(leaf, i, struct btrfs_file_extent_item);
+		bytenr = btrfs_file_extent_disk_bytenr(leaf, fi);
+		csize = btrfs_file_extent_disk_num_bytes(leaf, fi);
+		dsize = btrfs_file_extent_num_bytes(leaf, fi);
+
+		ret = btrfs_decompress(btrfs_file_extent_compression(leaf, fi),
+				       cbuf + bytenr - disk_start, csize,
+				       dest + pos - cur, dsize);
+		if (ret < 0) {
+			ret = -EIO;
+			goto out;
+		}
+		/* Zero out what the compressed data does not cover */
+		if (ret < dsize)
+			memset(dest + pos - cur + ret, 0, dsize - ret);
+		pos += dsize;
+	}
+	ret = pos - cur;
+out:
+	free(cbuf);
+	return ret;
+}
+
 static int read_and_truncate_page(struct btrfs_path *path,
 				  struct btrfs_file_extent_item *fi,
 				  int start, int len, char *dest)
@@ -741,9 +868,20 @@ int btrfs_file_read(struct btrfs_root *root, u64 ino, u64 file_offset, u64 len,
 			continue;
 		}
 
+		/* Compressed extents wanted whole are read in batches */
+		ret = read_compressed_extents(&path, ino, cur, aligned_end,
+					      dest + cur - file_offset);
+		if (ret < 0)
+			goto out;
+		if (ret > 0) {
+			cur += ret;
+			continue;
+		}
+
 		/* Read the remaining part of the extent */
 		extent_num_bytes = btrfs_file_extent_num_bytes(path.nodes[0],
 							       fi);
+		extent_num_bytes = key.offset + extent_num_bytes - cur;
 		ret = btrfs_read_extent_reg(&path, fi, cur,
 				min(extent_num_bytes, aligned_end - cur),
 				dest + cur - file_offset);
@@ -845,6 +845,25 @@ u64 btrfs_stripe_length(struct btrfs_fs_info *fs_info,
 	return stripe_len;
 }
 
+/*
+ * Like search_cache_extent() on the chunk mapping, but try the chunk found by
+ * the previous lookup first. File data and tree blocks are mostly read from
+ * the same few chunks, so this saves walking the tree for every block.
+ */
+static struct cache_extent *search_chunk_map(struct btrfs_mapping_tree *map_tree,
+					     u64 logical)
+{
+	struct cache_extent *ce = map_tree->last;
+
+	if (ce && ce->start <= logical && ce->start + ce->size > logical)
+		return ce;
+
+	ce = search_cache_extent(&map_tree->cache_tree, logical);
+	if (ce && ce->start <= logical && ce->start + ce->size > logical)
+		map_tree->last = ce;
+	return ce;
+}
+
 int btrfs_num_copies(struct btrfs_fs_info *fs_info, u64 logical, u64 len)
 {
 	struct btrfs_mapping_tree *map_tree = &fs_info->mapping_tree;
@@ -852,7 +871,7 @@ int btrfs_num_copies(struct btrfs_fs_info *fs_info, u64 logical, u64 len)
 	struct map_lookup *map;
 	int ret;
 
-	ce = search_cache_extent(&map_tree->cache_tree, logical);
+	ce = search_chunk_map(map_tree, logical);
 	if (!ce) {
 		fprintf(stderr, "No mapping for %llu-%llu\n",
 			(unsigned long long)logical,
@@ -971,7 +990,7 @@ int __btrfs_map_block(struct btrfs_fs_info *fs_info, int rw,
 		stripes_allocated = 1;
 	}
 again:
-	ce = search_cache_extent(&map_tree->cache_tree, logical);
+	ce = search_chunk_map(map_tree, logical);
 	if (!ce) {
 		kfree(multi);
 		*length = (u64)-1;
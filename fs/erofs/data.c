@@ -216,61 +216,187 @@ static int erofs_read_raw_data(struct erofs_inode *inode, char *buffer,
 	return 0;
 }
 
-int z_erofs_read_one_data(struct erofs_inode *inode,
-			  struct erofs_map_blocks *map, char *raw, char *buffer,
-			  erofs_off_t skip, erofs_off_t length, bool trimmed)
+/* decompressed pclusters kept around for reads which straddle them */
+#define Z_EROFS_PCLUSTER_CACHE_SIZE	4
+/* larger extents are never cached */
+#define Z_EROFS_PCLUSTER_CACHE_MAX	(128 * 1024)
+/* most extents and compressed bytes fetched by a single device read */
+#define Z_EROFS_BATCH_EXTENTS		16
+#define Z_EROFS_BATCH_MAX		(256 * 1024)
+
+/* A decompressed pcluster, holding the first @len bytes of its extent */
+struct z_erofs_pcluster_cache {
+	erofs_off_t pa, la;
+	unsigned int len, size;
+	unsigned int seq;
+	char *data;
+};
+
+static struct z_erofs_pcluster_cache z_erofs_pcache[Z_EROFS_PCLUSTER_CACHE_SIZE];
+static unsigned int z_erofs_pcache_seq;
+
+/* An extent of a compressed file and the part of it wanted by the reader */
+struct z_erofs_extent {
+	erofs_off_t la, pa, dev_pa;
+	u64 llen, plen;
+	unsigned int flags;
+	char alg;
+
+	char *out;
+	erofs_off_t skip, length;
+	bool trimmed;
+};
+
+void z_erofs_drop_cache(void)
 {
-	struct erofs_map_dev mdev;
-	int ret = 0;
+	int i;
 
-	if (map->m_flags & EROFS_MAP_FRAGMENT) {
-		struct erofs_inode packed_inode = {
-			.nid = sbi.packed_nid,
-		};
+	for (i = 0; i < Z_EROFS_PCLUSTER_CACHE_SIZE; i++) {
+		free(z_erofs_pcache[i].data);
+		z_erofs_pcache[i] = (struct z_erofs_pcluster_cache){ 0 };
+	}
+}
 
-		ret = erofs_read_inode_from_disk(&packed_inode);
-		if (ret) {
-			erofs_err("failed to read packed inode from disk");
-			return ret;
+static struct z_erofs_pcluster_cache *
+z_erofs_cache_find(struct z_erofs_extent *e)
+{
+	struct z_erofs_pcluster_cache *pc;
+	int i;
+
+	for (i = 0; i < Z_EROFS_PCLUSTER_CACHE_SIZE; i++) {
+		pc = &z_erofs_pcache[i];
+		if (pc->len && pc->pa == e->pa && pc->la == e->la &&
+		    pc->len >= e->length) {
+			pc->seq = ++z_erofs_pcache_seq;
+			return pc;
 		}
-
-		return erofs_pread(&packed_inode, buffer, length - skip,
-				   inode->fragmentoff + skip);
 	}
+	return NULL;
+}
 
-	/* no device id here, thus it will always succeed */
-	mdev = (struct erofs_map_dev) {
-		.m_pa = map->m_pa,
-	};
-	ret = erofs_map_dev(&mdev);
-	if (ret) {
-		DBG_BUGON(1);
-		return ret;
+/* Pick the least recently used slot and make room for @e's extent */
+static struct z_erofs_pcluster_cache *
+z_erofs_cache_alloc(struct z_erofs_extent *e)
+{
+	struct z_erofs_pcluster_cache *pc = &z_erofs_pcache[0];
+	char *data;
+	int i;
+
+	for (i = 1; i < Z_EROFS_PCLUSTER_CACHE_SIZE; i++) {
+		if (z_erofs_pcache[i].seq < pc->seq)
+			pc = &z_erofs_pcache[i];
 	}
 
-	ret = erofs_dev_read(mdev.m_deviceid, raw, mdev.m_pa, map->m_plen);
-	if (ret < 0)
-		return ret;
+	pc->len = 0;
+	if (pc->size < e->llen) {
+		data = realloc(pc->data, e->llen);
+		if (!data)
+			return NULL;
+		pc->data = data;
+		pc->size = e->llen;
+	}
+	pc->seq = ++z_erofs_pcache_seq;
+	return pc;
+}
 
-	ret = z_erofs_decompress(&(struct z_erofs_decompress_req) {
+static int z_erofs_decode(struct z_erofs_extent *e, char *raw, char *out,
+			  erofs_off_t skip, erofs_off_t length, bool partial)
+{
+	return z_erofs_decompress(&(struct z_erofs_decompress_req) {
 			.in = raw,
-			.out = buffer,
+			.out = out,
 			.decodedskip = skip,
 			.interlaced_offset =
-				map->m_algorithmformat == Z_EROFS_COMPRESSION_INTERLACED ?
-					erofs_blkoff(map->m_la) : 0,
-			.inputsize = map->m_plen,
+				e->alg == Z_EROFS_COMPRESSION_INTERLACED ?
+					erofs_blkoff(e->la) : 0,
+			.inputsize = e->plen,
 			.decodedlength = length,
-			.alg = map->m_algorithmformat,
-			.partial_decoding = trimmed ? true :
-				!(map->m_flags & EROFS_MAP_FULL_MAPPED) ||
-					(map->m_flags & EROFS_MAP_PARTIAL_REF),
+			.alg = e->alg,
+			.partial_decoding = partial ? true :
+				!(e->flags & EROFS_MAP_FULL_MAPPED) ||
+					(e->flags & EROFS_MAP_PARTIAL_REF),
 			 });
+}
+
+/*
+ * Decompress the wanted part of @e from its compressed data at @raw. The whole
+ * extent is decompressed in place when it is wanted in full, otherwise it goes
+ * through the pcluster cache, so that the next read straddling it is cheap.
+ */
+static int z_erofs_decode_extent(struct z_erofs_extent *e, char *raw)
+{
+	struct z_erofs_pcluster_cache *pc;
+	int ret;
+
+	if (!e->skip && !e->trimmed)
+		return z_erofs_decode(e, raw, e->out, 0, e->length, false);
+
+	pc = NULL;
+	if (e->llen <= Z_EROFS_PCLUSTER_CACHE_MAX)
+		pc = z_erofs_cache_alloc(e);
+	if (!pc)
+		return z_erofs_decode(e, raw, e->out, e->skip, e->length,
+				      e->trimmed);
+
+	ret = z_erofs_decode(e, raw, pc->data, 0, e->llen, false);
 	if (ret < 0)
 		return ret;
+	pc->pa = e->pa;
+	pc->la = e->la;
+	pc->len = e->llen;
+	memcpy(e->out, pc->data + e->skip, e->length - e->skip);
 	return 0;
 }
 
+/* Read the compressed data of @nr adjacent extents at once and decode them */
+static int z_erofs_read_batch(struct z_erofs_extent *batch, int nr,
+			      char **raw, unsigned int *bufsize)
+{
+	/* extents are gathered backwards, the last one comes first on disk */
+	erofs_off_t start = batch[nr - 1].dev_pa;
+	erofs_off_t len = batch[0].dev_pa + batch[0].plen - start;
+	char *buf;
+	int i, ret;
+
+	if (len > *bufsize) {
+		buf = realloc(*raw, len);
+		if (!buf)
+			return -ENOMEM;
+		*raw = buf;
+		*bufsize = len;
+	}
+
+	ret = erofs_dev_read(0, *raw, start, len);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		ret = z_erofs_decode_extent(&batch[i],
+					    *raw + batch[i].dev_pa - start);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static int z_erofs_read_fragment(struct erofs_inode *inode, char *buffer,
+				 erofs_off_t skip, erofs_off_t length)
+{
+	struct erofs_inode packed_inode = {
+		.nid = sbi.packed_nid,
+	};
+	int ret;
+
+	ret = erofs_read_inode_from_disk(&packed_inode);
+	if (ret) {
+		erofs_err("failed to read packed inode from disk");
+		return ret;
+	}
+
+	return erofs_pread(&packed_inode, buffer, length - skip,
+			   inode->fragmentoff + skip);
+}
+
 static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 			     erofs_off_t size, erofs_off_t offset)
 {
@@ -278,16 +404,25 @@ static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 	struct erofs_map_blocks map = {
 		.index = UINT_MAX,
 	};
+	struct z_erofs_extent batch[Z_EROFS_BATCH_EXTENTS], ext, *prev;
+	struct z_erofs_pcluster_cache *pc;
+	struct erofs_map_dev mdev;
 	bool trimmed;
 	unsigned int bufsize = 0;
 	char *raw = NULL;
+	int nr = 0;
 	int ret = 0;
 
 	end = offset + size;
 	while (end > offset) {
 		map.m_la = end - 1;
 
-		ret = z_erofs_map_blocks_iter(inode, &map, 0);
+		/*
+		 * look up the whole extent, so that one which is only partly
+		 * wanted can be kept in the pcluster cache for the next read.
+		 */
+		ret = z_erofs_map_blocks_iter(inode, &map,
+					      EROFS_GET_BLOCKS_FIEMAP);
 		if (ret)
 			break;
 
@@ -318,21 +453,64 @@ static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 			continue;
 		}
 
-		if (map.m_plen > bufsize) {
-			bufsize = map.m_plen;
-			raw = realloc(raw, bufsize);
-			if (!raw) {
-				ret = -ENOMEM;
+		if (map.m_flags & EROFS_MAP_FRAGMENT) {
+			ret = z_erofs_read_fragment(inode, buffer + end - offset,
+						    skip, length);
+			if (ret < 0)
 				break;
-			}
+			continue;
 		}
 
-		ret = z_erofs_read_one_data(inode, &map, raw,
-					    buffer + end - offset, skip, length,
-					    trimmed);
-		if (ret < 0)
+		/* no device id here, thus it will always succeed */
+		mdev = (struct erofs_map_dev) {
+			.m_pa = map.m_pa,
+		};
+		ret = erofs_map_dev(&mdev);
+		if (ret) {
+			DBG_BUGON(1);
 			break;
+		}
+
+		ext = (struct z_erofs_extent) {
+			.la = map.m_la,
+			.pa = map.m_pa,
+			.dev_pa = mdev.m_pa,
+			/* the last extent may be mapped past EOF */
+			.llen = min(map.m_llen, inode->i_size - map.m_la),
+			.plen = map.m_plen,
+			.flags = map.m_flags,
+			.alg = map.m_algorithmformat,
+			.out = buffer + end - offset,
+			.skip = skip,
+			.length = length,
+			.trimmed = trimmed,
+		};
+
+		pc = z_erofs_cache_find(&ext);
+		if (pc) {
+			memcpy(ext.out, pc->data + skip, length - skip);
+			continue;
+		}
+
+		/*
+		 * Flush the pending batch unless this pcluster sits right in
+		 * front of it on disk.
+		 */
+		prev = nr ? &batch[nr - 1] : NULL;
+		if (prev && (nr == Z_EROFS_BATCH_EXTENTS ||
+			     ext.pa + ext.plen != prev->pa ||
+			     ext.dev_pa + ext.plen != prev->dev_pa ||
+			     batch[0].dev_pa + batch[0].plen - ext.dev_pa >
+					Z_EROFS_BATCH_MAX)) {
+			ret = z_erofs_read_batch(batch, nr, &raw, &bufsize);
+			if (ret < 0)
+				break;
+			nr = 0;
+		}
+		batch[nr++] = ext;
 	}
+	if (!ret && nr)
+		ret = z_erofs_read_batch(batch, nr, &raw, &bufsize);
 	if (raw)
 		free(raw);
 	return ret < 0 ? ret : 0;
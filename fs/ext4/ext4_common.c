@@ -183,6 +183,204 @@ uint64_t ext4fs_bg_get_inode_table_id(const struct ext2_block_group *bg,
 	return block_nr;
 }
 
+/*
+ * Read block 'blk' of directory 'dir' into 'buf'.
+ * Return 0 on success, -EIO otherwise.
+ */
+static int ext4fs_read_dir_block(struct ext2_inode *dir, uint32_t blk,
+				 char *buf)
+{
+	int log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root) -
+			 get_fs()->dev_desc->log2blksz;
+	long int blknr;
+
+	blknr = read_allocated_block(dir, blk, NULL);
+	if (blknr <= 0)
+		return -EIO;
+	if (!ext4fs_devread((lbaint_t)blknr << log2_blksz, 0,
+			    EXT2_BLOCK_SIZE(ext4fs_root), buf))
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Find the entry called 'name' in hash tree leaf block 'buf'.
+ * Return 1 if found, 0 if not, -EINVAL if the block is corrupted.
+ */
+static int ext4fs_dx_scan_leaf(char *buf, int blksz, const char *name,
+			       struct ext2_dirent *dirent)
+{
+	int namelen = strlen(name);
+	struct ext2_dirent *de;
+	int offset, len;
+
+	for (offset = 0; offset + sizeof(*de) <= blksz; offset += len) {
+		de = (struct ext2_dirent *)(buf + offset);
+		len = le16_to_cpu(de->direntlen);
+		if (len < sizeof(*de) || (len & 3) || offset + len > blksz)
+			return -EINVAL;
+
+		if (de->inode && de->namelen == namelen &&
+		    !memcmp(buf + offset + sizeof(*de), name, namelen)) {
+			*dirent = *de;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Check the dx_countlimit at 'entries' in a hash tree block 'buf'.
+ * Return the number of entries, or 0 if it is corrupted.
+ */
+static int ext4fs_dx_count(char *buf, int blksz, struct dx_entry *entries)
+{
+	struct dx_countlimit *cl = (struct dx_countlimit *)entries;
+	int count = le16_to_cpu(cl->count);
+	int limit = le16_to_cpu(cl->limit);
+
+	if (!count || count > limit ||
+	    (char *)(entries + limit) > buf + blksz)
+		return 0;
+
+	return count;
+}
+
+/**
+ * ext4fs_dx_find() - look up a name using the hash tree of a directory
+ *
+ * Only the leaf blocks the name hashes to are read, instead of the whole
+ * directory. "." and ".." only live in the root block, which is not a leaf,
+ * so they are never found this way.
+ *
+ * @dir:	inode of the directory
+ * @name:	name to look up
+ * @dirent:	returns the directory entry found
+ * Return:	1 if found, 0 if not, -ve if the directory has no usable hash
+ *		tree and must be scanned linearly
+ */
+static int ext4fs_dx_find(struct ext2_inode *dir, const char *name,
+			  struct ext2_dirent *dirent)
+{
+	struct ext2_sblock *sb = &ext4fs_root->sblock;
+	int blksz = EXT2_BLOCK_SIZE(ext4fs_root);
+	struct dx_entry *entries[DX_MAX_LEVELS], *at[DX_MAX_LEVELS];
+	int count[DX_MAX_LEVELS];
+	struct dx_root_info *info;
+	int levels, level, version, ret;
+	struct dx_entry *p, *q, *m;
+	u32 hash, next;
+	char *bufs, *buf;
+
+	if (!(le32_to_cpu(dir->flags) & EXT4_INDEX_FL) ||
+	    !(le32_to_cpu(sb->feature_compatibility) &
+	      EXT4_FEATURE_COMPAT_DIR_INDEX) ||
+	    !strcmp(name, ".") || !strcmp(name, ".."))
+		return -ENOENT;
+
+	/* One block per level of the tree, and one for the leaf */
+	bufs = malloc(blksz * (DX_MAX_LEVELS + 1));
+	if (!bufs)
+		return -ENOMEM;
+
+	ret = ext4fs_read_dir_block(dir, 0, bufs);
+	if (ret)
+		goto out;
+
+	/* dx_root_info follows the "." and ".." entries */
+	ret = -EINVAL;
+	info = (struct dx_root_info *)(bufs + 2 * sizeof(struct ext2_dirent) +
+				       8);
+	levels = info->indirect_levels + 1;
+	if (info->reserved_zero || info->info_length < sizeof(*info) ||
+	    (info->unused_flags & 1) || levels > DX_MAX_LEVELS)
+		goto out;
+
+	version = info->hash_version;
+	if (version <= DX_HASH_TEA &&
+	    (le32_to_cpu(sb->flags) & EXT2_FLAGS_UNSIGNED_HASH))
+		version += DX_HASH_LEGACY_UNSIGNED;
+	if (ext4fs_dirhash(name, strlen(name), version, sb->hash_seed, &hash))
+		goto out;
+
+	/* Walk down to the leaf covering the hash */
+	entries[0] = (struct dx_entry *)((char *)info + info->info_length);
+	for (level = 0; level < levels; level++) {
+		buf = bufs + level * blksz;
+		if (level) {
+			if (ext4fs_read_dir_block(dir, le32_to_cpu
+						  (at[level - 1]->block) &
+						  0x0fffffff, buf))
+				goto out;
+			/* Skip the empty dirent covering the node */
+			entries[level] = (struct dx_entry *)(buf + 8);
+		}
+		count[level] = ext4fs_dx_count(buf, blksz, entries[level]);
+		if (!count[level])
+			goto out;
+
+		p = entries[level] + 1;
+		q = entries[level] + count[level] - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (le32_to_cpu(m->hash) > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		at[level] = p - 1;
+	}
+
+	buf = bufs + levels * blksz;
+	while (1) {
+		ret = ext4fs_read_dir_block(dir, le32_to_cpu(at[levels - 1]->block)
+					    & 0x0fffffff, buf);
+		if (ret)
+			goto out;
+		ret = ext4fs_dx_scan_leaf(buf, blksz, name, dirent);
+		if (ret)
+			goto out;
+
+		/*
+		 * Names with the same hash may continue in the next leaf,
+		 * which then has the lowest bit of its hash set.
+		 */
+		for (level = levels - 1; level >= 0; level--) {
+			if (++at[level] < entries[level] + count[level])
+				break;
+		}
+		if (level < 0)
+			goto out;
+		next = le32_to_cpu(at[level]->hash);
+		if (!(next & 1) || (next & ~1) != hash)
+			goto out;
+
+		/* Go down to the first leaf under the new position */
+		ret = -EINVAL;
+		for (level++; level < levels; level++) {
+			char *nbuf = bufs + level * blksz;
+
+			if (ext4fs_read_dir_block(dir, le32_to_cpu
+						  (at[level - 1]->block) &
+						  0x0fffffff, nbuf))
+				goto out;
+			entries[level] = (struct dx_entry *)(nbuf + 8);
+			count[level] = ext4fs_dx_count(nbuf, blksz,
+						       entries[level]);
+			if (!count[level])
+				goto out;
+			at[level] = entries[level];
+		}
+		ret = 0;
+	}
+
+out:
+	free(bufs);
+	return ret;
+}
+
 #if defined(CONFIG_EXT4_WRITE)
 uint32_t ext4fs_div_roundup(uint32_t size, uint32_t n)
 {
@@ -209,6 +407,10 @@ void put_ext4(uint64_t off, const void *buf, uint32_t size)
 	if (fs->dev_desc == NULL)
 		return;
 
+	/* The metadata being written may be cached */
+	ext_cache_fini(&fs->gd_cache);
+	ext_cache_fini(&fs->inode_cache);
+
 	if ((startblock + (size >> log2blksz)) >
 	    (part_offset + fs->total_sect)) {
 		printf("part_offset is " LBAFU "\n", part_offset);
@@ -640,10 +842,18 @@ static int search_dir(struct ext2_inode *parent_inode, char *dirname)
 	struct ext_filesystem *fs = get_fs();
 	uint32_t directory_blocks;
 	char *direntname;
+	struct ext2_dirent dirent;
 
 	directory_blocks = le32_to_cpu(parent_inode->size) >>
 		LOG2_BLOCK_SIZE(ext4fs_root);
 
+	/* Only scan every block if the hash tree cannot be used */
+	status = ext4fs_dx_find(parent_inode, dirname, &dirent);
+	if (status == 1)
+		return le32_to_cpu(dirent.inode);
+	if (status == 0)
+		return -1;
+
 	block_buffer = zalloc(fs->blksz);
 	if (!block_buffer)
 		goto fail;
@@ -1587,9 +1797,14 @@ static int ext4fs_blockgroup
 	debug("ext4fs read %d group descriptor (blkno %ld blkoff %u)\n",
 	      group, blkno, blkoff);
 
-	return ext4fs_devread((lbaint_t)blkno <<
-			      (LOG2_BLOCK_SIZE(data) - log2blksz),
-			      blkoff, desc_size, (char *)blkgrp);
+	/* Neighbouring groups share a descriptor block, keep it around */
+	if (!ext_cache_read(&get_fs()->gd_cache, (lbaint_t)blkno <<
+			    (LOG2_BLOCK_SIZE(data) - log2blksz),
+			    EXT2_BLOCK_SIZE(data)))
+		return 0;
+	memcpy(blkgrp, get_fs()->gd_cache.buf + blkoff, desc_size);
+
+	return 1;
 }
 
 int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
@@ -1632,16 +1847,71 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 	/* Free blkgrp as it is no longer required. */
 	free(blkgrp);
 
-	/* Read the inode. */
-	status = ext4fs_devread((lbaint_t)blkno << (LOG2_BLOCK_SIZE(data) -
-				log2blksz), blkoff,
-				sizeof(struct ext2_inode), (char *)inode);
+	/* Read the inode, its neighbours are likely to be wanted next. */
+	status = ext_cache_read(&fs->inode_cache, (lbaint_t)blkno <<
+				(LOG2_BLOCK_SIZE(data) - log2blksz),
+				EXT2_BLOCK_SIZE(data));
 	if (status == 0)
 		return 0;
+	memcpy(inode, fs->inode_cache.buf + blkoff, sizeof(struct ext2_inode));
 
 	return 1;
 }
 
+/*
+ * Find the run of blocks of an extent mapped file containing 'fileblock'
+ * and remember it in 'cache'. A hole is a run with run_blknr == 0.
+ * Return 0 on success, -EINVAL if the extent tree is corrupted.
+ */
+static int ext4fs_find_extent_run(struct ext2_inode *inode, int fileblock,
+				  struct ext_block_cache *cache)
+{
+	int log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root) -
+			 get_fs()->dev_desc->log2blksz;
+	struct ext4_extent_header *ext_block;
+	struct ext4_extent *extent;
+	long int startblock, endblock;
+	unsigned long long start;
+	int i;
+
+	ext_block = ext4fs_get_extent_block(ext4fs_root, cache,
+					    (struct ext4_extent_header *)
+					    inode->b.blocks.dir_blocks,
+					    fileblock, log2_blksz);
+	if (!ext_block) {
+		printf("invalid extent block\n");
+		return -EINVAL;
+	}
+
+	extent = (struct ext4_extent *)(ext_block + 1);
+
+	/* Past the last extent of the leaf, assume a single block hole */
+	cache->run_fileblock = fileblock;
+	cache->run_blknr = 0;
+	cache->run_len = 1;
+
+	for (i = 0; i < le16_to_cpu(ext_block->eh_entries); i++) {
+		startblock = le32_to_cpu(extent[i].ee_block);
+		endblock = startblock + le16_to_cpu(extent[i].ee_len);
+
+		if (startblock > fileblock) {
+			/* Sparse file */
+			cache->run_len = startblock - fileblock;
+			break;
+		} else if (fileblock < endblock) {
+			start = le16_to_cpu(extent[i].ee_start_hi);
+			start = (start << 32) +
+				le32_to_cpu(extent[i].ee_start_lo);
+			cache->run_fileblock = startblock;
+			cache->run_blknr = start;
+			cache->run_len = endblock - startblock;
+			break;
+		}
+	}
+
+	return 0;
+}
+
 long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 			      struct ext_block_cache *cache)
 {
@@ -1652,62 +1922,23 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 	long int rblock;
 	long int perblock_parent;
 	long int perblock_child;
-	unsigned long long start;
+	struct ext_block_cache cd;
 	/* get the blocksize of the filesystem */
 	blksz = EXT2_BLOCK_SIZE(ext4fs_root);
 	log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root)
 		- get_fs()->dev_desc->log2blksz;
 
 	if (le32_to_cpu(inode->flags) & EXT4_EXTENTS_FL) {
-		long int startblock, endblock;
-		struct ext_block_cache *c, cd;
-		struct ext4_extent_header *ext_block;
-		struct ext4_extent *extent;
-		int i;
-
-		if (cache) {
-			c = cache;
-		} else {
-			c = &cd;
-			ext_cache_init(c);
-		}
-		ext_block =
-			ext4fs_get_extent_block(ext4fs_root, c,
-						(struct ext4_extent_header *)
-						inode->b.blocks.dir_blocks,
-						fileblock, log2_blksz);
-		if (!ext_block) {
-			printf("invalid extent block\n");
-			if (!cache)
-				ext_cache_fini(c);
-			return -EINVAL;
-		}
+		int len;
 
-		extent = (struct ext4_extent *)(ext_block + 1);
+		if (cache)
+			return read_allocated_run(inode, fileblock, cache, &len);
 
-		for (i = 0; i < le16_to_cpu(ext_block->eh_entries); i++) {
-			startblock = le32_to_cpu(extent[i].ee_block);
-			endblock = startblock + le16_to_cpu(extent[i].ee_len);
-
-			if (startblock > fileblock) {
-				/* Sparse file */
-				if (!cache)
-					ext_cache_fini(c);
-				return 0;
+		ext_cache_init(&cd);
+		blknr = read_allocated_run(inode, fileblock, &cd, &len);
+		ext_cache_fini(&cd);
 
-			} else if (fileblock < endblock) {
-				start = le16_to_cpu(extent[i].ee_start_hi);
-				start = (start << 32) +
-					le32_to_cpu(extent[i].ee_start_lo);
-				if (!cache)
-					ext_cache_fini(c);
-				return (fileblock - startblock) + start;
-			}
-		}
-
-		if (!cache)
-			ext_cache_fini(c);
-		return 0;
+		return blknr;
 	}
 
 	/* Direct blocks. */
@@ -1995,6 +2226,43 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 	return blknr;
 }
 
+/**
+ * read_allocated_run() - find the disk blocks of a run of file blocks
+ *
+ * For extent mapped files, the extent found is remembered in @cache so
+ * that the following blocks are found without walking the extent tree.
+ *
+ * @inode:	inode of the file
+ * @fileblock:	file block to look up
+ * @cache:	block cache used for this file only
+ * @lenp:	returns the number of blocks from @fileblock on which are
+ *		contiguous on disk, or part of the same hole
+ * Return:	disk block of @fileblock, 0 for a hole, -ve on error
+ */
+long int read_allocated_run(struct ext2_inode *inode, int fileblock,
+			    struct ext_block_cache *cache, int *lenp)
+{
+	int ret;
+
+	if (!(le32_to_cpu(inode->flags) & EXT4_EXTENTS_FL)) {
+		*lenp = 1;
+		return read_allocated_block(inode, fileblock, cache);
+	}
+
+	if (!cache->run_len || fileblock < cache->run_fileblock ||
+	    fileblock >= cache->run_fileblock + cache->run_len) {
+		ret = ext4fs_find_extent_run(inode, fileblock, cache);
+		if (ret)
+			return ret;
+	}
+
+	*lenp = cache->run_fileblock + cache->run_len - fileblock;
+	if (!cache->run_blknr)
+		return 0;
+
+	return cache->run_blknr + (fileblock - cache->run_fileblock);
+}
+
 /**
  * ext4fs_reinit_global() - Reinitialize values of ext4 write implementation's
  *			    global pointers
@@ -2027,6 +2295,8 @@ void ext4fs_reinit_global(void)
 		ext4fs_indir3_size = 0;
 		ext4fs_indir3_blkno = -1;
 	}
+	ext_cache_fini(&get_fs()->gd_cache);
+	ext_cache_fini(&get_fs()->inode_cache);
 }
 void ext4fs_close(void)
 {
@@ -2042,6 +2312,63 @@ void ext4fs_close(void)
 	ext4fs_reinit_global();
 }
 
+/*
+ * Allocate the node of directory entry 'dirent' of 'diro' and work out
+ * its type, reading its inode if the entry does not tell.
+ * Return 1 on success, 0 on failure.
+ */
+static int ext4fs_dirent_node(struct ext2fs_node *diro,
+			      struct ext2_dirent *dirent,
+			      struct ext2fs_node **fnode, int *ftype)
+{
+	struct ext2fs_node *fdiro;
+	int type = FILETYPE_UNKNOWN;
+	int status;
+
+	fdiro = zalloc(sizeof(struct ext2fs_node));
+	if (!fdiro)
+		return 0;
+
+	fdiro->data = diro->data;
+	fdiro->ino = le32_to_cpu(dirent->inode);
+
+	if (dirent->filetype != FILETYPE_UNKNOWN) {
+		fdiro->inode_read = 0;
+
+		if (dirent->filetype == FILETYPE_DIRECTORY)
+			type = FILETYPE_DIRECTORY;
+		else if (dirent->filetype == FILETYPE_SYMLINK)
+			type = FILETYPE_SYMLINK;
+		else if (dirent->filetype == FILETYPE_REG)
+			type = FILETYPE_REG;
+	} else {
+		status = ext4fs_read_inode(diro->data,
+					   le32_to_cpu(dirent->inode),
+					   &fdiro->inode);
+		if (status == 0) {
+			free(fdiro);
+			return 0;
+		}
+		fdiro->inode_read = 1;
+
+		if ((le16_to_cpu(fdiro->inode.mode) &
+		     FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY) {
+			type = FILETYPE_DIRECTORY;
+		} else if ((le16_to_cpu(fdiro->inode.mode)
+			    & FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK) {
+			type = FILETYPE_SYMLINK;
+		} else if ((le16_to_cpu(fdiro->inode.mode)
+			    & FILETYPE_INO_MASK) == FILETYPE_INO_REG) {
+			type = FILETYPE_REG;
+		}
+	}
+
+	*fnode = fdiro;
+	*ftype = type;
+
+	return 1;
+}
+
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 				struct ext2fs_node **fnode, int *ftype)
 {
@@ -2059,6 +2386,20 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 		if (status == 0)
 			return 0;
 	}
+	/*
+	 * Use the hash tree when looking for a name, if there is one. The
+	 * whole directory is only scanned if the tree is missing, corrupted
+	 * or uses a hash we do not know.
+	 */
+	if (name && fnode && ftype) {
+		struct ext2_dirent dirent;
+
+		status = ext4fs_dx_find(&diro->inode, name, &dirent);
+		if (status == 1)
+			return ext4fs_dirent_node(diro, &dirent, fnode, ftype);
+		if (status == 0)
+			return 0;
+	}
 	/* Search the file.  */
 	while (fpos < le32_to_cpu(diro->inode.size)) {
 		struct ext2_dirent dirent;
@@ -2077,7 +2418,7 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 		if (dirent.namelen != 0) {
 			char filename[dirent.namelen + 1];
 			struct ext2fs_node *fdiro;
-			int type = FILETYPE_UNKNOWN;
+			int type;
 
 			status = ext4fs_read_file(diro,
 						  fpos +
@@ -2087,49 +2428,10 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			if (status < 0)
 				return 0;
 
-			fdiro = zalloc(sizeof(struct ext2fs_node));
-			if (!fdiro)
+			if (!ext4fs_dirent_node(diro, &dirent, &fdiro, &type))
 				return 0;
 
-			fdiro->data = diro->data;
-			fdiro->ino = le32_to_cpu(dirent.inode);
-
 			filename[dirent.namelen] = '\0';
-
-			if (dirent.filetype != FILETYPE_UNKNOWN) {
-				fdiro->inode_read = 0;
-
-				if (dirent.filetype == FILETYPE_DIRECTORY)
-					type = FILETYPE_DIRECTORY;
-				else if (dirent.filetype == FILETYPE_SYMLINK)
-					type = FILETYPE_SYMLINK;
-				else if (dirent.filetype == FILETYPE_REG)
-					type = FILETYPE_REG;
-			} else {
-				status = ext4fs_read_inode(diro->data,
-							   le32_to_cpu
-							   (dirent.inode),
-							   &fdiro->inode);
-				if (status == 0) {
-					free(fdiro);
-					return 0;
-				}
-				fdiro->inode_read = 1;
-
-				if ((le16_to_cpu(fdiro->inode.mode) &
-				     FILETYPE_INO_MASK) ==
-				    FILETYPE_INO_DIRECTORY) {
-					type = FILETYPE_DIRECTORY;
-				} else if ((le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_SYMLINK) {
-					type = FILETYPE_SYMLINK;
-				} else if ((le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_REG) {
-					type = FILETYPE_REG;
-				}
-			}
 #ifdef DEBUG
 			printf("iterate >%s<\n", filename);
 #endif /* of DEBUG */
@@ -2340,7 +2642,11 @@ int ext4fs_open(const char *filename, loff_t *len)
 	if (ext4fs_root == NULL)
 		return -1;
 
-	ext4fs_file = NULL;
+	/* the filesystem may stay mounted across several opens */
+	if (ext4fs_file) {
+		ext4fs_free_node(ext4fs_file, &ext4fs_root->diropen);
+		ext4fs_file = NULL;
+	}
 	status = ext4fs_find_file(filename, &ext4fs_root->diropen, &fdiro,
 				  FILETYPE_REG);
 	if (status == 0)
@@ -59,6 +59,41 @@ int ext4fs_find_file1(const char *currpath, struct ext2fs_node *currroot,
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			struct ext2fs_node **fnode, int *ftype);
 
+/* Hash functions of hash tree directories, see dx_root_info.hash_version */
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+#define DX_HASH_EOF			0x7fffffff
+
+/* Deepest hash tree supported, with the largedir feature */
+#define DX_MAX_LEVELS			3
+
+struct dx_entry {
+	__le32 hash;
+	__le32 block;
+};
+
+/* Overlays the hash of the first dx_entry of a dx_root or dx_node */
+struct dx_countlimit {
+	__le16 limit;
+	__le16 count;
+};
+
+/* Follows the "." and ".." entries in the first block of the directory */
+struct dx_root_info {
+	__le32 reserved_zero;
+	__u8 hash_version;
+	__u8 info_length;
+	__u8 indirect_levels;
+	__u8 unused_flags;
+};
+
+int ext4fs_dirhash(const char *name, int len, int version,
+		   const __le32 seed[4], u32 *hashp);
+
 #if defined(CONFIG_EXT4_WRITE)
 uint32_t ext4fs_div_roundup(uint32_t size, uint32_t n);
 uint16_t ext4fs_checksum_update(unsigned int i);
@@ -53,19 +53,18 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 		loff_t len, char *buf, loff_t *actread)
 {
 	struct ext_filesystem *fs = get_fs();
-	int i;
+	int i, n;
 	lbaint_t blockcnt;
 	int log2blksz = fs->dev_desc->log2blksz;
 	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data) - log2blksz;
 	int blocksize = (1 << (log2_fs_blocksize + log2blksz));
 	unsigned int filesize = le32_to_cpu(node->inode.size);
-	lbaint_t previous_block_number = -1;
+	lbaint_t firstblock;
 	lbaint_t delayed_start = 0;
 	lbaint_t delayed_extent = 0;
 	lbaint_t delayed_skipfirst = 0;
 	lbaint_t delayed_next = 0;
 	char *delayed_buf = NULL;
-	char *start_buf = buf;
 	short status;
 	struct ext_block_cache cache;
 
@@ -81,42 +80,42 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 	}
 
 	blockcnt = lldiv(((len + pos) + blocksize - 1), blocksize);
+	firstblock = lldiv(pos, blocksize);
 
-	for (i = lldiv(pos, blocksize); i < blockcnt; i++) {
+	/* Handle each run of blocks contiguous on disk, or hole, at once */
+	for (i = firstblock; i < blockcnt; i += n) {
 		long int blknr;
-		int blockoff = pos - (blocksize * i);
-		int blockend = blocksize;
+		loff_t runend;
 		int skipfirst = 0;
-		blknr = read_allocated_block(&node->inode, i, &cache);
+		int runlen;
+
+		blknr = read_allocated_run(&node->inode, i, &cache, &n);
 		if (blknr < 0) {
 			ext_cache_fini(&cache);
 			return -1;
 		}
+		if (n > blockcnt - i)
+			n = blockcnt - i;
 
 		blknr = blknr << log2_fs_blocksize;
 
 		/* Last block.  */
-		if (i == blockcnt - 1) {
-			blockend = (len + pos) - (blocksize * i);
-
-			/* The last portion is exactly blocksize. */
-			if (!blockend)
-				blockend = blocksize;
-		}
+		runend = (loff_t)blocksize * (i + n);
+		if (runend > len + pos)
+			runend = len + pos;
+		runlen = runend - (loff_t)blocksize * i;
 
 		/* First block. */
-		if (i == lldiv(pos, blocksize)) {
-			skipfirst = blockoff;
-			blockend -= skipfirst;
+		if (i == firstblock) {
+			skipfirst = pos - (loff_t)blocksize * i;
+			runlen -= skipfirst;
 		}
 		if (blknr) {
-			int status;
-
-			if (previous_block_number != -1) {
-				if (delayed_next == blknr) {
-					delayed_extent += blockend;
-					delayed_next += blockend >> log2blksz;
-				} else {	/* spill */
+			if (delayed_extent && delayed_next == blknr &&
+			    !skipfirst) {
+				delayed_extent += runlen;
+			} else {
+				if (delayed_extent) {	/* spill */
 					status = ext4fs_devread(delayed_start,
 							delayed_skipfirst,
 							delayed_extent,
@@ -125,27 +124,15 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 						ext_cache_fini(&cache);
 						return -1;
 					}
-					previous_block_number = blknr;
-					delayed_start = blknr;
-					delayed_extent = blockend;
-					delayed_skipfirst = skipfirst;
-					delayed_buf = buf;
-					delayed_next = blknr +
-						(blockend >> log2blksz);
 				}
-			} else {
-				previous_block_number = blknr;
 				delayed_start = blknr;
-				delayed_extent = blockend;
+				delayed_extent = runlen;
 				delayed_skipfirst = skipfirst;
 				delayed_buf = buf;
-				delayed_next = blknr +
-					(blockend >> log2blksz);
 			}
+			delayed_next = blknr + (n << log2_fs_blocksize);
 		} else {
-			int n;
-			int n_left;
-			if (previous_block_number != -1) {
+			if (delayed_extent) {
 				/* spill */
 				status = ext4fs_devread(delayed_start,
 							delayed_skipfirst,
@@ -155,18 +142,13 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 					ext_cache_fini(&cache);
 					return -1;
 				}
-				previous_block_number = -1;
+				delayed_extent = 0;
 			}
-			/* Zero no more than `len' bytes. */
-			n = blocksize - skipfirst;
-			n_left = len - ( buf - start_buf );
-			if (n > n_left)
-				n = n_left;
-			memset(buf, 0, n);
+			memset(buf, 0, runlen);
 		}
-		buf += blocksize - skipfirst;
+		buf += runlen;
 	}
-	if (previous_block_number != -1) {
+	if (delayed_extent) {
 		/* spill */
 		status = ext4fs_devread(delayed_start,
 					delayed_skipfirst, delayed_extent,
@@ -175,7 +157,6 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 			ext_cache_fini(&cache);
 			return -1;
 		}
-		previous_block_number = -1;
 	}
 
 	*actread  = len;
@@ -293,12 +274,15 @@ int ext_cache_read(struct ext_block_cache *cache, lbaint_t block, int size)
 	/* This could be more lenient, but this is simple and enough for now */
 	if (cache->buf && cache->block == block && cache->size == size)
 		return 1;
-	ext_cache_fini(cache);
+	/* Keep the run found by read_allocated_run(), it is still valid */
+	free(cache->buf);
+	cache->size = 0;
 	cache->buf = memalign(ARCH_DMA_MINALIGN, size);
 	if (!cache->buf)
 		return 0;
 	if (!ext4fs_devread(block, 0, size, cache->buf)) {
-		ext_cache_fini(cache);
+		free(cache->buf);
+		cache->buf = NULL;
 		return 0;
 	}
 	cache->block = block;
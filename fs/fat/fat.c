@@ -26,6 +26,7 @@
 #include <linux/compiler.h>
 #include <linux/ctype.h>
 #include <linux/log2.h>
+#include <linux/math64.h>
 
 /* maximum number of clusters for FAT12 */
 #define MAX_FAT12	0xFF4
@@ -152,16 +153,109 @@ static void get_name(dir_entry *dirent, char *s_name)
 }
 
 static int flush_dirty_fat_buffer(fsdata *mydata);
+static int flush_fat_window(fsdata *mydata, int win);
 
 #if !CONFIG_IS_ENABLED(FAT_WRITE)
-/* Stub for read only operation */
+/* Stubs for read only operation */
 int flush_dirty_fat_buffer(fsdata *mydata)
 {
 	(void)(mydata);
 	return 0;
 }
+
+int flush_fat_window(fsdata *mydata, int win)
+{
+	(void)(mydata);
+	(void)(win);
+	return 0;
+}
 #endif
 
+/*
+ * Forget all cached cluster runs, e.g. after the FAT has been modified.
+ */
+static void fat_extent_invalidate(fsdata *mydata)
+{
+	memset(mydata->extents, '\0', sizeof(mydata->extents));
+	mydata->extent_next = 0;
+}
+
+/*
+ * Forget all cached FAT blocks and cluster runs. Any dirty FAT buffer must
+ * have been flushed before.
+ */
+static void fat_reset_caches(fsdata *mydata)
+{
+	int i;
+
+	for (i = 0; i < FATBUFWINDOWS; i++) {
+		mydata->fatbufnum[i] = -1;
+		mydata->fatbufused[i] = 0;
+	}
+	mydata->fatbufclock = 0;
+	mydata->fat_dirty = 0;
+	fat_extent_invalidate(mydata);
+}
+
+/*
+ * Allocate the FAT buffers of 'mydata' and mark them all empty.
+ * Return 0 on success, -1 on failure.
+ */
+static int fat_alloc_fatbuf(fsdata *mydata)
+{
+	fat_reset_caches(mydata);
+	mydata->free_map = NULL;
+	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE * FATBUFWINDOWS);
+	if (!mydata->fatbuf) {
+		debug("Error: allocating memory\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Return the index of the FAT buffer holding FAT block 'bufnum', reading it
+ * from disk into the least recently used buffer if needed.
+ * Return -1 on failure.
+ */
+static int get_fatbuf(fsdata *mydata, __u32 bufnum)
+{
+	__u32 getsize = FATBUFBLOCKS;
+	__u32 fatlength = mydata->fatlength;
+	__u32 startblock = bufnum * FATBUFBLOCKS;
+	int i, win = 0;
+
+	for (i = 0; i < FATBUFWINDOWS; i++) {
+		if (mydata->fatbufnum[i] == bufnum) {
+			mydata->fatbufused[i] = ++mydata->fatbufclock;
+			return i;
+		}
+		if (mydata->fatbufused[i] < mydata->fatbufused[win])
+			win = i;
+	}
+
+	/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
+	if (startblock + getsize > fatlength)
+		getsize = fatlength - startblock;
+
+	startblock += mydata->fat_sect;	/* Offset from start of disk */
+
+	/* Write back the evicted buffer to the disk */
+	if (flush_fat_window(mydata, win) < 0)
+		return -1;
+
+	mydata->fatbufnum[win] = -1;
+	if (disk_read(startblock, getsize, FATBUF(mydata, win)) < 0) {
+		debug("Error reading FAT blocks\n");
+		return -1;
+	}
+	mydata->fatbufnum[win] = bufnum;
+	mydata->fatbufused[win] = ++mydata->fatbufclock;
+
+	return win;
+}
+
 /*
  * Get the entry at index 'entry' in a FAT (12/16/32) table.
  * On failure 0x00 is returned.
@@ -171,6 +265,8 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	__u32 bufnum;
 	__u32 offset, off8;
 	__u32 ret = 0x00;
+	__u8 *fatbuf;
+	int win;
 
 	if (CHECK_CLUST(entry, mydata->fatsize)) {
 		log_err("Invalid FAT entry: %#08x\n", entry);
@@ -199,42 +295,24 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	debug("FAT%d: entry: 0x%08x = %d, offset: 0x%04x = %d\n",
 	       mydata->fatsize, entry, entry, offset, offset);
 
-	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		__u32 getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		startblock += mydata->fat_sect;	/* Offset from start of disk */
-
-		/* Write back the fatbuf to the disk */
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return ret;
-		}
-		mydata->fatbufnum = bufnum;
-	}
+	/* Find or read the block of FAT entries in the cache. */
+	win = get_fatbuf(mydata, bufnum);
+	if (win < 0)
+		return ret;
+	fatbuf = FATBUF(mydata, win);
 
 	/* Get the actual entry from the table */
 	switch (mydata->fatsize) {
 	case 32:
-		ret = FAT2CPU32(((__u32 *) mydata->fatbuf)[offset]);
+		ret = FAT2CPU32(((__u32 *)fatbuf)[offset]);
 		break;
 	case 16:
-		ret = FAT2CPU16(((__u16 *) mydata->fatbuf)[offset]);
+		ret = FAT2CPU16(((__u16 *)fatbuf)[offset]);
 		break;
 	case 12:
 		off8 = (offset * 3) / 2;
 		/* fatbut + off8 may be unaligned, read in byte granularity */
-		ret = mydata->fatbuf[off8] + (mydata->fatbuf[off8 + 1] << 8);
+		ret = fatbuf[off8] + (fatbuf[off8 + 1] << 8);
 
 		if (offset & 0x1)
 			ret >>= 4;
@@ -246,6 +324,123 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	return ret;
 }
 
+/*
+ * Remember that clusters 'index' to 'index + len - 1' of the chain starting
+ * at cluster 'start' are the contiguous clusters 'clust' to
+ * 'clust + len - 1'.
+ */
+static void fat_extent_add(fsdata *mydata, __u32 start, __u32 index,
+			   __u32 clust, __u32 len)
+{
+	struct fat_extent *ext;
+	int i;
+
+	/* Extend a run we already know about */
+	for (i = 0; i < FAT_EXTENTS; i++) {
+		ext = &mydata->extents[i];
+		if (ext->len && ext->start == start && ext->index == index) {
+			if (len > ext->len)
+				ext->len = len;
+			return;
+		}
+	}
+
+	ext = &mydata->extents[mydata->extent_next++ % FAT_EXTENTS];
+	ext->start = start;
+	ext->index = index;
+	ext->clust = clust;
+	ext->len = len;
+}
+
+/*
+ * Find the known run of the chain starting at 'start' closest to and not
+ * after position 'index'. Return NULL if there is none.
+ */
+static struct fat_extent *fat_extent_find(fsdata *mydata, __u32 start,
+					  __u32 index)
+{
+	struct fat_extent *ext, *best = NULL;
+	int i;
+
+	for (i = 0; i < FAT_EXTENTS; i++) {
+		ext = &mydata->extents[i];
+		if (!ext->len || ext->start != start || ext->index > index)
+			continue;
+		if (!best || ext->index > best->index)
+			best = ext;
+	}
+
+	return best;
+}
+
+/**
+ * fat_get_run() - find a run of contiguous clusters in a cluster chain
+ *
+ * Locate cluster number 'index' of the chain starting at cluster 'start' and
+ * count how many clusters following it are contiguous on disk, up to 'max'.
+ * Runs found on the way are remembered, so that seeking within or re-reading
+ * a file does not need to walk the FAT again.
+ *
+ * @mydata:	file system description
+ * @start:	first cluster of the chain
+ * @index:	position of the wanted cluster in the chain
+ * @max:	maximum number of clusters wanted, at least 1
+ * @clustp:	returns the cluster at position 'index'
+ * @lenp:	returns the number of contiguous clusters starting at *clustp
+ * Return:	0 on success, -1 if the chain is shorter or invalid
+ */
+static int fat_get_run(fsdata *mydata, __u32 start, __u32 index, __u32 max,
+		       __u32 *clustp, __u32 *lenp)
+{
+	struct fat_extent *ext;
+	__u32 pos, clust, runpos, runclust, newclust;
+
+	ext = fat_extent_find(mydata, start, index);
+	if (ext && index < ext->index + ext->len &&
+	    ext->index + ext->len - index >= max) {
+		*clustp = ext->clust + (index - ext->index);
+		*lenp = max;
+		return 0;
+	}
+
+	/* Walk the chain from the end of the closest known run */
+	if (ext) {
+		runpos = ext->index;
+		runclust = ext->clust;
+		pos = ext->index + ext->len - 1;
+	} else {
+		runpos = 0;
+		runclust = start;
+		pos = 0;
+	}
+	clust = runclust + (pos - runpos);
+
+	while (pos < index || pos - index + 1 < max) {
+		newclust = get_fatent(mydata, clust);
+		if (newclust != clust + 1) {
+			fat_extent_add(mydata, start, runpos, runclust,
+				       pos - runpos + 1);
+			if (pos >= index)
+				break;
+			if (CHECK_CLUST(newclust, mydata->fatsize)) {
+				debug("curclust: 0x%x\n", newclust);
+				printf("Invalid FAT entry\n");
+				return -1;
+			}
+			runpos = pos + 1;
+			runclust = newclust;
+		}
+		pos++;
+		clust = newclust;
+	}
+	fat_extent_add(mydata, start, runpos, runclust, pos - runpos + 1);
+
+	*clustp = runclust + (index - runpos);
+	*lenp = min(pos - index + 1, max);
+
+	return 0;
+}
+
 /*
  * Read at most 'size' bytes from the specified cluster into 'buffer'.
  * Return 0 on success, -1 otherwise.
@@ -329,8 +524,8 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 {
 	loff_t filesize = FAT2CPU32(dentptr->size);
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
-	__u32 curclust = START(dentptr);
-	__u32 endclust, newclust;
+	__u32 start = START(dentptr);
+	__u32 index, clust, len;
 	loff_t actsize;
 
 	*gotsize = 0;
@@ -346,21 +541,9 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 
 	debug("%llu bytes\n", filesize);
 
-	actsize = bytesperclust;
-
 	/* go to cluster at pos */
-	while (actsize <= pos) {
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-		actsize += bytesperclust;
-	}
-
-	/* actsize > pos */
-	actsize -= bytesperclust;
+	index = DIV_ROUND_DOWN_ULL(pos, bytesperclust);
+	actsize = (loff_t)index * bytesperclust;
 	filesize -= actsize;
 	pos -= actsize;
 
@@ -368,6 +551,9 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 	if (pos) {
 		__u8 *tmp_buffer;
 
+		if (fat_get_run(mydata, start, index, 1, &clust, &len))
+			return -1;
+
 		actsize = min(filesize, (loff_t)bytesperclust);
 		tmp_buffer = malloc_cache_aligned(actsize);
 		if (!tmp_buffer) {
@@ -375,7 +561,7 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 			return -1;
 		}
 
-		if (get_cluster(mydata, curclust, tmp_buffer, actsize) != 0) {
+		if (get_cluster(mydata, clust, tmp_buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			free(tmp_buffer);
 			return -1;
@@ -385,62 +571,29 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 		memcpy(buffer, tmp_buffer + pos, actsize);
 		free(tmp_buffer);
 		*gotsize += actsize;
-		if (!filesize)
-			return 0;
 		buffer += actsize;
-
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
+		index++;
 	}
 
-	actsize = bytesperclust;
-	endclust = curclust;
-
-	do {
-		/* search for consecutive clusters */
-		while (actsize < filesize) {
-			newclust = get_fatent(mydata, endclust);
-			if ((newclust - 1) != endclust)
-				goto getit;
-			if (CHECK_CLUST(newclust, mydata->fatsize)) {
-				debug("curclust: 0x%x\n", newclust);
-				printf("Invalid FAT entry\n");
-				return -1;
-			}
-			endclust = newclust;
-			actsize += bytesperclust;
-		}
+	/* read each run of consecutive clusters at once */
+	while (filesize) {
+		if (fat_get_run(mydata, start, index,
+				DIV_ROUND_UP_ULL(filesize, bytesperclust),
+				&clust, &len))
+			return -1;
 
-		/* get remaining bytes */
-		actsize = filesize;
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
+		actsize = min(filesize, (loff_t)len * bytesperclust);
+		if (get_cluster(mydata, clust, buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			return -1;
 		}
 		*gotsize += actsize;
-		return 0;
-getit:
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
-			printf("Error reading cluster\n");
-			return -1;
-		}
-		*gotsize += (int)actsize;
 		filesize -= actsize;
 		buffer += actsize;
+		index += len;
+	}
 
-		curclust = get_fatent(mydata, endclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-		actsize = bytesperclust;
-		endclust = curclust;
-	} while (1);
+	return 0;
 }
 
 /*
@@ -684,13 +837,22 @@ static int get_fs_info(fsdata *mydata)
 		mydata->root_cluster = 0;
 	}
 
-	mydata->fatbufnum = -1;
-	mydata->fat_dirty = 0;
-	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (mydata->fatbuf == NULL) {
-		debug("Error: allocating memory\n");
+	/* Data clusters may end before the FAT does, or the other way round */
+	mydata->max_clust = min(div_u64((u64)mydata->total_sect -
+					mydata->data_begin, mydata->clust_size),
+				div_u64((u64)mydata->fatlength *
+					mydata->sect_size * 8, mydata->fatsize));
+	mydata->fsinfo_sect = 0;
+	if (mydata->fatsize == 32 && bs.info_sector &&
+	    bs.info_sector < mydata->fat_sect)
+		mydata->fsinfo_sect = bs.info_sector;
+	mydata->fsinfo_loaded = 0;
+	mydata->fsinfo_dirty = 0;
+	mydata->free_count = FAT_FREE_UNKNOWN;
+	mydata->next_free = FAT_FREE_UNKNOWN;
+
+	if (fat_alloc_fatbuf(mydata))
 		return -1;
-	}
 
 	debug("FAT%d, fat_sect: %d, fatlength: %d\n",
 	       mydata->fatsize, mydata->fat_sect, mydata->fatlength);
@@ -214,19 +214,19 @@ static int disk_write(__u32 block, __u32 nr_blocks, void *buf)
 }
 
 /*
- * Write fat buffer into block device
+ * Write fat buffer 'win' into block device if it has been modified
  */
-static int flush_dirty_fat_buffer(fsdata *mydata)
+static int flush_fat_window(fsdata *mydata, int win)
 {
 	int getsize = FATBUFBLOCKS;
 	__u32 fatlength = mydata->fatlength;
-	__u8 *bufptr = mydata->fatbuf;
-	__u32 startblock = mydata->fatbufnum * FATBUFBLOCKS;
+	__u8 *bufptr = FATBUF(mydata, win);
+	__u32 startblock = mydata->fatbufnum[win] * FATBUFBLOCKS;
 
-	debug("debug: evicting %d, dirty: %d\n", mydata->fatbufnum,
-	      (int)mydata->fat_dirty);
+	debug("debug: evicting %d, dirty: %d\n", mydata->fatbufnum[win],
+	      !!(mydata->fat_dirty & BIT(win)));
 
-	if ((!mydata->fat_dirty) || (mydata->fatbufnum == -1))
+	if (!(mydata->fat_dirty & BIT(win)) || mydata->fatbufnum[win] == -1)
 		return 0;
 
 	/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
@@ -249,11 +249,223 @@ static int flush_dirty_fat_buffer(fsdata *mydata)
 			return -1;
 		}
 	}
-	mydata->fat_dirty = 0;
+	mydata->fat_dirty &= ~BIT(win);
+
+	return 0;
+}
+
+/*
+ * Read the free cluster hints from the FSInfo sector of a FAT32 file system
+ */
+static void fat_load_fsinfo(fsdata *mydata)
+{
+	ALLOC_CACHE_ALIGN_BUFFER(__u8, block, mydata->sect_size);
+	struct fat_fsinfo *fsinfo = (struct fat_fsinfo *)block;
+	__u32 free_count, next_free;
+
+	if (mydata->fsinfo_loaded)
+		return;
+	mydata->fsinfo_loaded = 1;
+
+	if (!mydata->fsinfo_sect)
+		return;
+
+	if (disk_read(mydata->fsinfo_sect, 1, block) != 1 ||
+	    le32_to_cpu(fsinfo->lead_sig) != FAT_FSINFO_LEAD_SIG ||
+	    le32_to_cpu(fsinfo->struct_sig) != FAT_FSINFO_STRUCT_SIG ||
+	    le32_to_cpu(fsinfo->trail_sig) != FAT_FSINFO_TRAIL_SIG) {
+		debug("FSInfo sector %u is invalid\n", mydata->fsinfo_sect);
+		mydata->fsinfo_sect = 0;
+		return;
+	}
+
+	free_count = le32_to_cpu(fsinfo->free_count);
+	next_free = le32_to_cpu(fsinfo->next_free);
+	if (free_count <= mydata->max_clust - 2 && !mydata->free_map)
+		mydata->free_count = free_count;
+	if (next_free >= 2 && next_free < mydata->max_clust)
+		mydata->next_free = next_free;
+	debug("FSInfo: free_count: %u, next_free: %u\n", free_count, next_free);
+}
+
+/*
+ * Write the free cluster hints back to the FSInfo sector
+ */
+static int fat_store_fsinfo(fsdata *mydata)
+{
+	ALLOC_CACHE_ALIGN_BUFFER(__u8, block, mydata->sect_size);
+	struct fat_fsinfo *fsinfo = (struct fat_fsinfo *)block;
+
+	if (!mydata->fsinfo_dirty || !mydata->fsinfo_sect)
+		return 0;
+
+	if (disk_read(mydata->fsinfo_sect, 1, block) != 1) {
+		debug("error: reading FSInfo sector\n");
+		return -1;
+	}
+	fsinfo->free_count = cpu_to_le32(mydata->free_count);
+	fsinfo->next_free = cpu_to_le32(mydata->next_free);
+	if (disk_write(mydata->fsinfo_sect, 1, block) < 0) {
+		debug("error: writing FSInfo sector\n");
+		return -1;
+	}
+	mydata->fsinfo_dirty = 0;
+
+	return 0;
+}
+
+/*
+ * Write all modified fat buffers and the FSInfo sector into block device
+ */
+static int flush_dirty_fat_buffer(fsdata *mydata)
+{
+	int win;
+
+	for (win = 0; win < FATBUFWINDOWS; win++) {
+		if (flush_fat_window(mydata, win) < 0)
+			return -1;
+	}
+
+	return fat_store_fsinfo(mydata);
+}
+
+/*
+ * Build the map of clusters in use from the FAT, so that free clusters can
+ * be found without reading the FAT again.
+ * Return 0 on success, -1 if there is not enough memory.
+ */
+static int fat_init_free_map(fsdata *mydata)
+{
+	__u32 words = DIV_ROUND_UP(mydata->max_clust, 32);
+	__u32 entry, free_count = 0;
+	__u32 *map;
+
+	map = calloc(words, sizeof(*map));
+	if (!map) {
+		debug("Error: allocating free cluster map\n");
+		return -1;
+	}
+
+	/* Entries 0 and 1, and those past the last cluster are never free */
+	map[0] = 0x3;
+	if (mydata->max_clust % 32)
+		map[words - 1] |= ~0U << (mydata->max_clust % 32);
+
+	for (entry = 2; entry < mydata->max_clust; entry++) {
+		if (get_fatent(mydata, entry))
+			map[entry / 32] |= BIT(entry % 32);
+		else
+			free_count++;
+	}
+
+	mydata->free_map = map;
+	if (mydata->free_count != free_count) {
+		debug("free_count: %u, counted: %u\n", mydata->free_count,
+		      free_count);
+		mydata->free_count = free_count;
+		mydata->fsinfo_dirty = 1;
+	}
 
 	return 0;
 }
 
+/*
+ * With FS_MOUNT_CACHE, the free cluster map of the last write is kept, so
+ * that the next write to the same filesystem does not read the whole FAT
+ * again. FAT updates keep it exact. Anything else writing to the device, or
+ * a change of media, drops it through fat_invalidate_dev().
+ */
+static struct {
+	struct blk_desc *dev;	/* Device the map belongs to, NULL if none */
+	lbaint_t start;		/* First block of the partition */
+	__u32 max_clust;	/* Number of FAT entries */
+	__u32 free_count;	/* Number of free clusters */
+	__u32 next_free;	/* Where to look for a free cluster first */
+	__u32 *map;		/* The map itself */
+} fat_kept;
+
+/* Set while this driver writes, so that its own writes keep the map */
+static bool fat_writing;
+
+void fat_invalidate_dev(struct blk_desc *desc)
+{
+	if (fat_writing || (desc && desc != fat_kept.dev))
+		return;
+
+	free(fat_kept.map);
+	fat_kept.map = NULL;
+	fat_kept.dev = NULL;
+}
+
+/*
+ * Start writing to the filesystem of 'mydata', taking over the free
+ * cluster map kept from a previous write to it
+ */
+static void fat_get_free_map(fsdata *mydata)
+{
+	fat_writing = true;
+	if (!fat_kept.dev || fat_kept.dev != cur_dev ||
+	    fat_kept.start != cur_part_info.start ||
+	    fat_kept.max_clust != mydata->max_clust)
+		return;
+
+	mydata->free_map = fat_kept.map;
+	mydata->free_count = fat_kept.free_count;
+	mydata->next_free = fat_kept.next_free;
+	fat_kept.map = NULL;
+	fat_kept.dev = NULL;
+}
+
+/*
+ * Finish writing, keeping the free cluster map for the next write if the
+ * FAT on the device was updated successfully (ret is 0)
+ */
+static void fat_put_free_map(fsdata *mydata, int ret)
+{
+	fat_writing = false;
+	if (!CONFIG_IS_ENABLED(FS_MOUNT_CACHE) || ret || !mydata->free_map) {
+		free(mydata->free_map);
+		mydata->free_map = NULL;
+		return;
+	}
+
+	fat_invalidate_dev(NULL);
+	fat_kept.dev = cur_dev;
+	fat_kept.start = cur_part_info.start;
+	fat_kept.max_clust = mydata->max_clust;
+	fat_kept.free_count = mydata->free_count;
+	fat_kept.next_free = mydata->next_free;
+	fat_kept.map = mydata->free_map;
+	mydata->free_map = NULL;
+}
+
+/*
+ * Track a change of the FAT entry of cluster 'entry' from 'old' to 'new' in
+ * the free cluster map and counter.
+ */
+static void fat_update_free(fsdata *mydata, __u32 entry, __u32 old, __u32 new)
+{
+	if (!old == !new || entry < 2 || entry >= mydata->max_clust)
+		return;
+
+	if (mydata->free_map) {
+		if (new)
+			mydata->free_map[entry / 32] |= BIT(entry % 32);
+		else
+			mydata->free_map[entry / 32] &= ~BIT(entry % 32);
+	}
+
+	if (mydata->free_count != FAT_FREE_UNKNOWN) {
+		if (new)
+			mydata->free_count--;
+		else
+			mydata->free_count++;
+	}
+	if (new)
+		mydata->next_free = entry + 1;
+	mydata->fsinfo_dirty = 1;
+}
+
 /**
  * fat_find_empty_dentries() - find a sequence of available directory entries
  *
@@ -443,6 +655,8 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 {
 	__u32 bufnum, offset, off16;
 	__u16 val1, val2;
+	__u8 *fatbuf;
+	int win;
 
 	switch (mydata->fatsize) {
 	case 32:
@@ -462,39 +676,26 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 		return -1;
 	}
 
-	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		int getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		startblock += mydata->fat_sect;
+	/* Find or read the block of FAT entries in the cache. */
+	win = get_fatbuf(mydata, bufnum);
+	if (win < 0)
+		return -1;
+	fatbuf = FATBUF(mydata, win);
 
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return -1;
-		}
-		mydata->fatbufnum = bufnum;
-	}
+	fat_load_fsinfo(mydata);
+	fat_update_free(mydata, entry, get_fatent(mydata, entry), entry_value);
 
-	/* Mark as dirty */
-	mydata->fat_dirty = 1;
+	/* Mark as dirty, cluster chains may have changed */
+	mydata->fat_dirty |= BIT(win);
+	fat_extent_invalidate(mydata);
 
 	/* Set the actual entry */
 	switch (mydata->fatsize) {
 	case 32:
-		((__u32 *) mydata->fatbuf)[offset] = cpu_to_le32(entry_value);
+		((__u32 *)fatbuf)[offset] = cpu_to_le32(entry_value);
 		break;
 	case 16:
-		((__u16 *) mydata->fatbuf)[offset] = cpu_to_le16(entry_value);
+		((__u16 *)fatbuf)[offset] = cpu_to_le16(entry_value);
 		break;
 	case 12:
 		off16 = (offset * 3) / 4;
@@ -502,33 +703,33 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 		switch (offset & 0x3) {
 		case 0:
 			val1 = cpu_to_le16(entry_value) & 0xfff;
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xfff;
-			((__u16 *)mydata->fatbuf)[off16] |= val1;
+			((__u16 *)fatbuf)[off16] &= ~0xfff;
+			((__u16 *)fatbuf)[off16] |= val1;
 			break;
 		case 1:
 			val1 = cpu_to_le16(entry_value) & 0xf;
 			val2 = (cpu_to_le16(entry_value) >> 4) & 0xff;
 
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xf000;
-			((__u16 *)mydata->fatbuf)[off16] |= (val1 << 12);
+			((__u16 *)fatbuf)[off16] &= ~0xf000;
+			((__u16 *)fatbuf)[off16] |= (val1 << 12);
 
-			((__u16 *)mydata->fatbuf)[off16 + 1] &= ~0xff;
-			((__u16 *)mydata->fatbuf)[off16 + 1] |= val2;
+			((__u16 *)fatbuf)[off16 + 1] &= ~0xff;
+			((__u16 *)fatbuf)[off16 + 1] |= val2;
 			break;
 		case 2:
 			val1 = cpu_to_le16(entry_value) & 0xff;
 			val2 = (cpu_to_le16(entry_value) >> 8) & 0xf;
 
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xff00;
-			((__u16 *)mydata->fatbuf)[off16] |= (val1 << 8);
+			((__u16 *)fatbuf)[off16] &= ~0xff00;
+			((__u16 *)fatbuf)[off16] |= (val1 << 8);
 
-			((__u16 *)mydata->fatbuf)[off16 + 1] &= ~0xf;
-			((__u16 *)mydata->fatbuf)[off16 + 1] |= val2;
+			((__u16 *)fatbuf)[off16 + 1] &= ~0xf;
+			((__u16 *)fatbuf)[off16 + 1] |= val2;
 			break;
 		case 3:
 			val1 = cpu_to_le16(entry_value) & 0xfff;
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xfff0;
-			((__u16 *)mydata->fatbuf)[off16] |= (val1 << 4);
+			((__u16 *)fatbuf)[off16] &= ~0xfff0;
+			((__u16 *)fatbuf)[off16] |= (val1 << 4);
 			break;
 		default:
 			break;
@@ -542,23 +743,96 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 	return 0;
 }
 
+/* Number of FAT entries looked at before building the free cluster map */
+#define FAT_FREE_SCAN	1024
+
+/*
+ * Look for a free cluster by reading at most 'count' FAT entries from
+ * 'from' on, wrapping around at the end of the FAT.
+ * Return 0 if there is none.
+ */
+static __u32 fat_scan_free(fsdata *mydata, __u32 from, __u32 count)
+{
+	__u32 entry = from;
+
+	while (count--) {
+		if (!get_fatent(mydata, entry))
+			return entry;
+		if (++entry >= mydata->max_clust)
+			entry = 2;
+	}
+
+	return 0;
+}
+
+/*
+ * Look for a free cluster in the free cluster map from 'from' on, wrapping
+ * around at the end of the FAT.
+ * Return 0 if there is none.
+ */
+static __u32 fat_map_find_free(fsdata *mydata, __u32 from)
+{
+	__u32 words = DIV_ROUND_UP(mydata->max_clust, 32);
+	__u32 i = from / 32, n, val;
+
+	/* Skip the clusters before 'from' in its word, until wrapping */
+	val = mydata->free_map[i] | (BIT(from % 32) - 1);
+	for (n = 0; n <= words; n++) {
+		if (val != ~0U)
+			return i * 32 + ffs(~val) - 1;
+		if (++i == words)
+			i = 0;
+		val = mydata->free_map[i];
+	}
+
+	return 0;
+}
+
+/*
+ * Find a free cluster, preferably 'from' or the first one after it.
+ * The FAT is read directly while free clusters are found quickly, and a
+ * map of free clusters is built once they are not.
+ * Return 0 if the file system is full.
+ */
+static __u32 fat_find_free(fsdata *mydata, __u32 from)
+{
+	__u32 entry;
+
+	if (from < 2 || from >= mydata->max_clust)
+		from = 2;
+
+	if (!mydata->free_map) {
+		entry = fat_scan_free(mydata, from,
+				      min_t(__u32, FAT_FREE_SCAN,
+					    mydata->max_clust - 2));
+		if (entry)
+			return entry;
+
+		/* Without memory for the map, keep reading the FAT */
+		if (fat_init_free_map(mydata))
+			return fat_scan_free(mydata, from,
+					     mydata->max_clust - 2);
+	}
+
+	return fat_map_find_free(mydata, from);
+}
+
 /*
  * Determine the next free cluster after 'entry' in a FAT (12/16/32) table
  * and link it to 'entry'. EOC marker is not set on returned entry.
+ * Return 0 if the file system is full.
  */
 static __u32 determine_fatent(fsdata *mydata, __u32 entry)
 {
-	__u32 next_fat, next_entry = entry + 1;
+	__u32 next_entry;
+
+	next_entry = fat_find_free(mydata, entry + 1);
+	if (!next_entry)
+		return 0;
+
+	/* found free entry, link to entry */
+	set_fatent_value(mydata, entry, next_entry);
 
-	while (1) {
-		next_fat = get_fatent(mydata, next_entry);
-		if (next_fat == 0) {
-			/* found free entry, link to entry */
-			set_fatent_value(mydata, entry, next_entry);
-			break;
-		}
-		next_entry++;
-	}
 	debug("FAT%d: entry: %08x, entry_value: %04x\n",
 	       mydata->fatsize, entry, next_entry);
 
@@ -801,18 +1075,17 @@ get_set_cluster(fsdata *mydata, __u32 clustnum, loff_t pos, __u8 *buffer,
 }
 
 /*
- * Find the first empty cluster
+ * Find an empty cluster, starting from the FSInfo hint if there is one
+ * Return -ENOSPC if the file system is full.
  */
 static int find_empty_cluster(fsdata *mydata)
 {
-	__u32 fat_val, entry = 3;
+	__u32 entry;
 
-	while (1) {
-		fat_val = get_fatent(mydata, entry);
-		if (fat_val == 0)
-			break;
-		entry++;
-	}
+	fat_load_fsinfo(mydata);
+	entry = fat_find_free(mydata, mydata->next_free);
+	if (!entry)
+		return -ENOSPC;
 
 	return entry;
 }
@@ -821,7 +1094,7 @@ static int find_empty_cluster(fsdata *mydata)
  * new_dir_table() - allocate a cluster for additional directory entries
  *
  * @itr:	directory iterator
- * Return:	0 on success, -EIO otherwise
+ * Return:	0 on success, -ENOSPC if the disk is full, -EIO otherwise
  */
 static int new_dir_table(fat_itr *itr)
 {
@@ -831,6 +1104,8 @@ static int new_dir_table(fat_itr *itr)
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
 
 	dir_newclust = find_empty_cluster(mydata);
+	if (dir_newclust < 0)
+		return dir_newclust;
 
 	/*
 	 * Flush before updating FAT to ensure valid directory structure
@@ -933,8 +1208,9 @@ set_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos, __u8 *buffer,
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
 	__u32 curclust = START(dentptr);
 	__u32 endclust = 0, newclust = 0;
-	u64 cur_pos, filesize;
+	u64 cur_pos, filesize, clusters;
 	loff_t offset, actsize, wsize;
+	int ret;
 
 	*gotsize = 0;
 	filesize = pos + maxsize;
@@ -1070,16 +1346,40 @@ set_clusters:
 	/* allocate and write */
 	assert(!pos);
 
+	/*
+	 * All clusters left to write are new, fail early if they don't fit.
+	 * The free count of the FSInfo sector may be stale, so only the
+	 * count of the free cluster map is believed.
+	 */
+	fat_load_fsinfo(mydata);
+	clusters = DIV_ROUND_UP_ULL(filesize, bytesperclust);
+	if (!mydata->free_map && (mydata->free_count == FAT_FREE_UNKNOWN ||
+				  clusters > mydata->free_count))
+		fat_init_free_map(mydata);
+	if (mydata->free_map && clusters > mydata->free_count) {
+		printf("Error: no space left: %llu\n", filesize);
+		return -1;
+	}
+
 	/* Assure that curclust is valid */
 	if (!curclust) {
-		curclust = find_empty_cluster(mydata);
+		ret = find_empty_cluster(mydata);
+		if (ret < 0) {
+			printf("Error: no space left: %llu\n", filesize);
+			return -1;
+		}
+		curclust = ret;
 		set_start_cluster(mydata, dentptr, curclust);
 	} else {
 		newclust = get_fatent(mydata, curclust);
 
 		if (IS_LAST_CLUST(newclust, mydata->fatsize)) {
 			newclust = determine_fatent(mydata, curclust);
-			set_fatent_value(mydata, curclust, newclust);
+			if (!newclust) {
+				printf("Error: no space left: %llu\n",
+				       filesize);
+				return -1;
+			}
 			curclust = newclust;
 		} else {
 			debug("error: something wrong\n");
@@ -1099,6 +1399,11 @@ set_clusters:
 		/* search for consecutive clusters */
 		while (actsize < filesize) {
 			newclust = determine_fatent(mydata, endclust);
+			if (!newclust) {
+				printf("Error: no space left: %llu\n",
+				       filesize);
+				return -1;
+			}
 
 			if ((newclust - 1) != endclust)
 				/* write to <curclust..endclust> */
@@ -1391,6 +1696,7 @@ int file_fat_write_at(const char *filename, loff_t pos, void *buffer,
 		goto exit;
 
 	total_sector = datablock.total_sect;
+	fat_get_free_map(&datablock);
 
 	ret = fat_itr_resolve(itr, parent, TYPE_DIR);
 	if (ret) {
@@ -1474,6 +1780,7 @@ int file_fat_write_at(const char *filename, loff_t pos, void *buffer,
 	ret = flush_dir(itr);
 
 exit:
+	fat_put_free_map(mydata, ret);
 	free(filename_copy);
 	free(mydata->fatbuf);
 	free(itr);
@@ -1489,8 +1796,7 @@ int file_fat_write(const char *filename, void *buffer, loff_t offset,
 static int fat_dir_entries(fat_itr *itr)
 {
 	fat_itr *dirs;
-	fsdata fsdata = { .fatbuf = NULL, }, *mydata = &fsdata;
-						/* for FATBUFSIZE */
+	fsdata fsdata = { .fatbuf = NULL, };
 	int count;
 
 	dirs = malloc_cache_aligned(sizeof(fat_itr));
@@ -1504,14 +1810,11 @@ static int fat_dir_entries(fat_itr *itr)
 	fat_itr_child(dirs, itr);
 	fsdata = *dirs->fsdata;
 
-	/* allocate local fat buffer */
-	fsdata.fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (!fsdata.fatbuf) {
-		debug("Error: allocating memory\n");
+	/* allocate local fat buffers */
+	if (fat_alloc_fatbuf(&fsdata)) {
 		count = -ENOMEM;
 		goto exit;
 	}
-	fsdata.fatbufnum = -1;
 	dirs->fsdata = &fsdata;
 
 	for (count = 0; fat_itr_next(dirs); count++)
@@ -1634,6 +1937,7 @@ int fat_unlink(const char *filename)
 		goto exit;
 
 	total_sector = fsdata.total_sect;
+	fat_get_free_map(&fsdata);
 
 	ret = fat_itr_resolve(itr, dirname, TYPE_DIR);
 	if (ret) {
@@ -1665,6 +1969,7 @@ int fat_unlink(const char *filename)
 	ret = delete_dentry_long(itr);
 
 exit:
+	fat_put_free_map(&fsdata, ret);
 	free(fsdata.fatbuf);
 	free(itr);
 	free(filename_copy);
@@ -1712,6 +2017,7 @@ int fat_mkdir(const char *dirname)
 		goto exit;
 
 	total_sector = datablock.total_sect;
+	fat_get_free_map(&datablock);
 
 	ret = fat_itr_resolve(itr, parent, TYPE_DIR);
 	if (ret) {
@@ -1808,6 +2114,7 @@ int fat_mkdir(const char *dirname)
 	ret = flush_dir(itr);
 
 exit:
+	fat_put_free_map(mydata, ret);
 	free(dirname_copy);
 	free(mydata->fatbuf);
 	free(itr);
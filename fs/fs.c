@@ -418,6 +418,190 @@ const char *fs_get_type_name(void)
 	return fs_get_info(fs_type)->name;
 }
 
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+#define FS_MOUNTS	4
+
+/**
+ * struct fs_mount - a filesystem found on a block device
+ *
+ * @desc:	block device, NULL if the slot is free
+ * @part:	partition number, 0 for the whole device
+ * @start:	first block of the partition, to notice a changed table
+ * @size:	number of blocks in the partition
+ * @fstype:	filesystem type found there (FS_TYPE_...)
+ * @seq:	when the mount was last used, for replacement
+ */
+struct fs_mount {
+	struct blk_desc *desc;
+	int part;
+	lbaint_t start;
+	lbaint_t size;
+	int fstype;
+	uint seq;
+};
+
+static struct fs_mount fs_mounts[FS_MOUNTS];
+static uint fs_mount_seq;
+
+/*
+ * The filesystem drivers keep their state in globals, so only one mount can
+ * be live at a time. Its probed state is kept between commands until another
+ * mount needs the driver, or until the device is written to, which sets
+ * fs_mount_stale. The other entries only remember which driver to probe.
+ */
+static struct fs_mount *fs_mounted;
+static bool fs_mount_stale;
+
+/* Close the driver of the live mount, forgetting it if it is stale */
+static void fs_umount_live(void)
+{
+	if (!fs_mounted)
+		return;
+
+	fs_get_info(fs_mounted->fstype)->close();
+	if (fs_mount_stale)
+		fs_mounted->desc = NULL;
+	fs_mounted = NULL;
+	fs_mount_stale = false;
+}
+
+void fs_umount(void)
+{
+	int i;
+
+	fs_umount_live();
+	for (i = 0; i < FS_MOUNTS; i++)
+		fs_mounts[i].desc = NULL;
+	if (CONFIG_IS_ENABLED(FAT_WRITE))
+		fat_invalidate_dev(NULL);
+}
+
+void fs_invalidate_dev(struct blk_desc *desc)
+{
+	int i;
+
+	if (CONFIG_IS_ENABLED(FAT_WRITE))
+		fat_invalidate_dev(desc);
+	for (i = 0; i < FS_MOUNTS; i++) {
+		struct fs_mount *mnt = &fs_mounts[i];
+
+		if (mnt->desc != desc)
+			continue;
+		/* the live filesystem may be the one writing, close it later */
+		if (mnt == fs_mounted)
+			fs_mount_stale = true;
+		else
+			mnt->desc = NULL;
+	}
+}
+
+/**
+ * fs_mount_lookup() - Select a filesystem found by an earlier probe
+ *
+ * Uses fs_dev_desc and fs_partition as set up by the caller.
+ *
+ * @fstype:	filesystem type wanted, or FS_TYPE_ANY
+ * @part:	partition number
+ * Return:	0 if the filesystem is ready to use, -ENOENT if it must be
+ *		probed
+ */
+static int fs_mount_lookup(int fstype, int part)
+{
+	struct fs_mount *mnt;
+	int i;
+
+	if (!fs_dev_desc)
+		return -ENOENT;
+
+	for (i = 0, mnt = fs_mounts; i < FS_MOUNTS; i++, mnt++) {
+		if (mnt->desc == fs_dev_desc && mnt->part == part &&
+		    mnt->start == fs_partition.start &&
+		    mnt->size == fs_partition.size)
+			break;
+	}
+	if (i == FS_MOUNTS)
+		return -ENOENT;
+	if (fstype != FS_TYPE_ANY && fstype != mnt->fstype)
+		return -ENOENT;
+
+	if (mnt != fs_mounted || fs_mount_stale) {
+		fs_umount_live();
+		if (!mnt->desc ||
+		    fs_get_info(mnt->fstype)->probe(fs_dev_desc, &fs_partition)) {
+			mnt->desc = NULL;
+			return -ENOENT;
+		}
+		fs_mounted = mnt;
+	}
+	mnt->seq = ++fs_mount_seq;
+	fs_type = mnt->fstype;
+	fs_dev_part = part;
+
+	return 0;
+}
+
+/* Record the filesystem just probed as the live mount */
+static void fs_mount_add(struct fstype_info *info, int part)
+{
+	struct fs_mount *mnt, *victim = fs_mounts;
+	int i;
+
+	/* filesystems without a block device keep their own state */
+	if (!fs_dev_desc || info->null_dev_desc_ok)
+		return;
+
+	for (i = 0, mnt = fs_mounts; i < FS_MOUNTS; i++, mnt++) {
+		if (!mnt->desc) {
+			victim = mnt;
+			break;
+		}
+		if (mnt->seq < victim->seq)
+			victim = mnt;
+	}
+
+	victim->desc = fs_dev_desc;
+	victim->part = part;
+	victim->start = fs_partition.start;
+	victim->size = fs_partition.size;
+	victim->fstype = info->fstype;
+	victim->seq = ++fs_mount_seq;
+	fs_mounted = victim;
+}
+
+/* Keep the live mount open on fs_close(), unless it has gone stale */
+static bool fs_mount_keep(void)
+{
+	if (!fs_mounted || fs_type != fs_mounted->fstype)
+		return false;
+	if (fs_mount_stale) {
+		fs_mounted->desc = NULL;
+		fs_mounted = NULL;
+		fs_mount_stale = false;
+		return false;
+	}
+
+	return true;
+}
+#else
+static inline void fs_umount_live(void)
+{
+}
+
+static inline int fs_mount_lookup(int fstype, int part)
+{
+	return -ENOENT;
+}
+
+static inline void fs_mount_add(struct fstype_info *info, int part)
+{
+}
+
+static inline bool fs_mount_keep(void)
+{
+	return false;
+}
+#endif
+
 int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 {
 	struct fstype_info *info;
@@ -428,6 +612,10 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 	if (part < 0)
 		return -1;
 
+	if (!fs_mount_lookup(fstype, part))
+		return 0;
+	fs_umount_live();
+
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (fstype != FS_TYPE_ANY && info->fstype != FS_TYPE_ANY &&
 				fstype != info->fstype)
@@ -439,6 +627,7 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_add(info, part);
 			return 0;
 		}
 	}
@@ -460,10 +649,15 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 		return ret;
 	fs_dev_desc = desc;
 
+	if (!fs_mount_lookup(FS_TYPE_ANY, part))
+		return 0;
+	fs_umount_live();
+
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_add(info, part);
 			return 0;
 		}
 	}
@@ -475,7 +669,12 @@ void fs_close(void)
 {
 	struct fstype_info *info = fs_get_info(fs_type);
 
-	info->close();
+	if (!fs_mount_keep())
+		info->close();
+
+	/* write back what the filesystem left in the block cache */
+	if (fs_dev_desc)
+		blkcache_flush(fs_dev_desc->uclass_id, fs_dev_desc->devnum);
 
 	fs_type = FS_TYPE_ANY;
 }
@@ -94,113 +94,254 @@ static int sqfs_calc_n_blks(__le64 start, __le64 end, u64 *offset)
 }
 
 /*
- * Retrieves fragment block entry and returns true if the fragment block is
- * compressed
+ * Reads 'size' bytes at byte position 'pos' of the filesystem. The data starts
+ * at 'skip' bytes into the returned buffer, which the caller must free.
  */
-static int sqfs_frag_lookup(u32 inode_fragment_index,
-			    struct squashfs_fragment_block_entry *e)
+static unsigned char *sqfs_read_bytes(u64 pos, u32 size, u32 *skip)
 {
-	u64 start, end, exp_tbl, n_blks, src_len, table_offset, start_block;
-	unsigned char *metadata_buffer, *metadata, *table;
-	struct squashfs_fragment_block_entry *entries;
-	struct squashfs_super_block *sblk = ctxt.sblk;
-	unsigned long dest_len;
-	int block, offset, ret;
-	u16 header;
+	u64 start, n_blks;
+	unsigned char *buf;
 
-	metadata_buffer = NULL;
-	entries = NULL;
-	table = NULL;
+	start = lldiv(pos, ctxt.cur_dev->blksz);
+	*skip = pos - start * ctxt.cur_dev->blksz;
+	n_blks = DIV_ROUND_UP(size + *skip, ctxt.cur_dev->blksz);
 
-	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
-		return -EINVAL;
+	buf = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+	if (!buf)
+		return NULL;
+
+	if (sqfs_disk_read(start, n_blks, buf) < 0) {
+		free(buf);
+		return NULL;
+	}
 
-	start = get_unaligned_le64(&sblk->fragment_table_start);
-	end = get_unaligned_le64(&sblk->id_table_start);
-	exp_tbl = get_unaligned_le64(&sblk->export_table_start);
+	return buf;
+}
 
-	if (exp_tbl > start && exp_tbl < end)
-		end = exp_tbl;
+/*
+ * Copies 'size' bytes at byte position 'pos' of the filesystem to 'dest'. The
+ * whole device blocks in the middle are read straight into 'dest' when it is
+ * aligned for DMA, only the partial blocks at either end go through 'bounce',
+ * which must hold 'size' plus two device blocks.
+ */
+static int sqfs_read_to(u64 pos, u32 size, char *dest, unsigned char *bounce)
+{
+	u32 blksz = ctxt.cur_dev->blksz;
+	u64 start = lldiv(pos, blksz);
+	u32 skip = pos - start * blksz;
+	u32 head = skip ? min(size, blksz - skip) : 0;
+	u32 n_blks = (size - head) / blksz;
+	u32 tail = size - head - n_blks * blksz;
+
+	if (!n_blks || !IS_ALIGNED((ulong)dest + head, ARCH_DMA_MINALIGN)) {
+		if (sqfs_disk_read(start, DIV_ROUND_UP(skip + size, blksz),
+				   bounce) < 0)
+			return -EIO;
+		memcpy(dest, bounce + skip, size);
+		return 0;
+	}
 
-	n_blks = sqfs_calc_n_blks(sblk->fragment_table_start,
-				  cpu_to_le64(end), &table_offset);
+	if (head) {
+		if (sqfs_disk_read(start, 1, bounce) < 0)
+			return -EIO;
+		memcpy(dest, bounce + skip, head);
+		start++;
+	}
 
-	start /= ctxt.cur_dev->blksz;
+	if (sqfs_disk_read(start, n_blks, dest + head) < 0)
+		return -EIO;
 
-	/* Allocate a proper sized buffer to store the fragment index table */
-	table = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!table) {
-		ret = -ENOMEM;
-		goto out;
+	if (tail) {
+		if (sqfs_disk_read(start + n_blks, 1, bounce) < 0)
+			return -EIO;
+		memcpy(dest + head + n_blks * blksz, bounce, tail);
 	}
 
-	if (sqfs_disk_read(start, n_blks, table) < 0) {
-		ret = -EINVAL;
-		goto out;
+	return 0;
+}
+
+static struct squashfs_cache_entry *
+sqfs_cache_find(struct squashfs_cache_entry *cache, int count, u64 start)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (cache[i].size && cache[i].start == start) {
+			cache[i].seq = ++ctxt.cache_seq;
+			return &cache[i];
+		}
 	}
 
-	block = SQFS_FRAGMENT_INDEX(inode_fragment_index);
-	offset = SQFS_FRAGMENT_INDEX_OFFSET(inode_fragment_index);
+	return NULL;
+}
 
-	/*
-	 * Get the start offset of the metadata block that contains the right
-	 * fragment block entry
-	 */
-	start_block = get_unaligned_le64(table + table_offset + block *
-					 sizeof(u64));
+/*
+ * Reads the block of 'size' bytes at 'pos' into the least recently used entry
+ * of 'cache', decompressing it if 'comp' is set, and files it under 'start'.
+ * 'max' is the size of a decompressed block.
+ */
+static struct squashfs_cache_entry *
+sqfs_cache_load(struct squashfs_cache_entry *cache, int count, u64 start,
+		u64 pos, u32 size, bool comp, u32 max)
+{
+	struct squashfs_cache_entry *ent = cache;
+	unsigned long dest_len = max;
+	unsigned char *src;
+	u32 skip;
+	int i, ret;
 
-	start = start_block / ctxt.cur_dev->blksz;
-	n_blks = sqfs_calc_n_blks(cpu_to_le64(start_block),
-				  sblk->fragment_table_start, &table_offset);
+	if (!comp && size > max)
+		return NULL;
 
-	metadata_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!metadata_buffer) {
-		ret = -ENOMEM;
-		goto out;
+	for (i = 1; i < count; i++) {
+		if (!ent->size)
+			break;
+		if (!cache[i].size || cache[i].seq < ent->seq)
+			ent = &cache[i];
 	}
 
-	if (sqfs_disk_read(start, n_blks, metadata_buffer) < 0) {
-		ret = -EINVAL;
-		goto out;
+	if (!ent->data) {
+		ent->data = malloc(max);
+		if (!ent->data)
+			return NULL;
 	}
+	ent->size = 0;
 
-	/* Every metadata block starts with a 16-bit header */
-	header = get_unaligned_le16(metadata_buffer + table_offset);
-	metadata = metadata_buffer + table_offset + SQFS_HEADER_SIZE;
+	src = sqfs_read_bytes(pos, size, &skip);
+	if (!src)
+		return NULL;
 
-	if (!metadata || !header) {
-		ret = -ENOMEM;
-		goto out;
+	if (comp) {
+		ret = sqfs_decompress(&ctxt, ent->data, &dest_len, src + skip,
+				      size);
+	} else {
+		memcpy(ent->data, src + skip, size);
+		dest_len = size;
+		ret = 0;
 	}
+	free(src);
+	if (ret || !dest_len)
+		return NULL;
 
-	entries = malloc(SQFS_METADATA_BLOCK_SIZE);
-	if (!entries) {
-		ret = -ENOMEM;
-		goto out;
-	}
+	ent->start = start;
+	ent->size = dest_len;
+	ent->seq = ++ctxt.cache_seq;
 
-	if (SQFS_COMPRESSED_METADATA(header)) {
-		src_len = SQFS_METADATA_SIZE(header);
-		dest_len = SQFS_METADATA_BLOCK_SIZE;
-		ret = sqfs_decompress(&ctxt, entries, &dest_len, metadata,
-				      src_len);
-		if (ret) {
-			ret = -EINVAL;
-			goto out;
-		}
-	} else {
-		memcpy(entries, metadata, SQFS_METADATA_SIZE(header));
+	return ent;
+}
+
+static void sqfs_cache_free(struct squashfs_cache_entry *cache, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		free(cache[i].data);
+		cache[i].data = NULL;
+		cache[i].size = 0;
 	}
+}
 
-	*e = entries[offset];
-	ret = SQFS_COMPRESSED_BLOCK(e->size);
+/* Returns the decompressed metadata block starting at 'start' */
+static struct squashfs_cache_entry *sqfs_get_metablock(u64 start)
+{
+	struct squashfs_cache_entry *ent;
+	unsigned char *hdr;
+	u32 skip, size;
+	bool comp;
+	int ret;
 
-out:
-	free(entries);
-	free(metadata_buffer);
+	ent = sqfs_cache_find(ctxt.meta_cache, SQFS_META_CACHE_SIZE, start);
+	if (ent)
+		return ent;
+
+	hdr = sqfs_read_bytes(start, SQFS_HEADER_SIZE, &skip);
+	if (!hdr)
+		return NULL;
+	ret = sqfs_read_metablock(hdr, skip, &comp, &size);
+	free(hdr);
+	if (ret)
+		return NULL;
+
+	return sqfs_cache_load(ctxt.meta_cache, SQFS_META_CACHE_SIZE, start,
+			       start + SQFS_HEADER_SIZE, size, comp,
+			       SQFS_METADATA_BLOCK_SIZE);
+}
+
+/* Returns the decompressed fragment block described by 'e' */
+static struct squashfs_cache_entry *
+sqfs_get_fragment(struct squashfs_fragment_block_entry *e)
+{
+	struct squashfs_cache_entry *ent;
+
+	ent = sqfs_cache_find(ctxt.frag_cache, SQFS_FRAG_CACHE_SIZE, e->start);
+	if (ent)
+		return ent;
+
+	return sqfs_cache_load(ctxt.frag_cache, SQFS_FRAG_CACHE_SIZE, e->start,
+			       e->start, SQFS_BLOCK_SIZE(e->size),
+			       SQFS_COMPRESSED_BLOCK(e->size),
+			       get_unaligned_le32(&ctxt.sblk->block_size));
+}
+
+/* Loads the positions of the fragment table's metadata blocks, once */
+static int sqfs_read_frag_index(void)
+{
+	struct squashfs_super_block *sblk = ctxt.sblk;
+	unsigned char *table;
+	u32 count, skip;
+
+	if (ctxt.frag_index)
+		return 0;
+
+	count = DIV_ROUND_UP(get_unaligned_le32(&sblk->fragments),
+			     SQFS_MAX_ENTRIES);
+	table = sqfs_read_bytes(get_unaligned_le64(&sblk->fragment_table_start),
+				count * sizeof(u64), &skip);
+	if (!table)
+		return -EINVAL;
+
+	ctxt.frag_index = malloc(count * sizeof(u64));
+	if (!ctxt.frag_index) {
+		free(table);
+		return -ENOMEM;
+	}
+	memcpy(ctxt.frag_index, table + skip, count * sizeof(u64));
 	free(table);
 
-	return ret;
+	return 0;
+}
+
+/*
+ * Retrieves fragment block entry and returns true if the fragment block is
+ * compressed
+ */
+static int sqfs_frag_lookup(u32 inode_fragment_index,
+			    struct squashfs_fragment_block_entry *e)
+{
+	struct squashfs_fragment_block_entry *entries;
+	struct squashfs_super_block *sblk = ctxt.sblk;
+	struct squashfs_cache_entry *ent;
+	int block, offset, ret;
+
+	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
+		return -EINVAL;
+
+	ret = sqfs_read_frag_index();
+	if (ret)
+		return ret;
+
+	block = SQFS_FRAGMENT_INDEX(inode_fragment_index);
+	offset = SQFS_FRAGMENT_INDEX_OFFSET(inode_fragment_index);
+
+	/* Get the metadata block that contains the right fragment block entry */
+	ent = sqfs_get_metablock(get_unaligned_le64(&ctxt.frag_index[block]));
+	if (!ent || (offset + 1) * sizeof(*e) > ent->size)
+		return -EINVAL;
+
+	entries = (struct squashfs_fragment_block_entry *)ent->data;
+	*e = entries[offset];
+
+	return SQFS_COMPRESSED_BLOCK(e->size);
 }
 
 /*
@@ -878,13 +1019,56 @@ out:
 	return metablks_count;
 }
 
+static void sqfs_put_tables(struct squashfs_tables *tables)
+{
+	if (!tables || --tables->refcount)
+		return;
+
+	free(tables->inode_table);
+	free(tables->dir_table);
+	free(tables->pos_list);
+	free(tables);
+}
+
+/*
+ * Returns a reference to the decompressed inode and directory tables, which
+ * are only read the first time they are needed after mounting.
+ */
+static struct squashfs_tables *sqfs_get_tables(void)
+{
+	struct squashfs_tables *tables = ctxt.tables;
+
+	if (!tables) {
+		tables = calloc(1, sizeof(*tables));
+		if (!tables)
+			return NULL;
+		tables->refcount = 1;
+
+		if (sqfs_read_inode_table(&tables->inode_table))
+			goto err;
+
+		tables->metablks_count =
+			sqfs_read_directory_table(&tables->dir_table,
+						  &tables->pos_list);
+		if (tables->metablks_count < 1)
+			goto err;
+
+		ctxt.tables = tables;
+	}
+	tables->refcount++;
+
+	return tables;
+err:
+	sqfs_put_tables(tables);
+	return NULL;
+}
+
 int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
 {
-	unsigned char *inode_table = NULL, *dir_table = NULL;
-	int j, token_count = 0, ret = 0, metablks_count;
+	int j, token_count = 0, ret = 0;
+	struct squashfs_tables *tables;
 	struct squashfs_dir_stream *dirs;
 	char **token_list = NULL, *path = NULL;
-	u32 *pos_list = NULL;
 
 	dirs = calloc(1, sizeof(*dirs));
 	if (!dirs)
@@ -897,17 +1081,12 @@ int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
 	dirs->inode_table = NULL;
 	dirs->dir_table = NULL;
 
-	ret = sqfs_read_inode_table(&inode_table);
-	if (ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	metablks_count = sqfs_read_directory_table(&dir_table, &pos_list);
-	if (metablks_count < 1) {
+	tables = sqfs_get_tables();
+	if (!tables) {
 		ret = -EINVAL;
 		goto out;
 	}
+	dirs->tables = tables;
 
 	/* Tokenize filename */
 	token_count = sqfs_count_tokens(filename);
@@ -936,10 +1115,10 @@ int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
 	 * ldir's (extended directory) size is greater than dir, so it works as
 	 * a general solution for the malloc size, since 'i' is a union.
 	 */
-	dirs->inode_table = inode_table;
-	dirs->dir_table = dir_table;
-	ret = sqfs_search_dir(dirs, token_list, token_count, pos_list,
-			      metablks_count);
+	dirs->inode_table = tables->inode_table;
+	dirs->dir_table = tables->dir_table;
+	ret = sqfs_search_dir(dirs, token_list, token_count, tables->pos_list,
+			      tables->metablks_count);
 	if (ret)
 		goto out;
 
@@ -963,10 +1142,10 @@ out:
 	for (j = 0; j < token_count; j++)
 		free(token_list[j]);
 	free(token_list);
-	free(pos_list);
 	free(path);
 	if (ret) {
-		free(inode_table);
+		sqfs_put_tables(dirs->tables);
+		free(dirs->dir_header);
 		free(dirs);
 	}
 
@@ -1320,13 +1499,16 @@ static int sqfs_get_lregfile_info(struct squashfs_lreg_inode *lreg,
 int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	      loff_t *actread)
 {
-	char *dir = NULL, *fragment_block, *datablock = NULL;
-	char *fragment = NULL, *file = NULL, *resolved, *data;
-	u64 start, n_blks, table_size, data_offset, table_offset, sparse_size;
+	char *dir = NULL, *datablock = NULL, *file = NULL, *resolved, *data;
+	u64 start, n_blks, table_size, data_offset, table_offset;
+	u64 file_size, expected;
+	unsigned char *data_buffer = NULL;
+	u32 block_size;
 	int ret, j, i_number, datablk_count = 0;
 	struct squashfs_super_block *sblk = ctxt.sblk;
 	struct squashfs_fragment_block_entry frag_entry;
 	struct squashfs_file_info finfo = {0};
+	struct squashfs_cache_entry *frag;
 	struct squashfs_symlink_inode *symlink;
 	struct fs_dir_stream *dirsp = NULL;
 	struct squashfs_dir_stream *dirs;
@@ -1428,6 +1610,9 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		goto out;
 	}
 
+	file_size = finfo.size;
+	block_size = get_unaligned_le32(&sblk->block_size);
+
 	/* If the user specifies a length, check its sanity */
 	if (len) {
 		if (len > finfo.size) {
@@ -1442,78 +1627,91 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 
 	if (datablk_count) {
 		data_offset = finfo.start;
-		datablock = malloc(get_unaligned_le32(&sblk->block_size));
-		if (!datablock) {
+		/* Room for a whole block and the partial device blocks around it */
+		data_buffer = malloc_cache_aligned(block_size +
+						   2 * ctxt.cur_dev->blksz);
+		if (!data_buffer) {
 			ret = -ENOMEM;
 			goto out;
 		}
 	}
 
 	for (j = 0; j < datablk_count; j++) {
-		char *data_buffer;
+		char *dest = buf + *actread;
+		u64 left = len - *actread;
 
-		start = lldiv(data_offset, ctxt.cur_dev->blksz);
 		table_size = SQFS_BLOCK_SIZE(finfo.blk_sizes[j]);
-		table_offset = data_offset - (start * ctxt.cur_dev->blksz);
-		n_blks = DIV_ROUND_UP(table_size + table_offset,
-				      ctxt.cur_dev->blksz);
+		if (table_size > block_size) {
+			/*
+			 * Possible causes: too many data blocks or too large
+			 * SquashFS block size. Tip: re-compile the SquashFS
+			 * image with mksquashfs's -b <block_size> option.
+			 */
+			printf("Error: too many data blocks to be read.\n");
+			ret = -EINVAL;
+			goto out;
+		}
+		/* What the block holds once decompressed */
+		expected = min_t(u64, block_size, file_size - (u64)j * block_size);
 
-		/* Don't load any data for sparse blocks */
 		if (finfo.blk_sizes[j] == 0) {
-			n_blks = 0;
-			table_offset = 0;
-			data_buffer = NULL;
-			data = NULL;
+			/* This is a sparse block */
+			dest_len = min_t(u64, expected, left);
+			memset(dest, 0, dest_len);
+			ret = 0;
+		} else if (!SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j]) &&
+			   table_size <= left) {
+			ret = sqfs_read_to(data_offset, table_size, dest,
+					   data_buffer);
+			dest_len = table_size;
 		} else {
-			data_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-
-			if (!data_buffer) {
-				ret = -ENOMEM;
-				goto out;
-			}
-
+			start = lldiv(data_offset, ctxt.cur_dev->blksz);
+			table_offset = data_offset - (start * ctxt.cur_dev->blksz);
+			n_blks = DIV_ROUND_UP(table_size + table_offset,
+					      ctxt.cur_dev->blksz);
 			ret = sqfs_disk_read(start, n_blks, data_buffer);
+			data = data_buffer + table_offset;
+
 			if (ret < 0) {
-				/*
-				 * Possible causes: too many data blocks or too large
-				 * SquashFS block size. Tip: re-compile the SquashFS
-				 * image with mksquashfs's -b <block_size> option.
-				 */
-				printf("Error: too many data blocks to be read.\n");
-				goto out;
+				ret = -EIO;
+			} else if (!SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j])) {
+				dest_len = min_t(u64, table_size, left);
+				memcpy(dest, data, dest_len);
+				ret = 0;
+			} else if (expected <= left) {
+				/* Decompress straight into the destination */
+				dest_len = expected;
+				ret = sqfs_decompress(&ctxt, dest, &dest_len,
+						      data, table_size);
+				if (ret)
+					goto out;
+			} else {
+				/* Only part of the block is wanted */
+				if (!datablock) {
+					datablock = malloc(block_size);
+					if (!datablock) {
+						ret = -ENOMEM;
+						goto out;
+					}
+				}
+				dest_len = block_size;
+				ret = sqfs_decompress(&ctxt, datablock, &dest_len,
+						      data, table_size);
+				if (ret)
+					goto out;
+
+				dest_len = min_t(u64, dest_len, left);
+				memcpy(dest, datablock, dest_len);
 			}
-
-			data = data_buffer + table_offset;
 		}
-
-		/* Load the data */
-		if (finfo.blk_sizes[j] == 0) {
-			/* This is a sparse block */
-			sparse_size = get_unaligned_le32(&sblk->block_size);
-			if ((*actread + sparse_size) > len)
-				sparse_size = len - *actread;
-			memset(buf + *actread, 0, sparse_size);
-			*actread += sparse_size;
-		} else if (SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j])) {
-			dest_len = get_unaligned_le32(&sblk->block_size);
-			ret = sqfs_decompress(&ctxt, datablock, &dest_len,
-					      data, table_size);
-			if (ret)
-				goto out;
-
-			if ((*actread + dest_len) > len)
-				dest_len = len - *actread;
-			memcpy(buf + *actread, datablock, dest_len);
-			*actread += dest_len;
-		} else {
-			if ((*actread + table_size) > len)
-				table_size = len - *actread;
-			memcpy(buf + *actread, data, table_size);
-			*actread += table_size;
+		if (ret < 0) {
+			printf("Error: failed to read data block %d (err=%d)\n",
+			       j, ret);
+			goto out;
 		}
 
+		*actread += dest_len;
 		data_offset += table_size;
-		free(data_buffer);
 		if (*actread >= len)
 			break;
 	}
@@ -1526,53 +1724,24 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		goto out;
 	}
 
-	start = lldiv(frag_entry.start, ctxt.cur_dev->blksz);
-	table_size = SQFS_BLOCK_SIZE(frag_entry.size);
-	table_offset = frag_entry.start - (start * ctxt.cur_dev->blksz);
-	n_blks = DIV_ROUND_UP(table_size + table_offset, ctxt.cur_dev->blksz);
-
-	fragment = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-
-	if (!fragment) {
-		ret = -ENOMEM;
+	frag = sqfs_get_fragment(&frag_entry);
+	if (!frag) {
+		ret = -EINVAL;
 		goto out;
 	}
 
-	ret = sqfs_disk_read(start, n_blks, fragment);
-	if (ret < 0)
+	if (finfo.offset + finfo.size - *actread > frag->size) {
+		ret = -EINVAL;
 		goto out;
-
-	/* File compressed and fragmented */
-	if (finfo.frag && finfo.comp) {
-		dest_len = get_unaligned_le32(&sblk->block_size);
-		fragment_block = malloc(dest_len);
-		if (!fragment_block) {
-			ret = -ENOMEM;
-			goto out;
-		}
-
-		ret = sqfs_decompress(&ctxt, fragment_block, &dest_len,
-				      (void *)fragment  + table_offset,
-				      frag_entry.size);
-		if (ret) {
-			free(fragment_block);
-			goto out;
-		}
-
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
-
-		free(fragment_block);
-
-	} else if (finfo.frag && !finfo.comp) {
-		fragment_block = (void *)fragment + table_offset;
-
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
 	}
 
+	memcpy(buf + *actread, frag->data + finfo.offset,
+	       finfo.size - *actread);
+	*actread = finfo.size;
+	ret = 0;
+
 out:
-	free(fragment);
+	free(data_buffer);
 	free(datablock);
 	free(file);
 	free(dir);
@@ -1711,6 +1880,13 @@ free_strings:
 
 void sqfs_close(void)
 {
+	sqfs_put_tables(ctxt.tables);
+	ctxt.tables = NULL;
+	free(ctxt.frag_index);
+	ctxt.frag_index = NULL;
+	sqfs_cache_free(ctxt.meta_cache, SQFS_META_CACHE_SIZE);
+	sqfs_cache_free(ctxt.frag_cache, SQFS_FRAG_CACHE_SIZE);
+
 	sqfs_decompressor_cleanup(&ctxt);
 	free(ctxt.sblk);
 	ctxt.sblk = NULL;
@@ -1725,8 +1901,7 @@ void sqfs_closedir(struct fs_dir_stream *dirs)
 		return;
 
 	sqfs_dirs = (struct squashfs_dir_stream *)dirs;
-	free(sqfs_dirs->inode_table);
-	free(sqfs_dirs->dir_table);
+	sqfs_put_tables(sqfs_dirs->tables);
 	free(sqfs_dirs->dir_header);
 	free(sqfs_dirs);
 }
@@ -71,6 +71,33 @@ struct squashfs_super_block {
 	__le64 export_table_start;
 };
 
+/* Number of decompressed metadata and fragment blocks kept while mounted */
+#define SQFS_META_CACHE_SIZE 8
+#define SQFS_FRAG_CACHE_SIZE 3
+
+/*
+ * Inode and directory tables, decompressed once per mount. They are shared by
+ * the directory streams, which may outlive the mount, hence the refcount.
+ */
+struct squashfs_tables {
+	int refcount;
+	unsigned char *inode_table;
+	unsigned char *dir_table;
+	/* metadata block positions in the directory table, see sqfs_dir_offset */
+	u32 *pos_list;
+	int metablks_count;
+};
+
+/* A decompressed block, looked up by its position in the filesystem */
+struct squashfs_cache_entry {
+	u64 start;
+	/* number of valid bytes in 'data', 0 if the entry is unused */
+	u32 size;
+	/* when the entry was last used, the oldest one is replaced first */
+	uint seq;
+	unsigned char *data;
+};
+
 struct squashfs_ctxt {
 	struct disk_partition cur_part_info;
 	struct blk_desc *cur_dev;
@@ -78,6 +105,12 @@ struct squashfs_ctxt {
 #if IS_ENABLED(CONFIG_ZSTD)
 	void *zstd_workspace;
 #endif
+	struct squashfs_tables *tables;
+	/* positions of the fragment table's metadata blocks */
+	u64 *frag_index;
+	struct squashfs_cache_entry meta_cache[SQFS_META_CACHE_SIZE];
+	struct squashfs_cache_entry frag_cache[SQFS_FRAG_CACHE_SIZE];
+	uint cache_seq;
 };
 
 struct squashfs_directory_index {
@@ -272,8 +305,9 @@ struct squashfs_dir_stream {
 	struct squashfs_ldir_inode i_ldir;
 	/*
 	 * References to the tables' beginnings. They are assigned in
-	 * sqfs_opendir() and freed in sqfs_closedir().
+	 * sqfs_opendir() and released in sqfs_closedir().
 	 */
+	struct squashfs_tables *tables;
 	unsigned char *inode_table;
 	unsigned char *dir_table;
 };
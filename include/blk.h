@@ -140,20 +140,148 @@ void blkcache_fill(int iftype, int dev,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer);
 
+/**
+ * blkcache_readahead() - get the number of blocks to read ahead after a
+ * cache miss
+ *
+ * This should be called after blkcache_read() misses. If the device is
+ * being read sequentially, this provides a buffer to read the requested
+ * blocks followed by the read-ahead window. The buffer is then passed to
+ * blkcache_fill_readahead().
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number
+ * @param blkcnt - number of blocks requested
+ * @param blksz - size in bytes of each block
+ * @param lba - number of blocks in the device
+ * @param bufp - returns a buffer for @blkcnt plus the returned number of
+ * blocks
+ *
+ * Return: number of blocks to read after @blkcnt, 0 for none
+ */
+lbaint_t blkcache_readahead(int iftype, int dev,
+			    lbaint_t start, lbaint_t blkcnt,
+			    unsigned long blksz, lbaint_t lba, void **bufp);
+
+/**
+ * blkcache_fill_readahead() - add blocks read ahead to the block cache
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number
+ * @param blkcnt - number of blocks requested
+ * @param window - number of blocks read ahead after @blkcnt
+ * @param blksz - size in bytes of each block
+ * @param buffer - buffer containing @blkcnt + @window blocks
+ */
+void blkcache_fill_readahead(int iftype, int dev,
+			     lbaint_t start, lbaint_t blkcnt, lbaint_t window,
+			     unsigned long blksz, void const *buffer);
+
+/**
+ * blkcache_set_readahead() - set the maximum read-ahead window
+ *
+ * @iftype - UCLASS_ID_ for type of device, or -1 for all devices, including
+ * those not used yet
+ * @dev - device index of particular type, if @iftype is not -1
+ * @blocks - maximum number of blocks to read ahead, 0 to disable read-ahead
+ */
+void blkcache_set_readahead(int iftype, int dev, uint blocks);
+
+/**
+ * blkcache_write() - offer data to be written to a block device to the
+ * block cache
+ *
+ * In write-back mode the blocks are stored in the cache and marked dirty,
+ * to be written to the device by blkcache_flush() or when they are evicted.
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number
+ * @param blkcnt - number of blocks to write
+ * @param blksz - size in bytes of each block
+ * @param buffer - buffer containing data to write
+ *
+ * Return: - 1 if the cache took the blocks, 0 if they must be written to the
+ * device and passed to blkcache_update() afterwards.
+ */
+int blkcache_write(int iftype, int dev,
+		   lbaint_t start, lbaint_t blkcnt,
+		   unsigned long blksz, void const *buffer);
+
+/**
+ * blkcache_update() - update the block cache with data written to a block
+ * device
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number
+ * @param blkcnt - number of blocks written
+ * @param blksz - size in bytes of each block
+ * @param buffer - buffer containing data written
+ */
+void blkcache_update(int iftype, int dev,
+		     lbaint_t start, lbaint_t blkcnt,
+		     unsigned long blksz, void const *buffer);
+
+/**
+ * blkcache_flush() - write dirty blocks in the cache to the device
+ *
+ * @iftype - UCLASS_ID_ for type of device, or -1 for any
+ * @dev - device index of particular type, if @iftype is not -1
+ * Return: 0 if OK, -EIO if some blocks could not be written back; these
+ * are dropped from the cache
+ */
+int blkcache_flush(int iftype, int dev);
+
 /**
  * blkcache_invalidate() - discard the cache for a set of blocks
  * because of a write or device (re)initialization.
  *
+ * Dirty blocks are discarded too, use blkcache_flush() first to keep them.
+ *
  * @iftype - UCLASS_ID_ for type of device, or -1 for any
  * @dev - device index of particular type, if @iftype is not -1
  */
 void blkcache_invalidate(int iftype, int dev);
 
+/**
+ * enum blkcache_mode - how the block cache handles writes
+ *
+ * @BLKCACHE_WRITETHROUGH: write to the device, then update cached blocks
+ * @BLKCACHE_WRITEBACK: keep small writes in the cache until flushed
+ */
+enum blkcache_mode {
+	BLKCACHE_WRITETHROUGH,
+	BLKCACHE_WRITEBACK,
+};
+
+/**
+ * blkcache_set_mode() - select how the block cache handles writes
+ *
+ * Switching to write-through flushes all dirty blocks.
+ *
+ * @param mode - new mode
+ * Return: 0 if OK, -EIO if dirty blocks could not be written back
+ */
+int blkcache_set_mode(enum blkcache_mode mode);
+
+/**
+ * blkcache_get_mode() - get how the block cache handles writes
+ *
+ * Return: current mode
+ */
+enum blkcache_mode blkcache_get_mode(void);
+
 /**
  * blkcache_configure() - configure block cache
  *
- * @param blocks - maximum blocks per entry
- * @param entries - maximum entries in cache
+ * The cache holds @blocks * @entries blocks. Reads of more than @blocks
+ * blocks bypass the cache.
+ *
+ * @param blocks - maximum blocks per request
+ * @param entries - number of @blocks sized entries in cache
  */
 void blkcache_configure(unsigned blocks, unsigned entries);
 
@@ -163,18 +291,52 @@ void blkcache_configure(unsigned blocks, unsigned entries);
 struct block_cache_stats {
 	unsigned hits;
 	unsigned misses;
-	unsigned entries; /* current entry count */
+	unsigned evictions;
+	unsigned writebacks; /* device writes of dirty blocks */
+	unsigned ra_reads; /* device reads with read-ahead */
+	unsigned ra_used; /* blocks read ahead and then read */
+	unsigned ra_wasted; /* blocks read ahead and dropped unread */
+	unsigned entries; /* current count of cached blocks */
+	unsigned dirty; /* current count of dirty blocks */
 	unsigned max_blocks_per_entry;
 	unsigned max_entries;
 };
 
+/*
+ * per-device statistics of the block cache
+ */
+struct block_cache_dev_stats {
+	int iftype;
+	int devnum;
+	unsigned hits;
+	unsigned misses;
+	unsigned evictions;
+	unsigned dirty; /* current count of dirty blocks */
+	unsigned ra_max; /* maximum read-ahead window in blocks */
+	unsigned ra_window; /* current read-ahead window in blocks */
+	unsigned ra_reads;
+	unsigned ra_used;
+	unsigned ra_wasted;
+};
+
 /**
  * get_blkcache_stats() - return statistics and reset
  *
+ * This resets the per-device statistics too.
+ *
  * @param stats - statistics are copied here
  */
 void blkcache_stats(struct block_cache_stats *stats);
 
+/**
+ * blkcache_dev_stats() - return statistics of a device using the cache
+ *
+ * @param idx - index of device, starting at 0
+ * @param stats - statistics are copied here
+ * Return: 0 if OK, -ENOENT if @idx is past the last device
+ */
+int blkcache_dev_stats(int idx, struct block_cache_dev_stats *stats);
+
 /** blkcache_free() - free all memory allocated to the block cache */
 void blkcache_free(void);
 
@@ -191,6 +353,35 @@ static inline void blkcache_fill(int iftype, int dev,
 				 lbaint_t start, lbaint_t blkcnt,
 				 unsigned long blksz, void const *buffer) {}
 
+static inline lbaint_t blkcache_readahead(int iftype, int dev,
+					  lbaint_t start, lbaint_t blkcnt,
+					  unsigned long blksz, lbaint_t lba,
+					  void **bufp)
+{
+	return 0;
+}
+
+static inline void blkcache_fill_readahead(int iftype, int dev,
+					   lbaint_t start, lbaint_t blkcnt,
+					   lbaint_t window, unsigned long blksz,
+					   void const *buffer) {}
+
+static inline int blkcache_write(int iftype, int dev,
+				 lbaint_t start, lbaint_t blkcnt,
+				 unsigned long blksz, void const *buffer)
+{
+	return 0;
+}
+
+static inline void blkcache_update(int iftype, int dev,
+				   lbaint_t start, lbaint_t blkcnt,
+				   unsigned long blksz, void const *buffer) {}
+
+static inline int blkcache_flush(int iftype, int dev)
+{
+	return 0;
+}
+
 static inline void blkcache_invalidate(int iftype, int dev) {}
 
 static inline void blkcache_free(void) {}
@@ -201,6 +392,54 @@ static inline void blkcache_free(void) {}
 struct udevice;
 
 /* Operations on block devices */
+/**
+ * enum blk_req_op - operation performed by an asynchronous block request
+ *
+ * @BLK_REQ_READ: Read blocks from the device
+ * @BLK_REQ_WRITE: Write blocks to the device
+ */
+enum blk_req_op {
+	BLK_REQ_READ,
+	BLK_REQ_WRITE,
+};
+
+/**
+ * struct blk_sg - segment of memory for a block request
+ *
+ * @buf: Start of the segment
+ * @blkcnt: Number of blocks in the segment
+ */
+struct blk_sg {
+	void *buf;
+	lbaint_t blkcnt;
+};
+
+/**
+ * struct blk_req - asynchronous block request
+ *
+ * The blocks starting at @start are transferred to or from the segments in
+ * @sg, in order. The caller must not touch the request or its memory until
+ * @done is set.
+ *
+ * @op: Operation to perform
+ * @start: First block to transfer
+ * @sg: Segments of memory to transfer to or from
+ * @nr_sg: Number of segments in @sg
+ * @done: Set when the request has completed
+ * @result: Number of blocks transferred, or -ve error number; valid once
+ *	@done is set
+ * @priv: Available to the driver while the request is in flight
+ */
+struct blk_req {
+	enum blk_req_op op;
+	lbaint_t start;
+	struct blk_sg *sg;
+	int nr_sg;
+	bool done;
+	long result;
+	void *priv;
+};
+
 struct blk_ops {
 	/**
 	 * read() - read from a block device
@@ -259,6 +498,47 @@ struct blk_ops {
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
 
+	/**
+	 * submit() - queue requests without waiting for them to complete
+	 *
+	 * This is optional. Devices which can have several commands in flight
+	 * implement it together with poll(); for other devices the uclass
+	 * carries out requests synchronously with read() and write().
+	 *
+	 * The driver may take fewer requests than offered, e.g. when its queue
+	 * is full. The rest can be offered again once poll() has completed
+	 * some. Requests complete by having their result and done fields set.
+	 *
+	 * @dev:	Device to submit to
+	 * @reqs:	Requests to submit
+	 * @count:	Number of requests in @reqs
+	 * @return number of requests taken (0 if the queue is full), or -ve
+	 * error number
+	 */
+	int (*submit)(struct udevice *dev, struct blk_req **reqs, int count);
+
+	/**
+	 * poll() - complete requests which the device has finished
+	 *
+	 * This must not wait for requests still in progress.
+	 *
+	 * @dev:	Device to check
+	 * @return number of requests still in flight, or -ve error number
+	 */
+	int (*poll)(struct udevice *dev);
+
+	/**
+	 * cancel() - give up on the requests still in flight
+	 *
+	 * This is optional, for devices which implement submit(). Each
+	 * request in flight is completed with -ECANCELED and the driver
+	 * must not touch it or its memory again; a late completion from the
+	 * device is ignored.
+	 *
+	 * @dev:	Device whose requests to cancel
+	 */
+	void (*cancel)(struct udevice *dev);
+
 #if IS_ENABLED(CONFIG_BOUNCE_BUFFER)
 	/**
 	 * buffer_aligned() - test memory alignment of block operation buffer
@@ -317,6 +597,29 @@ long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 	       const void *buffer);
 
+/**
+ * blk_write_uncached() - Write to a block device, bypassing the block cache
+ *
+ * This is used by the block cache to write back dirty blocks.
+ *
+ * @dev: Device to write to
+ * @start: Start block for the write
+ * @blkcnt: Number of blocks to write
+ * @buf: Data to write
+ * @return number of blocks written (which may be less than @blkcnt),
+ * or -ve on error. This never returns 0 unless @blkcnt is 0
+ */
+long blk_write_uncached(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			const void *buffer);
+
+/**
+ * blk_flush() - Write back data held in the block cache for a device
+ *
+ * @dev: Device to flush
+ * Return: 0 if OK, -EIO if some blocks could not be written
+ */
+int blk_flush(struct udevice *dev);
+
 /**
  * blk_erase() - Erase part of a block device
  *
@@ -328,6 +631,58 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
  */
 long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt);
 
+/**
+ * blk_submit() - Start asynchronous block requests
+ *
+ * Requests are queued on devices which support it. Otherwise, and for
+ * devices which need a bounce buffer, they are carried out straight away.
+ * Reads write back any dirty blocks of the device held in the block cache
+ * first, so they see the latest data, and bypass the block cache. Writes
+ * also drop the device's blocks from the block cache.
+ *
+ * @dev: Device to submit to
+ * @reqs: Requests to submit
+ * @count: Number of requests in @reqs
+ * Return: number of requests taken, which may be fewer than @count when the
+ * device queue is full, or -ve on error
+ */
+int blk_submit(struct udevice *dev, struct blk_req **reqs, int count);
+
+/**
+ * blk_poll() - Complete finished asynchronous block requests
+ *
+ * @dev: Device to check
+ * Return: number of requests still in flight, or -ve on error
+ */
+int blk_poll(struct udevice *dev);
+
+/**
+ * blk_cancel() - Give up on asynchronous block requests still in flight
+ *
+ * Each request in flight is completed with -ECANCELED, after which its memory
+ * may be reused. Devices without a cancel() operation are polled until their
+ * requests complete instead, for up to the request timeout.
+ *
+ * @dev: Device whose requests to cancel
+ */
+void blk_cancel(struct udevice *dev);
+
+/**
+ * blk_submit_all() - Carry out asynchronous block requests and wait for them
+ *
+ * This keeps the device queue as full as possible until all requests have
+ * completed. If it fails, it first waits for the requests in flight to
+ * complete, or cancels them, so that none are left using their memory.
+ *
+ * @dev: Device to submit to
+ * @reqs: Requests to submit
+ * @count: Number of requests in @reqs
+ * Return: 0 if all requests transferred all their blocks, -EIO if some did
+ * not, -ETIMEDOUT if the device stopped completing requests, or other -ve
+ * on error
+ */
+int blk_submit_all(struct udevice *dev, struct blk_req **reqs, int count);
+
 /**
  * blk_find_device() - Find a block device
  *
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Running work on secondary CPU cores
+ */
+
+#ifndef __CPU_WORKER_H
+#define __CPU_WORKER_H
+
+#include <linux/types.h>
+
+/**
+ * struct cpu_worker_job - A piece of work which may run on any core
+ *
+ * @func: Function to run, passed @arg and the number of the core running it:
+ *	0 for the core which called cpu_worker_run(), 1 to cpu_worker_count()
+ *	for the workers. Jobs run alongside each other, so this must not use
+ *	anything with global state, such as malloc(), the console or driver
+ *	model. Returns 0 if OK, -ve on error
+ * @arg: Argument for @func
+ * @ret: Value returned by @func, set once the job has run
+ */
+struct cpu_worker_job {
+	int (*func)(void *arg, int core);
+	void *arg;
+	int ret;
+};
+
+#if CONFIG_IS_ENABLED(CPU_WORKER)
+/**
+ * cpu_worker_count() - Get the number of secondary cores available for work
+ *
+ * The workers are started the first time this is called.
+ *
+ * Return: number of workers, 0 if there are none
+ */
+int cpu_worker_count(void);
+
+/**
+ * cpu_worker_run() - Run jobs on this core and all the workers
+ *
+ * Jobs are taken in order by whichever core is free, the calling core
+ * included, and this returns once they have all finished. Without any
+ * workers, or when called from a job, the jobs simply run one after the other
+ * on the calling core.
+ *
+ * @jobs: Jobs to run
+ * @count: Number of jobs
+ * Return: 0 if all the jobs succeeded, else the error from the first one
+ *	which failed
+ */
+int cpu_worker_run(struct cpu_worker_job *jobs, int count);
+
+/**
+ * cpu_worker_main() - Wait for and run jobs, on a worker
+ *
+ * This is called by the architecture on each started worker and never
+ * returns.
+ *
+ * @worker: Worker number, from 1
+ */
+void cpu_worker_main(int worker);
+
+/**
+ * arch_cpu_worker_count() - Get the number of secondary cores U-Boot may use
+ *
+ * Return: number of cores, 0 if none (the default)
+ */
+int arch_cpu_worker_count(void);
+
+/**
+ * arch_cpu_worker_start() - Start a worker
+ *
+ * This must arrange for cpu_worker_main() to be called on the worker's core,
+ * with a stack of its own.
+ *
+ * @worker: Worker number, from 1 to arch_cpu_worker_count()
+ * Return: 0 if OK, -ve on error
+ */
+int arch_cpu_worker_start(int worker);
+
+/**
+ * arch_cpu_worker_wait() - Wait while a worker is idle
+ *
+ * This may return early. By default it returns at once, so idle workers spin.
+ *
+ * @addr: Address being polled
+ * @val: Value at @addr while there is nothing to do
+ */
+void arch_cpu_worker_wait(const u32 *addr, u32 val);
+
+/**
+ * arch_cpu_worker_wake() - Wake workers waiting in arch_cpu_worker_wait()
+ *
+ * @addr: Address which has changed
+ */
+void arch_cpu_worker_wake(const u32 *addr);
+#else
+static inline int cpu_worker_count(void)
+{
+	return 0;
+}
+
+static inline int cpu_worker_run(struct cpu_worker_job *jobs, int count)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < count; i++) {
+		jobs[i].ret = jobs[i].func(jobs[i].arg, 0);
+		if (jobs[i].ret && !ret)
+			ret = jobs[i].ret;
+	}
+
+	return ret;
+}
+#endif
+
+#endif
@@ -30,6 +30,18 @@ struct disk_partition;
 #define FAT12BUFSIZE	((FATBUFSIZE*2)/3)
 #define FAT16BUFSIZE	(FATBUFSIZE/2)
 #define FAT32BUFSIZE	(FATBUFSIZE/4)
+#define FATBUFWINDOWS	8	/* Number of FAT buffers kept at once */
+#define FATBUF(mydata, win) \
+	((mydata)->fatbuf + (win) * (mydata)->sect_size * FATBUFBLOCKS)
+
+/* Number of runs of cluster chains remembered */
+#define FAT_EXTENTS	16
+
+/* FAT32 FSInfo sector signatures, and value of unknown free_count/next_free */
+#define FAT_FSINFO_LEAD_SIG	0x41615252
+#define FAT_FSINFO_STRUCT_SIG	0x61417272
+#define FAT_FSINFO_TRAIL_SIG	0xaa550000
+#define FAT_FREE_UNKNOWN	0xffffffff
 
 /* Maximum number of entry for long file name according to spec */
 #define MAX_LFN_SLOT	20
@@ -122,6 +134,17 @@ typedef struct volume_info
 	/* Boot sign comes last, 2 bytes */
 } volume_info;
 
+/* FAT32 file system information sector */
+struct fat_fsinfo {
+	__u32	lead_sig;	/* FAT_FSINFO_LEAD_SIG */
+	__u8	reserved1[480];
+	__u32	struct_sig;	/* FAT_FSINFO_STRUCT_SIG */
+	__u32	free_count;	/* Number of free clusters, or FAT_FREE_UNKNOWN */
+	__u32	next_free;	/* Where to look for a free cluster first */
+	__u8	reserved2[12];
+	__u32	trail_sig;	/* FAT_FSINFO_TRAIL_SIG */
+};
+
 /* see dir_entry::lcase: */
 #define CASE_LOWER_BASE	8	/* base (name) is lower case */
 #define CASE_LOWER_EXT	16	/* extension is lower case */
@@ -155,6 +178,16 @@ typedef struct dir_slot {
 	__u8	name11_12[4];	/* Last 2 characters in name */
 } dir_slot;
 
+/*
+ * Run of contiguous clusters in a cluster chain
+ */
+struct fat_extent {
+	__u32	start;		/* First cluster of the chain */
+	__u32	index;		/* Position of the run in the chain */
+	__u32	clust;		/* First cluster of the run */
+	__u32	len;		/* Number of clusters in the run, 0 if unused */
+};
+
 /*
  * Private filesystem parameters
  *
@@ -162,20 +195,31 @@ typedef struct dir_slot {
  * (see FAT32 accesses)
  */
 typedef struct {
-	__u8	*fatbuf;	/* Current FAT buffer */
+	__u8	*fatbuf;	/* FATBUFWINDOWS FAT buffers */
 	int	fatsize;	/* Size of FAT in bits */
 	__u32	fatlength;	/* Length of FAT in sectors */
 	__u16	fat_sect;	/* Starting sector of the FAT */
-	__u8	fat_dirty;      /* Set if fatbuf has been modified */
+	__u32	fat_dirty;	/* Bit set for each modified FAT buffer */
 	__u32	rootdir_sect;	/* Start sector of root directory */
 	__u16	sect_size;	/* Size of sectors in bytes */
 	__u16	clust_size;	/* Size of clusters in sectors */
 	int	data_begin;	/* The sector of the first cluster, can be negative */
-	int	fatbufnum;	/* Used by get_fatent, init to -1 */
+	int	fatbufnum[FATBUFWINDOWS];	/* FAT block in each buffer, or -1 */
+	__u32	fatbufused[FATBUFWINDOWS];	/* When each buffer was last used */
+	__u32	fatbufclock;	/* Incremented on each FAT buffer use */
+	struct fat_extent extents[FAT_EXTENTS];	/* Known cluster runs */
+	int	extent_next;	/* Number of runs added since invalidation */
 	int	rootdir_size;	/* Size of root dir for non-FAT32 */
 	__u32	root_cluster;	/* First cluster of root dir for FAT32 */
 	u32	total_sect;	/* Number of sectors */
 	int	fats;		/* Number of FATs */
+	__u16	fsinfo_sect;	/* FSInfo sector of FAT32, 0 if none */
+	__u8	fsinfo_loaded;	/* Set once the FSInfo sector has been read */
+	__u8	fsinfo_dirty;	/* Set if free_count or next_free changed */
+	__u32	max_clust;	/* Number of FAT entries, including the first two */
+	__u32	free_count;	/* Number of free clusters, or FAT_FREE_UNKNOWN */
+	__u32	next_free;	/* Where to look for a free cluster first */
+	__u32	*free_map;	/* Bit set for each cluster in use, or NULL */
 } fsdata;
 
 struct fat_itr;
@@ -210,6 +254,17 @@ int fat_mkdir(const char *dirname);
 void fat_close(void);
 void *fat_next_cluster(fat_itr *itr, unsigned int *nbytes);
 
+/**
+ * fat_invalidate_dev() - Forget the free clusters of a block device
+ *
+ * The map of free clusters built by a write is kept for the next write to
+ * the same filesystem. Writes which do not come from the FAT driver, and
+ * changes of media, must drop it.
+ *
+ * @desc:	block device which changed, NULL for all
+ */
+void fat_invalidate_dev(struct blk_desc *desc);
+
 /**
  * fat_uuid() - get FAT volume ID
  *
@@ -90,6 +90,42 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part);
  */
 void fs_close(void);
 
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+/**
+ * fs_umount() - Forget all filesystems kept mounted between commands
+ *
+ * With FS_MOUNT_CACHE, fs_close() leaves the filesystem probed by
+ * fs_set_blk_dev() or fs_set_blk_dev_with_part() mounted, so that the next
+ * command on the same partition does not have to probe it and read its
+ * superblock again. This closes it and drops the table of known mounts.
+ *
+ * It must be called before using a filesystem driver directly, rather than
+ * through the fs layer, since the drivers keep their state in globals.
+ */
+void fs_umount(void);
+
+/**
+ * fs_invalidate_dev() - Drop the mounts of a block device
+ *
+ * Called by the block layer when a device is written to or removed, and
+ * when its medium may have changed, e.g. an MMC card is initialised again or
+ * another hardware partition is selected. A filesystem that is currently
+ * mounted from it is closed by the next fs_close() or fs_set_blk_dev() and
+ * probed again on the next use.
+ *
+ * @desc: Block device
+ */
+void fs_invalidate_dev(struct blk_desc *desc);
+#else
+static inline void fs_umount(void)
+{
+}
+
+static inline void fs_invalidate_dev(struct blk_desc *desc)
+{
+}
+#endif
+
 /**
  * fs_get_type() - Get type of current filesystem
  *
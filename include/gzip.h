@@ -45,6 +45,42 @@ int gunzip(void *dst, int dstlen, unsigned char *src, unsigned long *lenp);
 int zunzip(void *dst, int dstlen, unsigned char *src, unsigned long *lenp,
 	   int stoponerr, int offset);
 
+struct gunzip_stream;
+
+/**
+ * gunzip_stream_start() - Start decompressing gzipped data piece by piece
+ *
+ * @dst: Destination for uncompressed data
+ * @dstlen: Size of destination buffer
+ * Return: stream state to pass to gunzip_stream_feed(), or NULL if out of
+ *	memory
+ */
+struct gunzip_stream *gunzip_stream_start(void *dst, ulong dstlen);
+
+/**
+ * gunzip_stream_feed() - Decompress the next piece of gzipped data
+ *
+ * The pieces may be split anywhere, the header and trailer included. The
+ * CRC and length in the trailer are checked once the end is reached.
+ *
+ * @gs: Stream state from gunzip_stream_start()
+ * @src: Next piece of compressed data
+ * @len: Length of @src
+ * @lenp: Returns the number of bytes uncompressed so far
+ * Return: 1 at the end of the compressed data, 0 if more is needed,
+ *	-ENOSPC if the destination buffer is full, -EINVAL if the data is
+ *	corrupted
+ */
+int gunzip_stream_feed(struct gunzip_stream *gs, const void *src, ulong len,
+		       ulong *lenp);
+
+/**
+ * gunzip_stream_end() - Free the state of a gunzip stream
+ *
+ * @gs: Stream state from gunzip_stream_start()
+ */
+void gunzip_stream_end(struct gunzip_stream *gs);
+
 /**
  * gzwrite progress indicators: defined weak to allow board-specific
  * overrides:
@@ -1021,6 +1021,66 @@ int image_decomp(int comp, ulong load, ulong image_start, int type,
 		 void *load_buf, void *image_buf, ulong image_len,
 		 uint unc_len, ulong *load_end);
 
+/**
+ * struct image_decomp_stream - an image being decompressed piece by piece
+ *
+ * @comp:	Compression algorithm that is used (IH_COMP_...)
+ * @load_buf:	Place to decompress to
+ * @unc_len:	Available space for decompression
+ * @len:	Number of bytes decompressed so far
+ * @done:	true once the end of the compressed data has been seen
+ * @priv:	State of the decompressor
+ */
+struct image_decomp_stream {
+	int comp;
+	void *load_buf;
+	ulong unc_len;
+	ulong len;
+	bool done;
+	void *priv;
+};
+
+/**
+ * image_decomp_stream_start() - start decompressing an image piece by piece
+ *
+ * This allows decompressing an image while it is still being read, instead
+ * of reading all of it to a temporary place first. Only gzip, lzma, lz4 and
+ * zstd are supported, besides no compression at all.
+ *
+ * @ds:		Stream to set up
+ * @comp:	Compression algorithm that is used (IH_COMP_...)
+ * @load_buf:	Place to decompress to
+ * @unc_len:	Available space for decompression
+ * Return: 0 if OK, -ENOSYS if @comp cannot be streamed, -ENOMEM if out of
+ *	memory
+ */
+int image_decomp_stream_start(struct image_decomp_stream *ds, int comp,
+			      void *load_buf, ulong unc_len);
+
+/**
+ * image_decomp_stream_feed() - decompress the next piece of an image
+ *
+ * Anything fed after the end of the compressed data is ignored.
+ *
+ * @ds:		Stream from image_decomp_stream_start()
+ * @buf:	Next piece of the compressed image
+ * @len:	Length of @buf
+ * Return: 0 if OK, -ENOSPC if the space for decompression is used up,
+ *	-ENOMEM if out of memory, other -ve value if the data is corrupted
+ */
+int image_decomp_stream_feed(struct image_decomp_stream *ds, const void *buf,
+			     ulong len);
+
+/**
+ * image_decomp_stream_end() - finish decompressing an image piece by piece
+ *
+ * This frees the decompressor, it must be called even after an error.
+ *
+ * @ds:		Stream from image_decomp_stream_start()
+ * Return: 0 if all of the image was decompressed, -EINVAL if it ended early
+ */
+int image_decomp_stream_end(struct image_decomp_stream *ds);
+
 /**
  * Set up properties in the FDT
  *
@@ -1338,6 +1398,93 @@ int fit_image_verify_with_data(const void *fit, int image_noffset,
 			       const void *key_blob, const void *data,
 			       size_t size);
 
+/* Most hash nodes an image can have for its hashes to be streamed */
+#define FIT_HASH_STREAM_MAX	4
+
+/**
+ * struct fit_hash_stream_node - A hash node of an image being streamed
+ *
+ * @noffset:	Offset in the FIT of the hash node
+ * @algo:	Algorithm to use, or NULL if this hash is ignored
+ * @ctx:	Context for @algo, or NULL if not in use
+ */
+struct fit_hash_stream_node {
+	int noffset;
+	struct hash_algo *algo;
+	void *ctx;
+};
+
+/**
+ * struct fit_hash_stream - Hashes of an image, worked out as it is loaded
+ *
+ * This allows an image to be hashed piece by piece while it is read from
+ * storage, so it does not have to be read again afterwards to check it.
+ *
+ * @fit:	FIT containing the image
+ * @image_noffset: Offset in @fit of the image node
+ * @remaining:	Number of bytes still to be hashed
+ * @count:	Number of entries in @hash
+ * @err:	true if hashing failed
+ * @hash:	Hash nodes of the image
+ */
+struct fit_hash_stream {
+	const void *fit;
+	int image_noffset;
+	size_t remaining;
+	int count;
+	bool err;
+	struct fit_hash_stream_node hash[FIT_HASH_STREAM_MAX];
+};
+
+/**
+ * fit_image_hash_stream_start() - Start hashing an image in pieces
+ *
+ * This fails if the image cannot be verified this way, e.g. because it has
+ * signatures, which need the whole of the data at once. The caller should
+ * then use fit_image_verify_with_data() instead.
+ *
+ * @hs:		Hash stream to set up
+ * @fit:	Pointer to the FIT format image header
+ * @image_noffset: Offset in @fit of image to verify
+ * @key_blob:	FDT containing public keys
+ * @size:	Size of image data which will be passed in
+ * Return: 0 if OK, -EOPNOTSUPP if the image must be verified all at once,
+ *	-ENOMEM if out of memory
+ */
+int fit_image_hash_stream_start(struct fit_hash_stream *hs, const void *fit,
+				int image_noffset, const void *key_blob,
+				size_t size);
+
+/**
+ * fit_image_hash_stream_update() - Hash the next piece of an image
+ *
+ * @hs:		Hash stream
+ * @data:	Next piece of image data
+ * @len:	Length of @data
+ */
+void fit_image_hash_stream_update(struct fit_hash_stream *hs, const void *data,
+				  size_t len);
+
+/**
+ * fit_image_hash_stream_verify() - Finish hashing an image and check it
+ *
+ * This shows the same output as fit_image_verify_with_data() and frees
+ * the hash contexts.
+ *
+ * @hs:		Hash stream, with all of the image data passed in
+ * Return: 1 if all hashes are valid, 0 otherwise
+ */
+int fit_image_hash_stream_verify(struct fit_hash_stream *hs);
+
+/**
+ * fit_image_hash_stream_abort() - Stop hashing an image
+ *
+ * This frees the hash contexts, without checking anything.
+ *
+ * @hs:		Hash stream
+ */
+void fit_image_hash_stream_abort(struct fit_hash_stream *hs);
+
 int fit_image_verify(const void *fit, int noffset);
 #if CONFIG_IS_ENABLED(FIT_SIGNATURE)
 int fit_config_verify(const void *fit, int conf_noffset);
@@ -455,4 +455,35 @@ struct abuf;
  */
 int zstd_decompress(struct abuf *in, struct abuf *out);
 
+struct zstd_stream;
+
+/**
+ * zstd_stream_start() - Start decompressing Zstandard data piece by piece
+ *
+ * @dst: Output buffer to hold the results (must be large enough)
+ * @dst_size: Size of @dst
+ * Return: stream state to pass to zstd_stream_feed(), or NULL on error
+ */
+struct zstd_stream *zstd_stream_start(void *dst, size_t dst_size);
+
+/**
+ * zstd_stream_feed() - Decompress the next piece of Zstandard data
+ *
+ * @zs: Stream state from zstd_stream_start()
+ * @src: Next piece of compressed data
+ * @src_size: Length of @src
+ * @dst_sizep: Returns the size of the data decompressed so far
+ * Return: 1 at the end of the frame, 0 if more data is needed, -ENOSPC if
+ *	@dst is full, -EINVAL if the data is corrupted
+ */
+int zstd_stream_feed(struct zstd_stream *zs, const void *src, size_t src_size,
+		     size_t *dst_sizep);
+
+/**
+ * zstd_stream_end() - Free the state of a Zstandard stream
+ *
+ * @zs: Stream state from zstd_stream_start()
+ */
+void zstd_stream_end(struct zstd_stream *zs);
+
 #endif  /* LINUX_ZSTD_H */
@@ -5,6 +5,8 @@
  * Copyright 2017 Duncan Hare, All rights reserved.
  */
 
+#include <linux/log2.h>
+
 #define TCP_ACTIVITY 127		/* Number of packets received   */
 					/* before console progress mark */
 /**
@@ -68,8 +70,8 @@ struct ip_tcp_hdr {
  * TCP header options, Seq, MSS, and SACK
  */
 
-#define TCP_SACK 32			/* Number of packets analyzed   */
-					/* on leading edge of stream    */
+#define TCP_SACK 32			/* Number of out-of-order data  */
+					/* ranges remembered            */
 
 #define TCP_O_END	0x00		/* End of option list		*/
 #define TCP_1_NOP	0x01		/* Single padding NOP		*/
@@ -86,7 +88,19 @@ struct ip_tcp_hdr {
 #define TCP_OPT_LEN_8	0x08
 #define TCP_OPT_LEN_A	0x0a		/* Timestamp Length		*/
 #define TCP_MSS		1460		/* Max segment size		*/
-#define TCP_SCALE	0x01		/* Scale			*/
+
+/* Largest receive window, and the shift needed to advertise it */
+#if CONFIG_PROT_TCP_RCV_WND
+#define TCP_RCV_WND	CONFIG_PROT_TCP_RCV_WND
+#else
+#define TCP_RCV_WND	(PKTBUFSRX * TCP_MSS)
+#endif
+#define TCP_SCALE	(TCP_RCV_WND > 0xffff ? ilog2(TCP_RCV_WND >> 16) + 1 : 0)
+
+#define TCP_DELACK_SEGS		2	/* ACK at least every N segments */
+#define TCP_DELACK_TIMEOUT	10UL	/* ms before a delayed ACK is sent */
+
+#define TCP_STREAMS	CONFIG_PROT_TCP_STREAMS	/* Connections open at once */
 
 /**
  * struct tcp_mss - TCP option structure for MSS (Max segment size)
@@ -140,9 +154,13 @@ struct sack_edges {
  * A hill is the inverse of a hole, and is data received.
  * TCP received hills (a sequence of data), and inferrs Holes
  * from the "hills" or packets received.
+ *
+ * Up to TCP_SACK hills are remembered, but only three fit in the 40 bytes
+ * of TCP options alongside the timestamp, so each ACK reports the most
+ * recently changed ones (RFC 2018).
  */
 
-#define TCP_SACK_HILLS	4
+#define TCP_SACK_HILLS	3
 
 /**
  * struct tcp_sack_v - TCP option structure for SACK
@@ -277,8 +295,12 @@ enum tcp_state {
 	TCP_FIN_WAIT_2
 };
 
+void tcp_select_stream(u16 rport, u16 lport);
 enum tcp_state tcp_get_tcp_state(void);
 void tcp_set_tcp_state(enum tcp_state new_state);
+void tcp_set_rcv_buf(ulong size);
+u32 tcp_get_ack_edge(void);
+void tcp_delayed_ack_check(void);
 int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 		       u8 action, u32 tcp_seq_num, u32 tcp_ack_num);
 
@@ -13,7 +13,8 @@ enum wget_state {
 	WGET_CONNECTING,
 	WGET_CONNECTED,
 	WGET_TRANSFERRING,
-	WGET_TRANSFERRED
+	WGET_TRANSFERRED,
+	WGET_IDLE
 };
 
 #define DEBUG_WGET		0	/* Set to 1 for debug messages */
@@ -548,4 +548,33 @@ long os_get_time_offset(void);
  */
 void os_set_time_offset(long offset);
 
+/**
+ * os_thread_create() - start a host thread
+ *
+ * The thread runs until @func returns or the process exits.
+ *
+ * @func:	function to run in the thread
+ * @arg:	argument to pass to @func
+ * Return:	0 if OK, -ve on error
+ */
+int os_thread_create(void (*func)(void *arg), void *arg);
+
+/**
+ * os_futex_wait() - wait for a value to change
+ *
+ * This returns once os_futex_wake() is called for @addr, or at once if the
+ * value at @addr is no longer @val. It may also return early.
+ *
+ * @addr:	address to wait on
+ * @val:	value at @addr while waiting
+ */
+void os_futex_wait(const uint32_t *addr, uint32_t val);
+
+/**
+ * os_futex_wake() - wake all threads waiting in os_futex_wait()
+ *
+ * @addr:	address being waited on
+ */
+void os_futex_wake(const uint32_t *addr);
+
 #endif
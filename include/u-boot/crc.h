@@ -123,4 +123,18 @@ void crc32c_init(uint32_t *crc32c_table, uint32_t pol);
 uint32_t crc32c_cal(uint32_t crc, const char *data, int length,
 		    uint32_t *crc32c_table);
 
+/**
+ * crc32c() - Calculate the CRC32C (Castagnoli) of a buffer
+ *
+ * This uses the CPU's CRC instructions where available, else handles eight
+ * bytes at a time with tables built on first use. As with the Linux function,
+ * there is no inversion of @crc or of the result.
+ *
+ * @crc: Previous crc (use ~0 at start)
+ * @buf: Bytes to checksum
+ * @len: Number of bytes to process
+ * Return: checksum value
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
 #endif /* _UBOOT_CRC_H */
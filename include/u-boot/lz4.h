@@ -21,6 +21,41 @@
  */
 int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn);
 
+struct ulz4fn_stream;
+
+/**
+ * ulz4fn_stream_start() - Start decompressing LZ4 data piece by piece
+ *
+ * @dst: Destination for uncompressed data
+ * @dstn: Size of destination buffer
+ * Return: stream state to pass to ulz4fn_stream_feed(), or NULL if out of
+ *	memory
+ */
+struct ulz4fn_stream *ulz4fn_stream_start(void *dst, size_t dstn);
+
+/**
+ * ulz4fn_stream_feed() - Decompress the next piece of LZ4 data
+ *
+ * The pieces may be split anywhere. Blocks which are complete in a piece are
+ * decompressed straight from it, the others are collected in a buffer first.
+ *
+ * @zs: Stream state from ulz4fn_stream_start()
+ * @src: Next piece of compressed data
+ * @srcn: Length of @src
+ * @dstn: Returns the number of bytes uncompressed so far
+ * Return: 1 at the end of the frame, 0 if more data is needed, else the same
+ *	errors as ulz4fn()
+ */
+int ulz4fn_stream_feed(struct ulz4fn_stream *zs, const void *src, size_t srcn,
+		       size_t *dstn);
+
+/**
+ * ulz4fn_stream_end() - Free the state of an LZ4 stream
+ *
+ * @zs: Stream state from ulz4fn_stream_start()
+ */
+void ulz4fn_stream_end(struct ulz4fn_stream *zs);
+
 /**
  * LZ4_decompress_safe() - Decompression protected against buffer overflow
  * @source: source address of the compressed data
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Choosing between implementations of the SHA block functions
+ */
+
+#ifndef _SHA_IMPL_H
+#define _SHA_IMPL_H
+
+#include <linker_lists.h>
+#include <linux/types.h>
+
+/**
+ * enum sha_impl_algo - Algorithms which can have more than one implementation
+ *
+ * @SHA_IMPL_SHA256: SHA-256, with a state of uint32_t[8] and 64-byte blocks
+ * @SHA_IMPL_SHA512: SHA-384 and SHA-512, with a state of uint64_t[8] and
+ *	128-byte blocks
+ */
+enum sha_impl_algo {
+	SHA_IMPL_SHA256,
+	SHA_IMPL_SHA512,
+
+	SHA_IMPL_COUNT,
+};
+
+/**
+ * struct sha_impl - An implementation of a SHA block function
+ *
+ * The SHA functions use the available implementation with the highest
+ * priority, so everything which hashes data (FIT verification, the hash
+ * command, etc.) benefits from the CPU's hash instructions where there are
+ * some. The generic C version has priority 0 and is always available.
+ *
+ * @name: Name of the implementation, e.g. "armv8-ce"
+ * @algo: Algorithm implemented
+ * @priority: Preference over other implementations of the same algorithm,
+ *	higher is better
+ * @probe: Check whether this CPU can run the implementation, or NULL if any
+ *	can. Returns true if it can
+ * @process: Hash @blocks blocks at @data, updating @state. @blocks is never 0
+ */
+struct sha_impl {
+	const char *name;
+	enum sha_impl_algo algo;
+	int priority;
+	bool (*probe)(void);
+	void (*process)(void *state, const uint8_t *data, unsigned int blocks);
+};
+
+/* Declare a new implementation of a SHA block function */
+#define U_BOOT_SHA_IMPL(__name) \
+	ll_entry_declare(struct sha_impl, __name, sha_impl)
+
+/**
+ * sha_impl_get() - Get the implementation to use for an algorithm
+ *
+ * @algo: Algorithm to look up
+ * Return: implementation which was chosen with sha_impl_set(), else the best
+ *	one which this CPU can run
+ */
+const struct sha_impl *sha_impl_get(enum sha_impl_algo algo);
+
+/**
+ * sha_impl_set() - Choose the implementation to use for an algorithm
+ *
+ * @algo: Algorithm to update
+ * @name: Name of implementation, or NULL to go back to the best one
+ * Return: 0 if OK, -ENOENT if there is no such implementation,
+ *	-EOPNOTSUPP if this CPU cannot run it
+ */
+int sha_impl_set(enum sha_impl_algo algo, const char *name);
+
+/**
+ * sha_impl_usable() - Check whether this CPU can run an implementation
+ *
+ * @impl: Implementation to check
+ * Return: true if it can
+ */
+bool sha_impl_usable(const struct sha_impl *impl);
+
+/**
+ * sha_impl_algo_name() - Get the name of an algorithm
+ *
+ * @algo: Algorithm
+ * Return: name, e.g. "sha256"
+ */
+const char *sha_impl_algo_name(enum sha_impl_algo algo);
+
+#endif /* _SHA_IMPL_H */
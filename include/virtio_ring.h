@@ -103,6 +103,8 @@ struct vring {
  * @vring: actual memory layout for this queue
  * @vring_desc_shadow: guest-only copy of descriptors
  * @event: host publishes avail event idx
+ * @indirect: buffers may be added with an indirect descriptor table
+ * @indirect_desc: indirect descriptor tables, one per ring descriptor
  * @free_head: head of free buffer list
  * @num_added: number we've added since last sync
  * @last_used_idx: last used index we've seen
@@ -117,6 +119,8 @@ struct virtqueue {
 	struct vring vring;
 	struct vring_desc_shadow *vring_desc_shadow;
 	bool event;
+	bool indirect;
+	struct vring_desc *indirect_desc;
 	unsigned int free_head;
 	unsigned int num_added;
 	u16 last_used_idx;
@@ -124,6 +128,12 @@ struct virtqueue {
 	u16 avail_idx_shadow;
 };
 
+/*
+ * Number of entries in each indirect descriptor table. Buffers made up of
+ * more scatterlists than this use a chain of ring descriptors instead.
+ */
+#define VIRTQUEUE_INDIRECT_NUM		8
+
 /*
  * Alignment requirements for vring elements.
  * When using pre-virtio 1.0 layout, these fall out naturally.
@@ -187,6 +197,9 @@ struct virtio_sg;
  * @in_sgs:	the number of scatterlists which are writable
  *		(after readable ones)
  *
+ * If the device supports indirect descriptors, the scatterlists take up a
+ * single ring descriptor, so that more buffers fit in the ring.
+ *
  * Caller must ensure we don't call this with other virtqueue operations
  * at the same time (except where noted).
  *
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Running work on secondary CPU cores
+ *
+ * Each worker waits for the generation number to change, then takes jobs
+ * until there are none left. The calling core takes jobs too, then waits for
+ * the others to finish theirs. The busy count tells the calling core when no
+ * worker is looking at the shared state any more.
+ */
+
+#include <cpu_worker.h>
+#include <cyclic.h>
+#include <log.h>
+#include <linux/compiler.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+
+static struct {
+	struct cpu_worker_job *jobs;
+	int count;
+	int workers;
+	int next;
+	int done;
+	int busy;
+	u32 gen;
+	bool active;
+	int started;
+	bool failed;
+} cw;
+
+__weak int arch_cpu_worker_count(void)
+{
+	return 0;
+}
+
+__weak int arch_cpu_worker_start(int worker)
+{
+	return -ENOSYS;
+}
+
+__weak void arch_cpu_worker_wait(const u32 *addr, u32 val)
+{
+}
+
+__weak void arch_cpu_worker_wake(const u32 *addr)
+{
+}
+
+int cpu_worker_count(void)
+{
+	int count = arch_cpu_worker_count();
+	int ret;
+
+	while (cw.started < count && !cw.failed) {
+		ret = arch_cpu_worker_start(cw.started + 1);
+		if (ret) {
+			log_debug("Cannot start worker %d (err=%d)\n",
+				  cw.started + 1, ret);
+			cw.failed = true;
+			break;
+		}
+		cw.started++;
+	}
+
+	return min(count, cw.started);
+}
+
+/* Take jobs until there are none left */
+static void cpu_worker_take(int core)
+{
+	struct cpu_worker_job *job;
+	int i;
+
+	while ((i = __atomic_fetch_add(&cw.next, 1, __ATOMIC_ACQ_REL)) <
+	       cw.count) {
+		job = &cw.jobs[i];
+		job->ret = job->func(job->arg, core);
+		__atomic_fetch_add(&cw.done, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void cpu_worker_main(int worker)
+{
+	u32 gen = 0;
+
+	for (;;) {
+		while (__atomic_load_n(&cw.gen, __ATOMIC_ACQUIRE) == gen)
+			arch_cpu_worker_wait(&cw.gen, gen);
+
+		__atomic_fetch_add(&cw.busy, 1, __ATOMIC_SEQ_CST);
+		gen = __atomic_load_n(&cw.gen, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&cw.active, __ATOMIC_SEQ_CST) &&
+		    worker <= cw.workers)
+			cpu_worker_take(worker);
+		__atomic_fetch_sub(&cw.busy, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void cpu_worker_wait_idle(void)
+{
+	while (__atomic_load_n(&cw.busy, __ATOMIC_ACQUIRE))
+		;
+}
+
+int cpu_worker_run(struct cpu_worker_job *jobs, int count)
+{
+	int workers = 0;
+	int i, ret = 0;
+
+	if (count > 1 && !__atomic_load_n(&cw.active, __ATOMIC_ACQUIRE))
+		workers = cpu_worker_count();
+
+	if (!workers) {
+		for (i = 0; i < count; i++)
+			jobs[i].ret = jobs[i].func(jobs[i].arg, 0);
+	} else {
+		/* A worker may still be leaving the last run */
+		cpu_worker_wait_idle();
+		cw.jobs = jobs;
+		cw.count = count;
+		cw.workers = workers;
+		cw.next = 0;
+		cw.done = 0;
+		__atomic_store_n(&cw.active, true, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&cw.gen, 1, __ATOMIC_SEQ_CST);
+		arch_cpu_worker_wake(&cw.gen);
+
+		cpu_worker_take(0);
+		while (__atomic_load_n(&cw.done, __ATOMIC_ACQUIRE) < count)
+			schedule();
+		__atomic_store_n(&cw.active, false, __ATOMIC_SEQ_CST);
+		cpu_worker_wait_idle();
+	}
+
+	for (i = 0; i < count; i++) {
+		if (jobs[i].ret) {
+			ret = jobs[i].ret;
+			break;
+		}
+	}
+
+	return ret;
+}
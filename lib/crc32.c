@@ -25,6 +25,9 @@
 #define __efi_runtime
 #define __efi_runtime_data
 #define __efi_runtime_rodata
+#define CRC32_SLICE_BY_8	1
+#else
+#define CRC32_SLICE_BY_8	CONFIG_IS_ENABLED(CRC32_SLICE_BY_8)
 #endif
 
 #define tole(x) cpu_to_le32(x)
@@ -82,6 +85,8 @@ static void __efi_runtime make_crc_table(void)
   }
   crc_table_empty = 0;
 }
+#elif CRC32_SLICE_BY_8
+#include "crc32table.h"
 #elif !defined(CONFIG_ARM64_CRC32)
 /* ========================================================================
  * Table of CRC-32's of all single-byte values (made by make_crc_table)
@@ -183,10 +188,45 @@ const uint32_t * ZEXPORT get_crc_table()
 uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
 {
 #ifdef CONFIG_ARM64_CRC32
-    crc = cpu_to_le32(crc);
-    while (len--)
-        crc = __builtin_aarch64_crc32b(crc, *buf++);
-    return le32_to_cpu(crc);
+	crc = cpu_to_le32(crc);
+	while (len && ((uintptr_t)buf & 7)) {
+		crc = __builtin_aarch64_crc32b(crc, *buf++);
+		len--;
+	}
+	/* Eight bytes per instruction */
+	for (; len >= 8; len -= 8, buf += 8)
+		crc = __builtin_aarch64_crc32x(crc, *(const uint64_t *)buf);
+	while (len--)
+		crc = __builtin_aarch64_crc32b(crc, *buf++);
+	return le32_to_cpu(crc);
+#elif CRC32_SLICE_BY_8
+	const uint32_t (*tab)[256] = crc32_table;
+	uint32_t lo, hi;
+
+	/* Align it */
+	while (len && ((uintptr_t)buf & 7)) {
+		crc = tab[0][(crc ^ *buf++) & 255] ^ (crc >> 8);
+		len--;
+	}
+
+	/*
+	 * Eight bytes at a time: the CRC of each byte followed by the bytes
+	 * after it comes from a table of its own, so no step waits for another
+	 */
+	for (; len >= 8; len -= 8, buf += 8) {
+		lo = crc ^ le32_to_cpu(*(const uint32_t *)buf);
+		hi = le32_to_cpu(*(const uint32_t *)(buf + 4));
+		crc = tab[7][lo & 255] ^ tab[6][(lo >> 8) & 255] ^
+		      tab[5][(lo >> 16) & 255] ^ tab[4][lo >> 24] ^
+		      tab[3][hi & 255] ^ tab[2][(hi >> 8) & 255] ^
+		      tab[1][(hi >> 16) & 255] ^ tab[0][hi >> 24];
+	}
+
+	/* And the last few bytes */
+	while (len--)
+		crc = tab[0][(crc ^ *buf++) & 255] ^ (crc >> 8);
+
+	return crc;
 #else
     const uint32_t *tab = crc_table;
     const uint32_t *b =(const uint32_t *)buf;
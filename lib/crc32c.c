@@ -11,6 +11,14 @@
  */
 
 #include <compiler.h>
+#include <u-boot/crc.h>
+#include <linux/bitops.h>
+#ifdef CONFIG_X86
+#include <asm/cpu.h>
+#endif
+
+/* Bit-reflected CRC32C polynomial */
+#define CRC32C_POLY_LE	0x82f63b78
 
 uint32_t crc32c_cal(uint32_t crc, const char *data, int length,
 		    uint32_t *crc32c_table)
@@ -35,3 +43,111 @@ void crc32c_init(uint32_t *crc32c_table, uint32_t pol)
 		crc32c_table[i] = v;
 	}
 }
+
+#if defined(CONFIG_ARM64_CRC32)
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	const u8 *p = buf;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = __builtin_aarch64_crc32cb(crc, *p++);
+		len--;
+	}
+	for (; len >= 8; len -= 8, p += 8)
+		crc = __builtin_aarch64_crc32cx(crc, *(const u64 *)p);
+	while (len--)
+		crc = __builtin_aarch64_crc32cb(crc, *p++);
+
+	return crc;
+}
+#else
+/*
+ * crc32c_table[k][n] is the CRC of the byte n followed by k zero bytes, so
+ * that eight bytes can be handled at once
+ */
+static uint32_t crc32c_table[8][256];
+static bool crc32c_table_ready;
+
+static void crc32c_make_table(void)
+{
+	uint32_t v;
+	int i, k;
+
+	crc32c_init(crc32c_table[0], CRC32C_POLY_LE);
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			v = crc32c_table[k - 1][i];
+			crc32c_table[k][i] = crc32c_table[0][v & 0xff] ^
+					     (v >> 8);
+		}
+	}
+	crc32c_table_ready = true;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const u8 *p, size_t len)
+{
+	const uint32_t (*tab)[256] = crc32c_table;
+	uint32_t lo, hi;
+
+	if (!crc32c_table_ready)
+		crc32c_make_table();
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		lo = crc ^ le32_to_cpu(*(const uint32_t *)p);
+		hi = le32_to_cpu(*(const uint32_t *)(p + 4));
+		crc = tab[7][lo & 0xff] ^ tab[6][(lo >> 8) & 0xff] ^
+		      tab[5][(lo >> 16) & 0xff] ^ tab[4][lo >> 24] ^
+		      tab[3][hi & 0xff] ^ tab[2][(hi >> 8) & 0xff] ^
+		      tab[1][(hi >> 16) & 0xff] ^ tab[0][hi >> 24];
+	}
+	while (len--)
+		crc = tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef CONFIG_X86
+/*
+ * The SSE4.2 crc32 instruction works on general-purpose registers, so it is
+ * fine to use even though U-Boot is built without SSE
+ */
+static uint32_t crc32c_sse42(uint32_t crc, const u8 *p, size_t len)
+{
+	while (len && ((uintptr_t)p & 3)) {
+		asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+		p++;
+		len--;
+	}
+	for (; len >= 4; len -= 4, p += 4)
+		asm ("crc32l %1, %0" : "+r" (crc) : "rm" (*(const u32 *)p));
+	for (; len; len--, p++)
+		asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+
+	return crc;
+}
+
+static bool crc32c_has_sse42(void)
+{
+	static int has_sse42 = -1;
+
+	if (has_sse42 < 0)
+		has_sse42 = !!(cpuid_ecx(1) & BIT(20));
+
+	return has_sse42;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+#ifdef CONFIG_X86
+	if (crc32c_has_sse42())
+		return crc32c_sse42(crc, buf, len);
+#endif
+
+	return crc32c_sw(crc, buf, len);
+}
+#endif
@@ -12,6 +12,7 @@
 #include <image.h>
 #include <malloc.h>
 #include <memalign.h>
+#include <linux/errno.h>
 #include <u-boot/crc.h>
 #include <watchdog.h>
 #include <u-boot/zlib.h>
@@ -307,3 +308,63 @@ int zunzip(void *dst, int dstlen, unsigned char *src, unsigned long *lenp,
 
 	return err;
 }
+
+struct gunzip_stream {
+	z_stream s;
+};
+
+struct gunzip_stream *gunzip_stream_start(void *dst, ulong dstlen)
+{
+	struct gunzip_stream *gs;
+	int r;
+
+	gs = calloc(1, sizeof(*gs));
+	if (!gs)
+		return NULL;
+
+	gs->s.zalloc = gzalloc;
+	gs->s.zfree = gzfree;
+
+	/* Let zlib parse the gzip header, which may be split across pieces */
+	r = inflateInit2(&gs->s, 16 + MAX_WBITS);
+	if (r != Z_OK) {
+		printf("Error: inflateInit2() returned %d\n", r);
+		free(gs);
+		return NULL;
+	}
+	gs->s.next_out = dst;
+	gs->s.avail_out = dstlen;
+
+	return gs;
+}
+
+int gunzip_stream_feed(struct gunzip_stream *gs, const void *src, ulong len,
+		       ulong *lenp)
+{
+	int r;
+
+	gs->s.next_in = (unsigned char *)src;
+	gs->s.avail_in = len;
+	r = inflate(&gs->s, Z_NO_FLUSH);
+	*lenp = gs->s.total_out;
+
+	switch (r) {
+	case Z_STREAM_END:
+		return 1;
+	case Z_OK:
+	case Z_BUF_ERROR:
+		/* Input is only left over when there is no room for output */
+		return gs->s.avail_in ? -ENOSPC : 0;
+	default:
+		printf("Error: inflate() returned %d\n", r);
+		return -EINVAL;
+	}
+}
+
+void gunzip_stream_end(struct gunzip_stream *gs)
+{
+	if (!gs)
+		return;
+	inflateEnd(&gs->s);
+	free(gs);
+}
@@ -4,7 +4,9 @@
  */
 
 #include <compiler.h>
+#include <cpu_worker.h>
 #include <image.h>
+#include <malloc.h>
 #include <linux/kernel.h>
 #include <linux/types.h>
 #include <asm/unaligned.h>
@@ -15,12 +17,141 @@
 
 #define LZ4F_BLOCKUNCOMPRESSED_FLAG 0x80000000U
 
+/*
+ * Decode the block of size @block_size at @in, described by @block_header,
+ * to *@outp, not writing past @end. *@outp is moved past the output.
+ */
+static inline int ulz4fn_block(const void *in, u32 block_header,
+			       u32 block_size, void **outp, const void *end)
+{
+	void *out = *outp;
+	int ret;
+
+	if (block_header & LZ4F_BLOCKUNCOMPRESSED_FLAG) {
+		size_t size = min((ptrdiff_t)block_size, (ptrdiff_t)(end - out));
+
+		memcpy(out, in, size);
+		*outp = out + size;
+		if (size < block_size)
+			return -ENOBUFS;	/* output overrun */
+		return 0;
+	}
+
+	/* constant folding essential, do not touch params! */
+	ret = LZ4_decompress_generic(in, out, block_size,
+			end - out, endOnInputSize,
+			decode_full_block, noDict, out, NULL, 0);
+	if (ret < 0)
+		return -EPROTO;	/* decompression error */
+	*outp = out + ret;
+	return 0;
+}
+
+struct ulz4fn_job {
+	const void *in;
+	u32 block_header;
+	void *out;
+	const void *end;
+	size_t len;
+};
+
+static int ulz4fn_block_job(void *arg, int core)
+{
+	struct ulz4fn_job *job = arg;
+	void *out = job->out;
+	int ret;
+
+	ret = ulz4fn_block(job->in, job->block_header,
+			   job->block_header & ~LZ4F_BLOCKUNCOMPRESSED_FLAG,
+			   &out, job->end);
+	job->len = out - job->out;
+
+	return ret;
+}
+
+/*
+ * Decode the blocks starting at @in on all the CPU cores. The blocks are
+ * independent, but where each one goes is only known once those before it
+ * are decoded. Encoders fill every block but the last, so assume that and
+ * check it afterwards.
+ *
+ * Return: true if the blocks were decoded, false to decode them on this core
+ */
+static bool ulz4fn_parallel(const void *src, size_t srcn, const void *in,
+			    u32 block_max, int has_block_checksum, void *dst,
+			    size_t *dstn)
+{
+	const void *end = dst + *dstn;
+	struct cpu_worker_job *jobs;
+	struct ulz4fn_job *blocks;
+	const void *pos = in;
+	bool ok = false;
+	int count, i;
+
+	/* Decoding in place needs the blocks in order */
+	if (src < end && dst < src + srcn)
+		return false;
+
+	for (count = 0; ; count++) {
+		u32 block_size;
+
+		if (pos + sizeof(u32) > src + srcn)
+			return false;
+		block_size = get_unaligned_le32(pos) &
+			~LZ4F_BLOCKUNCOMPRESSED_FLAG;
+		if (!block_size)
+			break;
+		pos += sizeof(u32) + block_size;
+		if (has_block_checksum)
+			pos += sizeof(u32);
+		if (pos > src + srcn)
+			return false;
+	}
+	if (count < 2 || (count - 1) * (size_t)block_max >= *dstn)
+		return false;
+
+	jobs = calloc(count, sizeof(*jobs));
+	blocks = calloc(count, sizeof(*blocks));
+	if (!jobs || !blocks)
+		goto out;
+
+	for (i = 0, pos = in; i < count; i++) {
+		struct ulz4fn_job *block = &blocks[i];
+
+		block->block_header = get_unaligned_le32(pos);
+		block->in = pos + sizeof(u32);
+		block->out = dst + i * (size_t)block_max;
+		block->end = min(end, (const void *)block->out + block_max);
+		jobs[i].func = ulz4fn_block_job;
+		jobs[i].arg = block;
+		pos = block->in +
+			(block->block_header & ~LZ4F_BLOCKUNCOMPRESSED_FLAG);
+		if (has_block_checksum)
+			pos += sizeof(u32);
+	}
+
+	if (cpu_worker_run(jobs, count))
+		goto out;
+	for (i = 0; i < count - 1; i++) {
+		if (blocks[i].len != block_max)
+			goto out;
+	}
+	*dstn = blocks[count - 1].out + blocks[count - 1].len - dst;
+	ok = true;
+out:
+	free(blocks);
+	free(jobs);
+
+	return ok;
+}
+
 int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 {
 	const void *end = dst + *dstn;
 	const void *in = src;
 	void *out = dst;
 	int has_block_checksum;
+	u32 block_max;
 	int ret;
 	*dstn = 0;
 
@@ -59,6 +190,17 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 		}
 		/* Header checksum byte */
 		in += sizeof(u8);
+		block_max = 1 << (2 * ((block_desc >> 4) & 0x7) + 8);
+	}
+
+	if (cpu_worker_count()) {
+		size_t size = end - dst;
+
+		if (ulz4fn_parallel(src, srcn, in, block_max,
+				    has_block_checksum, dst, &size)) {
+			*dstn = size;
+			return 0;
+		}
 	}
 
 	while (1) {
@@ -78,25 +220,9 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 			break;
 		}
 
-		if (block_header & LZ4F_BLOCKUNCOMPRESSED_FLAG) {
-			size_t size = min((ptrdiff_t)block_size, (ptrdiff_t)(end - out));
-			memcpy(out, in, size);
-			out += size;
-			if (size < block_size) {
-				ret = -ENOBUFS;	/* output overrun */
-				break;
-			}
-		} else {
-			/* constant folding essential, do not touch params! */
-			ret = LZ4_decompress_generic(in, out, block_size,
-					end - out, endOnInputSize,
-					decode_full_block, noDict, out, NULL, 0);
-			if (ret < 0) {
-				ret = -EPROTO;	/* decompression error */
-				break;
-			}
-			out += ret;
-		}
+		ret = ulz4fn_block(in, block_header, block_size, &out, end);
+		if (ret)
+			break;
 
 		in += block_size;
 		if (has_block_checksum)
@@ -106,3 +232,185 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 	*dstn = out - dst;
 	return ret;
 }
+
+enum ulz4fn_stage {
+	ULZ4FN_FRAME_HEADER,
+	ULZ4FN_BLOCK_HEADER,
+	ULZ4FN_BLOCK,
+	ULZ4FN_BLOCK_CHECKSUM,
+	ULZ4FN_DONE,
+};
+
+struct ulz4fn_stream {
+	enum ulz4fn_stage stage;
+	void *dst;
+	void *out;
+	const void *end;
+	u8 header[15];		/* frame header, then block header */
+	u32 header_len;		/* bytes collected in header[] */
+	u32 need;		/* bytes needed to finish the current stage */
+	bool has_block_checksum;
+	u32 block_header;
+	u32 block_max;		/* largest block allowed by the frame header */
+	u8 *block;		/* holds a block split across pieces */
+	u32 block_len;		/* bytes collected in block[] */
+};
+
+struct ulz4fn_stream *ulz4fn_stream_start(void *dst, size_t dstn)
+{
+	struct ulz4fn_stream *zs;
+
+	zs = calloc(1, sizeof(*zs));
+	if (!zs)
+		return NULL;
+	zs->dst = dst;
+	zs->out = dst;
+	zs->end = dst + dstn;
+	zs->need = sizeof(u32) + 3 * sizeof(u8);
+
+	return zs;
+}
+
+/* Check the frame header collected so far, asking for more if needed */
+static int ulz4fn_frame_header(struct ulz4fn_stream *zs)
+{
+	u8 flags = zs->header[4];
+	u8 block_desc = zs->header[5];
+
+	if (get_unaligned_le32(zs->header) != LZ4F_MAGIC ||
+	    ((flags >> 6) & 0x3) != 1)
+		return -EPROTONOSUPPORT;	/* unknown format */
+	if ((flags & 0x03) || (block_desc & 0x8f))
+		return -EINVAL;	/* reserved bits must be zero */
+	if (!((flags >> 5) & 0x1))
+		return -EPROTONOSUPPORT; /* we can't support this yet */
+
+	/*
+	 * The header checksum byte is included already, ask for the content
+	 * size before it if there is one. It is not used.
+	 */
+	if (((flags >> 3) & 0x1) && zs->header_len == 7) {
+		zs->need = sizeof(u64);
+		return 0;
+	}
+
+	zs->has_block_checksum = (flags >> 4) & 0x1;
+	zs->block_max = 1 << (2 * ((block_desc >> 4) & 0x7) + 8);
+	zs->stage = ULZ4FN_BLOCK_HEADER;
+	zs->header_len = 0;
+	zs->need = sizeof(u32);
+
+	return 0;
+}
+
+/* Decode the block at @in, collecting it first if it is not all there */
+static int ulz4fn_stream_block(struct ulz4fn_stream *zs, const u8 **inp,
+			       size_t avail)
+{
+	u32 block_size = zs->block_header & ~LZ4F_BLOCKUNCOMPRESSED_FLAG;
+	const u8 *in = *inp;
+	size_t n;
+	int ret;
+
+	if (!zs->block_len && avail >= block_size) {
+		ret = ulz4fn_block(in, zs->block_header, block_size, &zs->out,
+				   zs->end);
+		*inp = in + block_size;
+	} else {
+		if (!zs->block) {
+			zs->block = malloc(zs->block_max);
+			if (!zs->block)
+				return -ENOMEM;
+		}
+		n = min_t(size_t, avail, block_size - zs->block_len);
+		memcpy(zs->block + zs->block_len, in, n);
+		zs->block_len += n;
+		*inp = in + n;
+		if (zs->block_len < block_size)
+			return 0;
+		ret = ulz4fn_block(zs->block, zs->block_header, block_size,
+				   &zs->out, zs->end);
+		zs->block_len = 0;
+	}
+	if (ret)
+		return ret;
+
+	if (zs->has_block_checksum) {
+		zs->stage = ULZ4FN_BLOCK_CHECKSUM;
+		zs->need = sizeof(u32);
+	} else {
+		zs->stage = ULZ4FN_BLOCK_HEADER;
+		zs->need = sizeof(u32);
+	}
+
+	return 0;
+}
+
+int ulz4fn_stream_feed(struct ulz4fn_stream *zs, const void *src, size_t srcn,
+		       size_t *dstn)
+{
+	const u8 *in = src;
+	const u8 *in_end = in + srcn;
+	u32 block_size;
+	size_t n;
+	int ret = 0;
+
+	while (in < in_end && zs->stage != ULZ4FN_DONE) {
+		if (zs->stage == ULZ4FN_BLOCK) {
+			ret = ulz4fn_stream_block(zs, &in, in_end - in);
+			if (ret)
+				break;
+			continue;
+		}
+
+		n = min_t(size_t, in_end - in, zs->need);
+		if (zs->stage != ULZ4FN_BLOCK_CHECKSUM)
+			memcpy(zs->header + zs->header_len, in, n);
+		zs->header_len += n;
+		zs->need -= n;
+		in += n;
+		if (zs->need)
+			break;
+
+		switch (zs->stage) {
+		case ULZ4FN_FRAME_HEADER:
+			ret = ulz4fn_frame_header(zs);
+			break;
+		case ULZ4FN_BLOCK_HEADER:
+			zs->block_header = get_unaligned_le32(zs->header);
+			zs->header_len = 0;
+			block_size = zs->block_header &
+				     ~LZ4F_BLOCKUNCOMPRESSED_FLAG;
+			if (!block_size)
+				zs->stage = ULZ4FN_DONE;
+			else if (block_size > zs->block_max)
+				ret = -EINVAL;	/* corrupted block size */
+			else
+				zs->stage = ULZ4FN_BLOCK;
+			break;
+		case ULZ4FN_BLOCK_CHECKSUM:
+			zs->header_len = 0;
+			zs->stage = ULZ4FN_BLOCK_HEADER;
+			zs->need = sizeof(u32);
+			break;
+		default:
+			break;
+		}
+		if (ret)
+			break;
+	}
+
+	*dstn = zs->out - zs->dst;
+	if (ret)
+		return ret;
+
+	return zs->stage == ULZ4FN_DONE;
+}
+
+void ulz4fn_stream_end(struct ulz4fn_stream *zs)
+{
+	if (!zs)
+		return;
+	free(zs->block);
+	free(zs);
+}
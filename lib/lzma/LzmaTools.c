@@ -30,6 +30,8 @@
 #include "LzmaTools.h"
 #include "LzmaDec.h"
 
+#include <linux/errno.h>
+#include <linux/kernel.h>
 #include <linux/string.h>
 #include <malloc.h>
 
@@ -120,4 +122,115 @@ int lzmaBuffToBuffDecompress(unsigned char *outStream, SizeT *uncompressedSize,
     return res;
 }
 
+struct lzma_stream_state {
+	CLzmaDec dec;
+	ISzAlloc alloc;
+	unsigned char header[LZMA_DATA_OFFSET];
+	unsigned int header_len;
+	unsigned char *out;
+	SizeT out_size;
+	SizeT dic_limit;
+	int known_size;
+};
+
+struct lzma_stream_state *lzmaStreamStart(unsigned char *outStream,
+					  SizeT outSize)
+{
+	struct lzma_stream_state *ls;
+
+	ls = calloc(1, sizeof(*ls));
+	if (!ls)
+		return NULL;
+
+	LzmaDec_Construct(&ls->dec);
+	ls->alloc.Alloc = SzAlloc;
+	ls->alloc.Free = SzFree;
+	ls->out = outStream;
+	ls->out_size = outSize;
+
+	return ls;
+}
+
+/* Set up the decoder once the properties and size have been collected */
+static int lzmaStreamHeader(struct lzma_stream_state *ls)
+{
+	UInt64 size = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		size |= (UInt64)ls->header[LZMA_SIZE_OFFSET + i] << (i * 8);
+
+	/* All 0xff means the size is unknown and the data has an end mark */
+	ls->known_size = size != (UInt64)-1;
+	if (ls->known_size && size > ls->out_size)
+		return -ENOSPC;
+	ls->dic_limit = ls->known_size ? (SizeT)size : ls->out_size;
+
+	switch (LzmaDec_AllocateProbs(&ls->dec, ls->header, LZMA_PROPS_SIZE,
+				      &ls->alloc)) {
+	case SZ_OK:
+		break;
+	case SZ_ERROR_MEM:
+		return -ENOMEM;
+	default:
+		return -EINVAL;
+	}
+
+	/* Decode straight to the output, which is the whole dictionary */
+	ls->dec.dic = ls->out;
+	ls->dec.dicBufSize = ls->out_size;
+	LzmaDec_Init(&ls->dec);
+
+	return 0;
+}
+
+int lzmaStreamFeed(struct lzma_stream_state *ls, const unsigned char *inStream,
+		   SizeT length, SizeT *outProcessed)
+{
+	ELzmaStatus status;
+	SizeT n;
+	int ret;
+
+	*outProcessed = ls->dec.dicPos;
+	if (ls->header_len < LZMA_DATA_OFFSET) {
+		n = min_t(SizeT, length, LZMA_DATA_OFFSET - ls->header_len);
+		memcpy(ls->header + ls->header_len, inStream, n);
+		ls->header_len += n;
+		inStream += n;
+		length -= n;
+		if (ls->header_len < LZMA_DATA_OFFSET)
+			return 0;
+
+		ret = lzmaStreamHeader(ls);
+		if (ret)
+			return ret;
+	}
+
+	n = length;
+	if (LzmaDec_DecodeToDic(&ls->dec, ls->dic_limit, inStream, &n,
+				LZMA_FINISH_ANY, &status) != SZ_OK)
+		return -EINVAL;
+	*outProcessed = ls->dec.dicPos;
+
+	if (status == LZMA_STATUS_FINISHED_WITH_MARK)
+		return 1;
+	if (ls->dec.dicPos == ls->dic_limit) {
+		if (ls->known_size)
+			return 1;
+		/* Without a known size only the end mark may remain */
+		if (n < length)
+			return -ENOSPC;
+	}
+
+	return 0;
+}
+
+void lzmaStreamEnd(struct lzma_stream_state *ls)
+{
+	if (!ls)
+		return;
+	LzmaDec_FreeProbs(&ls->dec, &ls->alloc);
+	free(ls);
+}
+
 #endif
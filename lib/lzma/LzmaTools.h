@@ -28,4 +28,40 @@
 int lzmaBuffToBuffDecompress(unsigned char *outStream, SizeT *uncompressedSize,
 			     const unsigned char *inStream, SizeT length);
 
+struct lzma_stream_state;
+
+/**
+ * lzmaStreamStart() - Start decompressing LZMA data piece by piece
+ *
+ * @outStream: output buffer
+ * @outSize: size of @outStream
+ * @return stream state to pass to lzmaStreamFeed(), or NULL if out of memory
+ */
+struct lzma_stream_state *lzmaStreamStart(unsigned char *outStream,
+					  SizeT outSize);
+
+/**
+ * lzmaStreamFeed() - Decompress the next piece of LZMA data
+ *
+ * The pieces may be split anywhere, the properties and size at the start
+ * included.
+ *
+ * @ls: stream state from lzmaStreamStart()
+ * @inStream: next piece of compressed data
+ * @length: sizeof @inStream
+ * @outProcessed: returns the number of bytes uncompressed so far
+ * @return 1 at the end of the data, 0 if more is needed, -ENOSPC if the output
+ *	buffer is too small, -ENOMEM if out of memory, -EINVAL if the data is
+ *	corrupted
+ */
+int lzmaStreamFeed(struct lzma_stream_state *ls, const unsigned char *inStream,
+		   SizeT length, SizeT *outProcessed);
+
+/**
+ * lzmaStreamEnd() - Free the state of an LZMA stream
+ *
+ * @ls: stream state from lzmaStreamStart()
+ */
+void lzmaStreamEnd(struct lzma_stream_state *ls);
+
 #endif
@@ -7,6 +7,7 @@
 
 #ifndef USE_HOSTCC
 #include <cyclic.h>
+#include <u-boot/sha_impl.h>
 #endif /* USE_HOSTCC */
 #include <string.h>
 #include <u-boot/sha256.h>
@@ -54,7 +55,7 @@ void sha256_starts(sha256_context * ctx)
 	ctx->state[7] = 0x5BE0CD19;
 }
 
-static void sha256_process_one(sha256_context *ctx, const uint8_t data[64])
+static void sha256_process_one(uint32_t state[8], const uint8_t data[64])
 {
 	uint32_t temp1, temp2;
 	uint32_t W[64];
@@ -101,14 +102,14 @@ static void sha256_process_one(sha256_context *ctx, const uint8_t data[64])
 	d += temp1; h = temp1 + temp2;		\
 }
 
-	A = ctx->state[0];
-	B = ctx->state[1];
-	C = ctx->state[2];
-	D = ctx->state[3];
-	E = ctx->state[4];
-	F = ctx->state[5];
-	G = ctx->state[6];
-	H = ctx->state[7];
+	A = state[0];
+	B = state[1];
+	C = state[2];
+	D = state[3];
+	E = state[4];
+	F = state[5];
+	G = state[6];
+	H = state[7];
 
 	P(A, B, C, D, E, F, G, H, W[0], 0x428A2F98);
 	P(H, A, B, C, D, E, F, G, W[1], 0x71374491);
@@ -175,26 +176,44 @@ static void sha256_process_one(sha256_context *ctx, const uint8_t data[64])
 	P(C, D, E, F, G, H, A, B, R(62), 0xBEF9A3F7);
 	P(B, C, D, E, F, G, H, A, R(63), 0xC67178F2);
 
-	ctx->state[0] += A;
-	ctx->state[1] += B;
-	ctx->state[2] += C;
-	ctx->state[3] += D;
-	ctx->state[4] += E;
-	ctx->state[5] += F;
-	ctx->state[6] += G;
-	ctx->state[7] += H;
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+	state[4] += E;
+	state[5] += F;
+	state[6] += G;
+	state[7] += H;
 }
 
-__weak void sha256_process(sha256_context *ctx, const unsigned char *data,
+static void sha256_generic_process(void *state, const uint8_t *data,
+				   unsigned int blocks)
+{
+	while (blocks--) {
+		sha256_process_one(state, data);
+		data += 64;
+	}
+}
+
+#ifndef USE_HOSTCC
+U_BOOT_SHA_IMPL(sha256_generic) = {
+	.name		= "generic",
+	.algo		= SHA_IMPL_SHA256,
+	.process	= sha256_generic_process,
+};
+#endif
+
+static void sha256_process(sha256_context *ctx, const unsigned char *data,
 			   unsigned int blocks)
 {
 	if (!blocks)
 		return;
 
-	while (blocks--) {
-		sha256_process_one(ctx, data);
-		data += 64;
-	}
+#ifdef USE_HOSTCC
+	sha256_generic_process(ctx->state, data, blocks);
+#else
+	sha_impl_get(SHA_IMPL_SHA256)->process(ctx->state, data, blocks);
+#endif
 }
 
 void sha256_update(sha256_context *ctx, const uint8_t *input, uint32_t length)
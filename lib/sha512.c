@@ -12,6 +12,7 @@
 
 #ifndef USE_HOSTCC
 #include <cyclic.h>
+#include <u-boot/sha_impl.h>
 #endif /* USE_HOSTCC */
 #include <compiler.h>
 #include <u-boot/sha512.h>
@@ -187,15 +188,33 @@ sha512_transform(uint64_t *state, const uint8_t *input)
 	a = b = c = d = e = f = g = h = t1 = t2 = 0;
 }
 
-static void sha512_block_fn(sha512_context *sst, const uint8_t *src,
-				    int blocks)
+static void sha512_generic_process(void *state, const uint8_t *data,
+				   unsigned int blocks)
 {
 	while (blocks--) {
-		sha512_transform(sst->state, src);
-		src += SHA512_BLOCK_SIZE;
+		sha512_transform(state, data);
+		data += SHA512_BLOCK_SIZE;
 	}
 }
 
+#ifndef USE_HOSTCC
+U_BOOT_SHA_IMPL(sha512_generic) = {
+	.name		= "generic",
+	.algo		= SHA_IMPL_SHA512,
+	.process	= sha512_generic_process,
+};
+#endif
+
+static void sha512_block_fn(sha512_context *sst, const uint8_t *src,
+			    int blocks)
+{
+#ifdef USE_HOSTCC
+	sha512_generic_process(sst->state, src, blocks);
+#else
+	sha_impl_get(SHA_IMPL_SHA512)->process(sst->state, src, blocks);
+#endif
+}
+
 static void sha512_base_do_update(sha512_context *sctx,
 					const uint8_t *data,
 					unsigned int len)
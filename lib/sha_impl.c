@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Choosing between implementations of the SHA block functions
+ */
+
+#include <errno.h>
+#include <asm/global_data.h>
+#include <linux/string.h>
+#include <u-boot/sha_impl.h>
+
+DECLARE_GLOBAL_DATA_PTR;
+
+/* Implementation in use for each algorithm, only kept after relocation */
+static const struct sha_impl *sha_impl_cur[SHA_IMPL_COUNT];
+
+static const char *const sha_impl_algo_names[SHA_IMPL_COUNT] = {
+	[SHA_IMPL_SHA256]	= "sha256",
+	[SHA_IMPL_SHA512]	= "sha512",
+};
+
+const char *sha_impl_algo_name(enum sha_impl_algo algo)
+{
+	return sha_impl_algo_names[algo];
+}
+
+bool sha_impl_usable(const struct sha_impl *impl)
+{
+	return !impl->probe || impl->probe();
+}
+
+const struct sha_impl *sha_impl_get(enum sha_impl_algo algo)
+{
+	struct sha_impl *start = ll_entry_start(struct sha_impl, sha_impl);
+	const int count = ll_entry_count(struct sha_impl, sha_impl);
+	const struct sha_impl *best = NULL;
+	bool relocated = gd->flags & GD_FLG_RELOC;
+	struct sha_impl *impl;
+
+	if (relocated && sha_impl_cur[algo])
+		return sha_impl_cur[algo];
+
+	for (impl = start; impl != start + count; impl++) {
+		if (impl->algo != algo ||
+		    (best && impl->priority <= best->priority))
+			continue;
+		if (sha_impl_usable(impl))
+			best = impl;
+	}
+
+	/* Before relocation, BSS cannot be used so look again next time */
+	if (relocated)
+		sha_impl_cur[algo] = best;
+
+	return best;
+}
+
+int sha_impl_set(enum sha_impl_algo algo, const char *name)
+{
+	struct sha_impl *start = ll_entry_start(struct sha_impl, sha_impl);
+	const int count = ll_entry_count(struct sha_impl, sha_impl);
+	struct sha_impl *impl;
+
+	if (!name) {
+		sha_impl_cur[algo] = NULL;
+		return 0;
+	}
+
+	for (impl = start; impl != start + count; impl++) {
+		if (impl->algo != algo || strcmp(impl->name, name))
+			continue;
+		if (!sha_impl_usable(impl))
+			return -EOPNOTSUPP;
+		sha_impl_cur[algo] = impl;
+		return 0;
+	}
+
+	return -ENOENT;
+}
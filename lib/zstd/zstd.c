@@ -6,18 +6,150 @@
 #define LOG_CATEGORY	LOGC_BOOT
 
 #include <abuf.h>
+#include <cpu_worker.h>
 #include <log.h>
 #include <malloc.h>
+#include <asm/unaligned.h>
 #include <linux/errno.h>
 #include <linux/zstd.h>
 
+/* Check whether @src starts with a Zstandard or skippable frame */
+static bool zstd_is_frame(const void *src, size_t src_size)
+{
+	u32 magic;
+
+	if (src_size < sizeof(magic))
+		return false;
+	magic = get_unaligned_le32(src);
+
+	return magic == ZSTD_MAGICNUMBER ||
+	       (magic & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START;
+}
+
+struct zstd_frame_job {
+	zstd_dctx **ctxs;
+	const void *src;
+	size_t src_size;
+	void *dst;
+	size_t dst_size;
+};
+
+static int zstd_frame_job(void *arg, int core)
+{
+	struct zstd_frame_job *frame = arg;
+	size_t len;
+
+	len = zstd_decompress_dctx(frame->ctxs[core], frame->dst,
+				   frame->dst_size, frame->src,
+				   frame->src_size);
+	if (zstd_is_error(len) || len != frame->dst_size)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Decompress the frames on all the CPU cores. This needs the size of each
+ * frame to be recorded in its header, to know where its output goes.
+ *
+ * Return: size of the decompressed data, -EAGAIN to decompress it on this
+ * core, or other -ve on error
+ */
+static int zstd_decompress_parallel(struct abuf *in, struct abuf *out)
+{
+	const void *src = abuf_data(in), *end = src + abuf_size(in);
+	struct zstd_frame_job *frames = NULL;
+	struct cpu_worker_job *jobs = NULL;
+	void *dst = abuf_data(out);
+	void *workspace = NULL;
+	zstd_dctx **ctxs = NULL;
+	zstd_frame_header hdr;
+	int count, cores, i;
+	size_t len, wsize;
+	u64 total;
+	int ret;
+
+	/* Decompressing in place needs the frames in order */
+	if (src < dst + abuf_size(out) && dst < end)
+		return -EAGAIN;
+
+	for (count = 0, total = 0; zstd_is_frame(src, end - src); src += len) {
+		len = zstd_find_frame_compressed_size(src, end - src);
+		if (zstd_is_error(len) ||
+		    zstd_get_frame_header(&hdr, src, end - src))
+			return -EAGAIN;
+		if (hdr.frameType == ZSTD_skippableFrame)
+			continue;
+		if (hdr.frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+			return -EAGAIN;
+		total += hdr.frameContentSize;
+		count++;
+	}
+	if (count < 2 || total > abuf_size(out))
+		return -EAGAIN;
+
+	ret = -EAGAIN;
+	cores = cpu_worker_count() + 1;
+	wsize = zstd_dctx_workspace_bound();
+	jobs = calloc(count, sizeof(*jobs));
+	frames = calloc(count, sizeof(*frames));
+	ctxs = calloc(cores, sizeof(*ctxs));
+	workspace = malloc(cores * wsize);
+	if (!jobs || !frames || !ctxs || !workspace)
+		goto do_free;
+	for (i = 0; i < cores; i++) {
+		ctxs[i] = zstd_init_dctx(workspace + i * wsize, wsize);
+		if (!ctxs[i])
+			goto do_free;
+	}
+
+	for (i = 0, src = abuf_data(in); i < count; src += len) {
+		len = zstd_find_frame_compressed_size(src, end - src);
+		zstd_get_frame_header(&hdr, src, end - src);
+		if (hdr.frameType == ZSTD_skippableFrame)
+			continue;
+		frames[i].ctxs = ctxs;
+		frames[i].src = src;
+		frames[i].src_size = len;
+		frames[i].dst = dst;
+		frames[i].dst_size = hdr.frameContentSize;
+		jobs[i].func = zstd_frame_job;
+		jobs[i].arg = &frames[i];
+		dst += hdr.frameContentSize;
+		i++;
+	}
+
+	ret = cpu_worker_run(jobs, count);
+	if (ret)
+		log_err("%s: failed to decompress: %d\n", __func__, ret);
+	else
+		ret = total;
+do_free:
+	free(workspace);
+	free(ctxs);
+	free(frames);
+	free(jobs);
+
+	return ret;
+}
+
 int zstd_decompress(struct abuf *in, struct abuf *out)
 {
+	const void *src = abuf_data(in);
+	size_t src_size = abuf_size(in);
+	void *dst = abuf_data(out);
+	size_t dst_size = abuf_size(out);
 	zstd_dctx *ctx;
-	size_t wsize, len;
+	size_t wsize, len, n;
 	void *workspace;
 	int ret;
 
+	if (cpu_worker_count()) {
+		ret = zstd_decompress_parallel(in, out);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
 	wsize = zstd_dctx_workspace_bound();
 	workspace = malloc(wsize);
 	if (!workspace) {
@@ -37,7 +169,7 @@ int zstd_decompress(struct abuf *in, struct abuf *out)
 	 * Find out how large the frame actually is, there may be junk at
 	 * the end of the frame that zstd_decompress_dctx() can't handle.
 	 */
-	len = zstd_find_frame_compressed_size(abuf_data(in), abuf_size(in));
+	len = zstd_find_frame_compressed_size(src, src_size);
 	if (zstd_is_error(len)) {
 		log_err("%s: failed to detect compressed size: %d\n", __func__,
 			zstd_get_error_code(len));
@@ -45,17 +177,115 @@ int zstd_decompress(struct abuf *in, struct abuf *out)
 		goto do_free;
 	}
 
-	len = zstd_decompress_dctx(ctx, abuf_data(out), abuf_size(out),
-				   abuf_data(in), len);
-	if (zstd_is_error(len)) {
-		log_err("%s: failed to decompress: %d\n", __func__,
-			zstd_get_error_code(len));
-		ret = -EINVAL;
-		goto do_free;
+	/* Carry on with any further frames, stopping at the junk */
+	for (;;) {
+		n = zstd_decompress_dctx(ctx, dst, dst_size, src, len);
+		if (zstd_is_error(n)) {
+			log_err("%s: failed to decompress: %d\n", __func__,
+				zstd_get_error_code(n));
+			ret = -EINVAL;
+			goto do_free;
+		}
+		dst += n;
+		dst_size -= n;
+		src += len;
+		src_size -= len;
+
+		if (!zstd_is_frame(src, src_size))
+			break;
+		len = zstd_find_frame_compressed_size(src, src_size);
+		if (zstd_is_error(len)) {
+			log_err("%s: failed to detect compressed size: %d\n",
+				__func__, zstd_get_error_code(len));
+			ret = -EINVAL;
+			goto do_free;
+		}
 	}
 
-	ret = len;
+	ret = dst - abuf_data(out);
 do_free:
 	free(workspace);
 	return ret;
 }
+
+struct zstd_stream {
+	zstd_dstream *dstream;
+	void *workspace;
+	zstd_out_buffer out;
+};
+
+struct zstd_stream *zstd_stream_start(void *dst, size_t dst_size)
+{
+	struct zstd_stream *zs;
+	size_t wsize;
+
+	zs = calloc(1, sizeof(*zs));
+	if (!zs)
+		return NULL;
+
+	/*
+	 * The output goes straight to @dst, which holds the whole window, so
+	 * only a buffer for one input block is needed besides the context
+	 */
+	wsize = zstd_dctx_workspace_bound() + ZSTD_BLOCKSIZE_MAX;
+	zs->workspace = malloc(wsize);
+	if (!zs->workspace) {
+		debug("%s: cannot allocate workspace of size %zu\n", __func__,
+		      wsize);
+		goto err;
+	}
+
+	zs->dstream = zstd_init_dstream(0, zs->workspace, wsize);
+	if (!zs->dstream ||
+	    zstd_is_error(ZSTD_DCtx_setParameter(zs->dstream,
+						 ZSTD_d_stableOutBuffer, 1))) {
+		log_err("%s: zstd_init_dstream() failed\n", __func__);
+		goto err;
+	}
+	zs->out.dst = dst;
+	zs->out.size = dst_size;
+
+	return zs;
+err:
+	free(zs->workspace);
+	free(zs);
+	return NULL;
+}
+
+int zstd_stream_feed(struct zstd_stream *zs, const void *src, size_t src_size,
+		     size_t *dst_sizep)
+{
+	zstd_in_buffer in = { .src = src, .size = src_size };
+	size_t in_pos, out_pos;
+	size_t ret;
+
+	do {
+		in_pos = in.pos;
+		out_pos = zs->out.pos;
+		ret = zstd_decompress_stream(zs->dstream, &zs->out, &in);
+		*dst_sizep = zs->out.pos;
+		if (zstd_is_error(ret)) {
+			if (zstd_get_error_code(ret) ==
+			    ZSTD_error_dstSize_tooSmall)
+				return -ENOSPC;
+			log_err("%s: failed to decompress: %d\n", __func__,
+				zstd_get_error_code(ret));
+			return -EINVAL;
+		}
+		/* The frame is complete, anything after it is ignored */
+		if (!ret)
+			return 1;
+		if (in.pos == in_pos && zs->out.pos == out_pos)
+			return -ENOSPC;
+	} while (in.pos < in.size);
+
+	return 0;
+}
+
+void zstd_stream_end(struct zstd_stream *zs)
+{
+	if (!zs)
+		return;
+	free(zs->workspace);
+	free(zs);
+}
@@ -400,6 +400,34 @@ int eth_send(void *packet, int length)
 	return ret;
 }
 
+/*
+ * Join or leave an IPv4 multicast group, by having the device accept frames
+ * sent to the group's MAC address, which is 01:00:5e followed by the low 23
+ * bits of the group address
+ */
+int eth_mcast_join(struct in_addr mcast_ip, int join)
+{
+	struct udevice *current;
+	u32 addr = ntohl(mcast_ip.s_addr);
+	u8 mcast_mac[ARP_HLEN];
+
+	current = eth_get_dev();
+	if (!current)
+		return -ENODEV;
+
+	if (!eth_get_ops(current)->mcast)
+		return -ENOSYS;
+
+	mcast_mac[0] = 0x01;
+	mcast_mac[1] = 0x00;
+	mcast_mac[2] = 0x5e;
+	mcast_mac[3] = (addr >> 16) & 0x7f;
+	mcast_mac[4] = (addr >> 8) & 0xff;
+	mcast_mac[5] = addr & 0xff;
+
+	return eth_get_ops(current)->mcast(current, mcast_mac, join);
+}
+
 int eth_rx(void)
 {
 	struct udevice *current;
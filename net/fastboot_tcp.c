@@ -78,6 +78,11 @@ static void fastboot_tcp_handler_ipv4(uchar *pkt, u16 dport,
 	u8 tcp_fin = action & TCP_FIN;
 	u8 tcp_push = action & TCP_PUSH;
 
+	if (action & TCP_RST) {
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+
 	curr_sport = sport;
 	curr_dport = dport;
 	curr_tcp_seq_num = tcp_seq_num;
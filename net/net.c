@@ -151,6 +151,8 @@ u8 net_server_ethaddr[6];
 struct in_addr	net_ip;
 /* Server IP addr (0 = unknown) */
 struct in_addr	net_server_ip;
+/* Multicast group joined for a TFTP download (0 = none) */
+struct in_addr	net_mcast_addr;
 /* Current receive packet */
 uchar *net_rx_packet;
 /* Current rx packet length */
@@ -649,6 +651,9 @@ restart:
 		 */
 		eth_rx();
 
+		if (IS_ENABLED(CONFIG_PROT_TCP))
+			tcp_delayed_ack_check();
+
 		/*
 		 *	Abort if ctrl-c was pressed.
 		 */
@@ -1346,6 +1351,9 @@ void net_process_received_packet(uchar *in_packet, int len)
 		dst_ip = net_read_ip(&ip->ip_dst);
 		if (net_ip.s_addr && dst_ip.s_addr != net_ip.s_addr &&
 		    dst_ip.s_addr != 0xFFFFFFFF) {
+			if (!IS_ENABLED(CONFIG_MCAST_TFTP) ||
+			    !net_mcast_addr.s_addr ||
+			    dst_ip.s_addr != net_mcast_addr.s_addr)
 				return;
 		}
 		/* Read source IP address for later use */
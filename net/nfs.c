@@ -41,11 +41,14 @@
 #include <net.h>
 #include <malloc.h>
 #include <mapmem.h>
+#include <linux/log2.h>
+#include <net/tcp.h>
 #include "nfs.h"
 #include "bootp.h"
 #include <time.h>
 
 #define HASHES_PER_LINE 65	/* Number of "loading" hashes per line	*/
+#define BYTES_PER_HASH	5120	/* Bytes loaded for each hash		*/
 #define NFS_RETRY_COUNT 30
 
 #define NFS_RPC_ERR	1
@@ -53,10 +56,85 @@
 
 static int fs_mounted;
 static unsigned long rpc_id;
-static int nfs_offset = -1;
-static int nfs_len;
 static const ulong nfs_timeout = CONFIG_NFS_TIMEOUT;
 
+/**
+ * struct nfs_read - a part of the file being read
+ *
+ * A part is free when both @id and @len are 0, and waits to be asked for
+ * (again) when only @id is 0.
+ *
+ * @id: XID of the READ request in flight
+ * @offset: where the part starts in the file
+ * @len: number of bytes still to come
+ */
+struct nfs_read {
+	u32 id;
+	u32 offset;
+	u32 len;
+};
+
+static struct nfs_read nfs_reads[CONFIG_NFS_READ_WINDOW];
+static u32 nfs_rsize;		/* bytes asked for in one READ */
+static u32 nfs_read_next;	/* where the next part starts */
+static u32 nfs_read_end;	/* end of the file, once it is known */
+static u32 nfs_read_done;	/* bytes received */
+static u32 nfs_read_hashes;	/* hashes printed */
+
+/* NFS over TCP: the requests as sent, and the replies as they arrive */
+#define NFS_TCP_TX_SIZE	8192
+#define NFS_TCP_WND	((u32)(4 * roundup_pow_of_two(CONFIG_NFS_READ_SIZE)))
+#define NFS_TCP_REC_SIZE	(CONFIG_NFS_READ_SIZE + sizeof(struct rpc_t))
+#define NFS_TCP_SEG	(TCP_MSS - TCP_TSOPT_SIZE - 2)
+#define NFS_TCP_LAST_FRAG	0x80000000
+
+/* Servers expect NFS requests to come from a reserved port */
+#define NFS_TCP_PORT_START	512
+#define NFS_TCP_PORT_RANGE	512
+
+enum nfs_tcp_state {
+	NFS_TCP_CLOSED,
+	NFS_TCP_CONNECTING,
+	NFS_TCP_OPEN,
+	NFS_TCP_CLOSING,
+};
+
+/**
+ * struct nfs_tcp - the TCP connection to the NFS server
+ *
+ * Each RPC message is sent as one record, which starts with a record mark
+ * giving its length. Replies are kept in @rx at their sequence number, as
+ * TCP hands over segments in the order they arrive, and are taken apart
+ * into @rec once everything before them is in.
+ *
+ * @state: state of the connection
+ * @port: our port
+ * @snd_una: first byte sent which the server has not acknowledged
+ * @snd_nxt: next byte to send
+ * @tx: bytes sent, at their sequence number modulo %NFS_TCP_TX_SIZE
+ * @rx: bytes received, at their sequence number modulo %NFS_TCP_WND
+ * @rx_pos: next byte to take from @rx
+ * @mark: record mark being read
+ * @mark_len: bytes of @mark read so far
+ * @frag_left: bytes left in the current record fragment
+ * @rec: the reply put together from its fragments
+ * @rec_len: bytes of the reply so far
+ */
+static struct nfs_tcp {
+	enum nfs_tcp_state state;
+	u16 port;
+	u32 snd_una;
+	u32 snd_nxt;
+	uchar tx[NFS_TCP_TX_SIZE];
+	uchar *rx;
+	u32 rx_pos;
+	u32 mark;
+	int mark_len;
+	u32 frag_left;
+	uchar *rec;
+	u32 rec_len;
+} nfs_tcp;
+
 static char dirfh[NFS3_FHSIZE]; /* NFSv2 / NFSv3 file handle of directory */
 static unsigned int dirfh3_length; /* (variable) length of dirfh when NFSv3 */
 static char filefh[NFS3_FHSIZE]; /* NFSv2 / NFSv3 file handle */
@@ -76,6 +154,7 @@ static int nfs_state;
 #define STATE_LOOKUP_REQ		5
 #define STATE_READ_REQ			6
 #define STATE_READLINK_REQ		7
+#define STATE_FSINFO_REQ		8
 
 static char *nfs_filename;
 static char *nfs_path;
@@ -180,17 +259,103 @@ static uint32_t *rpc_add_credentials(uint32_t *p)
 }
 
 /**************************************************************************
-RPC_LOOKUP - Lookup RPC Port numbers
+NFS over TCP - sending
 **************************************************************************/
-static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
+static bool nfs_use_tcp(int rpc_prog)
+{
+	return IS_ENABLED(CONFIG_NFS_TCP) && rpc_prog == PROG_NFS;
+}
+
+/* Send stream bytes from @from up to @to, for the first time or again */
+static void nfs_tcp_xmit(u32 from, u32 to)
+{
+	uchar *pkt = net_tx_packet + net_eth_hdr_size() + IP_TCP_HDR_SIZE +
+		     TCP_TSOPT_SIZE + 2;
+	u32 n, i;
+
+	tcp_select_stream(nfs_server_port, nfs_tcp.port);
+	while (from != to) {
+		n = min_t(u32, to - from, NFS_TCP_SEG);
+		for (i = 0; i < n; i++)
+			pkt[i] = nfs_tcp.tx[(from + i) % NFS_TCP_TX_SIZE];
+		net_send_tcp_packet(n, nfs_server_port, nfs_tcp.port, TCP_PUSH,
+				    from, tcp_get_ack_edge());
+		from += n;
+	}
+}
+
+/* Open a new connection, from a new port so that no old state gets in */
+static void nfs_tcp_connect(void)
+{
+	u16 port = NFS_TCP_PORT_START + get_timer(0) % NFS_TCP_PORT_RANGE;
+
+	if (port == nfs_tcp.port)
+		port = NFS_TCP_PORT_START +
+		       (port + 1 - NFS_TCP_PORT_START) % NFS_TCP_PORT_RANGE;
+	debug("%s: port %u\n", __func__, port);
+
+	nfs_tcp.port = port;
+	nfs_tcp.state = NFS_TCP_CONNECTING;
+	nfs_tcp.snd_una = 1;
+	nfs_tcp.snd_nxt = 1;
+	net_send_tcp_packet(0, nfs_server_port, port, TCP_SYN, 0, 0);
+}
+
+/*
+ * Send an RPC message as one record. Until the connection is open, this
+ * opens it and the message is sent by nfs_send() once it is.
+ */
+static int nfs_tcp_send(const void *msg, int len)
+{
+	u32 mark = htonl(NFS_TCP_LAST_FRAG | len);
+	u32 start = nfs_tcp.snd_nxt;
+	int i;
+
+	if (nfs_tcp.state != NFS_TCP_OPEN) {
+		nfs_tcp_connect();
+		return -EAGAIN;
+	}
+	if (start - nfs_tcp.snd_una + sizeof(mark) + len > NFS_TCP_TX_SIZE)
+		return -ENOBUFS;
+
+	for (i = 0; i < sizeof(mark); i++)
+		nfs_tcp.tx[(start + i) % NFS_TCP_TX_SIZE] = ((uchar *)&mark)[i];
+	start += sizeof(mark);
+	for (i = 0; i < len; i++)
+		nfs_tcp.tx[(start + i) % NFS_TCP_TX_SIZE] =
+			((const uchar *)msg)[i];
+
+	nfs_tcp_xmit(nfs_tcp.snd_nxt, start + len);
+	nfs_tcp.snd_nxt = start + len;
+
+	return 0;
+}
+
+static void nfs_tcp_close(void)
+{
+	if (nfs_tcp.state == NFS_TCP_OPEN) {
+		tcp_select_stream(nfs_server_port, nfs_tcp.port);
+		net_send_tcp_packet(0, nfs_server_port, nfs_tcp.port,
+				    TCP_ACK | TCP_FIN, nfs_tcp.snd_nxt,
+				    tcp_get_ack_edge());
+		nfs_tcp.snd_nxt++;
+		nfs_tcp.state = NFS_TCP_CLOSING;
+	} else if (nfs_tcp.state == NFS_TCP_CONNECTING) {
+		nfs_tcp.state = NFS_TCP_CLOSED;
+	}
+}
+
+/**************************************************************************
+RPC_REQ - Send an RPC call
+**************************************************************************/
+static int rpc_send(unsigned long id, int rpc_prog, int rpc_proc,
+		    uint32_t *data, int datalen)
 {
 	struct rpc_t rpc_pkt;
-	unsigned long id;
 	uint32_t *p;
 	int pktlen;
 	int sport;
 
-	id = ++rpc_id;
 	rpc_pkt.u.call.id = htonl(id);
 	rpc_pkt.u.call.type = htonl(MSG_CALL);
 	rpc_pkt.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
@@ -243,6 +408,9 @@ static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
 
 	pktlen = (char *)p + datalen * sizeof(uint32_t) - (char *)&rpc_pkt;
 
+	if (nfs_use_tcp(rpc_prog))
+		return nfs_tcp_send(&rpc_pkt.u.data[0], pktlen);
+
 	memcpy((char *)net_tx_packet + net_eth_hdr_size() + IP_UDP_HDR_SIZE,
 	       &rpc_pkt.u.data[0], pktlen);
 
@@ -255,6 +423,13 @@ static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
 
 	net_send_udp_packet(net_server_ethaddr, nfs_server_ip, sport,
 			    nfs_our_port, pktlen);
+
+	return 0;
+}
+
+static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
+{
+	rpc_send(++rpc_id, rpc_prog, rpc_proc, data, datalen);
 }
 
 /**************************************************************************
@@ -268,7 +443,7 @@ static void rpc_lookup_req(int prog, int ver)
 	data[2] = 0; data[3] = 0;	/* auth verifier */
 	data[4] = htonl(prog);
 	data[5] = htonl(ver);
-	data[6] = htonl(17);	/* IP_UDP */
+	data[6] = htonl(nfs_use_tcp(prog) ? IPPROTO_TCP : IPPROTO_UDP);
 	data[7] = 0;
 	rpc_req(PROG_PORTMAP, PORTMAP_GETPORT, data, 8);
 }
@@ -393,10 +568,31 @@ static void nfs_lookup_req(char *fname)
 	}
 }
 
+/**************************************************************************
+NFS_FSINFO - Ask an NFSv3 Server for its preferred Read Size
+**************************************************************************/
+static void nfs_fsinfo_req(void)
+{
+	uint32_t data[1024];
+	uint32_t *p;
+	int len;
+
+	p = &(data[0]);
+	p = rpc_add_credentials(p);
+
+	*p++ = htonl(filefh3_length);
+	memcpy(p, filefh, filefh3_length);
+	p += (filefh3_length / 4);
+
+	len = (uint32_t *)p - (uint32_t *)&(data[0]);
+
+	rpc_req(PROG_NFS, NFS3PROC_FSINFO, data, len);
+}
+
 /**************************************************************************
 NFS_READ - Read File on NFS Server
 **************************************************************************/
-static void nfs_read_req(int offset, int readlen)
+static int nfs_read_req(struct nfs_read *rd)
 {
 	uint32_t data[1024];
 	uint32_t *p;
@@ -408,22 +604,106 @@ static void nfs_read_req(int offset, int readlen)
 	if (choosen_nfs_version != NFS_V3) {
 		memcpy(p, filefh, NFS_FHSIZE);
 		p += (NFS_FHSIZE / 4);
-		*p++ = htonl(offset);
-		*p++ = htonl(readlen);
+		*p++ = htonl(rd->offset);
+		*p++ = htonl(rd->len);
 		*p++ = 0;
 	} else { /* NFS_V3 */
 		*p++ = htonl(filefh3_length);
 		memcpy(p, filefh, filefh3_length);
 		p += (filefh3_length / 4);
 		*p++ = htonl(0); /* offset is 64-bit long, so fill with 0 */
-		*p++ = htonl(offset);
-		*p++ = htonl(readlen);
+		*p++ = htonl(rd->offset);
+		*p++ = htonl(rd->len);
 		*p++ = 0;
 	}
 
 	len = (uint32_t *)p - (uint32_t *)&(data[0]);
 
-	rpc_req(PROG_NFS, NFS_READ, data, len);
+	return rpc_send(rd->id, PROG_NFS, NFS_READ, data, len);
+}
+
+/* Ask for the parts which are not in flight, as long as there is room */
+static void nfs_read_fill(void)
+{
+	struct nfs_read *rd;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id)
+			continue;
+		if (!rd->len && nfs_read_next < nfs_read_end) {
+			rd->offset = nfs_read_next;
+			rd->len = min(nfs_rsize, nfs_read_end - nfs_read_next);
+			nfs_read_next += rd->len;
+		}
+		if (rd->offset >= nfs_read_end)
+			rd->len = 0;
+		if (!rd->len)
+			continue;
+
+		rd->id = ++rpc_id;
+		if (nfs_read_req(rd)) {
+			rd->id = 0;
+			break;
+		}
+	}
+}
+
+/* Send the requests in flight again, with the same XIDs */
+static void nfs_read_resend(void)
+{
+	struct nfs_read *rd;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id && nfs_read_req(rd))
+			return;
+	}
+	nfs_read_fill();
+}
+
+static bool nfs_read_busy(void)
+{
+	struct nfs_read *rd;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id || rd->len)
+			return true;
+	}
+
+	return false;
+}
+
+/* Largest read which the transport and the NFS version allow */
+static u32 nfs_rsize_max(void)
+{
+	u32 size = CONFIG_NFS_READ_SIZE;
+
+	/* Over UDP the whole reply must fit in one (reassembled) datagram */
+	if (!IS_ENABLED(CONFIG_NFS_TCP)) {
+#if defined(CONFIG_IP_DEFRAG)
+		size = min_t(u32, size,
+			     rounddown_pow_of_two(CONFIG_NET_MAXDEFRAG -
+						  NFS_READ_OVERHEAD));
+#else
+		size = NFS_READ_SIZE;
+#endif
+	}
+	if (choosen_nfs_version != NFS_V3)
+		size = min_t(u32, size, NFS2_MAXDATA);
+
+	return max_t(u32, size, NFS_READ_SIZE);
+}
+
+static void nfs_read_start(void)
+{
+	debug("%s: rsize %u\n", __func__, nfs_rsize);
+
+	memset(nfs_reads, 0, sizeof(nfs_reads));
+	nfs_read_next = 0;
+	nfs_read_end = U32_MAX;
+	nfs_read_done = 0;
+	nfs_read_hashes = 0;
+	nfs_state = STATE_READ_REQ;
+	nfs_read_fill();
 }
 
 /**************************************************************************
@@ -450,13 +730,18 @@ static void nfs_send(void)
 		nfs_mount_req(nfs_path);
 		break;
 	case STATE_UMOUNT_REQ:
+		if (IS_ENABLED(CONFIG_NFS_TCP))
+			nfs_tcp_close();
 		nfs_umountall_req();
 		break;
 	case STATE_LOOKUP_REQ:
 		nfs_lookup_req(nfs_filename);
 		break;
+	case STATE_FSINFO_REQ:
+		nfs_fsinfo_req();
+		break;
 	case STATE_READ_REQ:
-		nfs_read_req(nfs_offset, nfs_len);
+		nfs_read_resend();
 		break;
 	case STATE_READLINK_REQ:
 		nfs_readlink_req();
@@ -712,21 +997,81 @@ static int nfs_readlink_reply(uchar *pkt, unsigned len)
 	return 0;
 }
 
-static int nfs_read_reply(uchar *pkt, unsigned len)
+static int nfs_fsinfo_reply(uchar *pkt, unsigned len)
 {
 	struct rpc_t rpc_pkt;
-	int rlen;
-	uchar *data_ptr;
+	u32 rtmax, rtpref;
+	int nfsv3_data_offset;
+	int ret;
 
 	debug("%s\n", __func__);
 
-	memcpy(&rpc_pkt.u.data[0], pkt, sizeof(rpc_pkt.u.reply));
+	memcpy(&rpc_pkt.u.data[0], pkt, len);
 
 	if (ntohl(rpc_pkt.u.reply.id) > rpc_id)
 		return -NFS_RPC_ERR;
 	else if (ntohl(rpc_pkt.u.reply.id) < rpc_id)
 		return -NFS_RPC_DROP;
 
+	ret = rpc_handle_error(&rpc_pkt);
+	if (ret)
+		return ret;
+
+	nfsv3_data_offset = nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
+	if ((uchar *)&rpc_pkt.u.reply.data[3 + nfsv3_data_offset] -
+	    (uchar *)&rpc_pkt > len)
+		return -1;
+
+	rtmax = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+	rtpref = ntohl(rpc_pkt.u.reply.data[2 + nfsv3_data_offset]);
+	if (rtpref)
+		nfs_rsize = min(nfs_rsize, rtpref);
+	if (rtmax)
+		nfs_rsize = min(nfs_rsize, rtmax);
+
+	return 0;
+}
+
+static struct nfs_read *nfs_read_find(u32 id)
+{
+	struct nfs_read *rd;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->id && rd->id == id)
+			return rd;
+	}
+
+	return NULL;
+}
+
+static void nfs_read_progress(u32 len)
+{
+	nfs_read_done += len;
+	while (nfs_read_hashes < DIV_ROUND_UP(nfs_read_done, BYTES_PER_HASH)) {
+		if (nfs_read_hashes && !(nfs_read_hashes % HASHES_PER_LINE))
+			puts("\n\t ");
+		putc('#');
+		nfs_read_hashes++;
+	}
+}
+
+static int nfs_read_reply(uchar *pkt, unsigned len)
+{
+	struct rpc_t rpc_pkt;
+	struct nfs_read *rd;
+	unsigned int data_offset;
+	bool eof;
+	u32 rlen;
+
+	debug("%s\n", __func__);
+
+	/* The data is stored straight from @pkt, so only copy the header */
+	memcpy(&rpc_pkt.u.data[0], pkt, min_t(unsigned, len, sizeof(rpc_pkt)));
+
+	rd = nfs_read_find(ntohl(rpc_pkt.u.reply.id));
+	if (!rd)
+		return -NFS_RPC_DROP;
+
 	if (rpc_pkt.u.reply.rstatus  ||
 	    rpc_pkt.u.reply.verifier ||
 	    rpc_pkt.u.reply.astatus  ||
@@ -738,34 +1083,41 @@ static int nfs_read_reply(uchar *pkt, unsigned len)
 		return -ntohl(rpc_pkt.u.reply.data[0]);
 	}
 
-	if ((nfs_offset != 0) && !((nfs_offset) %
-			(NFS_READ_SIZE / 2 * 10 * HASHES_PER_LINE)))
-		puts("\n\t ");
-	if (!(nfs_offset % ((NFS_READ_SIZE / 2) * 10)))
-		putc('#');
-
 	if (choosen_nfs_version != NFS_V3) {
 		rlen = ntohl(rpc_pkt.u.reply.data[18]);
-		data_ptr = (uchar *)&(rpc_pkt.u.reply.data[19]);
+		data_offset = (uchar *)&(rpc_pkt.u.reply.data[19]) -
+			      (uchar *)&rpc_pkt;
+		eof = !rlen;
 	} else {  /* NFS_V3 */
 		int nfsv3_data_offset =
 			nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
 
 		/* count value */
 		rlen = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+		eof = !rlen || rpc_pkt.u.reply.data[2 + nfsv3_data_offset];
 		/* Skip unused values :
-			EOF:		32 bits value,
 			data_size:	32 bits value,
 		*/
-		data_ptr = (uchar *)
-			&(rpc_pkt.u.reply.data[4 + nfsv3_data_offset]);
+		data_offset = (uchar *)
+			&(rpc_pkt.u.reply.data[4 + nfsv3_data_offset]) -
+			(uchar *)&rpc_pkt;
 	}
 
-	if (((uchar *)&(rpc_pkt.u.reply.data[0]) - (uchar *)(&rpc_pkt) + rlen) > len)
-			return -9999;
+	if (data_offset > len || rlen > len - data_offset || rlen > rd->len)
+		return -9999;
 
-	if (store_block(data_ptr, nfs_offset, rlen))
-			return -9999;
+	if (rlen && store_block(pkt + data_offset, rd->offset, rlen))
+		return -9999;
+	nfs_read_progress(rlen);
+
+	/* Ask for the rest of a short read again */
+	rd->id = 0;
+	rd->offset += rlen;
+	rd->len -= rlen;
+	if (eof) {
+		nfs_read_end = min(nfs_read_end, rd->offset);
+		rd->len = 0;
+	}
 
 	return rlen;
 }
@@ -783,22 +1135,25 @@ static void nfs_timeout_handler(void)
 		net_set_timeout_handler(nfs_timeout +
 					nfs_timeout * nfs_timeout_count,
 					nfs_timeout_handler);
-		nfs_send();
+		/* Over TCP, a request which did not get through is sent again */
+		if (IS_ENABLED(CONFIG_NFS_TCP) &&
+		    nfs_tcp.state == NFS_TCP_OPEN &&
+		    nfs_tcp.snd_una != nfs_tcp.snd_nxt)
+			nfs_tcp_xmit(nfs_tcp.snd_una, nfs_tcp.snd_nxt);
+		else
+			nfs_send();
 	}
 }
 
-static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
-			unsigned src, unsigned len)
+static void nfs_reply(uchar *pkt, unsigned len)
 {
 	int rlen;
 	int reply;
 
 	debug("%s\n", __func__);
 
-	if (len > sizeof(struct rpc_t))
-		return;
-
-	if (dest != nfs_our_port)
+	/* Only READ replies are taken apart without being copied first */
+	if (len > sizeof(struct rpc_t) && nfs_state != STATE_READ_REQ)
 		return;
 
 	switch (nfs_state) {
@@ -865,13 +1220,24 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			nfs_state = STATE_PRCLOOKUP_PROG_MOUNT_REQ;
 			nfs_send();
 		} else {
-			nfs_state = STATE_READ_REQ;
-			nfs_offset = 0;
-			nfs_len = NFS_READ_SIZE;
-			nfs_send();
+			nfs_rsize = nfs_rsize_max();
+			if (choosen_nfs_version == NFS_V3) {
+				nfs_state = STATE_FSINFO_REQ;
+				nfs_send();
+			} else {
+				nfs_read_start();
+			}
 		}
 		break;
 
+	case STATE_FSINFO_REQ:
+		reply = nfs_fsinfo_reply(pkt, len);
+		if (reply == -NFS_RPC_DROP)
+			break;
+		/* If the server does not say, stay with what we can take */
+		nfs_read_start();
+		break;
+
 	case STATE_READLINK_REQ:
 		reply = nfs_readlink_reply(pkt, len);
 		if (reply == -NFS_RPC_DROP) {
@@ -895,18 +1261,19 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		if (rlen == -NFS_RPC_DROP)
 			break;
 		net_set_timeout_handler(nfs_timeout, nfs_timeout_handler);
-		if (rlen > 0) {
-			nfs_offset += rlen;
+		if (rlen >= 0) {
+			nfs_read_fill();
+			if (nfs_read_busy())
+				break;
+			nfs_download_state = NETLOOP_SUCCESS;
+			nfs_state = STATE_UMOUNT_REQ;
 			nfs_send();
 		} else if ((rlen == -NFSERR_ISDIR) || (rlen == -NFSERR_INVAL)) {
 			/* symbolic link */
 			nfs_state = STATE_READLINK_REQ;
 			nfs_send();
 		} else {
-			if (!rlen)
-				nfs_download_state = NETLOOP_SUCCESS;
-			if (rlen < 0)
-				debug("NFS READ error (%d)\n", rlen);
+			debug("NFS READ error (%d)\n", rlen);
 			nfs_state = STATE_UMOUNT_REQ;
 			nfs_send();
 		}
@@ -914,6 +1281,149 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 	}
 }
 
+static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
+			unsigned src, unsigned len)
+{
+	if (dest != nfs_our_port)
+		return;
+
+	nfs_reply(pkt, len);
+}
+
+/**************************************************************************
+NFS over TCP - receiving
+**************************************************************************/
+
+/* Keep what TCP hands over at its place in the stream */
+static void nfs_tcp_store(uchar *pkt, u32 seq, unsigned int len)
+{
+	s32 off = seq - nfs_tcp.rx_pos;
+	u32 pos, n;
+
+	/* Only what is between @rx_pos and the window's end has a place */
+	if (off < 0) {
+		if (-off >= (s32)len)
+			return;
+		pkt -= off;
+		len += off;
+		off = 0;
+	}
+	if (off >= NFS_TCP_WND)
+		return;
+	len = min_t(u32, len, NFS_TCP_WND - off);
+
+	pos = (nfs_tcp.rx_pos + off) % NFS_TCP_WND;
+	n = min_t(u32, len, NFS_TCP_WND - pos);
+	memcpy(nfs_tcp.rx + pos, pkt, n);
+	memcpy(nfs_tcp.rx, pkt + n, len - n);
+}
+
+/* Take the records apart up to @end, passing each reply on */
+static void nfs_tcp_parse(u32 end)
+{
+	u32 pos, n;
+
+	while (nfs_tcp.rx_pos != end && nfs_tcp.state == NFS_TCP_OPEN) {
+		pos = nfs_tcp.rx_pos % NFS_TCP_WND;
+		if (nfs_tcp.mark_len < sizeof(nfs_tcp.mark)) {
+			nfs_tcp.mark = nfs_tcp.mark << 8 | nfs_tcp.rx[pos];
+			nfs_tcp.rx_pos++;
+			if (++nfs_tcp.mark_len == sizeof(nfs_tcp.mark))
+				nfs_tcp.frag_left = nfs_tcp.mark &
+						    ~NFS_TCP_LAST_FRAG;
+		} else {
+			n = min3(end - nfs_tcp.rx_pos, NFS_TCP_WND - pos,
+				 nfs_tcp.frag_left);
+			/* A reply too large to keep is dropped */
+			if (nfs_tcp.rec_len + n <= NFS_TCP_REC_SIZE)
+				memcpy(nfs_tcp.rec + nfs_tcp.rec_len,
+				       nfs_tcp.rx + pos, n);
+			nfs_tcp.rec_len += n;
+			nfs_tcp.frag_left -= n;
+			nfs_tcp.rx_pos += n;
+		}
+		if (nfs_tcp.mark_len < sizeof(nfs_tcp.mark) ||
+		    nfs_tcp.frag_left)
+			continue;
+
+		nfs_tcp.mark_len = 0;
+		if (!(nfs_tcp.mark & NFS_TCP_LAST_FRAG))
+			continue;
+		n = nfs_tcp.rec_len;
+		nfs_tcp.rec_len = 0;
+		if (n <= NFS_TCP_REC_SIZE)
+			nfs_reply(nfs_tcp.rec, n);
+	}
+}
+
+static void nfs_tcp_handler(uchar *pkt, u16 dport, struct in_addr sip,
+			    u16 sport, u32 tcp_seq_num, u32 tcp_ack_num,
+			    u8 action, unsigned int len)
+{
+	u32 end;
+
+	if (ntohs(dport) != nfs_tcp.port || nfs_tcp.state == NFS_TCP_CLOSED)
+		return;
+
+	if (action & TCP_RST) {
+		/* The next request, or its timeout, connects again */
+		debug("%s: reset\n", __func__);
+		nfs_tcp.state = NFS_TCP_CLOSED;
+		return;
+	}
+
+	tcp_select_stream(nfs_server_port, nfs_tcp.port);
+	switch (nfs_tcp.state) {
+	case NFS_TCP_CONNECTING:
+		if (tcp_get_tcp_state() != TCP_ESTABLISHED)
+			return;
+		nfs_tcp.state = NFS_TCP_OPEN;
+		nfs_tcp.rx_pos = tcp_get_ack_edge();
+		nfs_tcp.mark_len = 0;
+		nfs_tcp.rec_len = 0;
+		tcp_set_rcv_buf(NFS_TCP_WND);
+		net_send_tcp_packet(0, nfs_server_port, nfs_tcp.port, TCP_ACK,
+				    nfs_tcp.snd_nxt, tcp_get_ack_edge());
+		/* Now send what had to wait for the connection */
+		nfs_send();
+		return;
+	case NFS_TCP_CLOSING:
+		if (action & TCP_FIN) {
+			net_send_tcp_packet(0, nfs_server_port, nfs_tcp.port,
+					    TCP_ACK, nfs_tcp.snd_nxt,
+					    tcp_get_ack_edge());
+			nfs_tcp.state = NFS_TCP_CLOSED;
+		}
+		return;
+	default:
+		break;
+	}
+
+	if ((s32)(tcp_ack_num - nfs_tcp.snd_una) > 0 &&
+	    (s32)(tcp_ack_num - nfs_tcp.snd_nxt) <= 0)
+		nfs_tcp.snd_una = tcp_ack_num;
+
+	/* The FIN takes up a sequence number but is not data */
+	end = tcp_get_ack_edge();
+	if (tcp_get_tcp_state() == TCP_CLOSE_WAIT)
+		end--;
+
+	nfs_tcp_store(pkt, tcp_seq_num, len);
+	nfs_tcp_parse(end);
+
+	if (action & TCP_FIN && nfs_tcp.state == NFS_TCP_OPEN) {
+		tcp_select_stream(nfs_server_port, nfs_tcp.port);
+		net_send_tcp_packet(0, nfs_server_port, nfs_tcp.port,
+				    TCP_ACK | TCP_FIN, nfs_tcp.snd_nxt,
+				    tcp_get_ack_edge());
+		nfs_tcp.state = NFS_TCP_CLOSED;
+	} else if (nfs_tcp.state == NFS_TCP_OPEN) {
+		/* Everything up to the edge is taken, so the window slides */
+		tcp_select_stream(nfs_server_port, nfs_tcp.port);
+		tcp_set_rcv_buf(NFS_TCP_WND);
+	}
+}
+
 
 void nfs_start(void)
 {
@@ -969,6 +1479,20 @@ void nfs_start(void)
 	}
 	printf("\nLoad address: 0x%lx\nLoading: *\b", image_load_addr);
 
+	if (IS_ENABLED(CONFIG_NFS_TCP)) {
+		if (!nfs_tcp.rx)
+			nfs_tcp.rx = malloc(NFS_TCP_WND);
+		if (!nfs_tcp.rec)
+			nfs_tcp.rec = malloc(NFS_TCP_REC_SIZE);
+		if (!nfs_tcp.rx || !nfs_tcp.rec) {
+			net_set_state(NETLOOP_FAIL);
+			printf("*** ERROR: Fail allocate memory\n");
+			return;
+		}
+		nfs_tcp.state = NFS_TCP_CLOSED;
+		tcp_set_tcp_handler(nfs_tcp_handler);
+	}
+
 	net_set_timeout_handler(nfs_timeout, nfs_timeout_handler);
 	net_set_udp_handler(nfs_handler);
 
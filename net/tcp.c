@@ -25,34 +25,73 @@
 #include <net.h>
 #include <net/tcp.h>
 
-/*
- * TCP sliding window  control used by us to request re-TX
- */
-static struct tcp_sack_v tcp_lost;
-
 /* TCP option timestamp */
 static u32 loc_timestamp;
-static u32 rmt_timestamp;
-
-static u32 tcp_seq_init;
-static u32 tcp_ack_edge;
 
 static int tcp_activity_count;
 
 /*
- * Search for TCP_SACK and review the comments before the code section
- * TCP_SACK is the number of packets at the front of the stream
+ * Data received beyond the ACK edge, as hills sorted by sequence number.
+ * SACK reports these so that the sender only resends the holes. @age
+ * tells when a hill last grew, so that the newest can be reported first.
  */
-
-enum pkt_state {PKT, NOPKT};
 struct sack_r {
 	struct sack_edges se;
-	enum pkt_state st;
+	u32 age;
+};
+
+/**
+ * struct tcp_stream - state of one TCP connection
+ * @state: connection state
+ * @rmt_port: the other end's port
+ * @loc_port: our port
+ * @last_used: when the connection was last used, for recycling
+ * @rmt_timestamp: the other end's timestamp, echoed back
+ * @seq_init: the other end's initial sequence number
+ * @ack_edge: sequence number of the first byte not yet received in order
+ * @hills: data received beyond @ack_edge
+ * @hill_cnt: number of @hills
+ * @hill_age: age of the newest hill
+ * @fin_pending: a FIN arrived before some of the data in front of it
+ * @fin_seq: sequence number of that FIN
+ * @rcv_lim: sequence number after the last byte the application has room
+ *	for, if @rcv_lim_set
+ * @rcv_lim_set: the application has limited the receive window
+ * @wscale_ok: both ends agreed to scale the window
+ * @ack_now: the other end must hear about what arrived straight away
+ * @ack_segs: segments received in order and not yet acknowledged
+ * @ack_time: when the first of those arrived
+ * @ack_sent: last acknowledgment number sent
+ * @rmt_ack: last acknowledgment number received
+ */
+struct tcp_stream {
+	enum tcp_state state;
+	u16 rmt_port;
+	u16 loc_port;
+	ulong last_used;
+	u32 rmt_timestamp;
+	u32 seq_init;
+	u32 ack_edge;
+	struct sack_r hills[TCP_SACK];
+	unsigned int hill_cnt;
+	u32 hill_age;
+	bool fin_pending;
+	u32 fin_seq;
+	u32 rcv_lim;
+	bool rcv_lim_set;
+	bool wscale_ok;
+	bool ack_now;
+	unsigned int ack_segs;
+	ulong ack_time;
+	u32 ack_sent;
+	u32 rmt_ack;
 };
 
-static struct sack_r edge_a[TCP_SACK];
-static unsigned int sack_idx;
-static unsigned int prev_len;
+static struct tcp_stream tcp_streams[TCP_STREAMS];
+static ulong tcp_use_count;
+
+/* The connection whose packet is being handled, or which was last sent to */
+static struct tcp_stream *tcp_cur = tcp_streams;
 
 /*
  * TCP lengths are stored as a rounded up number of 32 bit words.
@@ -64,12 +103,64 @@ static unsigned int prev_len;
 #define SHIFT_TO_TCPHDRLEN_FIELD(x) ((x) << 4)
 #define GET_TCP_HDR_LEN_IN_BYTES(x) ((x) >> 2)
 
-/* TCP connection state */
-static enum tcp_state current_tcp_state;
-
 /* Current TCP RX packet handler */
 static rxhand_tcp *tcp_packet_handler;
 
+/**
+ * tcp_stream_get() - find the connection between two ports
+ * @rport: the other end's port
+ * @lport: our port
+ * @recycle: if there is no closed connection to take over, drop the one
+ *	used longest ago
+ *
+ * Return: the connection, or NULL if there is none and @recycle is false
+ */
+static struct tcp_stream *tcp_stream_get(u16 rport, u16 lport, bool recycle)
+{
+	struct tcp_stream *s, *t;
+
+	for (s = tcp_streams; s < tcp_streams + TCP_STREAMS; s++) {
+		if (s->rmt_port == rport && s->loc_port == lport)
+			goto found;
+	}
+
+	s = NULL;
+	for (t = tcp_streams; t < tcp_streams + TCP_STREAMS; t++) {
+		if (t->state == TCP_CLOSED) {
+			s = t;
+			break;
+		}
+		if (recycle && (!s || t->last_used < s->last_used))
+			s = t;
+	}
+	if (!s)
+		return NULL;
+
+	debug_cond(DEBUG_INT_STATE && s->state != TCP_CLOSED,
+		   "TCP dropping connection %u-%u\n", s->loc_port, s->rmt_port);
+	memset(s, '\0', sizeof(*s));
+	s->state = TCP_CLOSED;
+	s->rmt_port = rport;
+	s->loc_port = lport;
+found:
+	s->last_used = ++tcp_use_count;
+
+	return s;
+}
+
+/**
+ * tcp_select_stream() - pick the connection the functions below act on
+ * @rport: the other end's port
+ * @lport: our port
+ *
+ * The connection is picked automatically while one of its packets is
+ * handled, and when one is sent. A new connection starts out closed.
+ */
+void tcp_select_stream(u16 rport, u16 lport)
+{
+	tcp_cur = tcp_stream_get(rport, lport, true);
+}
+
 /**
  * tcp_get_tcp_state() - get current TCP state
  *
@@ -77,7 +168,7 @@ static rxhand_tcp *tcp_packet_handler;
  */
 enum tcp_state tcp_get_tcp_state(void)
 {
-	return current_tcp_state;
+	return tcp_cur->state;
 }
 
 /**
@@ -86,7 +177,7 @@ enum tcp_state tcp_get_tcp_state(void)
  */
 void tcp_set_tcp_state(enum tcp_state new_state)
 {
-	current_tcp_state = new_state;
+	tcp_cur->state = new_state;
 }
 
 static void dummy_handler(uchar *pkt, u16 dport,
@@ -109,6 +200,57 @@ void tcp_set_tcp_handler(rxhand_tcp *f)
 		tcp_packet_handler = f;
 }
 
+/**
+ * tcp_set_rcv_buf() - set the space the application has for received data
+ * @size: bytes it can take beyond what has arrived in order, 0 for no limit
+ *
+ * The receive window of the current connection never offers more than this.
+ * A new connection has no limit.
+ */
+void tcp_set_rcv_buf(ulong size)
+{
+	tcp_cur->rcv_lim = tcp_cur->ack_edge + min_t(ulong, size, S32_MAX);
+	tcp_cur->rcv_lim_set = size != 0;
+}
+
+/**
+ * tcp_get_ack_edge() - get the end of the data received in order
+ *
+ * Return: sequence number of the first byte not yet received
+ */
+u32 tcp_get_ack_edge(void)
+{
+	return tcp_cur->ack_edge;
+}
+
+/**
+ * tcp_rcv_space() - get the receive window
+ * @s: connection
+ *
+ * Return: bytes which may be received beyond the ACK edge
+ */
+static u32 tcp_rcv_space(struct tcp_stream *s)
+{
+	s32 space = s->rcv_lim - s->ack_edge;
+
+	if (!s->rcv_lim_set)
+		return TCP_RCV_WND;
+	if (space <= 0)
+		return 0;
+
+	return min_t(u32, TCP_RCV_WND, space);
+}
+
+static void tcp_reset_rx(struct tcp_stream *s)
+{
+	s->hill_cnt = 0;
+	s->fin_pending = false;
+	s->rcv_lim_set = false;
+	s->wscale_ok = false;
+	s->ack_now = false;
+	s->ack_segs = 0;
+}
+
 /**
  * tcp_set_pseudo_header() - set TCP pseudo header
  * @pkt: the packet
@@ -147,49 +289,72 @@ u16 tcp_set_pseudo_header(uchar *pkt, struct in_addr src, struct in_addr dest,
 	return compute_ip_checksum(pkt + PSEUDO_PAD_SIZE, checksum_len);
 }
 
+/**
+ * tcp_sack_hills() - pick the hills to report in a SACK option
+ * @s: connection
+ * @hill: the packet's SACK edges, filled in newest first
+ *
+ * Return: number of hills filled in
+ */
+static int tcp_sack_hills(struct tcp_stream *s, struct sack_edges *hill)
+{
+	u32 prev_age = U32_MAX;
+	int n, i, best;
+
+	for (n = 0; n < TCP_SACK_HILLS; n++) {
+		best = -1;
+		for (i = 0; i < s->hill_cnt; i++) {
+			if (s->hills[i].age < prev_age &&
+			    (best < 0 || s->hills[i].age > s->hills[best].age))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		hill[n].l = htonl(s->hills[best].se.l);
+		hill[n].r = htonl(s->hills[best].se.r);
+		prev_age = s->hills[best].age;
+	}
+
+	return n;
+}
+
 /**
  * net_set_ack_options() - set TCP options in acknowledge packets
  * @b: the packet
+ * @payload_len: bytes of data in the packet
+ *
+ * Applications put their data where the header ends without SACK blocks,
+ * so only a packet without data reports them.
  *
  * Return: TCP header length
  */
-int net_set_ack_options(union tcp_build_pkt *b)
+int net_set_ack_options(union tcp_build_pkt *b, int payload_len)
 {
+	struct tcp_stream *s = tcp_cur;
+	int sack_len = 0;
+
 	b->sack.hdr.tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(TCP_HDR_SIZE));
 
 	b->sack.t_opt.kind = TCP_O_TS;
 	b->sack.t_opt.len = TCP_OPT_LEN_A;
 	b->sack.t_opt.t_snd = htons(loc_timestamp);
-	b->sack.t_opt.t_rcv = rmt_timestamp;
+	b->sack.t_opt.t_rcv = s->rmt_timestamp;
 	b->sack.sack_v.kind = TCP_1_NOP;
 	b->sack.sack_v.len = 0;
 
 	if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
-		if (tcp_lost.len > TCP_OPT_LEN_2) {
-			debug_cond(DEBUG_DEV_PKT, "TCP ack opt lost.len %x\n",
-				   tcp_lost.len);
-			b->sack.sack_v.len = tcp_lost.len;
+		if (s->hill_cnt && !payload_len) {
+			sack_len = TCP_OPT_LEN_2 + TCP_SACK_SIZE *
+				tcp_sack_hills(s, b->sack.sack_v.hill);
+			debug_cond(DEBUG_DEV_PKT, "TCP ack opt sack len %x\n",
+				   sack_len);
 			b->sack.sack_v.kind = TCP_V_SACK;
-			b->sack.sack_v.hill[0].l = htonl(tcp_lost.hill[0].l);
-			b->sack.sack_v.hill[0].r = htonl(tcp_lost.hill[0].r);
-
-			/*
-			 * These SACK structures are initialized with NOPs to
-			 * provide TCP header alignment padding. There are 4
-			 * SACK structures used for both header padding and
-			 * internally.
-			 */
-			b->sack.sack_v.hill[1].l = htonl(tcp_lost.hill[1].l);
-			b->sack.sack_v.hill[1].r = htonl(tcp_lost.hill[1].r);
-			b->sack.sack_v.hill[2].l = htonl(tcp_lost.hill[2].l);
-			b->sack.sack_v.hill[2].r = htonl(tcp_lost.hill[2].r);
-			b->sack.sack_v.hill[3].l = TCP_O_NOP;
-			b->sack.sack_v.hill[3].r = TCP_O_NOP;
+			b->sack.sack_v.len = sack_len;
 		}
 
 		b->sack.hdr.tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(ROUND_TCPHDR_LEN(TCP_HDR_SIZE +
 										 TCP_TSOPT_SIZE +
-										 tcp_lost.len));
+										 sack_len));
 	} else {
 		b->sack.sack_v.kind = 0;
 		b->sack.hdr.tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(ROUND_TCPHDR_LEN(TCP_HDR_SIZE +
@@ -210,8 +375,9 @@ int net_set_ack_options(union tcp_build_pkt *b)
  */
 void net_set_syn_options(union tcp_build_pkt *b)
 {
-	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
-		tcp_lost.len = 0;
+	struct tcp_stream *s = tcp_cur;
+
+	tcp_reset_rx(s);
 
 	b->ip.hdr.tcp_hlen = 0xa0;
 
@@ -231,7 +397,7 @@ void net_set_syn_options(union tcp_build_pkt *b)
 	b->ip.t_opt.kind = TCP_O_TS;
 	b->ip.t_opt.len = TCP_OPT_LEN_A;
 	loc_timestamp = get_ticks();
-	rmt_timestamp = 0;
+	s->rmt_timestamp = 0;
 	b->ip.t_opt.t_snd = 0;
 	b->ip.t_opt.t_rcv = 0;
 	b->ip.end = TCP_O_END;
@@ -241,9 +407,13 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 		       u8 action, u32 tcp_seq_num, u32 tcp_ack_num)
 {
 	union tcp_build_pkt *b = (union tcp_build_pkt *)pkt;
+	struct tcp_stream *s = tcp_stream_get(dport, sport, true);
 	int pkt_hdr_len;
 	int pkt_len;
 	int tcp_len;
+	u32 win;
+
+	tcp_cur = s;
 
 	/*
 	 * Header: 5 32 bit words. 4 bits TCP header Length,
@@ -264,16 +434,16 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 		tcp_seq_num = 0;
 		tcp_ack_num = 0;
 		pkt_hdr_len = IP_TCP_O_SIZE;
-		if (current_tcp_state == TCP_SYN_SENT) {  /* Too many SYNs */
+		if (s->state == TCP_SYN_SENT) {  /* Too many SYNs */
 			action = TCP_FIN;
-			current_tcp_state = TCP_FIN_WAIT_1;
+			s->state = TCP_FIN_WAIT_1;
 		} else {
-			current_tcp_state = TCP_SYN_SENT;
+			s->state = TCP_SYN_SENT;
 		}
 		break;
 	case TCP_SYN | TCP_ACK:
 	case TCP_ACK:
-		pkt_hdr_len = IP_HDR_SIZE + net_set_ack_options(b);
+		pkt_hdr_len = IP_HDR_SIZE + net_set_ack_options(b, payload_len);
 		b->ip.hdr.tcp_flags = action;
 		debug_cond(DEBUG_DEV_PKT,
 			   "TCP Hdr:ACK (%pI4, %pI4, s=%u, a=%u, A=%x)\n",
@@ -286,20 +456,20 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 			   &net_server_ip, &net_ip, tcp_seq_num, tcp_ack_num);
 		payload_len = 0;
 		pkt_hdr_len = IP_TCP_HDR_SIZE;
-		current_tcp_state = TCP_FIN_WAIT_1;
+		s->state = TCP_FIN_WAIT_1;
 		break;
 	case TCP_RST | TCP_ACK:
 	case TCP_RST:
 		debug_cond(DEBUG_DEV_PKT,
 			   "TCP Hdr:RST  (%pI4, %pI4, s=%u, a=%u)\n",
 			   &net_server_ip, &net_ip, tcp_seq_num, tcp_ack_num);
-		current_tcp_state = TCP_CLOSED;
+		s->state = TCP_CLOSED;
 		break;
 	/* Notify connection closing */
 	case (TCP_FIN | TCP_ACK):
 	case (TCP_FIN | TCP_ACK | TCP_PUSH):
-		if (current_tcp_state == TCP_CLOSE_WAIT)
-			current_tcp_state = TCP_CLOSING;
+		if (s->state == TCP_CLOSE_WAIT)
+			s->state = TCP_CLOSING;
 
 		debug_cond(DEBUG_DEV_PKT,
 			   "TCP Hdr:FIN ACK PSH(%pI4, %pI4, s=%u, a=%u, A=%x)\n",
@@ -307,7 +477,7 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 			   tcp_seq_num, tcp_ack_num, action);
 		fallthrough;
 	default:
-		pkt_hdr_len = IP_HDR_SIZE + net_set_ack_options(b);
+		pkt_hdr_len = IP_HDR_SIZE + net_set_ack_options(b, payload_len);
 		b->ip.hdr.tcp_flags = action | TCP_PUSH | TCP_ACK;
 		debug_cond(DEBUG_DEV_PKT,
 			   "TCP Hdr:dft  (%pI4, %pI4, s=%u, a=%u, A=%x)\n",
@@ -318,29 +488,41 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 	pkt_len	= pkt_hdr_len + payload_len;
 	tcp_len	= pkt_len - IP_HDR_SIZE;
 
-	tcp_ack_edge = tcp_ack_num;
+	/*
+	 * Once the other end's SYN is in, acknowledge whatever has arrived in
+	 * order, whichever data the application is replying to
+	 */
+	if (s->state != TCP_CLOSED &&
+	    s->state != TCP_SYN_SENT)
+		tcp_ack_num = s->ack_edge;
+	if (b->ip.hdr.tcp_flags & TCP_ACK) {
+		s->ack_sent = tcp_ack_num;
+		s->ack_now = false;
+		s->ack_segs = 0;
+	}
+
 	/* TCP Header */
-	b->ip.hdr.tcp_ack = htonl(tcp_ack_edge);
+	b->ip.hdr.tcp_ack = htonl(tcp_ack_num);
 	b->ip.hdr.tcp_src = htons(sport);
 	b->ip.hdr.tcp_dst = htons(dport);
 	b->ip.hdr.tcp_seq = htonl(tcp_seq_num);
 
 	/*
 	 * TCP window size - TCP header variable tcp_win.
-	 * Change tcp_win only if you have an understanding of network
-	 * overrun, congestion, TCP segment sizes, TCP windows, TCP scale,
-	 * queuing theory  and packet buffering. If there are too few buffers,
-	 * there will be data loss, recovery may work or the sending TCP,
-	 * the server, could abort the stream transmission.
-	 * MSS is governed by maximum Ethernet frame length.
-	 * The number of buffers is governed by the desire to have a queue of
-	 * full buffers to be processed at the destination to maximize
-	 * throughput. Temporary memory use for the boot phase on modern
-	 * SOCs is may not be considered a constraint to buffer space, if
-	 * it is, then the u-boot tftp or nfs kernel netboot should be
-	 * considered.
+	 * Offer the space the application has left for the stream, up to
+	 * TCP_RCV_WND. Applications such as wget write each segment straight
+	 * to its place in memory, so a large window costs no buffers here,
+	 * and keeps a fast sender busy across a long round trip. The window
+	 * is only scaled once both ends have agreed to it, and never in a SYN.
 	 */
-	b->ip.hdr.tcp_win = htons(PKTBUFSRX * TCP_MSS >> TCP_SCALE);
+	if (b->ip.hdr.tcp_flags & TCP_SYN) {
+		win = TCP_RCV_WND;
+	} else {
+		win = tcp_rcv_space(s);
+		if (s->wscale_ok)
+			win >>= TCP_SCALE;
+	}
+	b->ip.hdr.tcp_win = htons(min_t(u32, win, 0xffff));
 
 	b->ip.hdr.tcp_xsum = 0;
 	b->ip.hdr.tcp_ugr = 0;
@@ -355,152 +537,150 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 }
 
 /**
- * tcp_hole() - Selective Acknowledgment (Essential for fast stream transfer)
- * @tcp_seq_num: TCP sequence start number
- * @len: the length of sequence numbers
+ * tcp_hill_add() - remember data received beyond the ACK edge
+ * @s: connection
+ * @l: sequence number of the first byte
+ * @r: sequence number after the last byte
+ *
+ * Hills which touch the new one are merged into it. If there is no room,
+ * the furthest hill is forgotten; the data is in memory anyway, the sender
+ * just resends it.
  */
-void tcp_hole(u32 tcp_seq_num, u32 len)
+static void tcp_hill_add(struct tcp_stream *s, u32 l, u32 r)
 {
-	u32 idx_sack, sack_in;
-	u32 sack_end = TCP_SACK - 1;
-	u32 hill = 0;
-	enum pkt_state expect = PKT;
-	u32 seq = tcp_seq_num - tcp_seq_init;
-	u32 hol_l = tcp_ack_edge - tcp_seq_init;
-	u32 hol_r = 0;
-
-	/* Place new seq number in correct place in receive array */
-	if (prev_len == 0)
-		prev_len = len;
-
-	idx_sack = sack_idx + ((tcp_seq_num - tcp_ack_edge) / prev_len);
-	if (idx_sack < TCP_SACK) {
-		edge_a[idx_sack].se.l = tcp_seq_num;
-		edge_a[idx_sack].se.r = tcp_seq_num + len;
-		edge_a[idx_sack].st = PKT;
+	unsigned int i, j;
 
-		/*
-		 * The fin (last) packet is not the same length as data
-		 * packets, and if it's length is recorded and used for
-		 *  array index calculation, calculation breaks.
-		 */
-		if (prev_len < len)
-			prev_len = len;
+	/* Offsets from the ACK edge compare correctly across wrap-around */
+	for (i = 0; i < s->hill_cnt; i++) {
+		if (s->hills[i].se.r - s->ack_edge >= l - s->ack_edge)
+			break;
+	}
+	for (j = i; j < s->hill_cnt; j++) {
+		if (s->hills[j].se.l - s->ack_edge > r - s->ack_edge)
+			break;
+		if (s->hills[j].se.l - s->ack_edge < l - s->ack_edge)
+			l = s->hills[j].se.l;
+		if (s->hills[j].se.r - s->ack_edge > r - s->ack_edge)
+			r = s->hills[j].se.r;
 	}
 
-	debug_cond(DEBUG_DEV_PKT,
-		   "TCP 1 seq %d, edg %d, len %d, sack_idx %d, sack_end %d\n",
-		    seq, hol_l, len, sack_idx, sack_end);
-
-	/* Right edge of contiguous stream, is the left edge of first hill */
-	hol_l = tcp_seq_num - tcp_seq_init;
-	hol_r = hol_l + len;
+	if (j == i) {
+		if (s->hill_cnt == TCP_SACK) {
+			if (i == TCP_SACK)
+				return;
+			s->hill_cnt--;
+		}
+		memmove(&s->hills[i + 1], &s->hills[i],
+			(s->hill_cnt - i) * sizeof(*s->hills));
+		s->hill_cnt++;
+	} else if (j > i + 1) {
+		memmove(&s->hills[i + 1], &s->hills[j],
+			(s->hill_cnt - j) * sizeof(*s->hills));
+		s->hill_cnt -= j - i - 1;
+	}
+	s->hills[i].se.l = l;
+	s->hills[i].se.r = r;
+	s->hills[i].age = ++s->hill_age;
+}
 
-	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
-		tcp_lost.len = TCP_OPT_LEN_2;
+/**
+ * tcp_rx_data() - Selective Acknowledgment (Essential for fast stream transfer)
+ * @s: connection
+ * @tcp_seq_num: TCP sequence start number
+ * @len: the length of sequence numbers, trimmed to the receive window
+ *
+ * Move the ACK edge over data which arrived in order, and remember the
+ * rest as hills. Anything the sender should hear about at once, such as a
+ * new or filled hole or a duplicate, sets @s->ack_now.
+ */
+static void tcp_rx_data(struct tcp_stream *s, u32 tcp_seq_num, int *len)
+{
+	s32 wnd = tcp_rcv_space(s);
+	s32 l = tcp_seq_num - s->ack_edge;
+	s32 r = l + *len;
 
 	debug_cond(DEBUG_DEV_PKT,
-		   "TCP 1 in %d, seq %d, pkt_l %d, pkt_r %d, sack_idx %d, sack_end %d\n",
-		   idx_sack, seq, hol_l, hol_r, sack_idx, sack_end);
-
-	for (sack_in = sack_idx; sack_in < sack_end && hill < TCP_SACK_HILLS;
-	     sack_in++)  {
-		switch (expect) {
-		case NOPKT:
-			switch (edge_a[sack_in].st) {
-			case NOPKT:
-				debug_cond(DEBUG_INT_STATE, "N");
-				break;
-			case PKT:
-				debug_cond(DEBUG_INT_STATE, "n");
-				if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
-					tcp_lost.hill[hill].l =
-						edge_a[sack_in].se.l;
-					tcp_lost.hill[hill].r =
-						edge_a[sack_in].se.r;
-				}
-				expect = PKT;
-				break;
-			}
-			break;
-		case PKT:
-			switch (edge_a[sack_in].st) {
-			case NOPKT:
-				debug_cond(DEBUG_INT_STATE, "p");
-				if (sack_in > sack_idx &&
-				    hill < TCP_SACK_HILLS) {
-					hill++;
-					if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
-						tcp_lost.len += TCP_OPT_LEN_8;
-				}
-				expect = NOPKT;
-				break;
-			case PKT:
-				debug_cond(DEBUG_INT_STATE, "P");
-
-				if (tcp_ack_edge == edge_a[sack_in].se.l) {
-					tcp_ack_edge = edge_a[sack_in].se.r;
-					edge_a[sack_in].st = NOPKT;
-					sack_idx++;
-				} else {
-					if (IS_ENABLED(CONFIG_PROT_TCP_SACK) &&
-					    hill < TCP_SACK_HILLS)
-						tcp_lost.hill[hill].r =
-							edge_a[sack_in].se.r;
-				if (IS_ENABLED(CONFIG_PROT_TCP_SACK) &&
-				    sack_in == sack_end - 1)
-					tcp_lost.hill[hill].r =
-						edge_a[sack_in].se.r;
-				}
-				break;
-			}
-			break;
+		   "TCP rx seq %u, edge %u, len %d, wnd %d, hills %u\n",
+		   tcp_seq_num, s->ack_edge, *len, wnd, s->hill_cnt);
+
+	if (r <= 0) {
+		s->ack_now = true;
+		return;
+	}
+	if (r > wnd) {
+		s->ack_now = true;
+		if (l >= wnd) {
+			*len = 0;
+			return;
 		}
+		*len = wnd - l;
+		r = wnd;
+	}
+	if (l > 0) {
+		tcp_hill_add(s, tcp_seq_num, tcp_seq_num + *len);
+		s->ack_now = true;
+		return;
+	}
+
+	s->ack_edge += r;
+	s->ack_segs++;
+	while (s->hill_cnt && (s32)(s->hills[0].se.l - s->ack_edge) <= 0) {
+		if ((s32)(s->hills[0].se.r - s->ack_edge) > 0)
+			s->ack_edge = s->hills[0].se.r;
+		s->hill_cnt--;
+		memmove(&s->hills[0], &s->hills[1],
+			s->hill_cnt * sizeof(*s->hills));
+		s->ack_now = true;
 	}
-	debug_cond(DEBUG_INT_STATE, "\n");
-	if (!IS_ENABLED(CONFIG_PROT_TCP_SACK) || tcp_lost.len <= TCP_OPT_LEN_2)
-		sack_idx = 0;
 }
 
 /**
  * tcp_parse_options() - parsing TCP options
  * @o: pointer to the option field.
  * @o_len: length of the option field.
+ *
+ * The options are for the current connection.
  */
 void tcp_parse_options(uchar *o, int o_len)
 {
+	struct tcp_stream *s = tcp_cur;
 	struct tcp_t_opt  *tsopt;
+	uchar *end = o + o_len;
 	uchar *p = o;
 
 	/*
 	 * NOPs are options with a zero length, and thus are special.
 	 * All other options have length fields.
 	 */
-	for (p = o; p < (o + o_len); p = p + p[1]) {
-		if (!p[1])
+	while (p < end) {
+		if (p[0] == TCP_O_END)
 			return; /* Finished processing options */
+		if (p[0] == TCP_1_NOP) {
+			p++;
+			continue;
+		}
+		if (p + 1 >= end || p[1] < TCP_OPT_LEN_2 || p + p[1] > end)
+			return;
 
 		switch (p[0]) {
-		case TCP_O_END:
-			return;
-		case TCP_O_MSS:
 		case TCP_O_SCL:
+			s->wscale_ok = true;
+			break;
+		case TCP_O_MSS:
 		case TCP_P_SACK:
 		case TCP_V_SACK:
 			break;
 		case TCP_O_TS:
 			tsopt = (struct tcp_t_opt *)p;
-			rmt_timestamp = tsopt->t_snd;
-			return;
+			s->rmt_timestamp = tsopt->t_snd;
+			break;
 		}
-
-		/* Process optional NOPs */
-		if (p[0] == TCP_O_NOP)
-			p++;
+		p += p[1];
 	}
 }
 
-static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
+static u8 tcp_state_machine(struct tcp_stream *s, u8 tcp_flags,
+			    u32 tcp_seq_num, int *payload_len)
 {
 	u8 tcp_fin = tcp_flags & TCP_FIN;
 	u8 tcp_syn = tcp_flags & TCP_SYN;
@@ -508,7 +688,6 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 	u8 tcp_push = tcp_flags & TCP_PUSH;
 	u8 tcp_ack = tcp_flags & TCP_ACK;
 	u8 action = TCP_DATA;
-	int i;
 
 	/*
 	 * tcp_flags are examined to determine TX action in a given state
@@ -521,21 +700,22 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 	 */
 	debug_cond(DEBUG_INT_STATE, "TCP STATE ENTRY %x\n", action);
 	if (tcp_rst) {
-		action = TCP_DATA;
-		current_tcp_state = TCP_CLOSED;
-		net_set_state(NETLOOP_FAIL);
+		/* Let the app decide whether to give up or connect again */
+		s->state = TCP_CLOSED;
 		debug_cond(DEBUG_INT_STATE, "TCP Reset %x\n", tcp_flags);
-		return TCP_RST;
+		return TCP_RST | TCP_PUSH;
 	}
 
-	switch  (current_tcp_state) {
+	switch  (s->state) {
 	case TCP_CLOSED:
 		debug_cond(DEBUG_INT_STATE, "TCP CLOSED %x\n", tcp_flags);
 		if (tcp_syn) {
+			/* Our SYN-ACK offers no window scaling */
+			tcp_reset_rx(s);
 			action = TCP_SYN | TCP_ACK;
-			tcp_seq_init = tcp_seq_num;
-			tcp_ack_edge = tcp_seq_num + 1;
-			current_tcp_state = TCP_SYN_RECEIVED;
+			s->seq_init = tcp_seq_num;
+			s->ack_edge = tcp_seq_num + 1;
+			s->state = TCP_SYN_RECEIVED;
 		} else if (tcp_ack || tcp_fin) {
 			action = TCP_DATA;
 		}
@@ -546,18 +726,15 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 			   tcp_flags, tcp_seq_num);
 		if (tcp_fin) {
 			action = action | TCP_PUSH;
-			current_tcp_state = TCP_CLOSE_WAIT;
+			s->state = TCP_CLOSE_WAIT;
 		} else if (tcp_ack || (tcp_syn && tcp_ack)) {
 			action |= TCP_ACK;
-			tcp_seq_init = tcp_seq_num;
-			tcp_ack_edge = tcp_seq_num + 1;
-			sack_idx = 0;
-			edge_a[sack_idx].se.l = tcp_ack_edge;
-			edge_a[sack_idx].se.r = tcp_ack_edge;
-			prev_len = 0;
-			current_tcp_state = TCP_ESTABLISHED;
-			for (i = 0; i < TCP_SACK; i++)
-				edge_a[i].st = NOPKT;
+			/* A passive open already has this from the SYN */
+			if (s->state == TCP_SYN_SENT) {
+				s->seq_init = tcp_seq_num;
+				s->ack_edge = tcp_seq_num + 1;
+			}
+			s->state = TCP_ESTABLISHED;
 
 			if (tcp_syn && tcp_ack)
 				action |= TCP_PUSH;
@@ -567,16 +744,23 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 		break;
 	case TCP_ESTABLISHED:
 		debug_cond(DEBUG_INT_STATE, "TCP_ESTABLISHED %x\n", tcp_flags);
-		if (payload_len > 0) {
-			tcp_hole(tcp_seq_num, payload_len);
-			tcp_fin = TCP_DATA;  /* cause standalone FIN */
+		if (tcp_fin) {
+			s->fin_pending = true;
+			s->fin_seq = tcp_seq_num + *payload_len;
+		}
+		if (*payload_len > 0) {
+			tcp_rx_data(s, tcp_seq_num, payload_len);
+			if (!*payload_len)
+				break;  /* outside the window */
 		}
 
-		if ((tcp_fin) &&
-		    (!IS_ENABLED(CONFIG_PROT_TCP_SACK) ||
-		     tcp_lost.len <= TCP_OPT_LEN_2)) {
+		/* The FIN only counts once everything before it is in */
+		if (s->fin_pending && s->ack_edge == s->fin_seq) {
+			s->fin_pending = false;
+			s->ack_edge++;
+			s->ack_now = true;
 			action = action | TCP_FIN | TCP_PUSH | TCP_ACK;
-			current_tcp_state = TCP_CLOSE_WAIT;
+			s->state = TCP_CLOSE_WAIT;
 		} else if (tcp_ack) {
 			action = TCP_DATA;
 		}
@@ -594,7 +778,7 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 		debug_cond(DEBUG_INT_STATE, "TCP_FIN_WAIT_2 (%x)\n", tcp_flags);
 		if (tcp_ack) {
 			action = TCP_PUSH | TCP_ACK;
-			current_tcp_state = TCP_CLOSED;
+			s->state = TCP_CLOSED;
 			puts("\n");
 		} else if (tcp_syn) {
 			action = TCP_DATA;
@@ -605,20 +789,20 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 	case TCP_FIN_WAIT_1:
 		debug_cond(DEBUG_INT_STATE, "TCP_FIN_WAIT_1 (%x)\n", tcp_flags);
 		if (tcp_fin) {
-			tcp_ack_edge++;
+			s->ack_edge++;
 			action = TCP_ACK | TCP_FIN;
-			current_tcp_state = TCP_FIN_WAIT_2;
+			s->state = TCP_FIN_WAIT_2;
 		}
 		if (tcp_syn)
 			action = TCP_RST;
 		if (tcp_ack)
-			current_tcp_state = TCP_CLOSED;
+			s->state = TCP_CLOSED;
 		break;
 	case TCP_CLOSING:
 		debug_cond(DEBUG_INT_STATE, "TCP_CLOSING (%x)\n", tcp_flags);
 		if (tcp_ack) {
 			action = TCP_PUSH;
-			current_tcp_state = TCP_CLOSED;
+			s->state = TCP_CLOSED;
 			puts("\n");
 		} else if (tcp_syn) {
 			action = TCP_RST;
@@ -630,6 +814,53 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 	return action;
 }
 
+static void tcp_send_ack(struct tcp_stream *s)
+{
+	net_send_tcp_packet(0, s->rmt_port, s->loc_port, TCP_ACK,
+			    s->rmt_ack, s->ack_edge);
+}
+
+/**
+ * tcp_delayed_ack() - acknowledge received data, if it is worth it yet
+ * @s: connection
+ *
+ * Nothing is sent if the application's reply has already carried the ACK.
+ * The sender hears about holes, duplicates and FINs straight away, but
+ * in-order data is only acknowledged every TCP_DELACK_SEGS segments, or by
+ * tcp_delayed_ack_check() after TCP_DELACK_TIMEOUT.
+ */
+static void tcp_delayed_ack(struct tcp_stream *s)
+{
+	if (s->state != TCP_ESTABLISHED &&
+	    s->state != TCP_CLOSE_WAIT)
+		return;
+	if (!s->ack_now && s->ack_sent == s->ack_edge)
+		return;
+
+	if (s->ack_now || s->ack_segs >= TCP_DELACK_SEGS)
+		tcp_send_ack(s);
+	else if (s->ack_segs == 1)
+		s->ack_time = get_timer(0);
+}
+
+/**
+ * tcp_delayed_ack_check() - send a delayed ACK which is due
+ *
+ * Called from the network loop, as the other end may send nothing more
+ * until it hears from us.
+ */
+void tcp_delayed_ack_check(void)
+{
+	struct tcp_stream *s;
+
+	for (s = tcp_streams; s < tcp_streams + TCP_STREAMS; s++) {
+		if ((s->state == TCP_ESTABLISHED ||
+		     s->state == TCP_CLOSE_WAIT) && s->ack_segs &&
+		    get_timer(s->ack_time) >= TCP_DELACK_TIMEOUT)
+			tcp_send_ack(s);
+	}
+}
+
 /**
  * rxhand_tcp_f() - process receiving data and call data handler.
  * @b: the packet
@@ -642,6 +873,8 @@ void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int pkt_len)
 	u8  tcp_action = TCP_DATA;
 	u32 tcp_seq_num, tcp_ack_num;
 	int tcp_hdr_len, payload_len;
+	struct tcp_stream *s;
+	uchar *payload;
 
 	/* Verify IP header */
 	debug_cond(DEBUG_DEV_PKT,
@@ -672,6 +905,16 @@ void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int pkt_len)
 
 	tcp_hdr_len = GET_TCP_HDR_LEN_IN_BYTES(b->ip.hdr.tcp_hlen);
 	payload_len = tcp_len - tcp_hdr_len;
+	payload = (uchar *)b + pkt_len - payload_len;
+
+	/* Only a connection which is closed can be taken over by a new one */
+	s = tcp_stream_get(ntohs(b->ip.hdr.tcp_src), ntohs(b->ip.hdr.tcp_dst),
+			   false);
+	if (!s) {
+		debug_cond(DEBUG_DEV_PKT, "TCP RX no free connection\n");
+		return;
+	}
+	tcp_cur = s;
 
 	if (tcp_hdr_len > TCP_HDR_SIZE)
 		tcp_parse_options((uchar *)b + IP_TCP_HDR_SIZE,
@@ -682,10 +925,14 @@ void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int pkt_len)
 	 */
 	tcp_seq_num = ntohl(b->ip.hdr.tcp_seq);
 	tcp_ack_num = ntohl(b->ip.hdr.tcp_ack);
+	s->rmt_ack = tcp_ack_num;
 
-	/* Packets are not ordered. Send to app as received. */
-	tcp_action = tcp_state_machine(b->ip.hdr.tcp_flags,
-				       tcp_seq_num, payload_len);
+	/*
+	 * Packets are not ordered. Send to app as received, so it must place
+	 * the data by its sequence number.
+	 */
+	tcp_action = tcp_state_machine(s, b->ip.hdr.tcp_flags,
+				       tcp_seq_num, &payload_len);
 
 	tcp_activity_count++;
 	if (tcp_activity_count > TCP_ACTIVITY) {
@@ -698,14 +945,14 @@ void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int pkt_len)
 			   "TCP Notify (action=%x, Seq=%u,Ack=%u,Pay%d)\n",
 			   tcp_action, tcp_seq_num, tcp_ack_num, payload_len);
 
-		(*tcp_packet_handler) ((uchar *)b + pkt_len - payload_len, b->ip.hdr.tcp_dst,
+		(*tcp_packet_handler) (payload, b->ip.hdr.tcp_dst,
 				       b->ip.hdr.ip_src, b->ip.hdr.tcp_src, tcp_seq_num,
 				       tcp_ack_num, tcp_action, payload_len);
 
 	} else if (tcp_action != TCP_DATA) {
 		debug_cond(DEBUG_DEV_PKT,
 			   "TCP Action (action=%x,Seq=%u,Ack=%u,Pay=%d)\n",
-			   tcp_action, tcp_ack_num, tcp_ack_edge, payload_len);
+			   tcp_action, tcp_ack_num, s->ack_edge, payload_len);
 
 		/*
 		 * Warning: Incoming Ack & Seq sequence numbers are transposed
@@ -714,6 +961,8 @@ void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int pkt_len)
 		net_send_tcp_packet(0, ntohs(b->ip.hdr.tcp_src),
 				    ntohs(b->ip.hdr.tcp_dst),
 				    (tcp_action & (~TCP_PUSH)),
-				    tcp_ack_num, tcp_ack_edge);
+				    tcp_ack_num, s->ack_edge);
 	}
+
+	tcp_delayed_ack(s);
 }
@@ -13,6 +13,7 @@
 #include <image.h>
 #include <lmb.h>
 #include <log.h>
+#include <malloc.h>
 #include <mapmem.h>
 #include <net.h>
 #include <net6.h>
@@ -28,6 +29,10 @@ DECLARE_GLOBAL_DATA_PTR;
 #define TIMEOUT		5000UL
 /* Number of "loading" hashes per line (for checking the image size) */
 #define HASHES_PER_LINE	65
+/* Shortest time to wait for a stalled window before asking again, in ms */
+#define TFTP_RTO_MIN	100
+/* Blocks kept when they arrive after a missing one */
+#define TFTP_AHEAD_MAX	64
 
 /*
  *	TFTP operations.
@@ -98,6 +103,49 @@ static ushort	tftp_windowsize;
 static ushort	tftp_next_ack;
 /* Last nack block we send */
 static ushort	tftp_last_nack;
+/* Blocks stored ahead of the next one expected, bit n is that block + 1 + n */
+static u64	tftp_ahead;
+/* Set if the last block, tftp_final_block, is among those stored ahead */
+static bool	tftp_final_ahead;
+static ushort	tftp_final_block;
+/* Number of times the window to ask for has been halved after losses */
+static int	tftp_window_shift;
+/* Time to wait for the next block before asking again, in ms */
+static ulong	tftp_rto;
+/* Smoothed round-trip time times 8 and its mean deviation times 4, in ms */
+static long	tftp_srtt;
+static long	tftp_rttvar;
+/* When the last ACK was sent, if it was not sent again since */
+static ulong	tftp_ack_time;
+static bool	tftp_timing;
+
+/**
+ * struct tftp_stats - Counts for the summary printed after a download
+ *
+ * @blocks: data blocks stored
+ * @lost: blocks which had to be asked for again
+ * @repeated: data blocks which had been received already
+ * @timeouts: times the server was asked again because nothing came
+ */
+static struct tftp_stats {
+	ulong blocks;
+	ulong lost;
+	ulong repeated;
+	ulong timeouts;
+} tftp_stats;
+/* Set if the download is to be asked for by multicast (RFC2090) */
+static bool	tftp_mcast_wanted;
+/* Set once the server has agreed to send the blocks to a multicast group */
+static bool	tftp_mcast_active;
+/* Set while the server wants us to acknowledge the blocks */
+static bool	tftp_mcast_master;
+/* Port the blocks are sent to in the group */
+static int	tftp_mcast_port;
+/* Blocks received, bit n for block n */
+static u8	*tftp_mcast_bitmap;
+/* First block not received yet, and the last block (0 = not known yet) */
+static ulong	tftp_mcast_next;
+static ulong	tftp_mcast_end;
 #ifdef CONFIG_CMD_TFTPPUT
 /* 1 if writing, else 0 */
 static int	tftp_put_active;
@@ -190,11 +238,32 @@ static void new_transfer(void)
 	tftp_prev_block = 0;
 	tftp_block_wrap = 0;
 	tftp_block_wrap_offset = 0;
+	tftp_ahead = 0;
+	tftp_final_ahead = false;
 #ifdef CONFIG_CMD_TFTPPUT
 	tftp_put_final_block_sent = 0;
 #endif
 }
 
+/* Check if the blocks are coming by multicast */
+static bool tftp_mcast(void)
+{
+	return IS_ENABLED(CONFIG_MCAST_TFTP) && tftp_mcast_active;
+}
+
+/* Leave the multicast group, if one was joined */
+static void tftp_mcast_stop(void)
+{
+	if (!tftp_mcast())
+		return;
+
+	eth_mcast_join(net_mcast_addr, 0);
+	net_mcast_addr.s_addr = 0;
+	free(tftp_mcast_bitmap);
+	tftp_mcast_bitmap = NULL;
+	tftp_mcast_active = false;
+}
+
 #ifdef CONFIG_CMD_TFTPPUT
 /**
  * Load the next block from memory to be sent over tftp.
@@ -283,6 +352,60 @@ static void update_block_number(void)
 	show_block_marker();
 }
 
+/* Window size to ask the server for */
+static ushort tftp_window_request(void)
+{
+	return max(tftp_window_size_option >> tftp_window_shift, 1);
+}
+
+/*
+ * The window size is only agreed in the request, so losses in a download
+ * shrink the window asked for in the next one. Halve it after a download
+ * which lost blocks and double it again after one which did not, up to
+ * tftpwindowsize.
+ */
+static void tftp_window_adapt(void)
+{
+	if (tftp_stats.lost || tftp_stats.timeouts) {
+		if (tftp_window_request() > 1)
+			tftp_window_shift++;
+	} else if (tftp_window_shift) {
+		tftp_window_shift--;
+	}
+}
+
+/* Note the time of an ACK, to measure how long the next block takes */
+static void tftp_ack_timing(void)
+{
+	tftp_ack_time = get_timer(0);
+	tftp_timing = true;
+}
+
+/*
+ * Update the time to wait for a block which does not come, as TCP does
+ * (RFC 6298), with the round-trip time of the last ACK if there is one
+ */
+static void tftp_update_rto(void)
+{
+	long rtt, delta;
+
+	if (tftp_timing) {
+		rtt = get_timer(tftp_ack_time);
+		if (tftp_srtt < 0) {
+			tftp_srtt = rtt << 3;
+			tftp_rttvar = rtt << 1;
+		} else {
+			delta = rtt - (tftp_srtt >> 3);
+			tftp_srtt += delta;
+			tftp_rttvar += abs(delta) - (tftp_rttvar >> 2);
+		}
+		tftp_timing = false;
+	}
+	if (tftp_srtt >= 0)
+		tftp_rto = clamp_t(ulong, (tftp_srtt >> 3) + tftp_rttvar,
+				   TFTP_RTO_MIN, timeout_ms);
+}
+
 /* The TFTP get or put is complete */
 static void tftp_complete(void)
 {
@@ -301,11 +424,19 @@ static void tftp_complete(void)
 		print_size(net_boot_file_size /
 			time_start * 1000, "/s");
 	}
+	if (!tftp_put_active) {
+		printf("\n\t %lu blocks, window %d: %lu lost, %lu repeated, %lu timeouts",
+		       tftp_stats.blocks, tftp_windowsize, tftp_stats.lost,
+		       tftp_stats.repeated, tftp_stats.timeouts);
+		if (!tftp_mcast())
+			tftp_window_adapt();
+	}
 	puts("\ndone\n");
 	if (!tftp_put_active)
 		efi_set_bootdev("Net", "", tftp_filename,
 				map_sysmem(tftp_load_addr, 0),
 				net_boot_file_size);
+	tftp_mcast_stop();
 	net_set_state(NETLOOP_SUCCESS);
 }
 
@@ -360,9 +491,14 @@ static void tftp_send(void)
 		 * Implemented only for tftp get.
 		 * Don't bother sending if it's 1
 		 */
-		if (tftp_state == STATE_SEND_RRQ && tftp_window_size_option > 1)
+		if (tftp_state == STATE_SEND_RRQ && !tftp_mcast_wanted &&
+		    tftp_window_request() > 1)
 			pkt += sprintf((char *)pkt, "windowsize%c%d%c",
-					0, tftp_window_size_option, 0);
+					0, tftp_window_request(), 0);
+
+		/* The server fills in the group, port and master client */
+		if (tftp_state == STATE_SEND_RRQ && tftp_mcast_wanted)
+			pkt += sprintf((char *)pkt, "multicast%c%c", 0, 0);
 		len = pkt - xp;
 		break;
 
@@ -436,8 +572,10 @@ static void tftp_send(void)
 		net_send_udp_packet(net_server_ethaddr, tftp_remote_ip,
 				    tftp_remote_port, tftp_our_port, len);
 
-	if (err_pkt)
+	if (err_pkt) {
+		tftp_mcast_stop();
 		net_set_state(NETLOOP_FAIL);
+	}
 }
 
 #ifdef CONFIG_CMD_TFTPPUT
@@ -452,6 +590,208 @@ static void icmp_handler(unsigned type, unsigned code, unsigned dest,
 }
 #endif
 
+/*
+ * Ask the server to go on from the block after tftp_cur_block, which may be
+ * before the end of the window it sent
+ */
+static void tftp_send_nack(void)
+{
+	tftp_send();
+	tftp_ack_timing();
+	tftp_last_nack = tftp_cur_block;
+	tftp_next_ack = (ushort)(tftp_cur_block + tftp_windowsize);
+}
+
+/*
+ * Handle a data block which is not the next one expected. One from further
+ * on is kept, so that only the blocks missing before it have to come again.
+ */
+static void tftp_data_ahead(ushort block, uchar *src, unsigned int len)
+{
+	ushort ahead = block - (ushort)(tftp_cur_block + 1);
+	u64 bit;
+
+	/* An old block, e.g. from a window which the server sent again */
+	if (ahead >= TFTP_SEQUENCE_SIZE / 2) {
+		tftp_stats.repeated++;
+		return;
+	}
+
+	if (tftp_state == STATE_DATA && ahead <= TFTP_AHEAD_MAX &&
+	    len <= tftp_block_size) {
+		bit = 1ULL << (ahead - 1);
+		if (tftp_ahead & bit) {
+			tftp_stats.repeated++;
+		} else {
+			if (store_block(tftp_cur_block + 1 + ahead, src, len)) {
+				eth_halt();
+				net_set_state(NETLOOP_FAIL);
+				return;
+			}
+			tftp_ahead |= bit;
+			tftp_stats.blocks++;
+			if (len < tftp_block_size) {
+				tftp_final_ahead = true;
+				tftp_final_block = block;
+			}
+		}
+	}
+
+	/*
+	 * If one packet is dropped most likely
+	 * all other buffers in the window
+	 * that will arrive will cause a sending NACK.
+	 * This just overwellms the server, let's just send one.
+	 */
+	if (tftp_last_nack != tftp_cur_block) {
+		tftp_stats.lost += ahead;
+		tftp_send_nack();
+	}
+}
+
+/*
+ * Move past the blocks stored ahead which follow on from tftp_cur_block, then
+ * have the server carry on after them
+ */
+static void tftp_take_ahead(void)
+{
+	bool stored;
+
+	do {
+		tftp_cur_block = (tftp_cur_block + 1) % TFTP_SEQUENCE_SIZE;
+		update_block_number();
+		tftp_prev_block = tftp_cur_block;
+		if (tftp_final_ahead && tftp_cur_block == tftp_final_block) {
+			tftp_send();
+			tftp_complete();
+			return;
+		}
+		stored = tftp_ahead & 1;
+		tftp_ahead >>= 1;
+	} while (stored);
+
+	/* There is another gap before the next block stored ahead */
+	if (tftp_ahead)
+		tftp_stats.lost += __ffs64(tftp_ahead) + 1;
+	tftp_send_nack();
+}
+
+/*
+ * Handle the multicast option of an OACK, "addr,port,mc". The first one gives
+ * the group to join. Later ones may leave out the address and port, and just
+ * say whether we are now the master client, which acknowledges the blocks.
+ */
+static int tftp_mcast_oack(const char *val, int len)
+{
+	struct in_addr addr;
+	char buf[32];
+	char *port, *mc;
+	int ret;
+
+	if (len <= 0)
+		return -EINVAL;
+	strlcpy(buf, val, min(len + 1, (int)sizeof(buf)));
+	port = strchr(buf, ',');
+	mc = port ? strchr(port + 1, ',') : NULL;
+	if (!mc)
+		return -EINVAL;
+	*port++ = '\0';
+	*mc++ = '\0';
+
+	if (!tftp_mcast_active) {
+		addr = string_to_ip(buf);
+		if ((ntohl(addr.s_addr) >> 28) != 0xe || !*port)
+			return -EINVAL;
+		tftp_mcast_bitmap = calloc(TFTP_SEQUENCE_SIZE / 8, 1);
+		if (!tftp_mcast_bitmap)
+			return -ENOMEM;
+		ret = eth_mcast_join(addr, 1);
+		if (ret) {
+			printf("Cannot join multicast group %pI4 (err=%d)\n",
+			       &addr, ret);
+			free(tftp_mcast_bitmap);
+			tftp_mcast_bitmap = NULL;
+			return ret;
+		}
+		net_mcast_addr = addr;
+		tftp_mcast_port = dectoul(port, NULL);
+		tftp_mcast_active = true;
+		tftp_mcast_next = 1;
+		tftp_mcast_end = 0;
+		new_transfer();
+	}
+	tftp_mcast_master = dectoul(mc, NULL) == 1;
+	debug("multicast %pI4:%d%s\n", &net_mcast_addr, tftp_mcast_port,
+	      tftp_mcast_master ? ", master" : "");
+
+	return 0;
+}
+
+/*
+ * Tell the server the first block we are missing, by acknowledging the one
+ * before it. Only the master client does this as the blocks come, but any
+ * client acknowledges the last block once it has them all, so that the server
+ * can move on to another one.
+ */
+static void tftp_mcast_ack(void)
+{
+	tftp_cur_block = tftp_mcast_next - 1;
+	if (tftp_mcast_end && tftp_mcast_next > tftp_mcast_end) {
+		tftp_send();
+		tftp_complete();
+		return;
+	}
+	if (tftp_mcast_master)
+		tftp_send();
+}
+
+/*
+ * Handle a block sent to the group. They may come in any order, since the
+ * server sends those missed by each client in turn.
+ */
+static void tftp_mcast_data(ushort block, uchar *src, unsigned int len)
+{
+	u8 bit = 1 << (block % 8);
+
+	if (!block || len > tftp_block_size ||
+	    (tftp_mcast_end && block > tftp_mcast_end) ||
+	    (tftp_mcast_bitmap[block / 8] & bit)) {
+		tftp_stats.repeated++;
+		return;
+	}
+
+	if (store_block(block, src, len)) {
+		tftp_mcast_stop();
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+	tftp_mcast_bitmap[block / 8] |= bit;
+	if (!(tftp_stats.blocks % 10))
+		putc('#');
+	else if (!((tftp_stats.blocks + 1) % (10 * HASHES_PER_LINE)))
+		puts("\n\t ");
+	tftp_stats.blocks++;
+	timeout_count_max = tftp_timeout_count_max;
+	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+
+	if (len < tftp_block_size)
+		tftp_mcast_end = block;
+	while (tftp_mcast_next < TFTP_SEQUENCE_SIZE &&
+	       tftp_mcast_bitmap[tftp_mcast_next / 8] &
+	       (1 << (tftp_mcast_next % 8)))
+		tftp_mcast_next++;
+	if (tftp_mcast_next == TFTP_SEQUENCE_SIZE && !tftp_mcast_end) {
+		puts("\nTFTP error: too many blocks for multicast\n");
+		tftp_mcast_stop();
+		eth_halt();
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+
+	tftp_mcast_ack();
+}
+
 static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			 unsigned src, unsigned len)
 {
@@ -460,9 +800,9 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 	int i;
 	u16 timeout_val_rcvd;
 
-	if (dest != tftp_our_port) {
-			return;
-	}
+	if (dest != tftp_our_port &&
+	    !(tftp_mcast() && dest == tftp_mcast_port))
+		return;
 	if (tftp_state != STATE_SEND_RRQ && src != tftp_remote_port &&
 	    tftp_state != STATE_RECV_WRQ && tftp_state != STATE_SEND_WRQ)
 		return;
@@ -568,6 +908,15 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 				debug("windowsize = %s, %d\n",
 				      (char *)pkt + i + 11, tftp_windowsize);
 			}
+			if (IS_ENABLED(CONFIG_MCAST_TFTP) &&
+			    tftp_mcast_wanted &&
+			    strcasecmp((char *)pkt + i, "multicast") == 0 &&
+			    tftp_mcast_oack((char *)pkt + i + 10,
+					    len - i - 10)) {
+				printf("Invalid multicast(=%s)\n",
+				       (char *)pkt + i + 10);
+				tftp_state = STATE_INVALID_OPTION;
+			}
 		}
 
 		tftp_next_ack = tftp_windowsize;
@@ -579,6 +928,11 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			tftp_cur_block++;
 		}
 #endif
+		if (tftp_mcast() && tftp_state == STATE_OACK) {
+			tftp_state = STATE_DATA;
+			tftp_mcast_ack();
+			break;
+		}
 		tftp_send(); /* Send ACK or first data block */
 		break;
 	case TFTP_DATA:
@@ -586,30 +940,16 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			return;
 		len -= 2;
 
+		if (tftp_mcast()) {
+			tftp_mcast_data(ntohs(*(__be16 *)pkt), pkt + 2, len);
+			break;
+		}
+
 		if (ntohs(*(__be16 *)pkt) != (ushort)(tftp_cur_block + 1)) {
 			debug("Received unexpected block: %d, expected: %d\n",
 			      ntohs(*(__be16 *)pkt),
 			      (ushort)(tftp_cur_block + 1));
-			/*
-			 * Only ACK if the block count received is greater than
-			 * the expected block count, otherwise skip ACK.
-			 * (required to properly handle the server retransmitting
-			 *  the window)
-			 */
-			if ((ushort)(tftp_cur_block + 1) - (short)(ntohs(*(__be16 *)pkt)) > 0)
-				break;
-			/*
-			 * If one packet is dropped most likely
-			 * all other buffers in the window
-			 * that will arrive will cause a sending NACK.
-			 * This just overwellms the server, let's just send one.
-			 */
-			if (tftp_last_nack != tftp_cur_block) {
-				tftp_send();
-				tftp_last_nack = tftp_cur_block;
-				tftp_next_ack = (ushort)(tftp_cur_block +
-							 tftp_windowsize);
-			}
+			tftp_data_ahead(ntohs(*(__be16 *)pkt), pkt + 2, len);
 			break;
 		}
 
@@ -640,19 +980,22 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 		if (tftp_cur_block == tftp_prev_block) {
 			/* Same block again; ignore it. */
+			tftp_stats.repeated++;
 			break;
 		}
 
 		update_block_number();
 		tftp_prev_block = tftp_cur_block;
 		timeout_count_max = tftp_timeout_count_max;
-		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+		tftp_update_rto();
+		net_set_timeout_handler(tftp_rto, tftp_timeout_handler);
 
 		if (store_block(tftp_cur_block, pkt + 2, len)) {
 			eth_halt();
 			net_set_state(NETLOOP_FAIL);
 			break;
 		}
+		tftp_stats.blocks++;
 
 		if (len < tftp_block_size) {
 			tftp_send();
@@ -660,12 +1003,21 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			break;
 		}
 
+		/* The blocks which follow may have come already */
+		if (tftp_ahead & 1) {
+			tftp_ahead >>= 1;
+			tftp_take_ahead();
+			break;
+		}
+		tftp_ahead >>= 1;
+
 		/*
 		 *	Acknowledge the block just received, which will prompt
 		 *	the remote for the next one.
 		 */
 		if (tftp_cur_block == tftp_next_ack) {
 			tftp_send();
+			tftp_ack_timing();
 			tftp_next_ack += tftp_windowsize;
 		}
 		break;
@@ -698,13 +1050,39 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 static void tftp_timeout_handler(void)
 {
+	bool receiving = tftp_state == STATE_DATA && !tftp_put_active;
+
+	/*
+	 * When a window stalls, ask for the rest of it well before the
+	 * server's own timeout, waiting twice as long each time
+	 */
+	if (tftp_rto < timeout_ms) {
+		tftp_stats.timeouts++;
+		tftp_rto = min(tftp_rto * 2, timeout_ms);
+		net_set_timeout_handler(tftp_rto, tftp_timeout_handler);
+		tftp_send();
+		tftp_timing = false;
+		tftp_next_ack = (ushort)(tftp_cur_block + tftp_windowsize);
+		return;
+	}
+
 	if (++timeout_count > timeout_count_max) {
+		if (receiving) {
+			tftp_stats.timeouts++;
+			tftp_window_adapt();
+		}
 		restart("Retry count exceeded");
 	} else {
 		puts("T ");
 		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
 		if (tftp_state != STATE_RECV_WRQ)
 			tftp_send();
+		if (receiving) {
+			tftp_stats.timeouts++;
+			tftp_timing = false;
+			tftp_next_ack = (ushort)(tftp_cur_block +
+						 tftp_windowsize);
+		}
 	}
 }
 
@@ -944,6 +1322,15 @@ void tftp_start(enum proto_t protocol)
 	tftp_cur_block = 0;
 	tftp_windowsize = 1;
 	tftp_last_nack = 0;
+	tftp_mcast_stop();
+	tftp_mcast_wanted = IS_ENABLED(CONFIG_MCAST_TFTP) &&
+			    protocol == TFTPGET &&
+			    !(IS_ENABLED(CONFIG_IPV6) && use_ip6) &&
+			    env_get_yesno("tftpmcast") == 1;
+	tftp_rto = timeout_ms;
+	tftp_srtt = -1;
+	tftp_timing = false;
+	memset(&tftp_stats, '\0', sizeof(tftp_stats));
 	/* zero out server ether in case the server ip has changed */
 	memset(net_server_ethaddr, 0, 6);
 	/* Revert tftp_block_size to dflt */
@@ -984,6 +1371,10 @@ void tftp_start_server(void)
 	tftp_our_port = WELL_KNOWN_PORT;
 	tftp_windowsize = 1;
 	tftp_next_ack = tftp_windowsize;
+	tftp_rto = timeout_ms;
+	tftp_srtt = -1;
+	tftp_timing = false;
+	memset(&tftp_stats, '\0', sizeof(tftp_stats));
 
 #ifdef CONFIG_TFTP_TSIZE
 	tftp_tsize = 0;
@@ -22,49 +22,93 @@ DECLARE_GLOBAL_DATA_PTR;
 /* The default, change with environment variable 'httpdstp' */
 #define SERVER_PORT		80
 
+/* Room for the response header; the body goes straight to memory */
+#define WGET_HDR_SIZE		2048
+
+/*
+ * With more than one connection (environment variable 'httpconns'), the
+ * first request asks for this much of the file, and the answer says how
+ * large the file is. The rest is then shared between the connections.
+ */
+#define WGET_RANGE_FIRST	0x100000
+
 static const char bootfile1[] = "GET ";
-static const char bootfile3[] = " HTTP/1.0\r\n\r\n";
+static const char bootfile3[] = " HTTP/1.0\r\n";
+static const char http_keep_alive[] = "Connection: keep-alive\r\n";
+static const char http_range[] = "Range: bytes=%lu-%lu\r\n";
 static const char http_eom[] = "\r\n\r\n";
-static const char http_ok[] = "200";
 static const char content_len[] = "Content-Length";
+static const char content_range[] = "Content-Range";
+static const char connection[] = "Connection";
+static const char keep_alive[] = "keep-alive";
 static const char linefeed[] = "\r\n";
 static struct in_addr web_server_ip;
-static int our_port;
+static unsigned int server_port;
 static int wget_timeout_count;
 
-struct pkt_qd {
-	uchar *pkt;
-	unsigned int tcp_seq_num;
-	unsigned int len;
+static unsigned int packets;
+
+/**
+ * struct wget_conn - an HTTP connection
+ * @state: progress of the connection's request
+ * @port: our TCP port
+ * @reused: the request went out on a connection kept open from before
+ * @keep_alive: the server keeps the connection open after the response
+ * @seq: our next sequence number
+ * @req_seq: sequence number of the request
+ * @resp_seq: sequence number of the start of the response
+ * @body_seq: sequence number of the start of the body
+ * @offset: where in the file the body goes
+ * @req_len: bytes requested, 0 for the whole file
+ * @len: length of the body, -1 if the server does not say
+ * @hdr: start of the response, until the end of the header is in
+ * @hdr_len: bytes stored in @hdr
+ * @hdr_scanned: bytes of @hdr already searched for the end of the header
+ * @retry_action: actions for TCP retry
+ * @retry_tcp_ack_num: TCP retry acknowledge number
+ * @retry_tcp_seq_num: TCP retry sequence number
+ * @retry_len: TCP retry length
+ */
+struct wget_conn {
+	enum wget_state state;
+	unsigned int port;
+	bool reused;
+	bool keep_alive;
+	u32 seq;
+	u32 req_seq;
+	u32 resp_seq;
+	u32 body_seq;
+	ulong offset;
+	ulong req_len;
+	long len;
+	char hdr[WGET_HDR_SIZE + 1];
+	unsigned int hdr_len;
+	unsigned int hdr_scanned;
+	u8 retry_action;
+	unsigned int retry_tcp_ack_num;
+	unsigned int retry_tcp_seq_num;
+	int retry_len;
 };
 
 /*
- * This is a control structure for out of order packets received.
- * The actual packet bufers are in the kernel space, and are
- * expected to be overwritten by the downloaded image.
+ * Connections which the server keeps open are used again by the next
+ * transfer from the same server
  */
-#define PKTQ_SZ (PKTBUFSRX / 4)
-static struct pkt_qd pkt_q[PKTQ_SZ];
-static int pkt_q_idx;
-static unsigned long content_length;
-static unsigned int packets;
-
-static unsigned int initial_data_seq_num;
-static unsigned int next_data_seq_num;
+static struct wget_conn wget_conns[TCP_STREAMS];
+static int wget_conn_count;
+static struct in_addr wget_kept_ip;
+static unsigned int wget_kept_port;
 
-static enum  wget_state current_wget_state;
+/* File size, if known yet, and the parts of the file still to request */
+static long wget_total;
+static ulong wget_next;
+static ulong wget_part;
 
 static char *image_url;
 static unsigned int wget_timeout = WGET_TIMEOUT;
 
 static enum net_loop_state wget_loop_state;
 
-/* Timeout retry parameters */
-static u8 retry_action;			/* actions for TCP retry */
-static unsigned int retry_tcp_ack_num;	/* TCP retry acknowledge number*/
-static unsigned int retry_tcp_seq_num;	/* TCP retry sequence number */
-static int retry_len;			/* TCP retry length */
-
 static ulong wget_load_size;
 
 /**
@@ -124,87 +168,372 @@ static inline int store_block(uchar *src, unsigned int offset, unsigned int len)
 	return 0;
 }
 
+/**
+ * wget_store() - store a segment of a response body
+ * @c: connection
+ * @pkt: data
+ * @tcp_seq_num: sequence number of the first byte
+ * @len: number of bytes
+ *
+ * Segments can arrive in any order, and a resent one may start before the
+ * body.
+ *
+ * Return:	0 if success, -1 if fails
+ */
+static int wget_store(struct wget_conn *c, uchar *pkt,
+		      unsigned int tcp_seq_num, unsigned int len)
+{
+	unsigned int skip = 0;
+
+	if ((int)(tcp_seq_num - c->body_seq) < 0) {
+		skip = c->body_seq - tcp_seq_num;
+		if (skip >= len)
+			return 0;
+	}
+
+	return store_block(pkt + skip,
+			   c->offset + tcp_seq_num + skip - c->body_seq,
+			   len - skip);
+}
+
+/**
+ * wget_find() - find a string in a buffer
+ * @buf: buffer to search, which need not be terminated
+ * @len: length of buffer
+ * @str: string to find
+ *
+ * Return: position of @str in @buf, or NULL if not found
+ */
+static char *wget_find(char *buf, ulong len, const char *str)
+{
+	ulong n = strlen(str);
+	ulong i;
+
+	for (i = 0; i + n <= len; i++) {
+		if (!memcmp(buf + i, str, n))
+			return buf + i;
+	}
+
+	return NULL;
+}
+
+/**
+ * wget_hdr_field() - find a field in a response header
+ * @hdr: response header, terminated
+ * @name: field name, in any case
+ *
+ * Return: the field's value, or NULL if there is no such field
+ */
+static char *wget_hdr_field(char *hdr, const char *name)
+{
+	int n = strlen(name);
+	char *p;
+
+	for (p = strstr(hdr, linefeed); p; p = strstr(p, linefeed)) {
+		p += strlen(linefeed);
+		if (!strncasecmp(p, name, n) && p[n] == ':') {
+			for (p += n + 1; *p == ' '; p++)
+				;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * wget_parse_range() - parse a Content-Range value
+ * @s: value, "bytes first-last/total"
+ * @first: returns the offset of the first byte
+ * @last: returns the offset of the last byte
+ * @total: returns the size of the file
+ *
+ * Return:	0 if success, -EINVAL if @s cannot be parsed
+ */
+static int wget_parse_range(const char *s, ulong *first, ulong *last,
+			    long *total)
+{
+	char *end;
+
+	if (strncasecmp(s, "bytes ", 6))
+		return -EINVAL;
+	*first = simple_strtoul(s + 6, &end, 10);
+	if (*end != '-')
+		return -EINVAL;
+	*last = simple_strtoul(end + 1, &end, 10);
+	if (*end != '/' || *last < *first)
+		return -EINVAL;
+	/* An unknown size leaves nothing more to ask for */
+	if (end[1] == '*')
+		*total = *last + 1;
+	else
+		*total = simple_strtoul(end + 1, NULL, 10);
+
+	return 0;
+}
+
+#define RANDOM_PORT_START 1024
+#define RANDOM_PORT_RANGE 0x4000
+
+/**
+ * random_port() - make port a little random (1024-17407)
+ *
+ * Return: random port number from 1024 to 17407
+ *
+ * This keeps the math somewhat trivial to compute, and seems to work with
+ * all supported protocols/clients/servers
+ */
+static unsigned int random_port(void)
+{
+	return RANDOM_PORT_START + (get_timer(0) % RANDOM_PORT_RANGE);
+}
+
+/**
+ * wget_find_conn() - find the connection using one of our ports
+ * @port: our port
+ *
+ * Return: connection, or NULL if none uses @port
+ */
+static struct wget_conn *wget_find_conn(unsigned int port)
+{
+	struct wget_conn *c;
+
+	for (c = wget_conns; c < wget_conns + TCP_STREAMS; c++) {
+		if (c->state != WGET_CLOSED && c->port == port)
+			return c;
+	}
+
+	return NULL;
+}
+
+static unsigned int wget_new_port(void)
+{
+	unsigned int port = random_port();
+
+	while (wget_find_conn(port))
+		port++;
+
+	return port;
+}
+
+/* Whether a connection has a request in progress */
+static bool wget_busy(struct wget_conn *c)
+{
+	return c->state != WGET_CLOSED && c->state != WGET_IDLE;
+}
+
+/*
+ * The server may have closed a connection kept open from an earlier
+ * transfer in the meantime, and then nothing comes back for the request
+ */
+static bool wget_stale(struct wget_conn *c)
+{
+	return c->reused && c->state == WGET_CONNECTED && !c->hdr_len;
+}
+
+/* Bytes of the response body received in order */
+static u32 wget_body_len(struct wget_conn *c)
+{
+	tcp_select_stream(server_port, c->port);
+
+	return tcp_get_ack_edge() - c->body_seq;
+}
+
+/**
+ * wget_send_request() - send the HTTP request of a connection
+ * @c: connection
+ *
+ * This is also how the request is sent again if nothing comes back.
+ */
+static void wget_send_request(struct wget_conn *c)
+{
+	uchar *ptr, *offset;
+
+	ptr = net_tx_packet + net_eth_hdr_size() +
+		IP_TCP_HDR_SIZE + TCP_TSOPT_SIZE + 2;
+	offset = ptr;
+
+	memcpy(offset, &bootfile1, strlen(bootfile1));
+	offset += strlen(bootfile1);
+
+	memcpy(offset, image_url, strlen(image_url));
+	offset += strlen(image_url);
+
+	memcpy(offset, &bootfile3, strlen(bootfile3));
+	offset += strlen(bootfile3);
+
+	memcpy(offset, &http_keep_alive, strlen(http_keep_alive));
+	offset += strlen(http_keep_alive);
+
+	if (c->req_len)
+		offset += sprintf((char *)offset, http_range, c->offset,
+				  c->offset + c->req_len - 1);
+
+	memcpy(offset, &linefeed, strlen(linefeed));
+	offset += strlen(linefeed);
+
+	tcp_select_stream(server_port, c->port);
+	net_send_tcp_packet((offset - ptr), server_port, c->port,
+			    TCP_PUSH, c->req_seq, tcp_get_ack_edge());
+}
+
+/**
+ * wget_start_request() - send a request on an open connection
+ * @c: connection, with @offset and @req_len set
+ */
+static void wget_start_request(struct wget_conn *c)
+{
+	tcp_select_stream(server_port, c->port);
+	c->req_seq = c->seq;
+	c->resp_seq = tcp_get_ack_edge();
+	c->hdr_len = 0;
+	c->hdr_scanned = 0;
+	c->keep_alive = false;
+	c->len = -1;
+	c->state = WGET_CONNECTED;
+
+	/* Take no more than fits in @hdr until the header is in */
+	tcp_set_rcv_buf(WGET_HDR_SIZE);
+	wget_send_request(c);
+}
+
 /**
  * wget_send_stored() - wget response dispatcher
+ * @c: connection
  *
  * WARNING, This, and only this, is the place in wget.c where
  * SEQUENCE NUMBERS are swapped between incoming (RX)
  * and outgoing (TX).
  * Procedure wget_handler() is correct for RX traffic.
  */
-static void wget_send_stored(void)
+static void wget_send_stored(struct wget_conn *c)
 {
-	u8 action = retry_action;
-	int len = retry_len;
-	unsigned int tcp_ack_num = retry_tcp_seq_num + (len == 0 ? 1 : len);
-	unsigned int tcp_seq_num = retry_tcp_ack_num;
-	unsigned int server_port;
-	uchar *ptr, *offset;
+	u8 action = c->retry_action;
+	int len = c->retry_len;
+	unsigned int tcp_ack_num = c->retry_tcp_seq_num + (len == 0 ? 1 : len);
+	unsigned int tcp_seq_num = c->retry_tcp_ack_num;
 
-	server_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
-
-	switch (current_wget_state) {
+	switch (c->state) {
 	case WGET_CLOSED:
 		debug_cond(DEBUG_WGET, "wget: send SYN\n");
-		current_wget_state = WGET_CONNECTING;
-		net_send_tcp_packet(0, server_port, our_port, action,
+		c->state = WGET_CONNECTING;
+		net_send_tcp_packet(0, server_port, c->port, action,
 				    tcp_seq_num, tcp_ack_num);
-		packets = 0;
 		break;
 	case WGET_CONNECTING:
-		pkt_q_idx = 0;
-		net_send_tcp_packet(0, server_port, our_port, action,
+		net_send_tcp_packet(0, server_port, c->port, action,
 				    tcp_seq_num, tcp_ack_num);
-
-		ptr = net_tx_packet + net_eth_hdr_size() +
-			IP_TCP_HDR_SIZE + TCP_TSOPT_SIZE + 2;
-		offset = ptr;
-
-		memcpy(offset, &bootfile1, strlen(bootfile1));
-		offset += strlen(bootfile1);
-
-		memcpy(offset, image_url, strlen(image_url));
-		offset += strlen(image_url);
-
-		memcpy(offset, &bootfile3, strlen(bootfile3));
-		offset += strlen(bootfile3);
-		net_send_tcp_packet((offset - ptr), server_port, our_port,
-				    TCP_PUSH, tcp_seq_num, tcp_ack_num);
-		current_wget_state = WGET_CONNECTED;
+		c->seq = tcp_seq_num;
+		wget_start_request(c);
 		break;
 	case WGET_CONNECTED:
+		/* Send the request again until some of the response is in */
+		tcp_select_stream(server_port, c->port);
+		if (!c->hdr_len && tcp_get_ack_edge() == c->resp_seq) {
+			wget_send_request(c);
+			break;
+		}
+		fallthrough;
 	case WGET_TRANSFERRING:
 	case WGET_TRANSFERRED:
-		net_send_tcp_packet(0, server_port, our_port, action,
+		net_send_tcp_packet(0, server_port, c->port, action,
 				    tcp_seq_num, tcp_ack_num);
 		break;
+	case WGET_IDLE:
+		break;
 	}
 }
 
-static void wget_send(u8 action, unsigned int tcp_seq_num,
-		      unsigned int tcp_ack_num, int len)
+/*
+ * Record what to send if nothing arrives before the timeout. TCP itself
+ * acknowledges the data as it comes in.
+ */
+static void wget_set_retry(struct wget_conn *c, u8 action,
+			   unsigned int tcp_seq_num, unsigned int tcp_ack_num,
+			   int len)
 {
-	retry_action = action;
-	retry_tcp_ack_num = tcp_ack_num;
-	retry_tcp_seq_num = tcp_seq_num;
-	retry_len = len;
+	c->retry_action = action;
+	c->retry_tcp_ack_num = tcp_ack_num;
+	c->retry_tcp_seq_num = tcp_seq_num;
+	c->retry_len = len;
+}
 
-	wget_send_stored();
+static void wget_send(struct wget_conn *c, u8 action, unsigned int tcp_seq_num,
+		      unsigned int tcp_ack_num, int len)
+{
+	wget_set_retry(c, action, tcp_seq_num, tcp_ack_num, len);
+	wget_send_stored(c);
 }
 
-void wget_fail(char *error_message, unsigned int tcp_seq_num,
-	       unsigned int tcp_ack_num, u8 action)
+void wget_fail(struct wget_conn *c, char *error_message,
+	       unsigned int tcp_seq_num, unsigned int tcp_ack_num, u8 action)
 {
 	printf("wget: Transfer Fail - %s\n", error_message);
 	net_set_timeout_handler(0, NULL);
-	wget_send(action, tcp_seq_num, tcp_ack_num, 0);
+	wget_send(c, action, tcp_seq_num, tcp_ack_num, 0);
 }
 
-void wget_success(u8 action, unsigned int tcp_seq_num,
+void wget_success(struct wget_conn *c, u8 action, unsigned int tcp_seq_num,
 		  unsigned int tcp_ack_num, int len, int packets)
 {
 	printf("Packets received %d, Transfer Successful\n", packets);
-	wget_send(action, tcp_seq_num, tcp_ack_num, len);
+	wget_send(c, action, tcp_seq_num, tcp_ack_num, len);
+}
+
+/* Open a new connection for the request of @c */
+static void wget_connect(struct wget_conn *c)
+{
+	c->state = WGET_CLOSED;
+	c->reused = false;
+	c->port = wget_new_port();
+	wget_send(c, TCP_SYN, 0, 0, 0);
+}
+
+/* Drop a connection, telling the server */
+static void wget_reset(struct wget_conn *c)
+{
+	net_send_tcp_packet(0, server_port, c->port, TCP_RST, c->seq, 0);
+	c->state = WGET_CLOSED;
+}
+
+/* Finish once no connection has a request in progress */
+static void wget_check_done(void)
+{
+	struct wget_conn *c;
+
+	for (c = wget_conns; c < wget_conns + TCP_STREAMS; c++) {
+		if (wget_busy(c))
+			return;
+	}
+
+	printf("Packets received %d, Transfer Successful\n", packets);
+	net_set_state(wget_loop_state);
+}
+
+/**
+ * wget_next_request() - give a connection the next part of the file
+ * @c: connection, idle or closed
+ *
+ * With nothing left to ask for, the transfer is over once the other
+ * connections are done too.
+ */
+static void wget_next_request(struct wget_conn *c)
+{
+	if (wget_total < 0 || wget_next >= wget_total) {
+		wget_check_done();
+		return;
+	}
+
+	c->offset = wget_next;
+	c->req_len = min_t(ulong, wget_part, wget_total - wget_next);
+	wget_next += c->req_len;
+	debug_cond(DEBUG_WGET, "wget: %u asks for %lx bytes at %lx\n",
+		   c->port, c->req_len, c->offset);
+
+	if (c->state == WGET_IDLE)
+		wget_start_request(c);
+	else
+		wget_connect(c);
 }
 
 /*
@@ -212,130 +541,228 @@ void wget_success(u8 action, unsigned int tcp_seq_num,
  */
 static void wget_timeout_handler(void)
 {
+	struct wget_conn *c;
+
 	if (++wget_timeout_count > WGET_RETRY_COUNT) {
 		puts("\nRetry count exceeded; starting again\n");
-		wget_send(TCP_RST, 0, 0, 0);
+		for (c = wget_conns; c < wget_conns + TCP_STREAMS; c++) {
+			if (wget_busy(c))
+				wget_reset(c);
+		}
 		net_start_again();
 	} else {
 		puts("T ");
 		net_set_timeout_handler(wget_timeout +
 					WGET_TIMEOUT * wget_timeout_count,
 					wget_timeout_handler);
-		wget_send_stored();
+		for (c = wget_conns; c < wget_conns + TCP_STREAMS; c++) {
+			/* A new connection is better than a second SYN */
+			if (wget_stale(c) || c->state == WGET_CONNECTING) {
+				wget_reset(c);
+				wget_connect(c);
+			} else if (wget_busy(c)) {
+				wget_send_stored(c);
+			}
+		}
 	}
 }
 
-#define PKT_QUEUE_OFFSET 0x20000
-#define PKT_QUEUE_PACKET_SIZE 0x800
-
-static void wget_connected(uchar *pkt, unsigned int tcp_seq_num,
-			   u8 action, unsigned int tcp_ack_num, unsigned int len)
+/**
+ * wget_connected() - handle the start of a response
+ * @c: connection
+ * @pkt: data
+ * @tcp_seq_num: sequence number of the first byte
+ * @action: TCP action
+ * @tcp_ack_num: TCP acknowledgment number
+ * @len: number of bytes
+ *
+ * Return:	0 if OK, -1 if the transfer has failed
+ */
+static int wget_connected(struct wget_conn *c, uchar *pkt,
+			  unsigned int tcp_seq_num, u8 action,
+			  unsigned int tcp_ack_num, unsigned int len)
 {
-	uchar *pkt_in_q;
+	int off = tcp_seq_num - c->resp_seq;
+	unsigned int avail, start, hlen, i, status;
+	ulong first, last;
+	long total;
 	char *pos;
-	int hlen, i;
-	uchar *ptr1;
 
-	pkt[len] = '\0';
-	pos = strstr((char *)pkt, http_eom);
+	wget_set_retry(c, action, tcp_seq_num, tcp_ack_num, len);
+
+	/* TCP keeps what arrives within @hdr until the header is in */
+	if (off < 0) {
+		if (-off >= (int)len)
+			return 0;
+		pkt -= off;
+		len += off;
+		off = 0;
+	}
+	len = min_t(unsigned int, len, WGET_HDR_SIZE - off);
+	memcpy(c->hdr + off, pkt, len);
+	c->hdr_len = max_t(unsigned int, c->hdr_len, off + len);
 
+	/*
+	 * The header may span several segments, so look for its end in what
+	 * has arrived in order
+	 */
+	tcp_select_stream(server_port, c->port);
+	avail = min_t(unsigned int, tcp_get_ack_edge() - c->resp_seq,
+		      c->hdr_len);
+	start = c->hdr_scanned;
+	if (start > strlen(http_eom))
+		start -= strlen(http_eom);
+	pos = wget_find(c->hdr + start, avail - start, http_eom);
+	c->hdr_scanned = avail;
 	if (!pos) {
 		debug_cond(DEBUG_WGET,
 			   "wget: Connected, data before Header %p\n", pkt);
-		pkt_in_q = (void *)image_load_addr + PKT_QUEUE_OFFSET +
-			(pkt_q_idx * PKT_QUEUE_PACKET_SIZE);
-
-		ptr1 = map_sysmem((phys_addr_t)pkt_in_q, len);
-		memcpy(ptr1, pkt, len);
-		unmap_sysmem(ptr1);
+		if (avail < WGET_HDR_SIZE)
+			return 0;
+		wget_fail(c, "wget: HTTP header too long\n", tcp_seq_num,
+			  tcp_ack_num, action);
+		net_set_state(NETLOOP_FAIL);
+		return -1;
+	}
 
-		pkt_q[pkt_q_idx].pkt = pkt_in_q;
-		pkt_q[pkt_q_idx].tcp_seq_num = tcp_seq_num;
-		pkt_q[pkt_q_idx].len = len;
-		pkt_q_idx++;
+	debug_cond(DEBUG_WGET, "wget: Connected HTTP Header %p\n", pkt);
+	hlen = pos - c->hdr + strlen(http_eom);
+	c->body_seq = c->resp_seq + hlen;
+	c->state = WGET_TRANSFERRING;
+
+	/* Whatever came after the header is the start of the body */
+	if (c->hdr_len > hlen &&
+	    wget_store(c, (uchar *)c->hdr + hlen, c->body_seq,
+		       c->hdr_len - hlen) != 0) {
+		wget_loop_state = NETLOOP_FAIL;
+		wget_fail(c, "wget: store error\n", tcp_seq_num, tcp_ack_num,
+			  action);
+		net_set_state(NETLOOP_FAIL);
+		return -1;
+	}
+	c->hdr[hlen] = '\0';
+
+	/* From here on, take as much as there is room for */
+	if (wget_load_size)
+		tcp_set_rcv_buf(wget_load_size - c->offset - wget_body_len(c));
+	else
+		tcp_set_rcv_buf(0);
+
+	pos = strstr(c->hdr, linefeed);
+	i = pos ? pos - c->hdr : hlen;
+	if (!c->offset)
+		printf("%.*s", i, c->hdr);
+
+	pos = strchr(c->hdr, ' ');
+	status = pos ? simple_strtoul(pos + 1, NULL, 10) : 0;
+
+	pos = wget_hdr_field(c->hdr, content_len);
+	if (pos) {
+		c->len = simple_strtoul(pos, NULL, 10);
+		debug_cond(DEBUG_WGET, "wget: Connected Len %lu\n", c->len);
+	}
 
-		if (pkt_q_idx >= PKTQ_SZ) {
-			printf("wget: Fatal error, queue overrun!\n");
+	if (status == 206) {
+		pos = wget_hdr_field(c->hdr, content_range);
+		if (!pos || wget_parse_range(pos, &first, &last, &total) ||
+		    first != c->offset) {
+			wget_fail(c, "wget: bad Content-Range\n", tcp_seq_num,
+				  tcp_ack_num, action);
 			net_set_state(NETLOOP_FAIL);
-
-			return;
+			return -1;
 		}
+		if (c->len < 0)
+			c->len = last - first + 1;
+	} else if (status == 200 && !c->offset) {
+		/* The whole file, as asked for or as the server prefers */
+		total = c->len;
+		last = c->len - 1;
 	} else {
-		debug_cond(DEBUG_WGET, "wget: Connected HTTP Header %p\n", pkt);
-		/* sizeof(http_eom) - 1 is the string length of (http_eom) */
-		hlen = pos - (char *)pkt + sizeof(http_eom) - 1;
-		pos = strstr((char *)pkt, linefeed);
-		if (pos > 0)
-			i = pos - (char *)pkt;
-		else
-			i = hlen;
-		printf("%.*s", i,  pkt);
-
-		current_wget_state = WGET_TRANSFERRING;
-
-		initial_data_seq_num = tcp_seq_num + hlen;
-		next_data_seq_num    = tcp_seq_num + len;
-
-		if (strstr((char *)pkt, http_ok) == 0) {
-			debug_cond(DEBUG_WGET,
-				   "wget: Connected Bad Xfer\n");
-			wget_loop_state = NETLOOP_FAIL;
-			wget_send(action, tcp_seq_num, tcp_ack_num, len);
-		} else {
-			debug_cond(DEBUG_WGET,
-				   "wget: Connctd pkt %p  hlen %x\n",
-				   pkt, hlen);
+		debug_cond(DEBUG_WGET, "wget: Connected Bad Xfer\n");
+		wget_loop_state = NETLOOP_FAIL;
+		if (c->offset) {
+			wget_fail(c, "wget: part of file not returned\n",
+				  tcp_seq_num, tcp_ack_num, action);
+			net_set_state(NETLOOP_FAIL);
+			return -1;
+		}
+		return 0;
+	}
 
-			pos = strstr((char *)pkt, content_len);
-			if (!pos) {
-				content_length = -1;
-			} else {
-				pos += sizeof(content_len) + 2;
-				strict_strtoul(pos, 10, &content_length);
-				debug_cond(DEBUG_WGET,
-					   "wget: Connected Len %lu\n",
-					   content_length);
+	debug_cond(DEBUG_WGET, "wget: Connctd pkt %p  hlen %x\n", pkt, hlen);
+	wget_loop_state = NETLOOP_SUCCESS;
+	pos = wget_hdr_field(c->hdr, connection);
+	c->keep_alive = c->len >= 0 && pos &&
+		!strncasecmp(pos, keep_alive, strlen(keep_alive));
+
+	/* The first answer tells what is left to share out */
+	if (wget_total < 0 && total >= 0) {
+		wget_total = total;
+		wget_next = last + 1;
+		if (wget_next < wget_total) {
+			wget_part = DIV_ROUND_UP(wget_total - wget_next,
+						 wget_conn_count);
+			for (i = 0; i < wget_conn_count; i++) {
+				if (&wget_conns[i] != c &&
+				    !wget_busy(&wget_conns[i]))
+					wget_next_request(&wget_conns[i]);
 			}
+		}
+	}
 
-			net_boot_file_size = 0;
+	return 0;
+}
 
-			if (len > hlen) {
-				if (store_block(pkt + hlen, 0, len - hlen) != 0) {
-					wget_loop_state = NETLOOP_FAIL;
-					wget_fail("wget: store error\n", tcp_seq_num, tcp_ack_num, action);
-					net_set_state(NETLOOP_FAIL);
-					return;
-				}
-			}
+/**
+ * wget_transferring() - follow the connection once the body is arriving
+ * @c: connection
+ * @tcp_state: TCP state of the connection
+ * @tcp_seq_num: TCP sequential number
+ * @tcp_ack_num: TCP acknowledgment number
+ * @action: TCP action
+ * @len: packet length
+ */
+static void wget_transferring(struct wget_conn *c, enum tcp_state tcp_state,
+			      u32 tcp_seq_num, u32 tcp_ack_num, u8 action,
+			      unsigned int len)
+{
+	switch (tcp_state) {
+	case TCP_FIN_WAIT_2:
+		wget_send(c, TCP_ACK, tcp_seq_num, tcp_ack_num, len);
+		fallthrough;
+	case TCP_SYN_SENT:
+	case TCP_SYN_RECEIVED:
+	case TCP_CLOSING:
+	case TCP_FIN_WAIT_1:
+	case TCP_CLOSED:
+		net_set_state(NETLOOP_FAIL);
+		break;
+	case TCP_ESTABLISHED:
+		wget_set_retry(c, TCP_ACK, tcp_seq_num, tcp_ack_num, len);
+		wget_loop_state = NETLOOP_SUCCESS;
+		if (!c->keep_alive || wget_body_len(c) < c->len)
+			break;
 
-			debug_cond(DEBUG_WGET,
-				   "wget: Connected Pkt %p hlen %x\n",
-				   pkt, hlen);
-
-			for (i = 0; i < pkt_q_idx; i++) {
-				int err;
-
-				ptr1 = map_sysmem(
-					(phys_addr_t)(pkt_q[i].pkt),
-					pkt_q[i].len);
-				err = store_block(ptr1,
-					  pkt_q[i].tcp_seq_num -
-					  initial_data_seq_num,
-					  pkt_q[i].len);
-				unmap_sysmem(ptr1);
-				debug_cond(DEBUG_WGET,
-					   "wget: Connctd pkt Q %p len %x\n",
-					   pkt_q[i].pkt, pkt_q[i].len);
-				if (err) {
-					wget_loop_state = NETLOOP_FAIL;
-					wget_fail("wget: store error\n", tcp_seq_num, tcp_ack_num, action);
-					net_set_state(NETLOOP_FAIL);
-					return;
-				}
-			}
+		/* Acknowledge it all now, rather than after a delay */
+		debug_cond(DEBUG_WGET, "wget: %u keeps the connection\n",
+			   c->port);
+		wget_send_stored(c);
+		c->state = WGET_IDLE;
+		wget_next_request(c);
+		break;
+	case TCP_CLOSE_WAIT:     /* End of transfer */
+		/* The FIN counts as one byte */
+		if (c->len >= 0 && wget_body_len(c) - 1 < c->len) {
+			wget_fail(c, "wget: connection closed early\n",
+				  tcp_seq_num, tcp_ack_num, action);
+			net_set_state(NETLOOP_FAIL);
+			break;
 		}
+		c->state = WGET_TRANSFERRED;
+		wget_send(c, action | TCP_ACK | TCP_FIN,
+			  tcp_seq_num, tcp_ack_num, len);
+		break;
 	}
-	wget_send(action, tcp_seq_num, tcp_ack_num, len);
 }
 
 /**
@@ -357,15 +784,40 @@ static void wget_handler(uchar *pkt, u16 dport,
 			 u32 tcp_seq_num, u32 tcp_ack_num,
 			 u8 action, unsigned int len)
 {
+	struct wget_conn *c = wget_find_conn(ntohs(dport));
 	enum tcp_state wget_tcp_state = tcp_get_tcp_state();
 
+	if (!c)
+		return;
+
 	net_set_timeout_handler(wget_timeout, wget_timeout_handler);
 	packets++;
 
-	switch (current_wget_state) {
+	if (action & TCP_RST) {
+		debug_cond(DEBUG_WGET, "wget: %u reset\n", c->port);
+		if (wget_stale(c))
+			wget_connect(c);
+		else if (c->state != WGET_IDLE)
+			net_set_state(NETLOOP_FAIL);
+		else
+			c->state = WGET_CLOSED;
+		return;
+	}
+	c->seq = tcp_ack_num;
+
+	switch (c->state) {
 	case WGET_CLOSED:
 		debug_cond(DEBUG_WGET, "wget: Handler: Error!, State wrong\n");
 		break;
+	case WGET_IDLE:
+		/* The server is closing a connection kept open */
+		if (wget_tcp_state == TCP_CLOSE_WAIT) {
+			net_send_tcp_packet(0, server_port, c->port,
+					    TCP_ACK | TCP_FIN, tcp_ack_num,
+					    tcp_seq_num + 1);
+			c->state = WGET_CLOSED;
+		}
+		break;
 	case WGET_CONNECTING:
 		debug_cond(DEBUG_WGET,
 			   "wget: Connecting In len=%x, Seq=%u, Ack=%u\n",
@@ -374,11 +826,11 @@ static void wget_handler(uchar *pkt, u16 dport,
 			if (wget_tcp_state == TCP_ESTABLISHED) {
 				debug_cond(DEBUG_WGET,
 					   "wget: Cting, send, len=%x\n", len);
-				wget_send(action, tcp_seq_num, tcp_ack_num,
+				wget_send(c, action, tcp_seq_num, tcp_ack_num,
 					  len);
 			} else {
 				printf("%.*s", len,  pkt);
-				wget_fail("wget: Handler Connected Fail\n",
+				wget_fail(c, "wget: Handler Connected Fail\n",
 					  tcp_seq_num, tcp_ack_num, action);
 			}
 		}
@@ -387,10 +839,18 @@ static void wget_handler(uchar *pkt, u16 dport,
 		debug_cond(DEBUG_WGET, "wget: Connected seq=%u, len=%x\n",
 			   tcp_seq_num, len);
 		if (!len) {
-			wget_fail("Image not found, no data returned\n",
+			if (wget_stale(c)) {
+				wget_reset(c);
+				wget_connect(c);
+				break;
+			}
+			wget_fail(c, "Image not found, no data returned\n",
 				  tcp_seq_num, tcp_ack_num, action);
-		} else {
-			wget_connected(pkt, tcp_seq_num, action, tcp_ack_num, len);
+		} else if (!wget_connected(c, pkt, tcp_seq_num, action,
+					   tcp_ack_num, len) &&
+			   c->state == WGET_TRANSFERRING) {
+			wget_transferring(c, wget_tcp_state, tcp_seq_num,
+					  tcp_ack_num, action, len);
 		}
 		break;
 	case WGET_TRANSFERRING:
@@ -398,69 +858,29 @@ static void wget_handler(uchar *pkt, u16 dport,
 			   "wget: Transferring, seq=%x, ack=%x,len=%x\n",
 			   tcp_seq_num, tcp_ack_num, len);
 
-		if (next_data_seq_num != tcp_seq_num) {
-			debug_cond(DEBUG_WGET, "wget: seq=%x packet was lost\n", next_data_seq_num);
-			return;
-		}
-		next_data_seq_num = tcp_seq_num + len;
-
-		if (store_block(pkt, tcp_seq_num - initial_data_seq_num, len) != 0) {
-			wget_fail("wget: store error\n",
+		if (wget_store(c, pkt, tcp_seq_num, len) != 0) {
+			wget_fail(c, "wget: store error\n",
 				  tcp_seq_num, tcp_ack_num, action);
 			net_set_state(NETLOOP_FAIL);
 			return;
 		}
 
-		switch (wget_tcp_state) {
-		case TCP_FIN_WAIT_2:
-			wget_send(TCP_ACK, tcp_seq_num, tcp_ack_num, len);
-			fallthrough;
-		case TCP_SYN_SENT:
-		case TCP_SYN_RECEIVED:
-		case TCP_CLOSING:
-		case TCP_FIN_WAIT_1:
-		case TCP_CLOSED:
-			net_set_state(NETLOOP_FAIL);
-			break;
-		case TCP_ESTABLISHED:
-			wget_send(TCP_ACK, tcp_seq_num, tcp_ack_num,
-				  len);
-			wget_loop_state = NETLOOP_SUCCESS;
-			break;
-		case TCP_CLOSE_WAIT:     /* End of transfer */
-			current_wget_state = WGET_TRANSFERRED;
-			wget_send(action | TCP_ACK | TCP_FIN,
-				  tcp_seq_num, tcp_ack_num, len);
-			break;
-		}
+		wget_transferring(c, wget_tcp_state, tcp_seq_num, tcp_ack_num,
+				  action, len);
 		break;
 	case WGET_TRANSFERRED:
-		printf("Packets received %d, Transfer Successful\n", packets);
-		net_set_state(wget_loop_state);
+		c->state = WGET_CLOSED;
+		wget_next_request(c);
 		break;
 	}
 }
 
-#define RANDOM_PORT_START 1024
-#define RANDOM_PORT_RANGE 0x4000
-
-/**
- * random_port() - make port a little random (1024-17407)
- *
- * Return: random port number from 1024 to 17407
- *
- * This keeps the math somewhat trivial to compute, and seems to work with
- * all supported protocols/clients/servers
- */
-static unsigned int random_port(void)
-{
-	return RANDOM_PORT_START + (get_timer(0) % RANDOM_PORT_RANGE);
-}
-
 #define BLOCKSIZE 512
 
 void wget_start(void)
 {
+	struct wget_conn *c, *first = NULL;
+
 	image_url = strchr(net_boot_file_name, ':');
 	if (image_url > 0) {
 		web_server_ip = string_to_ip(net_boot_file_name);
@@ -509,11 +929,43 @@ void wget_start(void)
 
 	net_set_timeout_handler(wget_timeout, wget_timeout_handler);
 	tcp_set_tcp_handler(wget_handler);
+	net_boot_file_size = 0;
 
+	server_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
+	wget_conn_count = clamp_t(int, env_get_ulong("httpconns", 10, 1), 1,
+				  TCP_STREAMS);
 	wget_timeout_count = 0;
-	current_wget_state = WGET_CLOSED;
+	wget_loop_state = NETLOOP_FAIL;
+	packets = 0;
+	wget_total = -1;
+	wget_next = 0;
+	wget_part = 0;
 
-	our_port = random_port();
+	/*
+	 * Use the connections kept open by the last transfer, if it was from
+	 * the same server. Others are forgotten; the server times them out.
+	 */
+	for (c = wget_conns; c < wget_conns + TCP_STREAMS; c++) {
+		c->reused = false;
+		if (c->state == WGET_CLOSED)
+			continue;
+		tcp_select_stream(wget_kept_port, c->port);
+		if (c->state == WGET_IDLE &&
+		    c - wget_conns < wget_conn_count &&
+		    web_server_ip.s_addr == wget_kept_ip.s_addr &&
+		    server_port == wget_kept_port &&
+		    tcp_get_tcp_state() == TCP_ESTABLISHED) {
+			debug_cond(DEBUG_WGET, "wget: reusing %u\n", c->port);
+			c->reused = true;
+			if (!first)
+				first = c;
+			continue;
+		}
+		tcp_set_tcp_state(TCP_CLOSED);
+		c->state = WGET_CLOSED;
+	}
+	wget_kept_ip = web_server_ip;
+	wget_kept_port = server_port;
 
 	/*
 	 * Zero out server ether to force arp resolution in case
@@ -523,7 +975,15 @@ void wget_start(void)
 
 	memset(net_server_ethaddr, 0, 6);
 
-	wget_send(TCP_SYN, 0, 0, 0);
+	/* The first request also finds out how large the file is */
+	if (!first)
+		first = wget_conns;
+	first->offset = 0;
+	first->req_len = wget_conn_count > 1 ? WGET_RANGE_FIRST : 0;
+	if (first->reused)
+		wget_start_request(first);
+	else
+		wget_connect(first);
 }
 
 #if (IS_ENABLED(CONFIG_CMD_DNS))
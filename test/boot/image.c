@@ -8,10 +8,15 @@
 
 #include <common.h>
 #include <image.h>
+#include <asm/global_data.h>
 #include <test/suites.h>
 #include <test/ut.h>
+#include <u-boot/crc.h>
+#include <u-boot/sha256.h>
 #include "bootstd_common.h"
 
+DECLARE_GLOBAL_DATA_PTR;
+
 /* Test of image phase */
 static int test_image_phase(struct unit_test_state *uts)
 {
@@ -34,3 +39,105 @@ static int test_image_phase(struct unit_test_state *uts)
 	return 0;
 }
 BOOTSTD_TEST(test_image_phase, 0);
+
+/* Create a FIT with one image, with a SHA-256 and a CRC32 hash */
+static int make_hash_fit(struct unit_test_state *uts, void *fit, int size,
+			 const u8 *data, int len, bool sig)
+{
+	u8 sha[SHA256_SUM_LEN];
+	u32 crc;
+
+	sha256_csum_wd(data, len, sha, CHUNKSZ_SHA256);
+	crc = cpu_to_be32(crc32(0, data, len));
+
+	ut_assertok(fdt_create(fit, size));
+	ut_assertok(fdt_finish_reservemap(fit));
+	ut_assertok(fdt_begin_node(fit, ""));
+	ut_assertok(fdt_begin_node(fit, FIT_IMAGES_PATH + 1));
+	ut_assertok(fdt_begin_node(fit, "image"));
+	ut_assertok(fdt_property(fit, FIT_DATA_PROP, data, len));
+	ut_assertok(fdt_begin_node(fit, "hash-1"));
+	ut_assertok(fdt_property_string(fit, FIT_ALGO_PROP, "sha256"));
+	ut_assertok(fdt_property(fit, FIT_VALUE_PROP, sha, sizeof(sha)));
+	ut_assertok(fdt_end_node(fit));
+	ut_assertok(fdt_begin_node(fit, "hash-2"));
+	ut_assertok(fdt_property_string(fit, FIT_ALGO_PROP, "crc32"));
+	ut_assertok(fdt_property(fit, FIT_VALUE_PROP, &crc, sizeof(crc)));
+	ut_assertok(fdt_end_node(fit));
+	if (sig) {
+		ut_assertok(fdt_begin_node(fit, "signature-1"));
+		ut_assertok(fdt_end_node(fit));
+	}
+	ut_assertok(fdt_end_node(fit));
+	ut_assertok(fdt_end_node(fit));
+	ut_assertok(fdt_end_node(fit));
+	ut_assertok(fdt_finish(fit));
+
+	return 0;
+}
+
+/* Test checking the hashes of an image passed in pieces */
+static int test_image_hash_stream(struct unit_test_state *uts)
+{
+	struct fit_hash_stream hs;
+	char fit[1024];
+	u8 data[300];
+	int node, i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+	ut_assertok(make_hash_fit(uts, fit, sizeof(fit), data, sizeof(data),
+				  false));
+	node = fdt_path_offset(fit, "/images/image");
+	ut_assert(node >= 0);
+
+	/* Uneven pieces, crossing the SHA-256 block size */
+	ut_assertok(fit_image_hash_stream_start(&hs, fit, node, gd_fdt_blob(),
+						sizeof(data)));
+	ut_asserteq(2, hs.count);
+	fit_image_hash_stream_update(&hs, data, 1);
+	fit_image_hash_stream_update(&hs, data + 1, 100);
+	fit_image_hash_stream_update(&hs, data + 101, sizeof(data) - 101);
+	ut_asserteq(1, fit_image_hash_stream_verify(&hs));
+
+	/* Data which was changed on the way */
+	ut_assertok(fit_image_hash_stream_start(&hs, fit, node, gd_fdt_blob(),
+						sizeof(data)));
+	data[150] ^= 1;
+	fit_image_hash_stream_update(&hs, data, sizeof(data));
+	data[150] ^= 1;
+	ut_asserteq(0, fit_image_hash_stream_verify(&hs));
+
+	/* Not all of the data */
+	ut_assertok(fit_image_hash_stream_start(&hs, fit, node, gd_fdt_blob(),
+						sizeof(data)));
+	fit_image_hash_stream_update(&hs, data, sizeof(data) - 1);
+	ut_asserteq(0, fit_image_hash_stream_verify(&hs));
+
+	/* Too much data */
+	ut_assertok(fit_image_hash_stream_start(&hs, fit, node, gd_fdt_blob(),
+						sizeof(data) - 1));
+	fit_image_hash_stream_update(&hs, data, sizeof(data));
+	ut_asserteq(0, fit_image_hash_stream_verify(&hs));
+
+	/* Abandoning the hashes part-way through */
+	ut_assertok(fit_image_hash_stream_start(&hs, fit, node, gd_fdt_blob(),
+						sizeof(data)));
+	fit_image_hash_stream_update(&hs, data, 10);
+	fit_image_hash_stream_abort(&hs);
+
+	/* Signatures need all the data at once */
+	if (!FIT_IMAGE_ENABLE_VERIFY)
+		return 0;
+	ut_assertok(make_hash_fit(uts, fit, sizeof(fit), data, sizeof(data),
+				  true));
+	node = fdt_path_offset(fit, "/images/image");
+	ut_asserteq(-EOPNOTSUPP,
+		    fit_image_hash_stream_start(&hs, fit, node, gd_fdt_blob(),
+						sizeof(data)));
+	ut_asserteq(1, fit_image_verify_with_data(fit, node, gd_fdt_blob(),
+						  data, sizeof(data)));
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_hash_stream, 0);
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Header file for the tests of network commands against sandbox servers
+ */
+
+#ifndef __NET_TEST_H
+#define __NET_TEST_H
+
+/**
+ * sb_net_byte() - Get a byte of the files served by the test servers
+ *
+ * The pattern does not repeat every 256 bytes, so that data placed at the
+ * wrong offset is noticed.
+ *
+ * @off:	offset in the file
+ * Return:	the byte at @off
+ */
+static inline u8 sb_net_byte(ulong off)
+{
+	return off * 7 + (off >> 9);
+}
+
+#endif
@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for the nfs command, against a small NFSv3 server
+ */
+
+#include <common.h>
+#include <command.h>
+#include <dm.h>
+#include <env.h>
+#include <mapmem.h>
+#include <net.h>
+#include <net/tcp.h>
+#include <asm/eth.h>
+#include <asm/unaligned.h>
+#include <linux/sizes.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+#include "../../net/nfs.h"
+#include "net_test.h"
+
+#define SB_MOUNT_PORT	635
+#define SB_NFS_PORT	2049
+#define SB_NFS_FH	"sbnfs-fh"
+#define SB_NFS_OUT_SIZE	0x80000		/* server's TCP send buffer */
+#define SB_NFS_MTU	1500
+
+#define SHIFT_TO_TCPHDRLEN_FIELD(x) ((x) << 4)
+#define LEN_B_TO_DW(x) ((x) >> 2)
+#define GET_TCP_HDR_LEN_IN_BYTES(x) ((x) >> 2)
+
+/**
+ * struct sb_nfs_state - the server
+ *
+ * @len: size of the file
+ * @rtpref: read size the server prefers
+ * @reads: READ calls answered, not counting replies which were dropped
+ * @ip_id: IP identification of the next reply
+ * @port: client's TCP port, 0 if there is no connection
+ * @rcv: next byte expected from the client
+ * @req: call being received over TCP
+ * @req_len: bytes of @req so far
+ * @seq: next byte to send
+ * @end: end of the bytes to send
+ * @acked: bytes the client has acknowledged
+ * @win: client's receive window
+ * @out: bytes to send, at their sequence number modulo %SB_NFS_OUT_SIZE
+ */
+static struct sb_nfs_state {
+	u32 len;
+	u32 rtpref;
+	int reads;
+	u16 ip_id;
+	u16 port;
+	u32 rcv;
+	uchar req[2048];
+	u32 req_len;
+	u32 seq;
+	u32 end;
+	u32 acked;
+	u32 win;
+	uchar out[SB_NFS_OUT_SIZE];
+} sb_nfs;
+
+/* Queue a packet for the client, made from the headers of @packet */
+static uchar *sb_nfs_queue(struct udevice *dev, void *packet)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = packet;
+	struct ethernet_hdr *eth_send;
+
+	if (priv->recv_packets >= PKTBUFSRX)
+		return NULL;
+
+	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_send->et_protlen = htons(PROT_IP);
+
+	return (uchar *)eth_send + ETHER_HDR_SIZE;
+}
+
+static void sb_nfs_queued(struct udevice *dev, int ip_len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+
+	priv->recv_packet_length[priv->recv_packets++] = ETHER_HDR_SIZE +
+							 ip_len;
+}
+
+/* Send a UDP reply, in IP fragments if it does not fit in one frame */
+static int sb_nfs_udp_send(struct udevice *dev, void *packet,
+			   const void *data, int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ip_udp_hdr *udp = packet + ETHER_HDR_SIZE;
+	int total = UDP_HDR_SIZE + len;
+	int frag = (SB_NFS_MTU - IP_HDR_SIZE) & ~7;
+	struct ip_udp_hdr *ip;
+	int off, n;
+
+	if (DIV_ROUND_UP(total, frag) > PKTBUFSRX - priv->recv_packets)
+		return -ENOSPC;
+
+	sb_nfs.ip_id++;
+	for (off = 0; off < total; off += n) {
+		n = min(total - off, frag);
+		ip = (void *)sb_nfs_queue(dev, packet);
+		net_set_ip_header((uchar *)ip, udp->ip_src, udp->ip_dst,
+				  IP_HDR_SIZE + n, IPPROTO_UDP);
+		ip->ip_id = htons(sb_nfs.ip_id);
+		ip->ip_off = htons(off / 8 | (off + n < total ?
+					      IP_FLAGS_MFRAG : 0));
+		ip->ip_sum = 0;
+		ip->ip_sum = compute_ip_checksum(ip, IP_HDR_SIZE);
+		if (!off) {
+			ip->udp_src = udp->udp_dst;
+			ip->udp_dst = udp->udp_src;
+			ip->udp_len = htons(total);
+			ip->udp_xsum = 0;
+			memcpy((uchar *)ip + IP_UDP_HDR_SIZE, data, n -
+			       UDP_HDR_SIZE);
+		} else {
+			memcpy((uchar *)ip + IP_HDR_SIZE,
+			       data + off - UDP_HDR_SIZE, n);
+		}
+		sb_nfs_queued(dev, IP_HDR_SIZE + n);
+	}
+
+	return 0;
+}
+
+static int sb_nfs_tcp_send(struct udevice *dev, void *packet, u8 flags,
+			   u32 seq, const void *data, int len)
+{
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	struct ip_tcp_hdr *tcp_send = (void *)sb_nfs_queue(dev, packet);
+	int pkt_len = IP_TCP_HDR_SIZE + len;
+
+	if (!tcp_send)
+		return -ENOSPC;
+
+	tcp_send->tcp_src = tcp->tcp_dst;
+	tcp_send->tcp_dst = tcp->tcp_src;
+	tcp_send->tcp_seq = htonl(seq);
+	tcp_send->tcp_ack = htonl(sb_nfs.rcv);
+	tcp_send->tcp_flags = flags;
+	tcp_send->tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(TCP_HDR_SIZE));
+	tcp_send->tcp_win = htons(0xffff);
+	tcp_send->tcp_xsum = 0;
+	tcp_send->tcp_ugr = 0;
+	memcpy((uchar *)tcp_send + IP_TCP_HDR_SIZE, data, len);
+	tcp_send->tcp_xsum = tcp_set_pseudo_header((uchar *)tcp_send,
+						   tcp->ip_src, tcp->ip_dst,
+						   pkt_len - IP_HDR_SIZE,
+						   pkt_len);
+	net_set_ip_header((uchar *)tcp_send, tcp->ip_src, tcp->ip_dst,
+			  pkt_len, IPPROTO_TCP);
+	sb_nfs_queued(dev, pkt_len);
+
+	return 0;
+}
+
+static u32 *sb_rpc_reply(u32 *p, u32 xid)
+{
+	*p++ = htonl(xid);
+	*p++ = htonl(MSG_REPLY);
+	*p++ = 0;		/* accepted */
+	*p++ = 0;		/* AUTH_NONE verifier */
+	*p++ = 0;
+	*p++ = 0;		/* success */
+
+	return p;
+}
+
+/*
+ * Answer the call in @call, which has @len bytes, into @reply
+ *
+ * Return: length of the reply, 0 if there is none
+ */
+static int sb_nfs_call(const u32 *call, int len, u32 *reply)
+{
+	u32 prog = ntohl(call[3]);
+	u32 proc = ntohl(call[5]);
+	const u32 *arg = call + 6;
+	u32 *p = sb_rpc_reply(reply, ntohl(call[0]));
+	u32 off, count, i;
+
+	/* Skip the credential and the verifier */
+	arg += 2 + ntohl(arg[1]) / 4;
+	arg += 2 + ntohl(arg[1]) / 4;
+
+	switch (prog) {
+	case PROG_PORTMAP:
+		*p++ = htonl(ntohl(arg[0]) == PROG_MOUNT ? SB_MOUNT_PORT :
+			     SB_NFS_PORT);
+		break;
+	case PROG_MOUNT:
+		if (proc == MOUNT_ADDENTRY) {
+			*p++ = 0;
+			*p++ = htonl(strlen(SB_NFS_FH));
+			memcpy(p, SB_NFS_FH, strlen(SB_NFS_FH));
+			p += strlen(SB_NFS_FH) / 4;
+			*p++ = 0;
+		}
+		break;
+	case PROG_NFS:
+		*p++ = 0;
+		if (proc == NFS3PROC_LOOKUP) {
+			*p++ = htonl(strlen(SB_NFS_FH));
+			memcpy(p, SB_NFS_FH, strlen(SB_NFS_FH));
+			p += strlen(SB_NFS_FH) / 4;
+			*p++ = 0;
+			*p++ = 0;
+		} else if (proc == NFS3PROC_FSINFO) {
+			*p++ = 0;
+			*p++ = htonl(SZ_1M);
+			*p++ = htonl(sb_nfs.rtpref);
+			for (i = 0; i < 10; i++)
+				*p++ = 0;
+		} else if (proc == NFS_READ) {
+			arg += 1 + ntohl(arg[0]) / 4;
+			off = ntohl(arg[1]);
+			count = ntohl(arg[2]);
+			count = off < sb_nfs.len ?
+				min(count, sb_nfs.len - off) : 0;
+			sb_nfs.reads++;
+			*p++ = 0;
+			*p++ = htonl(count);
+			*p++ = htonl(off + count >= sb_nfs.len);
+			*p++ = htonl(count);
+			for (i = 0; i < count; i++)
+				((u8 *)p)[i] = sb_net_byte(off + i);
+			p += DIV_ROUND_UP(count, 4);
+		}
+		break;
+	}
+
+	return (uchar *)p - (uchar *)reply;
+}
+
+static int sb_nfs_udp(struct udevice *dev, void *packet)
+{
+	struct ip_udp_hdr *udp = packet + ETHER_HDR_SIZE;
+	static u32 reply[(SZ_64K + 256) / 4];
+	int reads = sb_nfs.reads;
+	int len, ret;
+
+	len = sb_nfs_call((u32 *)(udp + 1), ntohs(udp->udp_len) - UDP_HDR_SIZE,
+			  reply);
+
+	/* The client asks again with the same XID */
+	ret = sb_nfs_udp_send(dev, packet, reply, len);
+	if (ret)
+		sb_nfs.reads = reads;
+
+	return ret;
+}
+
+/* Send what the window allows */
+static void sb_nfs_tcp_push(struct udevice *dev, void *packet)
+{
+	uchar data[TCP_MSS];
+	int n, i;
+
+	while (sb_nfs.seq != sb_nfs.end &&
+	       sb_nfs.seq - sb_nfs.acked < sb_nfs.win) {
+		n = min3(sb_nfs.end - sb_nfs.seq, (u32)TCP_MSS,
+			 sb_nfs.win - (sb_nfs.seq - sb_nfs.acked));
+		for (i = 0; i < n; i++)
+			data[i] = sb_nfs.out[(sb_nfs.seq + i) % SB_NFS_OUT_SIZE];
+		if (sb_nfs_tcp_send(dev, packet, TCP_ACK, sb_nfs.seq, data, n))
+			break;
+		sb_nfs.seq += n;
+	}
+}
+
+static int sb_nfs_tcp(struct udevice *dev, void *packet)
+{
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	int hdr_len = GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	int payload_len = ntohs(tcp->ip_len) - IP_HDR_SIZE - hdr_len;
+	uchar *payload = (uchar *)tcp + IP_HDR_SIZE + hdr_len;
+	static u32 reply[(SZ_64K + 256) / 4];
+	u32 seq = ntohl(tcp->tcp_seq);
+	u32 ack = ntohl(tcp->tcp_ack);
+	u32 mark, rec_len;
+	int len, i;
+
+	if (tcp->tcp_flags & TCP_RST) {
+		sb_nfs.port = 0;
+		return 0;
+	}
+	if (tcp->tcp_flags == TCP_SYN) {
+		sb_nfs.port = ntohs(tcp->tcp_src);
+		sb_nfs.rcv = seq + 1;
+		sb_nfs.req_len = 0;
+		sb_nfs.seq = 1;
+		sb_nfs.end = 1;
+		sb_nfs.acked = 1;
+		sb_nfs.win = 0;
+		return sb_nfs_tcp_send(dev, packet, TCP_SYN | TCP_ACK, 0,
+				       NULL, 0);
+	}
+	if (ntohs(tcp->tcp_src) != sb_nfs.port)
+		return sb_nfs_tcp_send(dev, packet, TCP_RST, ack, NULL, 0);
+
+	if ((s32)(ack - sb_nfs.acked) > 0)
+		sb_nfs.acked = ack;
+	sb_nfs.win = ntohs(tcp->tcp_win);
+
+	/* Take in calls which arrive in order, a record at a time */
+	if (payload_len && seq == sb_nfs.rcv &&
+	    sb_nfs.req_len + payload_len <= sizeof(sb_nfs.req)) {
+		sb_nfs.rcv += payload_len;
+		memcpy(sb_nfs.req + sb_nfs.req_len, payload, payload_len);
+		sb_nfs.req_len += payload_len;
+		while (sb_nfs.req_len >= 4) {
+			mark = get_unaligned_be32(sb_nfs.req);
+			rec_len = mark & ~0x80000000;
+			if (sb_nfs.req_len < 4 + rec_len)
+				break;
+			len = sb_nfs_call((u32 *)(sb_nfs.req + 4), rec_len,
+					  reply);
+			put_unaligned_be32(0x80000000 | len, &mark);
+			for (i = 0; i < 4; i++)
+				sb_nfs.out[sb_nfs.end++ % SB_NFS_OUT_SIZE] =
+					((uchar *)&mark)[i];
+			for (i = 0; i < len; i++)
+				sb_nfs.out[sb_nfs.end++ % SB_NFS_OUT_SIZE] =
+					((uchar *)reply)[i];
+			sb_nfs.req_len -= 4 + rec_len;
+			memmove(sb_nfs.req, sb_nfs.req + 4 + rec_len,
+				sb_nfs.req_len);
+		}
+	}
+	if (tcp->tcp_flags & TCP_FIN) {
+		sb_nfs.rcv++;
+		sb_nfs.port = 0;
+		return sb_nfs_tcp_send(dev, packet, TCP_ACK | TCP_FIN,
+				       sb_nfs.end, NULL, 0);
+	}
+
+	sb_nfs_tcp_push(dev, packet);
+
+	return 0;
+}
+
+static int sb_nfs_handler(struct udevice *dev, void *packet,
+			  unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sandbox_eth_arp_req_to_reply(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP)
+		return -EPROTONOSUPPORT;
+	if (ip->ip_p == IPPROTO_UDP)
+		return sb_nfs_udp(dev, packet);
+	if (IS_ENABLED(CONFIG_NFS_TCP) && ip->ip_p == IPPROTO_TCP)
+		return sb_nfs_tcp(dev, packet);
+
+	return -EPROTONOSUPPORT;
+}
+
+static int sb_nfs_run(struct unit_test_state *uts, u32 len, u32 rtpref)
+{
+	u8 *buf = map_sysmem(0x20000, len);
+	int reads;
+	u32 i;
+
+	memset(&sb_nfs, '\0', sizeof(sb_nfs));
+	sb_nfs.len = len;
+	sb_nfs.rtpref = rtpref;
+	memset(buf, '\0', len);
+
+	sandbox_eth_set_tx_handler(0, sb_nfs_handler);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	ut_assertok(run_command("nfs 20000 1.1.2.6:/export/file", 0));
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	ut_asserteq(len, env_get_hex("filesize", 0));
+	for (i = 0; i < len; i++) {
+		if (buf[i] != sb_net_byte(i))
+			ut_asserteq(sb_net_byte(i), buf[i]);
+	}
+
+	/*
+	 * Reads which were already in flight when the end of the file was
+	 * found show that they overlapped
+	 */
+	reads = DIV_ROUND_UP(len, rtpref);
+	ut_assert(sb_nfs.reads >= reads + (CONFIG_NFS_READ_WINDOW > 1));
+	ut_assert(sb_nfs.reads <= reads + CONFIG_NFS_READ_WINDOW - 1);
+
+	return 0;
+}
+
+/* Reads are as large as the server prefers, with several in flight */
+static int net_test_nfs(struct unit_test_state *uts)
+{
+	ut_assertok(sb_nfs_run(uts, 10000, NFS_READ_SIZE));
+
+	/* Over TCP there is no IP datagram to limit the read size */
+	if (IS_ENABLED(CONFIG_NFS_TCP))
+		ut_assertok(sb_nfs_run(uts, 300000, SZ_64K));
+
+	return 0;
+}
+
+LIB_TEST(net_test_nfs, 0);
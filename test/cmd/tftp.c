@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for the tftpboot command with a window of blocks, against a small
+ * TFTP server which loses some of them, and by multicast
+ */
+
+#include <common.h>
+#include <command.h>
+#include <dm.h>
+#include <env.h>
+#include <mapmem.h>
+#include <net.h>
+#include <asm/eth.h>
+#include <asm/unaligned.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+#include "net_test.h"
+
+#define SB_TFTP_PORT	69
+#define SB_TFTP_TID	5000
+#define SB_TFTP_BLKSIZE	512
+#define SB_TFTP_GROUP	"224.1.2.3"
+#define SB_TFTP_MCPORT	1758
+
+#define TFTP_RRQ	1
+#define TFTP_DATA	3
+#define TFTP_ACK	4
+#define TFTP_OACK	6
+
+/* How the server sends the file when asked to by multicast */
+enum sb_tftp_mcast {
+	SB_TFTP_UNICAST,	/* it does not support multicast */
+	SB_TFTP_MASTER,		/* the client is the master client at once */
+	SB_TFTP_LATE,		/* the client joins while others are loading */
+};
+
+/**
+ * struct sb_tftp_state - the server
+ *
+ * @len: size of the file
+ * @window: window size agreed
+ * @requested: window size the client asked for, 1 if it did not
+ * @drop: blocks to lose the first time they are sent, bit n for block n
+ * @sent: blocks sent at least once, bit n for block n
+ * @data: data packets sent, not counting lost ones
+ * @mcast: how to send the file if the client asks for multicast
+ * @master: the client is the master client
+ * @resent: blocks sent to the group more than once, bit n for block n
+ */
+static struct sb_tftp_state {
+	u32 len;
+	u32 window;
+	u32 requested;
+	u64 drop;
+	u64 sent;
+	int data;
+	enum sb_tftp_mcast mcast;
+	bool master;
+	u64 resent;
+} sb_tftp;
+
+/*
+ * Queue a UDP packet for the client, made from the headers of @packet, or for
+ * the multicast group if @group is set
+ */
+static int sb_tftp_send(struct udevice *dev, void *packet, const void *data,
+			int len, bool group)
+{
+	static const u8 group_ethaddr[ARP_HLEN] = {
+		0x01, 0x00, 0x5e, 0x01, 0x02, 0x03
+	};
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	struct ethernet_hdr *eth_send;
+	struct ip_udp_hdr *ips;
+
+	if (priv->recv_packets >= PKTBUFSRX)
+		return -ENOSPC;
+
+	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_send->et_dest, group ? group_ethaddr : eth->et_src,
+	       ARP_HLEN);
+	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_send->et_protlen = htons(PROT_IP);
+
+	ips = (void *)eth_send + ETHER_HDR_SIZE;
+	net_set_ip_header((uchar *)ips,
+			  group ? string_to_ip(SB_TFTP_GROUP) : ip->ip_src,
+			  ip->ip_dst, IP_UDP_HDR_SIZE + len, IPPROTO_UDP);
+	ips->udp_src = htons(SB_TFTP_TID);
+	ips->udp_dst = group ? htons(SB_TFTP_MCPORT) : ip->udp_src;
+	ips->udp_len = htons(UDP_HDR_SIZE + len);
+	ips->udp_xsum = 0;
+	memcpy(ips + 1, data, len);
+
+	priv->recv_packet_length[priv->recv_packets++] = ETHER_HDR_SIZE +
+		IP_UDP_HDR_SIZE + len;
+
+	return 0;
+}
+
+/* Send data block @block, to the client or to the group */
+static int sb_tftp_block(struct udevice *dev, void *packet, u32 block,
+			 bool group)
+{
+	u8 data[4 + SB_TFTP_BLKSIZE];
+	u32 off, n, i;
+
+	off = (block - 1) * SB_TFTP_BLKSIZE;
+	n = min(sb_tftp.len - off, (u32)SB_TFTP_BLKSIZE);
+	put_unaligned_be16(TFTP_DATA, data);
+	put_unaligned_be16(block, data + 2);
+	for (i = 0; i < n; i++)
+		data[4 + i] = sb_net_byte(off + i);
+
+	return sb_tftp_send(dev, packet, data, 4 + n, group);
+}
+
+/* The last block, which is short */
+static u32 sb_tftp_last(void)
+{
+	return sb_tftp.len / SB_TFTP_BLKSIZE + 1;
+}
+
+/* Send a window of blocks from @block, as many as there is room for */
+static void sb_tftp_window(struct udevice *dev, void *packet, u32 block)
+{
+	u32 end = min(block + sb_tftp.window, sb_tftp_last() + 1);
+
+	for (; block < end; block++) {
+		if (sb_tftp.drop & ~sb_tftp.sent & BIT_ULL(block)) {
+			sb_tftp.sent |= BIT_ULL(block);
+			continue;
+		}
+		sb_tftp.sent |= BIT_ULL(block);
+		if (sb_tftp_block(dev, packet, block, false))
+			break;
+		sb_tftp.data++;
+	}
+}
+
+/* Send a block to the group, noting whether it was sent before */
+static int sb_tftp_mcast_block(struct udevice *dev, void *packet, u32 block)
+{
+	int ret;
+
+	ret = sb_tftp_block(dev, packet, block, true);
+	if (ret)
+		return ret;
+	if (sb_tftp.sent & BIT_ULL(block))
+		sb_tftp.resent |= BIT_ULL(block);
+	sb_tftp.sent |= BIT_ULL(block);
+
+	return 0;
+}
+
+/*
+ * Handle an ACK by multicast. One from a client which is not the master
+ * client asks for blocks it missed, so it is made the master client.
+ */
+static int sb_tftp_mcast_ack(struct udevice *dev, void *packet, u32 block)
+{
+	char oack[32];
+	char *p;
+
+	if (!sb_tftp.master) {
+		sb_tftp.master = true;
+		put_unaligned_be16(TFTP_OACK, oack);
+		p = oack + 2;
+		p += sprintf(p, "multicast%c,,1", 0) + 1;
+
+		return sb_tftp_send(dev, packet, oack, p - oack, false);
+	}
+	if (block < sb_tftp_last())
+		return sb_tftp_mcast_block(dev, packet, block + 1);
+
+	return 0;
+}
+
+static int sb_tftp_handler(struct udevice *dev, void *packet,
+			   unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	char *req = (char *)(ip + 1);
+	char *end = req + ntohs(ip->udp_len) - UDP_HDR_SIZE;
+	char oack[64];
+	char *p, *opt;
+	u32 block;
+	int ret;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sandbox_eth_arp_req_to_reply(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP || ip->ip_p != IPPROTO_UDP)
+		return -EPROTONOSUPPORT;
+
+	if (ntohs(ip->udp_dst) == SB_TFTP_PORT &&
+	    get_unaligned_be16(req) == TFTP_RRQ) {
+		put_unaligned_be16(TFTP_OACK, oack);
+		p = oack + 2;
+		p += sprintf(p, "blksize%c%d", 0, SB_TFTP_BLKSIZE) + 1;
+		sb_tftp.requested = 1;
+		sb_tftp.window = 1;
+
+		/* Skip the file name and the mode */
+		opt = req + 2;
+		opt += strlen(opt) + 1;
+		opt += strlen(opt) + 1;
+		for (; opt < end; opt += strlen(opt) + 1) {
+			if (!strcmp(opt, "windowsize")) {
+				opt += strlen(opt) + 1;
+				sb_tftp.requested = dectoul(opt, NULL);
+				sb_tftp.window = sb_tftp.requested;
+				p += sprintf(p, "windowsize%c%d", 0,
+					     sb_tftp.window) + 1;
+			}
+			if (!strcmp(opt, "multicast") && sb_tftp.mcast) {
+				opt += strlen(opt) + 1;
+				sb_tftp.master = sb_tftp.mcast == SB_TFTP_MASTER;
+				p += sprintf(p, "multicast%c%s,%d,%d", 0,
+					     SB_TFTP_GROUP, SB_TFTP_MCPORT,
+					     sb_tftp.master) + 1;
+			}
+		}
+
+		ret = sb_tftp_send(dev, packet, oack, p - oack, false);
+		if (ret || sb_tftp.mcast != SB_TFTP_LATE)
+			return ret;
+
+		/* Blocks being sent to other clients, before the others */
+		for (block = 3; block <= 4; block++)
+			sb_tftp_mcast_block(dev, packet, block);
+
+		return 0;
+	}
+
+	if (ntohs(ip->udp_dst) == SB_TFTP_TID &&
+	    get_unaligned_be16(req) == TFTP_ACK) {
+		block = get_unaligned_be16(req + 2);
+		if (sb_tftp.mcast)
+			return sb_tftp_mcast_ack(dev, packet, block);
+		sb_tftp_window(dev, packet, block + 1);
+		return 0;
+	}
+
+	return -EPROTONOSUPPORT;
+}
+
+static int sb_tftp_run(struct unit_test_state *uts, u32 len, u64 drop,
+		       enum sb_tftp_mcast mcast)
+{
+	u8 *buf = map_sysmem(0x20000, len);
+	ulong start;
+	u32 i;
+
+	memset(&sb_tftp, '\0', sizeof(sb_tftp));
+	sb_tftp.len = len;
+	sb_tftp.drop = drop;
+	sb_tftp.mcast = mcast;
+	memset(buf, '\0', len);
+
+	sandbox_eth_set_tx_handler(0, sb_tftp_handler);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	start = get_timer(0);
+	ut_assertok(run_command("tftpboot 20000 1.1.2.5:file", 0));
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	/* The lost blocks were asked for again well before the timeout */
+	ut_assert(get_timer(start) < 5000);
+
+	ut_asserteq(len, env_get_hex("filesize", 0));
+	for (i = 0; i < len; i++) {
+		if (buf[i] != sb_net_byte(i))
+			ut_asserteq(sb_net_byte(i), buf[i]);
+	}
+
+	return 0;
+}
+
+/* Lost blocks are asked for again quickly, and shrink the next window */
+static int net_test_tftp_window(struct unit_test_state *uts)
+{
+	env_set("tftpblocksize", "512");
+	env_set("tftptimeout", "5000");
+	env_set("tftpwindowsize", "3");
+
+	/* One block lost in the middle of a window and one at the end */
+	ut_assertok(sb_tftp_run(uts, 20 * SB_TFTP_BLKSIZE + 100,
+				BIT_ULL(2) | BIT_ULL(9), SB_TFTP_UNICAST));
+	ut_asserteq(3, sb_tftp.requested);
+
+	/* The next download asks for a smaller window */
+	ut_assertok(sb_tftp_run(uts, 1000, 0, SB_TFTP_UNICAST));
+	ut_asserteq(1, sb_tftp.requested);
+
+	/* ...and the one after a download without losses a larger one */
+	ut_assertok(sb_tftp_run(uts, 1000, 0, SB_TFTP_UNICAST));
+	ut_asserteq(3, sb_tftp.requested);
+
+	env_set_ulong("tftpblocksize", CONFIG_TFTP_BLOCKSIZE);
+	env_set_ulong("tftpwindowsize", CONFIG_TFTP_WINDOWSIZE);
+
+	return 0;
+}
+
+LIB_TEST(net_test_tftp_window, 0);
+
+#ifdef CONFIG_MCAST_TFTP
+/* A multicast download, joined at the start and part-way through */
+static int net_test_tftp_mcast(struct unit_test_state *uts)
+{
+	env_set("tftpblocksize", "512");
+	env_set("tftptimeout", "1000");
+	env_set("tftpmcast", "yes");
+
+	/* The only client, which acknowledges every block */
+	ut_assertok(sb_tftp_run(uts, 7 * SB_TFTP_BLKSIZE + 100, 0,
+				SB_TFTP_MASTER));
+	ut_asserteq(0, sb_tftp.resent);
+	ut_asserteq(0, net_mcast_addr.s_addr);
+
+	/*
+	 * Joining while blocks 3 and 4 go out to other clients: the blocks
+	 * before and after them are asked for, but not those again
+	 */
+	ut_assertok(sb_tftp_run(uts, 7 * SB_TFTP_BLKSIZE + 100, 0,
+				SB_TFTP_LATE));
+	ut_asserteq(0, sb_tftp.resent);
+	ut_asserteq(GENMASK_ULL(8, 1), sb_tftp.sent);
+	ut_asserteq(0, net_mcast_addr.s_addr);
+
+	env_set("tftpmcast", NULL);
+	env_set("tftptimeout", "5000");
+	env_set_ulong("tftpblocksize", CONFIG_TFTP_BLOCKSIZE);
+
+	return 0;
+}
+
+LIB_TEST(net_test_tftp_mcast, 0);
+#endif
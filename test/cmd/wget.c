@@ -13,6 +13,7 @@
 #include <fdtdec.h>
 #include <log.h>
 #include <malloc.h>
+#include <mapmem.h>
 #include <net.h>
 #include <net/tcp.h>
 #include <net/wget.h>
@@ -23,42 +24,50 @@
 #include <test/lib.h>
 #include <test/test.h>
 #include <test/ut.h>
+#include "net_test.h"
 
 #define SHIFT_TO_TCPHDRLEN_FIELD(x) ((x) << 4)
 #define LEN_B_TO_DW(x) ((x) >> 2)
+#define GET_TCP_HDR_LEN_IN_BYTES(x) ((x) >> 2)
 
-static int sb_arp_handler(struct udevice *dev, void *packet,
-			  unsigned int len)
-{
-	struct eth_sandbox_priv *priv = dev_get_priv(dev);
-	struct arp_hdr *arp = packet + ETHER_HDR_SIZE;
-	int ret = 0;
-
-	if (ntohs(arp->ar_op) == ARPOP_REQUEST) {
-		priv->fake_host_ipaddr = net_read_ip(&arp->ar_spa);
-
-		ret = sandbox_eth_recv_arp_req(dev);
-		if (ret)
-			return ret;
-		ret = sandbox_eth_arp_req_to_reply(dev, packet, len);
-		return ret;
-	}
+/*
+ * A small HTTP server: it sends the response segments in the order given,
+ * as fast as the receive buffers allow, then closes the connection once
+ * the client has acknowledged them all
+ */
+struct sb_http_seg {
+	u32 off;
+	u32 len;
+};
 
-	return -EPROTONOSUPPORT;
-}
+static struct sb_http_state {
+	const char *resp;
+	const struct sb_http_seg *segs;
+	int seg_count;
+	int next_seg;
+	bool wscale;
+	bool fin_sent;
+	u32 resp_len;
+	u16 win;
+	int sack_count;
+	struct sack_edges sack[TCP_SACK_HILLS];
+} sb_http;
 
-static int sb_syn_handler(struct udevice *dev, void *packet,
-			  unsigned int len)
+static int sb_tcp_send(struct udevice *dev, void *packet, u8 flags, u32 seq,
+		       u32 ack, const void *data, int payload_len)
 {
 	struct eth_sandbox_priv *priv = dev_get_priv(dev);
 	struct ethernet_hdr *eth = packet;
 	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
 	struct ethernet_hdr *eth_send;
 	struct ip_tcp_hdr *tcp_send;
+	int hdr_len = IP_TCP_HDR_SIZE;
+	uchar *opt;
+	int pkt_len;
 
 	/* Don't allow the buffer to overrun */
 	if (priv->recv_packets >= PKTBUFSRX)
-		return 0;
+		return -ENOSPC;
 
 	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
 	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
@@ -67,92 +76,113 @@ static int sb_syn_handler(struct udevice *dev, void *packet,
 	tcp_send = (void *)eth_send + ETHER_HDR_SIZE;
 	tcp_send->tcp_src = tcp->tcp_dst;
 	tcp_send->tcp_dst = tcp->tcp_src;
-	tcp_send->tcp_seq = htonl(0);
-	tcp_send->tcp_ack = htonl(ntohl(tcp->tcp_seq) + 1);
-	tcp_send->tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(TCP_HDR_SIZE));
-	tcp_send->tcp_flags = TCP_SYN | TCP_ACK;
+	tcp_send->tcp_seq = htonl(seq);
+	tcp_send->tcp_ack = htonl(ack);
+	tcp_send->tcp_flags = flags;
+	if ((flags & TCP_SYN) && sb_http.wscale) {
+		opt = (void *)tcp_send + IP_TCP_HDR_SIZE;
+		opt[0] = TCP_1_NOP;
+		opt[1] = TCP_O_SCL;
+		opt[2] = TCP_OPT_LEN_3;
+		opt[3] = 7;
+		hdr_len += 4;
+	}
+	tcp_send->tcp_hlen =
+		SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(hdr_len - IP_HDR_SIZE));
 	tcp_send->tcp_win = htons(PKTBUFSRX * TCP_MSS >> TCP_SCALE);
 	tcp_send->tcp_xsum = 0;
 	tcp_send->tcp_ugr = 0;
+	memcpy((void *)tcp_send + hdr_len, data, payload_len);
+	pkt_len = hdr_len + payload_len;
 	tcp_send->tcp_xsum = tcp_set_pseudo_header((uchar *)tcp_send,
 						   tcp->ip_src,
 						   tcp->ip_dst,
-						   TCP_HDR_SIZE,
-						   IP_TCP_HDR_SIZE);
+						   pkt_len - IP_HDR_SIZE,
+						   pkt_len);
 	net_set_ip_header((uchar *)tcp_send,
 			  tcp->ip_src,
 			  tcp->ip_dst,
-			  IP_TCP_HDR_SIZE,
+			  pkt_len,
 			  IPPROTO_TCP);
 
 	priv->recv_packet_length[priv->recv_packets] =
-		ETHER_HDR_SIZE + IP_TCP_HDR_SIZE;
+		ETHER_HDR_SIZE + pkt_len;
 	++priv->recv_packets;
 
 	return 0;
 }
 
+static int sb_syn_handler(struct udevice *dev, void *packet,
+			  unsigned int len)
+{
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+
+	return sb_tcp_send(dev, packet, TCP_SYN | TCP_ACK, 0,
+			   ntohl(tcp->tcp_seq) + 1, NULL, 0);
+}
+
+/* Record the client's window and the SACK blocks it reports */
+static void sb_parse_ack(struct ip_tcp_hdr *tcp)
+{
+	int hdr_len = GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	uchar *opt = (uchar *)tcp + IP_TCP_HDR_SIZE;
+	uchar *end = (uchar *)tcp + IP_HDR_SIZE + hdr_len;
+	struct sack_edges *hill;
+	int i, n;
+
+	sb_http.win = ntohs(tcp->tcp_win);
+	while (opt < end && *opt != TCP_O_END) {
+		if (*opt == TCP_1_NOP) {
+			opt++;
+			continue;
+		}
+		if (*opt == TCP_V_SACK) {
+			n = (opt[1] - TCP_OPT_LEN_2) / TCP_SACK_SIZE;
+			hill = (void *)opt + TCP_OPT_LEN_2;
+			if (n > sb_http.sack_count) {
+				for (i = 0; i < n; i++) {
+					sb_http.sack[i].l = ntohl(hill[i].l);
+					sb_http.sack[i].r = ntohl(hill[i].r);
+				}
+				sb_http.sack_count = n;
+			}
+		}
+		opt += opt[1];
+	}
+}
+
 static int sb_ack_handler(struct udevice *dev, void *packet,
 			  unsigned int len)
 {
-	struct eth_sandbox_priv *priv = dev_get_priv(dev);
-	struct ethernet_hdr *eth = packet;
 	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
-	struct ethernet_hdr *eth_send;
-	struct ip_tcp_hdr *tcp_send;
-	void *data;
-	int pkt_len;
-	int payload_len = 0;
-	const char *payload1 = "HTTP/1.1 200 OK\r\n"
-		"Content-Length: 30\r\n\r\n\r\n"
-		"<html><body>Hi</body></html>\r\n";
+	int hdr_len = GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	int payload_len = ntohs(tcp->ip_len) - IP_HDR_SIZE - hdr_len;
+	u32 seq = ntohl(tcp->tcp_seq);
+	u32 ack = seq + payload_len;
+	const struct sb_http_seg *seg;
 
-	/* Don't allow the buffer to overrun */
-	if (priv->recv_packets >= PKTBUFSRX)
-		return 0;
+	sb_parse_ack(tcp);
 
-	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
-	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
-	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
-	eth_send->et_protlen = htons(PROT_IP);
-	tcp_send = (void *)eth_send + ETHER_HDR_SIZE;
-	tcp_send->tcp_src = tcp->tcp_dst;
-	tcp_send->tcp_dst = tcp->tcp_src;
-	data = (void *)tcp_send + IP_TCP_HDR_SIZE;
-
-	if (ntohl(tcp->tcp_seq) == 1 && ntohl(tcp->tcp_ack) == 1) {
-		tcp_send->tcp_seq = htonl(ntohl(tcp->tcp_ack));
-		tcp_send->tcp_ack = htonl(ntohl(tcp->tcp_seq) + 1);
-		payload_len = strlen(payload1);
-		memcpy(data, payload1, payload_len);
-		tcp_send->tcp_flags = TCP_ACK;
-	} else if (ntohl(tcp->tcp_seq) == 2) {
-		tcp_send->tcp_seq = htonl(ntohl(tcp->tcp_ack));
-		tcp_send->tcp_ack = htonl(ntohl(tcp->tcp_seq) + 1);
-		payload_len = 0;
-		tcp_send->tcp_flags = TCP_ACK | TCP_FIN;
-	}
-
-	tcp_send->tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(TCP_HDR_SIZE));
-	tcp_send->tcp_win = htons(PKTBUFSRX * TCP_MSS >> TCP_SCALE);
-	tcp_send->tcp_xsum = 0;
-	tcp_send->tcp_ugr = 0;
-	pkt_len = IP_TCP_HDR_SIZE + payload_len;
-	tcp_send->tcp_xsum = tcp_set_pseudo_header((uchar *)tcp_send,
-						   tcp->ip_src,
-						   tcp->ip_dst,
-						   pkt_len - IP_HDR_SIZE,
-						   pkt_len);
-	net_set_ip_header((uchar *)tcp_send,
-			  tcp->ip_src,
-			  tcp->ip_dst,
-			  pkt_len,
-			  IPPROTO_TCP);
+	if (tcp->tcp_flags & TCP_FIN)
+		return sb_tcp_send(dev, packet, TCP_ACK, sb_http.resp_len + 2,
+				   ack + 1, NULL, 0);
+
+	/* The request has arrived; send the response */
+	if (payload_len && !sb_http.next_seg)
+		sb_http.next_seg = 1;
+	while (sb_http.next_seg && sb_http.next_seg <= sb_http.seg_count) {
+		seg = &sb_http.segs[sb_http.next_seg - 1];
+		if (sb_tcp_send(dev, packet, TCP_ACK, seg->off + 1, ack,
+				sb_http.resp + seg->off, seg->len))
+			return 0;
+		sb_http.next_seg++;
+	}
 
-	if (ntohl(tcp->tcp_seq) == 1 || ntohl(tcp->tcp_seq) == 2) {
-		priv->recv_packet_length[priv->recv_packets] =
-			ETHER_HDR_SIZE + IP_TCP_HDR_SIZE + payload_len;
-		++priv->recv_packets;
+	if (sb_http.next_seg && !sb_http.fin_sent &&
+	    ntohl(tcp->tcp_ack) == sb_http.resp_len + 1) {
+		if (!sb_tcp_send(dev, packet, TCP_ACK | TCP_FIN,
+				 sb_http.resp_len + 1, ack, NULL, 0))
+			sb_http.fin_sent = true;
 	}
 
 	return 0;
@@ -166,7 +196,7 @@ static int sb_http_handler(struct udevice *dev, void *packet,
 	struct ip_tcp_hdr *tcp;
 
 	if (ntohs(eth->et_protlen) == PROT_ARP) {
-		return sb_arp_handler(dev, packet, len);
+		return sandbox_eth_arp_req_to_reply(dev, packet, len);
 	} else if (ntohs(eth->et_protlen) == PROT_IP) {
 		ip = packet + ETHER_HDR_SIZE;
 		if (ip->ip_p == IPPROTO_TCP) {
@@ -183,8 +213,27 @@ static int sb_http_handler(struct udevice *dev, void *packet,
 	return -EPROTONOSUPPORT;
 }
 
+static void sb_http_setup(const char *resp, const struct sb_http_seg *segs,
+			  int seg_count, bool wscale)
+{
+	memset(&sb_http, '\0', sizeof(sb_http));
+	sb_http.resp = resp;
+	sb_http.resp_len = strlen(resp);
+	sb_http.segs = segs;
+	sb_http.seg_count = seg_count;
+	sb_http.wscale = wscale;
+}
+
 static int net_test_wget(struct unit_test_state *uts)
 {
+	static const char payload1[] = "HTTP/1.1 200 OK\r\n"
+		"Content-Length: 30\r\n\r\n\r\n"
+		"<html><body>Hi</body></html>\r\n";
+	static const struct sb_http_seg segs[] = {
+		{ 0, sizeof(payload1) - 1 },
+	};
+
+	sb_http_setup(payload1, segs, ARRAY_SIZE(segs), false);
 	sandbox_eth_set_tx_handler(0, sb_http_handler);
 	sandbox_eth_set_priv(0, uts);
 
@@ -200,7 +249,365 @@ static int net_test_wget(struct unit_test_state *uts)
 	ut_assert_nextline("md5 for 00020000 ... 0002001f ==> 234af48e94b0085060249ecb5942ab57");
 	ut_assertok(ut_check_console_end(uts));
 
+	/* Without window scaling, the window is limited to 64KiB */
+	ut_asserteq(min(TCP_RCV_WND, 0xffff), sb_http.win);
+
 	return 0;
 }
 
 LIB_TEST(net_test_wget, 0);
+
+/* Segments arriving out of order go straight to memory, and SACK says so */
+static int net_test_wget_ooo(struct unit_test_state *uts)
+{
+	static const char hdr[] = "HTTP/1.1 200 OK\r\n"
+		"Content-Length: 256\r\n\r\n";
+	const int hlen = sizeof(hdr) - 1;
+	const struct sb_http_seg segs[] = {
+		{ 0, 20 },			/* header, in two parts */
+		{ 20, hlen - 20 },
+		{ hlen + 64, 64 },		/* first hill */
+		{ hlen + 192, 64 },		/* second hill */
+		{ hlen, 64 },
+		{ hlen + 128, 64 },
+	};
+	char resp[sizeof(hdr) + 256];
+	char *body = resp + hlen;
+	int i;
+
+	strcpy(resp, hdr);
+	for (i = 0; i < 256; i++)
+		body[i] = 'a' + i % 26;
+	body[256] = '\0';
+
+	sb_http_setup(resp, segs, ARRAY_SIZE(segs), true);
+	sandbox_eth_set_tx_handler(0, sb_http_handler);
+	sandbox_eth_set_priv(0, uts);
+
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set("loadaddr", "0x20000");
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.2:/index.html", 0));
+
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	ut_asserteq(256, env_get_hex("filesize", 0));
+	ut_asserteq_mem(body, map_sysmem(0x20000, 256), 256);
+
+	/* Both hills were reported, the newest first */
+	if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
+		ut_asserteq(2, sb_http.sack_count);
+		ut_asserteq(1 + hlen + 192, sb_http.sack[0].l);
+		ut_asserteq(1 + hlen + 256, sb_http.sack[0].r);
+		ut_asserteq(1 + hlen + 64, sb_http.sack[1].l);
+		ut_asserteq(1 + hlen + 128, sb_http.sack[1].r);
+	}
+
+	/* The window is scaled */
+	ut_asserteq(TCP_RCV_WND >> TCP_SCALE, sb_http.win);
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_ooo, 0);
+
+/*
+ * A server for a file made up on the fly. It keeps connections open after
+ * each response, and can answer Range requests. Connections it does not
+ * know about are reset.
+ */
+#define SB_FILE_CONNS	4
+#define SB_FILE_SEG	1024
+
+struct sb_file_conn {
+	u16 port;
+	u32 rcv;
+	u32 seq;
+	u32 acked;
+	u32 win;
+	u32 resp_seq;
+	u32 end;
+	ulong off;
+	int hlen;
+	char hdr[200];
+};
+
+static struct sb_file_state {
+	ulong len;
+	bool ranges;
+	int syns;
+	int requests;
+	int keep_alive_requests;
+	int bad_requests;
+	bool stray;
+	struct sb_file_conn conns[SB_FILE_CONNS];
+} sb_file;
+
+static struct sb_file_conn *sb_file_conn(u16 port, bool add)
+{
+	int i;
+
+	for (i = 0; i < SB_FILE_CONNS; i++) {
+		if (sb_file.conns[i].port == port)
+			return &sb_file.conns[i];
+	}
+	for (i = 0; add && i < SB_FILE_CONNS; i++) {
+		if (!sb_file.conns[i].port) {
+			memset(&sb_file.conns[i], '\0', sizeof(sb_file.conns[i]));
+			sb_file.conns[i].port = port;
+			return &sb_file.conns[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void sb_file_request(struct sb_file_conn *conn, const char *req)
+{
+	ulong first = 0, last = sb_file.len - 1;
+	const char *range;
+
+	if (strncmp(req, "GET /", 5)) {
+		sb_file.bad_requests++;
+		return;
+	}
+	sb_file.requests++;
+	if (strstr(req, "Connection: keep-alive\r\n"))
+		sb_file.keep_alive_requests++;
+
+	range = strstr(req, "Range: bytes=");
+	if (range && sb_file.ranges) {
+		first = simple_strtoul(range + 13, (char **)&range, 10);
+		last = min(simple_strtoul(range + 1, NULL, 10),
+			   sb_file.len - 1);
+		conn->hlen = sprintf(conn->hdr, "HTTP/1.1 206 Partial Content\r\n"
+				     "Content-Length: %lu\r\n"
+				     "Content-Range: bytes %lu-%lu/%lu\r\n"
+				     "Connection: Keep-Alive\r\n\r\n",
+				     last - first + 1, first, last,
+				     sb_file.len);
+	} else {
+		conn->hlen = sprintf(conn->hdr, "HTTP/1.1 200 OK\r\n"
+				     "Content-Length: %lu\r\n"
+				     "Connection: keep-alive\r\n\r\n",
+				     sb_file.len);
+	}
+	conn->off = first;
+	conn->resp_seq = conn->seq;
+	conn->end = conn->seq + conn->hlen + last - first + 1;
+}
+
+/* Send what the client's window allows */
+static int sb_file_send(struct udevice *dev, void *packet,
+			struct sb_file_conn *conn)
+{
+	char data[SB_FILE_SEG];
+	u32 pos;
+	int n, i;
+
+	while (conn->seq != conn->end &&
+	       conn->seq - conn->acked < conn->win) {
+		n = min3(conn->end - conn->seq, (u32)SB_FILE_SEG,
+			 conn->win - (conn->seq - conn->acked));
+		for (i = 0; i < n; i++) {
+			pos = conn->seq + i - conn->resp_seq;
+			if (pos < conn->hlen)
+				data[i] = conn->hdr[pos];
+			else
+				data[i] = sb_net_byte(conn->off + pos -
+						       conn->hlen);
+		}
+		if (sb_tcp_send(dev, packet, TCP_ACK, conn->seq, conn->rcv,
+				data, n))
+			break;
+		conn->seq += n;
+	}
+
+	/*
+	 * If asked to, follow the first response with a segment from well
+	 * past the end of the next one, leaving the client a hole to report
+	 */
+	if (sb_file.stray && conn->hlen && conn->seq == conn->end) {
+		n = conn->end - conn->resp_seq;
+		memset(data, 'x', 100);
+		if (!sb_tcp_send(dev, packet, TCP_ACK, conn->end + n + 100,
+				 conn->rcv, data, 100))
+			sb_file.stray = false;
+	}
+
+	return 0;
+}
+
+static int sb_file_handler(struct udevice *dev, void *packet,
+			   unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	struct sb_file_conn *conn;
+	int hdr_len, payload_len;
+	u32 seq, ack;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sandbox_eth_arp_req_to_reply(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP || tcp->ip_p != IPPROTO_TCP)
+		return -EPROTONOSUPPORT;
+
+	hdr_len = GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	payload_len = ntohs(tcp->ip_len) - IP_HDR_SIZE - hdr_len;
+	seq = ntohl(tcp->tcp_seq);
+	ack = ntohl(tcp->tcp_ack);
+
+	if (tcp->tcp_flags == TCP_SYN) {
+		conn = sb_file_conn(ntohs(tcp->tcp_src), true);
+		if (!conn)
+			return 0;
+		sb_file.syns++;
+		conn->rcv = seq + 1;
+		conn->seq = 1;
+		conn->acked = 1;
+		conn->end = 1;
+		return sb_tcp_send(dev, packet, TCP_SYN | TCP_ACK, 0, conn->rcv,
+				   NULL, 0);
+	}
+
+	conn = sb_file_conn(ntohs(tcp->tcp_src), false);
+	if (tcp->tcp_flags & TCP_RST) {
+		if (conn)
+			conn->port = 0;
+		return 0;
+	}
+	if (!conn)
+		return sb_tcp_send(dev, packet, TCP_RST, ack, 0, NULL, 0);
+
+	sb_parse_ack(tcp);
+	if ((s32)(ack - conn->acked) > 0)
+		conn->acked = ack;
+	conn->win = ntohs(tcp->tcp_win);
+
+	if (payload_len && seq == conn->rcv) {
+		char *req = (char *)tcp + IP_HDR_SIZE + hdr_len;
+
+		conn->rcv += payload_len;
+		req[payload_len] = '\0';
+		sb_file_request(conn, req);
+	}
+	if (tcp->tcp_flags & TCP_FIN) {
+		conn->port = 0;
+		return sb_tcp_send(dev, packet, TCP_ACK, conn->seq, seq + 1,
+				   NULL, 0);
+	}
+
+	return sb_file_send(dev, packet, conn);
+}
+
+static void sb_file_setup(ulong len, bool ranges)
+{
+	memset(&sb_http, '\0', sizeof(sb_http));
+	memset(&sb_file, '\0', sizeof(sb_file));
+	sb_file.len = len;
+	sb_file.ranges = ranges;
+	sandbox_eth_set_tx_handler(0, sb_file_handler);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set("loadaddr", "0x20000");
+}
+
+static int sb_file_check(struct unit_test_state *uts)
+{
+	ulong len = sb_file.len;
+	u8 *buf = map_sysmem(0x20000, len);
+	ulong i;
+
+	ut_asserteq(len, env_get_hex("filesize", 0));
+	for (i = 0; i < len; i++) {
+		if (buf[i] != sb_net_byte(i))
+			ut_asserteq(sb_net_byte(i), buf[i]);
+	}
+
+	return 0;
+}
+
+/* A second download from the same server uses the same connection */
+static int net_test_wget_keep_alive(struct unit_test_state *uts)
+{
+	sb_file_setup(5000, false);
+
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.3:/file", 0));
+	ut_assertok(sb_file_check(uts));
+	memset(map_sysmem(0x20000, 5000), '\0', 5000);
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.3:/file", 0));
+	ut_assertok(sb_file_check(uts));
+	ut_asserteq(1, sb_file.syns);
+	ut_asserteq(2, sb_file.requests);
+	ut_asserteq(2, sb_file.keep_alive_requests);
+
+	/* If the server has dropped it, a new connection is made */
+	memset(sb_file.conns, '\0', sizeof(sb_file.conns));
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.3:/file", 0));
+	ut_assertok(sb_file_check(uts));
+	ut_asserteq(2, sb_file.syns);
+	ut_asserteq(3, sb_file.requests);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_keep_alive, 0);
+
+/* A request sent while there is a hole in the response has no SACK blocks */
+static int net_test_wget_sack_data(struct unit_test_state *uts)
+{
+	sb_file_setup(1000, false);
+	sb_file.stray = true;
+
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.6:/file", 0));
+	ut_assertok(sb_file_check(uts));
+	ut_assert(!sb_file.stray);
+
+	/* The second request goes out on the same connection, intact */
+	memset(map_sysmem(0x20000, 1000), '\0', 1000);
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.6:/file", 0));
+	ut_assertok(sb_file_check(uts));
+	ut_asserteq(1, sb_file.syns);
+	ut_asserteq(2, sb_file.requests);
+	ut_asserteq(0, sb_file.bad_requests);
+
+	/* The hole was reported, in segments without data */
+	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
+		ut_asserteq(1, sb_http.sack_count);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_sack_data, 0);
+
+/* A large file comes in parts over several connections */
+static int net_test_wget_range(struct unit_test_state *uts)
+{
+	sb_file_setup(0x180000 + 1234, true);
+	env_set("httpconns", "3");
+
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.4:/file", 0));
+	ut_assertok(sb_file_check(uts));
+
+	/* The first part tells the size, then each connection gets a part */
+	ut_asserteq(3, sb_file.syns);
+	ut_asserteq(4, sb_file.requests);
+
+	/* A server without Range support sends it all on one connection */
+	sb_file_setup(5000, false);
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.5:/file", 0));
+	ut_assertok(sb_file_check(uts));
+	ut_asserteq(1, sb_file.syns);
+	ut_asserteq(1, sb_file.requests);
+
+	env_set("httpconns", NULL);
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_range, 0);
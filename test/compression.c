@@ -13,6 +13,8 @@
 #include <malloc.h>
 #include <mapmem.h>
 #include <asm/io.h>
+#include <asm/test.h>
+#include <asm/unaligned.h>
 
 #include <u-boot/lz4.h>
 #include <u-boot/zlib.h>
@@ -23,6 +25,7 @@
 #include <lzma/LzmaTools.h>
 
 #include <linux/lzo.h>
+#include <linux/sizes.h>
 #include <linux/zstd.h>
 #include <test/compression.h>
 #include <test/suites.h>
@@ -610,6 +613,267 @@ static int compression_test_bootm_none(struct unit_test_state *uts)
 }
 COMPRESSION_TEST(compression_test_bootm_none, 0);
 
+/**
+ * run_stream_test() - Run tests on decompressing an image piece by piece
+ *
+ * @comp_type:	Compression type to test
+ * @compress:	Our function to compress data
+ * Return: 0 if OK, non-zero on failure
+ */
+static int run_stream_test(struct unit_test_state *uts, int comp_type,
+			   mutate_func compress)
+{
+	static const ulong piece_sizes[] = { 1, 7, 64, 1024 };
+	struct image_decomp_stream ds;
+	char compressed[1024];
+	char out[TEST_BUFFER_SIZE];
+	ulong compress_size = sizeof(compressed);
+	ulong unc_len = strlen(plain);
+	ulong pos, n;
+	int i, ret;
+
+	printf("Testing: %s\n", genimg_get_comp_name(comp_type));
+	ut_assertok(compress(uts, (void *)plain, unc_len, compressed,
+			     compress_size, &compress_size));
+
+	/* Any split of the input gives the same result */
+	for (i = 0; i < ARRAY_SIZE(piece_sizes); i++) {
+		memset(out, 'A', sizeof(out));
+		ut_assertok(image_decomp_stream_start(&ds, comp_type, out,
+						      sizeof(out)));
+		for (pos = 0; pos < compress_size; pos += n) {
+			n = min(piece_sizes[i], compress_size - pos);
+			ut_assertok(image_decomp_stream_feed(&ds,
+							     compressed + pos,
+							     n));
+		}
+		ut_assertok(image_decomp_stream_end(&ds));
+		ut_asserteq(unc_len, ds.len);
+		ut_asserteq_mem(plain, out, unc_len);
+		ut_asserteq('A', out[unc_len]);
+	}
+
+	/* Decompression does not over-run */
+	memset(out, 'A', sizeof(out));
+	ut_assertok(image_decomp_stream_start(&ds, comp_type, out,
+					      unc_len - 1));
+	ret = image_decomp_stream_feed(&ds, compressed, compress_size);
+	ut_assert(image_decomp_stream_end(&ds) || ret);
+	ut_asserteq('A', out[unc_len - 1]);
+
+	/* We can't detect truncation when not decompressing */
+	if (comp_type == IH_COMP_NONE)
+		return 0;
+	ut_assertok(image_decomp_stream_start(&ds, comp_type, out,
+					      sizeof(out)));
+	ut_assertok(image_decomp_stream_feed(&ds, compressed,
+					     compress_size / 2));
+	ut_assert(image_decomp_stream_end(&ds));
+
+	return 0;
+}
+
+static int compression_test_stream_gzip(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_GZIP, compress_using_gzip);
+}
+COMPRESSION_TEST(compression_test_stream_gzip, 0);
+
+static int compression_test_stream_lzma(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_LZMA, compress_using_lzma);
+}
+COMPRESSION_TEST(compression_test_stream_lzma, 0);
+
+static int compression_test_stream_lz4(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_LZ4, compress_using_lz4);
+}
+COMPRESSION_TEST(compression_test_stream_lz4, 0);
+
+static int compression_test_stream_zstd(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_ZSTD, compress_using_zstd);
+}
+COMPRESSION_TEST(compression_test_stream_zstd, 0);
+
+static int compression_test_stream_none(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_NONE, compress_using_none);
+}
+COMPRESSION_TEST(compression_test_stream_none, 0);
+
+static void set_cpu_workers(int count)
+{
+	if (CONFIG_IS_ENABLED(CPU_WORKER))
+		sandbox_cpu_worker_set_count(count);
+}
+
+/* Make an LZ4 block which repeats the 8 bytes at @pat to fill @size bytes */
+static size_t lz4_make_block(u8 *out, const char *pat, size_t size)
+{
+	size_t left = size - 16 - 4 - 15;
+	u8 *start = out;
+
+	/* 8 literals, then a match at offset 8 for all but the last 8 bytes */
+	*out++ = 0x8f;
+	memcpy(out, pat, 8);
+	out += 8;
+	*out++ = 8;
+	*out++ = 0;
+	for (; left >= 255; left -= 255)
+		*out++ = 255;
+	*out++ = left;
+
+	/* The block must end with literals */
+	*out++ = 0x80;
+	memcpy(out, pat, 8);
+	out += 8;
+
+	return out - start;
+}
+
+/*
+ * Make an LZ4 frame with 64KiB blocks, the first @count - 1 of @sizes bytes.
+ * Each block repeats a pattern of its own and the third one is stored.
+ */
+static size_t lz4_make_frame(u8 *out, char *plain, const size_t *sizes,
+			     int count)
+{
+	u8 *start = out;
+	char pat[9];
+	int i, j;
+
+	put_unaligned_le32(0x184d2204, out);
+	out[4] = 0x60;	/* version 1, independent blocks */
+	out[5] = 0x40;	/* 64KiB blocks */
+	out[6] = 0;	/* header checksum, not checked */
+	out += 7;
+
+	for (i = 0; i < count; i++) {
+		snprintf(pat, sizeof(pat), "block%03d", i);
+		if (i == 2) {
+			for (j = 0; j < sizes[i]; j++)
+				plain[j] = pat[j % 8];
+			memcpy(out + 4, plain, sizes[i]);
+			put_unaligned_le32(sizes[i] | 0x80000000, out);
+			out += 4 + sizes[i];
+		} else {
+			for (j = 0; j < sizes[i]; j++)
+				plain[j] = pat[j % 8];
+			put_unaligned_le32(lz4_make_block(out + 4, pat,
+							  sizes[i]), out);
+			out += 4 + get_unaligned_le32(out);
+		}
+		plain += sizes[i];
+	}
+	put_unaligned_le32(0, out);
+	out += 4;
+
+	return out - start;
+}
+
+static int run_lz4_parallel(struct unit_test_state *uts, const size_t *sizes,
+			    int count)
+{
+	size_t in_size, len, total = 0;
+	char *plain, *out;
+	u8 *in;
+	int i, workers;
+
+	for (i = 0; i < count; i++)
+		total += sizes[i];
+	in = malloc(total + 64 * count);
+	plain = malloc(total);
+	out = malloc(total + 1);
+	ut_assertnonnull(in);
+	ut_assertnonnull(plain);
+	ut_assertnonnull(out);
+	in_size = lz4_make_frame(in, plain, sizes, count);
+
+	/* Check with the workers and with everything on this core */
+	for (workers = 3; workers >= 0; workers -= 3) {
+		set_cpu_workers(workers);
+		memset(out, 'A', total + 1);
+		len = total + 1;
+		ut_assertok(ulz4fn(in, in_size, out, &len));
+		ut_asserteq(total, len);
+		ut_asserteq_mem(plain, out, total);
+		ut_asserteq('A', out[total]);
+
+		len = total - 1;
+		ut_assert(ulz4fn(in, in_size, out, &len) < 0);
+	}
+	set_cpu_workers(3);
+
+	free(out);
+	free(plain);
+	free(in);
+
+	return 0;
+}
+
+/* Test decompressing the blocks of an LZ4 frame on several cores */
+static int compression_test_lz4_parallel(struct unit_test_state *uts)
+{
+	static const size_t full[] = { SZ_64K, SZ_64K, SZ_64K, SZ_64K, 4096 };
+	static const size_t part[] = { SZ_64K, 8192, SZ_64K, 4096 };
+
+	ut_assertok(run_lz4_parallel(uts, full, ARRAY_SIZE(full)));
+
+	/* A block which is not full cannot be placed without decoding */
+	ut_assertok(run_lz4_parallel(uts, part, ARRAY_SIZE(part)));
+
+	return 0;
+}
+COMPRESSION_TEST(compression_test_lz4_parallel, 0);
+
+/* Test decompressing several Zstandard frames, on several cores */
+static int compression_test_zstd_frames(struct unit_test_state *uts)
+{
+	static const u8 skip[] = { 0x50, 0x2a, 0x4d, 0x18, 2, 0, 0, 0, 1, 2 };
+	ulong plain_size = strlen(plain);
+	struct abuf in_buf, out_buf;
+	char in[1024], *out, *p;
+	int workers;
+
+	/* Two frames, a skippable frame, another frame, then padding */
+	p = in;
+	memcpy(p, zstd_compressed, zstd_compressed_size);
+	p += zstd_compressed_size;
+	memcpy(p, zstd_compressed, zstd_compressed_size);
+	p += zstd_compressed_size;
+	memcpy(p, skip, sizeof(skip));
+	p += sizeof(skip);
+	memcpy(p, zstd_compressed, zstd_compressed_size);
+	p += zstd_compressed_size;
+	memset(p, '\0', 8);
+	p += 8;
+
+	out = malloc(plain_size * 4);
+	ut_assertnonnull(out);
+	for (workers = 3; workers >= 0; workers -= 3) {
+		set_cpu_workers(workers);
+		memset(out, 'A', plain_size * 4);
+		abuf_init_set(&in_buf, in, p - in);
+		abuf_init_set(&out_buf, out, plain_size * 4);
+		ut_asserteq(plain_size * 3, zstd_decompress(&in_buf, &out_buf));
+		ut_asserteq_mem(plain, out, plain_size);
+		ut_asserteq_mem(plain, out + plain_size, plain_size);
+		ut_asserteq_mem(plain, out + plain_size * 2, plain_size);
+		ut_asserteq('A', out[plain_size * 3]);
+
+		/* Not enough space */
+		abuf_init_set(&out_buf, out, plain_size * 3 - 1);
+		ut_assert(zstd_decompress(&in_buf, &out_buf) < 0);
+	}
+	set_cpu_workers(3);
+	free(out);
+
+	return 0;
+}
+COMPRESSION_TEST(compression_test_zstd_frames, 0);
+
 int do_ut_compression(struct cmd_tbl *cmdtp, int flag, int argc,
 		      char *const argv[])
 {
@@ -5,12 +5,15 @@
 
 #include <common.h>
 #include <blk.h>
+#include <blkmap.h>
 #include <dm.h>
+#include <os.h>
 #include <part.h>
 #include <sandbox_host.h>
 #include <usb.h>
 #include <asm/global_data.h>
 #include <asm/state.h>
+#include <dm/device-internal.h>
 #include <dm/test.h>
 #include <test/test.h>
 #include <test/ut.h>
@@ -335,3 +338,337 @@ static int dm_test_blk_foreach(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_foreach, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* Test the block cache hashes single blocks and evicts when full */
+static int dm_test_blk_cache(struct unit_test_state *uts)
+{
+	struct block_cache_dev_stats dstats;
+	struct block_cache_stats stats;
+	char data[4 * DEFAULT_BLKSZ], buf[4 * DEFAULT_BLKSZ];
+	int i;
+
+	if (!CONFIG_IS_ENABLED(BLOCK_CACHE))
+		return -EAGAIN;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i / DEFAULT_BLKSZ + 1;
+
+	/* Start without the devices read before the test */
+	blkcache_free();
+
+	/* 4 blocks per request, 16 blocks in all */
+	blkcache_configure(4, 4);
+	blkcache_fill(UCLASS_HOST, 0, 100, 4, DEFAULT_BLKSZ, data);
+
+	/* A request within the range that was filled hits */
+	ut_asserteq(1, blkcache_read(UCLASS_HOST, 0, 101, 2, DEFAULT_BLKSZ,
+				     buf));
+	ut_asserteq_mem(data + DEFAULT_BLKSZ, buf, 2 * DEFAULT_BLKSZ);
+
+	/* So does one straddling two fills */
+	blkcache_fill(UCLASS_HOST, 0, 104, 2, DEFAULT_BLKSZ, data);
+	ut_asserteq(1, blkcache_read(UCLASS_HOST, 0, 103, 2, DEFAULT_BLKSZ,
+				     buf));
+	ut_asserteq_mem(data + 3 * DEFAULT_BLKSZ, buf, DEFAULT_BLKSZ);
+	ut_asserteq_mem(data, buf + DEFAULT_BLKSZ, DEFAULT_BLKSZ);
+
+	/* Another device with the same blocks misses */
+	ut_asserteq(0, blkcache_read(UCLASS_HOST, 1, 101, 2, DEFAULT_BLKSZ,
+				     buf));
+	ut_asserteq(0, blkcache_read(UCLASS_HOST, 0, 99, 2, DEFAULT_BLKSZ,
+				     buf));
+
+	/* Overflowing the cache evicts the oldest blocks */
+	for (i = 0; i < 4; i++)
+		blkcache_fill(UCLASS_HOST, 1, i * 4, 4, DEFAULT_BLKSZ, data);
+	ut_asserteq(1, blkcache_read(UCLASS_HOST, 1, 12, 4, DEFAULT_BLKSZ,
+				     buf));
+	ut_asserteq(0, blkcache_read(UCLASS_HOST, 0, 104, 1, DEFAULT_BLKSZ,
+				     buf));
+
+	ut_assertok(blkcache_dev_stats(0, &dstats));
+	ut_asserteq(UCLASS_HOST, dstats.iftype);
+	ut_asserteq(0, dstats.devnum);
+	ut_asserteq(2, dstats.hits);
+	ut_asserteq(2, dstats.misses);
+	ut_asserteq(6, dstats.evictions);
+	ut_assertok(blkcache_dev_stats(1, &dstats));
+	ut_asserteq(1, dstats.devnum);
+	ut_asserteq(1, dstats.hits);
+	ut_asserteq(1, dstats.misses);
+	ut_asserteq(-ENOENT, blkcache_dev_stats(2, &dstats));
+
+	blkcache_stats(&stats);
+	ut_asserteq(3, stats.hits);
+	ut_asserteq(3, stats.misses);
+	ut_asserteq(6, stats.evictions);
+	ut_asserteq(16, stats.entries);
+
+	blkcache_invalidate(UCLASS_HOST, 1);
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.hits);
+	ut_asserteq(0, stats.entries);
+
+	blkcache_configure(8, 32);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache, 0);
+
+/* Test the block cache holds back writes in write-back mode */
+static int dm_test_blk_cache_writeback(struct unit_test_state *uts)
+{
+	char mem[16 * DEFAULT_BLKSZ], data[2 * DEFAULT_BLKSZ];
+	char buf[2 * DEFAULT_BLKSZ];
+	struct block_cache_stats stats;
+	struct udevice *dev, *blk;
+
+	if (!CONFIG_IS_ENABLED(BLOCK_CACHE) || !CONFIG_IS_ENABLED(BLKMAP))
+		return -EAGAIN;
+
+	memset(mem, '\0', sizeof(mem));
+	memset(data, 0xaa, sizeof(data));
+	ut_assertok(blkmap_create("wbtest", &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(blkmap_map_mem(dev, 0, 16, mem));
+
+	ut_assertok(blkcache_set_mode(BLKCACHE_WRITEBACK));
+	ut_asserteq(BLKCACHE_WRITEBACK, blkcache_get_mode());
+
+	/* Writes stay in the cache but can be read back */
+	ut_asserteq(2, blk_write(blk, 4, 2, data));
+	ut_asserteq(1, blk_write(blk, 6, 1, data));
+	ut_asserteq(1, blk_write(blk, 4, 1, data));
+	ut_asserteq(0, mem[4 * DEFAULT_BLKSZ]);
+	ut_asserteq(2, blk_read(blk, 5, 2, buf));
+	ut_asserteq_mem(data, buf, sizeof(buf));
+
+	blkcache_stats(&stats);
+	ut_asserteq(3, stats.dirty);
+
+	/* Flushing merges the dirty blocks into one write */
+	ut_assertok(blk_flush(blk));
+	ut_asserteq_mem(data, mem + 4 * DEFAULT_BLKSZ, 2 * DEFAULT_BLKSZ);
+	ut_asserteq_mem(data, mem + 6 * DEFAULT_BLKSZ, DEFAULT_BLKSZ);
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.writebacks);
+	ut_asserteq(0, stats.dirty);
+
+	/* A read which misses writes back the dirty blocks it covers */
+	ut_asserteq(1, blk_write(blk, 9, 1, data));
+	ut_asserteq(2, blk_read(blk, 9, 2, buf));
+	ut_asserteq_mem(data, buf, DEFAULT_BLKSZ);
+	ut_asserteq_mem(data, mem + 9 * DEFAULT_BLKSZ, DEFAULT_BLKSZ);
+
+	/* Write-through updates the device and the cache */
+	ut_assertok(blkcache_set_mode(BLKCACHE_WRITETHROUGH));
+	memset(data, 0x55, sizeof(data));
+	ut_asserteq(1, blk_write(blk, 9, 1, data));
+	ut_asserteq_mem(data, mem + 9 * DEFAULT_BLKSZ, DEFAULT_BLKSZ);
+	ut_asserteq(1, blk_read(blk, 9, 1, buf));
+	ut_asserteq_mem(data, buf, DEFAULT_BLKSZ);
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.hits);
+	ut_asserteq(0, stats.dirty);
+
+	ut_assertok(blkmap_destroy(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache_writeback, 0);
+
+/* Test the block cache reads ahead when reading sequentially */
+static int dm_test_blk_cache_readahead(struct unit_test_state *uts)
+{
+	struct block_cache_dev_stats dstats;
+	struct block_cache_stats stats;
+	char mem[64 * DEFAULT_BLKSZ], buf[DEFAULT_BLKSZ];
+	struct udevice *dev, *blk;
+	struct blk_desc *desc;
+	int i;
+
+	if (!CONFIG_IS_ENABLED(BLOCK_CACHE) || !CONFIG_IS_ENABLED(BLKMAP))
+		return -EAGAIN;
+
+	for (i = 0; i < sizeof(mem); i++)
+		mem[i] = i / DEFAULT_BLKSZ;
+	ut_assertok(blkmap_create("ratest", &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(blkmap_map_mem(dev, 0, 64, mem));
+	blkcache_set_readahead(-1, 0, 16);
+
+	/* Start afresh, after the partition-table reads */
+	desc = dev_get_uclass_plat(blk);
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	blkcache_stats(&stats);
+
+	/* The window opens at the second read and then grows */
+	for (i = 8; i < 40; i++) {
+		ut_asserteq(1, blk_read(blk, i, 1, buf));
+		ut_asserteq_mem(mem + i * DEFAULT_BLKSZ, buf, DEFAULT_BLKSZ);
+	}
+	ut_assertok(blkcache_dev_stats(0, &dstats));
+	ut_asserteq(4, dstats.misses);
+	ut_asserteq(28, dstats.hits);
+	ut_asserteq(3, dstats.ra_reads);
+	ut_asserteq(28, dstats.ra_used);
+	ut_asserteq(16, dstats.ra_window);
+	ut_asserteq(16, dstats.ra_max);
+
+	/* A random read closes it again */
+	ut_asserteq(1, blk_read(blk, 60, 1, buf));
+	ut_asserteq_mem(mem + 60 * DEFAULT_BLKSZ, buf, DEFAULT_BLKSZ);
+	ut_assertok(blkcache_dev_stats(0, &dstats));
+	ut_asserteq(0, dstats.ra_window);
+
+	/* Blocks read ahead but never read are wasted */
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	ut_assertok(blkcache_dev_stats(0, &dstats));
+	ut_asserteq(12, dstats.ra_wasted);
+
+	ut_assertok(blkmap_destroy(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache_readahead, 0);
+
+/* Test asynchronous requests on a device without a queue */
+static int dm_test_blk_submit(struct unit_test_state *uts)
+{
+	char mem[16 * DEFAULT_BLKSZ], buf[4 * DEFAULT_BLKSZ];
+	struct blk_req req[2], *reqs[2];
+	struct blk_sg sg[2];
+	struct udevice *dev, *blk;
+	int i;
+
+	if (!CONFIG_IS_ENABLED(BLKMAP))
+		return -EAGAIN;
+
+	for (i = 0; i < sizeof(mem); i++)
+		mem[i] = i / DEFAULT_BLKSZ;
+	ut_assertok(blkmap_create("subtest", &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(blkmap_map_mem(dev, 0, 16, mem));
+
+	/* Read two blocks into each of two segments */
+	memset(buf, '\0', sizeof(buf));
+	sg[0].buf = buf + 2 * DEFAULT_BLKSZ;
+	sg[0].blkcnt = 2;
+	sg[1].buf = buf;
+	sg[1].blkcnt = 2;
+	memset(req, '\0', sizeof(req));
+	req[0].op = BLK_REQ_READ;
+	req[0].start = 3;
+	req[0].sg = sg;
+	req[0].nr_sg = 2;
+	reqs[0] = &req[0];
+	ut_asserteq(1, blk_submit(blk, reqs, 1));
+	ut_asserteq(true, req[0].done);
+	ut_asserteq(4, req[0].result);
+	ut_asserteq(0, blk_poll(blk));
+	ut_asserteq_mem(mem + 3 * DEFAULT_BLKSZ, buf + 2 * DEFAULT_BLKSZ,
+			2 * DEFAULT_BLKSZ);
+	ut_asserteq_mem(mem + 5 * DEFAULT_BLKSZ, buf, 2 * DEFAULT_BLKSZ);
+
+	/* Write them back elsewhere and read them again */
+	req[0].op = BLK_REQ_WRITE;
+	req[0].start = 10;
+	req[1] = req[0];
+	req[1].op = BLK_REQ_READ;
+	req[1].start = 0;
+	req[1].sg = &sg[1];
+	req[1].nr_sg = 1;
+	reqs[1] = &req[1];
+	ut_assertok(blk_submit_all(blk, reqs, 2));
+	ut_asserteq(2, req[1].result);
+	ut_asserteq_mem(mem + 3 * DEFAULT_BLKSZ, mem + 10 * DEFAULT_BLKSZ,
+			2 * DEFAULT_BLKSZ);
+	ut_asserteq_mem(mem, buf, 2 * DEFAULT_BLKSZ);
+
+	/* A request running off the end of the device fails */
+	req[0].op = BLK_REQ_READ;
+	req[0].start = 14;
+	ut_asserteq(-EIO, blk_submit_all(blk, reqs, 1));
+
+	ut_assertok(blkmap_destroy(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit, 0);
+
+/* Test asynchronous requests on a device with a queue */
+static int dm_test_blk_submit_queue(struct unit_test_state *uts)
+{
+	static char label[] = "queue";
+	char mem[8 * DEFAULT_BLKSZ], buf[8 * DEFAULT_BLKSZ];
+	struct blk_req req[8], *reqs[8];
+	struct udevice *dev, *blk;
+	struct blk_sg sg[8];
+	char fname[256];
+	int i, ret;
+
+	for (i = 0; i < sizeof(mem); i++)
+		mem[i] = i / DEFAULT_BLKSZ + 1;
+	ret = os_persistent_file(fname, sizeof(fname), "blk_queue.img");
+	ut_assert(!ret || ret == -ENOENT);
+	ut_assertok(os_write_file(fname, mem, sizeof(mem)));
+	ut_assertok(host_create_device(label, true, DEFAULT_BLKSZ, &dev));
+	ut_assertok(host_attach_file(dev, fname));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(device_probe(blk));
+
+	/* Read each block with its own request, in reverse order */
+	memset(buf, '\0', sizeof(buf));
+	memset(req, '\0', sizeof(req));
+	for (i = 0; i < 8; i++) {
+		sg[i].buf = buf + (7 - i) * DEFAULT_BLKSZ;
+		sg[i].blkcnt = 1;
+		req[i].op = BLK_REQ_READ;
+		req[i].start = i;
+		req[i].sg = &sg[i];
+		req[i].nr_sg = 1;
+		reqs[i] = &req[i];
+	}
+
+	/* Only four fit in the queue and nothing completes until polled */
+	ut_asserteq(4, blk_submit(blk, reqs, 8));
+	ut_asserteq(0, blk_submit(blk, reqs + 4, 4));
+	ut_asserteq(false, req[0].done);
+	ut_asserteq(3, blk_poll(blk));
+	ut_asserteq(true, req[0].done);
+	ut_asserteq(1, req[0].result);
+	ut_asserteq(false, req[1].done);
+	ut_asserteq(1, blk_submit(blk, reqs + 4, 4));
+	ut_asserteq(3, blk_poll(blk));
+
+	/* Finish the rest */
+	ut_assertok(blk_submit_all(blk, reqs + 5, 3));
+	while (blk_poll(blk))
+		;
+	for (i = 0; i < 8; i++) {
+		ut_asserteq(true, req[i].done);
+		ut_asserteq_mem(mem + i * DEFAULT_BLKSZ,
+				buf + (7 - i) * DEFAULT_BLKSZ, DEFAULT_BLKSZ);
+	}
+
+	/* Requests cancelled in flight are completed and leave the queue */
+	ut_asserteq(4, blk_submit(blk, reqs, 4));
+	ut_asserteq(3, blk_poll(blk));
+	blk_cancel(blk);
+	ut_asserteq(1, req[0].result);
+	for (i = 1; i < 4; i++) {
+		ut_asserteq(true, req[i].done);
+		ut_asserteq(-ECANCELED, req[i].result);
+	}
+	ut_asserteq(0, blk_poll(blk));
+	ut_asserteq(4, blk_submit(blk, reqs + 4, 4));
+	while (blk_poll(blk))
+		;
+
+	ut_assertok(host_detach_file(dev));
+	ut_assertok(device_unbind(dev));
+	ut_assertok(os_unlink(fname));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_submit_queue, 0);
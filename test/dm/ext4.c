@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for the directory hashes used by ext4 hash tree directories
+ */
+
+#include <common.h>
+#include <blk.h>
+#include <dm/test.h>
+#include <test/test.h>
+#include <test/ut.h>
+#include "../../fs/ext4/ext4_common.h"
+
+/* Reference hashes, as printed by debugfs "dx_hash -h <version> -s <seed>" */
+static const struct {
+	const char *name;
+	u32 hash[DX_HASH_TEA_UNSIGNED + 1];
+} ext4_hash_vec[] = {
+	{ "hello", {
+		0x32252546, 0xc5b58d16, 0x9862149c,
+		0x32252546, 0xc5b58d16, 0x9862149c } },
+	{ "longer_file_name_number_77", {
+		0x214afb16, 0x2fb3749c, 0x661a2b40,
+		0x214afb16, 0x2fb3749c, 0x661a2b40 } },
+	/* Signed and unsigned hashes differ for bytes above 0x7f */
+	{ "\xe9t\xe9_caf\xe9_with_a_name_longer_than_32_bytes", {
+		0xe9175a30, 0x8bef5830, 0x01f0cd90,
+		0x6c297c10, 0xd27e0a90, 0xbf92b05e } },
+};
+
+/* Test the legacy, half-MD4 and TEA hashes against known values */
+static int dm_test_ext4_dirhash(struct unit_test_state *uts)
+{
+	const __le32 seed[4] = {
+		cpu_to_le32(0xf1e9c5a3), cpu_to_le32(0x604f4d2b),
+		cpu_to_le32(0xa4937281), cpu_to_le32(0xe8d7c6b5),
+	};
+	const __le32 noseed[4] = { 0 };
+	const char *name;
+	int i, version;
+	u32 hash;
+
+	for (i = 0; i < ARRAY_SIZE(ext4_hash_vec); i++) {
+		name = ext4_hash_vec[i].name;
+		for (version = DX_HASH_LEGACY; version <= DX_HASH_TEA_UNSIGNED;
+		     version++) {
+			ut_assertok(ext4fs_dirhash(name, strlen(name), version,
+						   seed, &hash));
+			ut_asserteq(ext4_hash_vec[i].hash[version], hash);
+		}
+	}
+
+	/* An all-zero seed selects the default one */
+	name = "longer_file_name_number_77";
+	ut_assertok(ext4fs_dirhash(name, strlen(name), DX_HASH_LEGACY, noseed,
+				   &hash));
+	ut_asserteq(0x214afb16, hash);
+	ut_assertok(ext4fs_dirhash(name, strlen(name), DX_HASH_HALF_MD4,
+				   noseed, &hash));
+	ut_asserteq(0xe93ac510, hash);
+	ut_assertok(ext4fs_dirhash(name, strlen(name), DX_HASH_TEA, noseed,
+				   &hash));
+	ut_asserteq(0x4aea02d6, hash);
+	ut_assertok(ext4fs_dirhash("hello", 5, DX_HASH_HALF_MD4, noseed,
+				   &hash));
+	ut_asserteq(0x1746da32, hash);
+
+	/* Unknown hashes are refused, so the directory is scanned instead */
+	ut_asserteq(-EINVAL, ext4fs_dirhash(name, strlen(name),
+					    DX_HASH_TEA_UNSIGNED + 1, seed,
+					    &hash));
+
+	return 0;
+}
+DM_TEST(dm_test_ext4_dirhash, 0);
@@ -0,0 +1,490 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for reading and writing fragmented files on a FAT filesystem, and
+ * for allocating clusters
+ */
+
+#include <common.h>
+#include <blk.h>
+#include <dm.h>
+#include <fat.h>
+#include <fs.h>
+#include <mapmem.h>
+#include <memalign.h>
+#include <os.h>
+#include <part.h>
+#include <sandbox_host.h>
+#include <dm/device-internal.h>
+#include <dm/test.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+#define FAT_TEST_SECTORS	128
+#define FAT_TEST_ROOT		2
+
+/* The file is split into more runs than the FAT driver remembers */
+#define FAT_TEST_RUNS		(FAT_EXTENTS + 4)
+#define FAT_TEST_RUNLEN		3
+#define FAT_TEST_SIZE		(FAT_TEST_RUNS * FAT_TEST_RUNLEN * \
+				 DEFAULT_BLKSZ - 100)
+
+/* First cluster of run @i: the runs go backwards on disk, with gaps */
+static u32 fat_test_run(u32 i)
+{
+	return 5 + (FAT_TEST_RUNS - 1 - i) * (FAT_TEST_RUNLEN + 2);
+}
+
+static u8 fat_test_byte(u32 off)
+{
+	return off * 7 + (off >> 9);
+}
+
+/*
+ * Create an empty FAT32 filesystem with one-sector clusters and a single
+ * one-sector FAT after @reserved sectors, returning the FAT
+ */
+static __le32 *fat_test_format(u8 *dst, int reserved)
+{
+	struct boot_sector *bs = (void *)dst;
+	struct volume_info *vi = (void *)(bs + 1);
+	__le32 *fat = (void *)dst + reserved * DEFAULT_BLKSZ;
+
+	bs->sector_size[0] = DEFAULT_BLKSZ & 0xff;
+	bs->sector_size[1] = DEFAULT_BLKSZ >> 8;
+	bs->cluster_size = 1;
+	bs->reserved = cpu_to_le16(reserved);
+	bs->fats = 1;
+	bs->media = 0xf8;
+	bs->total_sect = cpu_to_le32(FAT_TEST_SECTORS);
+	bs->fat32_length = cpu_to_le32(1);
+	bs->root_cluster = cpu_to_le32(FAT_TEST_ROOT);
+	vi->ext_boot_sign = 0x29;
+	memcpy(vi->fs_type, "FAT32   ", sizeof(vi->fs_type));
+	memcpy(dst + 0x1fe, "\x55\xaa", 2);
+
+	fat[0] = cpu_to_le32(0x0ffffff8);
+	fat[1] = cpu_to_le32(0x0fffffff);
+	fat[FAT_TEST_ROOT] = cpu_to_le32(0x0ffffff8);
+
+	return fat;
+}
+
+/*
+ * Create a FAT32 filesystem with a FAT right after the boot sector, so that
+ * cluster n is sector n, holding the file FRAG.BIN
+ */
+static void fat_test_create(u8 *dst)
+{
+	__le32 *fat = fat_test_format(dst, 1);
+	struct dir_entry *dirent = (void *)dst +
+		FAT_TEST_ROOT * DEFAULT_BLKSZ;
+	u32 clust, next, off, i, j, k;
+
+	/* Chain the runs together and fill in the data along the chain */
+	off = 0;
+	for (i = 0; i < FAT_TEST_RUNS; i++) {
+		for (j = 0; j < FAT_TEST_RUNLEN; j++) {
+			u8 *data;
+
+			clust = fat_test_run(i) + j;
+			if (j + 1 < FAT_TEST_RUNLEN)
+				next = clust + 1;
+			else if (i + 1 < FAT_TEST_RUNS)
+				next = fat_test_run(i + 1);
+			else
+				next = 0x0ffffff8;
+			fat[clust] = cpu_to_le32(next);
+
+			data = dst + clust * DEFAULT_BLKSZ;
+			for (k = 0; k < DEFAULT_BLKSZ && off < FAT_TEST_SIZE;
+			     k++, off++)
+				data[k] = fat_test_byte(off);
+		}
+	}
+
+	memcpy(dirent->nameext.name, "FRAG    ", 8);
+	memcpy(dirent->nameext.ext, "BIN", 3);
+	dirent->attr = ATTR_ARCH;
+	dirent->start = cpu_to_le16(fat_test_run(0));
+	dirent->size = cpu_to_le32(FAT_TEST_SIZE);
+}
+
+/* Check that @len bytes read at @off into @buf match the file contents */
+static int fat_test_check(struct unit_test_state *uts, const u8 *buf,
+			  u32 off, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		ut_asserteq(fat_test_byte(off + i), buf[i]);
+
+	return 0;
+}
+
+/* Read @len bytes of @fname at @off and check them */
+static int fat_test_read(struct unit_test_state *uts,
+			 struct blk_desc *desc, const char *fname, u8 *buf,
+			 u32 off, u32 len)
+{
+	loff_t actread;
+
+	memset(buf, '\0', len);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_read(fname, map_to_sysmem(buf), off, len, &actread));
+	ut_asserteq(len, actread);
+	ut_assertok(fat_test_check(uts, buf, off, len));
+
+	return 0;
+}
+
+/*
+ * Write @img to a host file called @name, filling in @fname, and attach it
+ * as a host block device
+ */
+static int fat_test_attach(struct unit_test_state *uts, const u8 *img,
+			   const char *name, char *fname, int size,
+			   struct udevice **devp, struct blk_desc **descp)
+{
+	static char label[] = "fat";
+	struct udevice *blk;
+	int ret;
+
+	ret = os_persistent_file(fname, size, name);
+	ut_assert(!ret || ret == -ENOENT);
+	ut_assertok(os_write_file(fname, img, FAT_TEST_SECTORS * DEFAULT_BLKSZ));
+	ut_assertok(host_create_device(label, true, DEFAULT_BLKSZ, devp));
+	ut_assertok(host_attach_file(*devp, fname));
+	ut_assertok(blk_get_from_parent(*devp, &blk));
+	ut_assertok(device_probe(blk));
+	*descp = dev_get_uclass_plat(blk);
+
+	return 0;
+}
+
+static int fat_test_detach(struct unit_test_state *uts, struct udevice *dev,
+			   const char *fname)
+{
+	ut_assertok(host_detach_file(dev));
+	ut_assertok(device_unbind(dev));
+	ut_assertok(os_unlink(fname));
+
+	return 0;
+}
+
+/* Test reading and writing files spread over several runs of clusters */
+static int dm_test_fat_fragmented(struct unit_test_state *uts)
+{
+	static u8 img[FAT_TEST_SECTORS * DEFAULT_BLKSZ];
+	static u8 buf[FAT_TEST_SIZE];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char fname[256];
+	loff_t actwrite;
+	int i;
+
+	memset(img, '\0', sizeof(img));
+	fat_test_create(img);
+	ut_assertok(fat_test_attach(uts, img, "fat_frag.img", fname,
+				    sizeof(fname), &dev, &desc));
+
+	/* The whole file, then pieces starting and ending inside each run */
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf, 0,
+				  FAT_TEST_SIZE));
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf, 100, 300));
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf,
+				  2 * DEFAULT_BLKSZ + 300, 1000));
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf,
+				  17 * DEFAULT_BLKSZ, 2 * DEFAULT_BLKSZ));
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf,
+				  52 * DEFAULT_BLKSZ + 5,
+				  FAT_TEST_SIZE - 52 * DEFAULT_BLKSZ - 5));
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf,
+				  3 * DEFAULT_BLKSZ + 1, 10));
+
+	/* A new file has to be spread over the gaps between the runs */
+	for (i = 0; i < 20 * DEFAULT_BLKSZ; i++)
+		buf[i] = fat_test_byte(i);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_write("/new.bin", map_to_sysmem(buf), 0,
+			     20 * DEFAULT_BLKSZ, &actwrite));
+	ut_asserteq(20 * DEFAULT_BLKSZ, actwrite);
+	ut_assertok(fat_test_read(uts, desc, "/new.bin", buf, 0,
+				  20 * DEFAULT_BLKSZ));
+	ut_assertok(fat_test_read(uts, desc, "/new.bin", buf,
+				  6 * DEFAULT_BLKSZ + 7, 5 * DEFAULT_BLKSZ));
+
+	/* The original file must be untouched */
+	ut_assertok(fat_test_read(uts, desc, "/frag.bin", buf, 0,
+				  FAT_TEST_SIZE));
+
+	ut_assertok(fat_test_detach(uts, dev, fname));
+
+	return 0;
+}
+DM_TEST(dm_test_fat_fragmented, 0);
+
+/* Test that a filesystem stays mounted between commands until it is dropped */
+static int dm_test_fat_mount_cache(struct unit_test_state *uts)
+{
+	static u8 img[FAT_TEST_SECTORS * DEFAULT_BLKSZ];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char fname[256];
+	loff_t size;
+
+	if (!CONFIG_IS_ENABLED(FS_MOUNT_CACHE))
+		return -EAGAIN;
+
+	memset(img, '\0', sizeof(img));
+	fat_test_create(img);
+	ut_assertok(fat_test_attach(uts, img, "fat_mount.img", fname,
+				    sizeof(fname), &dev, &desc));
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/frag.bin", &size));
+	ut_asserteq(FAT_TEST_SIZE, size);
+
+	/*
+	 * Break the boot sector behind the back of the block layer, so that
+	 * probing the filesystem again would fail
+	 */
+	img[0x1fe] = 0;
+	ut_assertok(os_write_file(fname, img, sizeof(img)));
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+
+	/* The mount is used again, even after looking at the partitions */
+	part_init(desc);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/frag.bin", &size));
+	ut_asserteq(FAT_TEST_SIZE, size);
+
+	/* Once it is dropped, the filesystem is probed and not found */
+	fs_umount();
+	ut_asserteq(-1, fs_set_blk_dev_with_part(desc, 0));
+
+	/* Mend the boot sector and mount the filesystem again */
+	img[0x1fe] = 0x55;
+	ut_assertok(os_write_file(fname, img, sizeof(img)));
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/frag.bin", &size));
+
+	/* Writing to the device drops the mount */
+	img[0x1fe] = 0;
+	ut_asserteq(1, blk_dwrite(desc, 0, 1, img));
+	ut_asserteq(-1, fs_set_blk_dev_with_part(desc, 0));
+
+	ut_assertok(fat_test_detach(uts, dev, fname));
+
+	return 0;
+}
+DM_TEST(dm_test_fat_mount_cache, 0);
+
+/*
+ * The allocator tests use a filesystem with an FSInfo sector in sector 1 and
+ * the FAT in sector 2, so cluster n is sector n + 1. Clusters 2 to 126 exist
+ * and all but the root directory are free.
+ */
+#define FAT_ALLOC_CLUSTERS	(FAT_TEST_SECTORS - 1)
+#define FAT_ALLOC_FREE		(FAT_ALLOC_CLUSTERS - 3)
+
+/* Create the filesystem, with FSInfo claiming @free_count free clusters */
+static __le32 *fat_alloc_create(u8 *dst, u32 free_count)
+{
+	struct boot_sector *bs = (void *)dst;
+	struct fat_fsinfo *fsinfo = (void *)dst + DEFAULT_BLKSZ;
+	__le32 *fat = fat_test_format(dst, 2);
+
+	bs->info_sector = cpu_to_le16(1);
+	fsinfo->lead_sig = cpu_to_le32(FAT_FSINFO_LEAD_SIG);
+	fsinfo->struct_sig = cpu_to_le32(FAT_FSINFO_STRUCT_SIG);
+	fsinfo->trail_sig = cpu_to_le32(FAT_FSINFO_TRAIL_SIG);
+	fsinfo->free_count = cpu_to_le32(free_count);
+	fsinfo->next_free = cpu_to_le32(FAT_FREE_UNKNOWN);
+
+	return fat;
+}
+
+/* Check the free cluster count in the FSInfo sector of the device */
+static int fat_alloc_check_free(struct unit_test_state *uts,
+				struct blk_desc *desc, u32 free_count)
+{
+	ALLOC_CACHE_ALIGN_BUFFER(u8, block, DEFAULT_BLKSZ);
+	struct fat_fsinfo *fsinfo = (void *)block;
+
+	ut_asserteq(1, blk_dread(desc, 1, 1, block));
+	ut_asserteq(free_count, le32_to_cpu(fsinfo->free_count));
+
+	return 0;
+}
+
+/* Write @len bytes of test data to @fname, returning the fs_write() result */
+static int fat_alloc_write(struct unit_test_state *uts,
+			   struct blk_desc *desc, const char *fname, u8 *buf,
+			   u32 len)
+{
+	loff_t actwrite;
+	int ret;
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = fat_test_byte(i);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ret = fs_write(fname, map_to_sysmem(buf), 0, len, &actwrite);
+	if (!ret)
+		ut_asserteq(len, actwrite);
+
+	return ret;
+}
+
+/* Test that a wrong free count in the FSInfo sector does not stop a write */
+static int dm_test_fat_alloc_stale_fsinfo(struct unit_test_state *uts)
+{
+	static u8 img[FAT_TEST_SECTORS * DEFAULT_BLKSZ];
+	static u8 buf[10 * DEFAULT_BLKSZ];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char fname[256];
+
+	/* FSInfo claims that the volume is full, but it is empty */
+	memset(img, '\0', sizeof(img));
+	fat_alloc_create(img, 0);
+	ut_assertok(fat_test_attach(uts, img, "fat_stale.img", fname,
+				    sizeof(fname), &dev, &desc));
+
+	ut_assertok(fat_alloc_write(uts, desc, "/a.bin", buf, sizeof(buf)));
+	ut_assertok(fat_test_read(uts, desc, "/a.bin", buf, 0, sizeof(buf)));
+
+	/* The free count was counted from the FAT and written back */
+	ut_assertok(fat_alloc_check_free(uts, desc, FAT_ALLOC_FREE - 10));
+
+	ut_assertok(fat_test_detach(uts, dev, fname));
+
+	return 0;
+}
+DM_TEST(dm_test_fat_alloc_stale_fsinfo, 0);
+
+/* Test filling up a volume which has only a few clusters left */
+static int dm_test_fat_alloc_full(struct unit_test_state *uts)
+{
+	static u8 img[FAT_TEST_SECTORS * DEFAULT_BLKSZ];
+	static u8 buf[7 * DEFAULT_BLKSZ];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char fname[256];
+	__le32 *fat;
+	u32 clust;
+
+	/* Only the last six clusters are free, but FSInfo claims many more */
+	memset(img, '\0', sizeof(img));
+	fat = fat_alloc_create(img, 100);
+	for (clust = FAT_TEST_ROOT + 1; clust < FAT_ALLOC_CLUSTERS - 6; clust++)
+		fat[clust] = cpu_to_le32(0x0ffffff7);
+	ut_assertok(fat_test_attach(uts, img, "fat_full.img", fname,
+				    sizeof(fname), &dev, &desc));
+
+	/* Seven clusters do not fit, and nothing is changed */
+	ut_assert(fat_alloc_write(uts, desc, "/a.bin", buf, sizeof(buf)));
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_asserteq(0, fs_exists("/a.bin"));
+	ut_assertok(fat_alloc_check_free(uts, desc, 100));
+
+	/* Six clusters use up the volume */
+	ut_assertok(fat_alloc_write(uts, desc, "/a.bin", buf,
+				    6 * DEFAULT_BLKSZ));
+	ut_assertok(fat_test_read(uts, desc, "/a.bin", buf, 0,
+				  6 * DEFAULT_BLKSZ));
+
+	/* Not even a single byte fits now */
+	ut_assert(fat_alloc_write(uts, desc, "/b.bin", buf, 1));
+	ut_assertok(fat_test_read(uts, desc, "/a.bin", buf, 0,
+				  6 * DEFAULT_BLKSZ));
+
+	ut_assertok(fat_test_detach(uts, dev, fname));
+
+	return 0;
+}
+DM_TEST(dm_test_fat_alloc_full, 0);
+
+/* Test writing files into free space scattered over the volume */
+static int dm_test_fat_alloc_fragmented(struct unit_test_state *uts)
+{
+	static u8 img[FAT_TEST_SECTORS * DEFAULT_BLKSZ];
+	static u8 buf[30 * DEFAULT_BLKSZ];
+	u32 clust, free_count = FAT_ALLOC_FREE;
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char fname[256];
+	__le32 *fat;
+
+	/* Every other cluster is in use, up to the last six */
+	memset(img, '\0', sizeof(img));
+	fat = fat_alloc_create(img, FAT_FREE_UNKNOWN);
+	for (clust = FAT_TEST_ROOT + 1; clust < FAT_ALLOC_CLUSTERS - 6;
+	     clust += 2) {
+		fat[clust] = cpu_to_le32(0x0ffffff7);
+		free_count--;
+	}
+	ut_assertok(fat_test_attach(uts, img, "fat_free.img", fname,
+				    sizeof(fname), &dev, &desc));
+
+	ut_assertok(fat_alloc_write(uts, desc, "/a.bin", buf, sizeof(buf)));
+	ut_assertok(fat_alloc_check_free(uts, desc, free_count - 30));
+	ut_assertok(fat_alloc_write(uts, desc, "/b.bin", buf, sizeof(buf)));
+	ut_assertok(fat_alloc_check_free(uts, desc, free_count - 60));
+	ut_assertok(fat_test_read(uts, desc, "/a.bin", buf, 0, sizeof(buf)));
+	ut_assertok(fat_test_read(uts, desc, "/b.bin", buf, 0, sizeof(buf)));
+	ut_assert(fat_alloc_write(uts, desc, "/c.bin", buf,
+				  (free_count - 59) * DEFAULT_BLKSZ));
+
+	ut_assertok(fat_test_detach(uts, dev, fname));
+
+	return 0;
+}
+DM_TEST(dm_test_fat_alloc_fragmented, 0);
+
+/* Test that the free cluster map is kept between writes until dropped */
+static int dm_test_fat_alloc_keep_map(struct unit_test_state *uts)
+{
+	static u8 img[FAT_TEST_SECTORS * DEFAULT_BLKSZ];
+	static u8 buf[10 * DEFAULT_BLKSZ];
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char fname[256];
+	__le32 *fat;
+	u32 clust;
+
+	if (!CONFIG_IS_ENABLED(FS_MOUNT_CACHE))
+		return -EAGAIN;
+
+	memset(img, '\0', sizeof(img));
+	fat_alloc_create(img, FAT_FREE_UNKNOWN);
+	ut_assertok(fat_test_attach(uts, img, "fat_keep.img", fname,
+				    sizeof(fname), &dev, &desc));
+	ut_assertok(fat_alloc_write(uts, desc, "/a.bin", buf, sizeof(buf)));
+
+	/* Mark all clusters in use behind the back of the block layer */
+	ut_asserteq(FAT_TEST_SECTORS,
+		    blk_dread(desc, 0, FAT_TEST_SECTORS, img));
+	fat = (void *)img + 2 * DEFAULT_BLKSZ;
+	for (clust = FAT_TEST_ROOT + 1; clust < FAT_ALLOC_CLUSTERS; clust++) {
+		if (!fat[clust])
+			fat[clust] = cpu_to_le32(0x0ffffff7);
+	}
+	ut_assertok(os_write_file(fname, img, sizeof(img)));
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+
+	/* The next write still knows the clusters as free */
+	ut_assertok(fat_alloc_write(uts, desc, "/b.bin", buf, 1));
+	ut_assertok(fat_test_read(uts, desc, "/b.bin", buf, 0, 1));
+
+	/* Writing the FAT through the block layer, even unchanged, drops it */
+	ut_asserteq(1, blk_dread(desc, 2, 1, fat));
+	ut_asserteq(1, blk_dwrite(desc, 2, 1, fat));
+	ut_assert(fat_alloc_write(uts, desc, "/c.bin", buf, 1));
+	ut_assertok(fat_test_read(uts, desc, "/a.bin", buf, 0, sizeof(buf)));
+
+	ut_assertok(fat_test_detach(uts, dev, fname));
+
+	return 0;
+}
+DM_TEST(dm_test_fat_alloc_keep_map, 0);
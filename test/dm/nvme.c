@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for NVMe, using the sandbox controller emulation
+ */
+
+#include <common.h>
+#include <blk.h>
+#include <dm.h>
+#include <malloc.h>
+#include <memalign.h>
+#include <asm/test.h>
+#include <dm/device-internal.h>
+#include <dm/root.h>
+#include <dm/test.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+#define NVME_TEST_BLOCKS	2100
+/* Blocks in the largest command the emulation takes */
+#define NVME_TEST_MAX_BLOCKS	64
+
+static int nvme_test_probe(struct unit_test_state *uts, struct udevice **devp,
+			   struct blk_desc **descp)
+{
+	struct udevice *blk;
+
+	sandbox_set_enable_memio(true);
+	ut_assertok(device_bind(dm_root(), DM_DRIVER_GET(sandbox_nvme),
+				"nvme-sandbox", NULL, ofnode_null(), devp));
+	ut_assertok(device_probe(*devp));
+	ut_assertok(blk_get_from_parent(*devp, &blk));
+	*descp = dev_get_uclass_plat(blk);
+
+	return 0;
+}
+
+static int nvme_test_remove(struct unit_test_state *uts, struct udevice *dev)
+{
+	ut_assertok(device_remove(dev, DM_REMOVE_NORMAL));
+	ut_assertok(device_unbind(dev));
+	sandbox_set_enable_memio(false);
+
+	return 0;
+}
+
+/* Test that large transfers are split into commands kept in flight together */
+static int dm_test_nvme_rw(struct unit_test_state *uts)
+{
+	struct sandbox_nvme_stats *stats;
+	size_t size = NVME_TEST_BLOCKS * 512;
+	struct blk_desc *desc;
+	struct udevice *dev;
+	char *wbuf, *rbuf;
+	int i;
+
+	ut_assertok(nvme_test_probe(uts, &dev, &desc));
+	ut_asserteq(512, desc->blksz);
+	ut_asserteq(4096, desc->lba);
+	stats = sandbox_nvme_get_stats(dev);
+
+	wbuf = memalign(ARCH_DMA_MINALIGN, size);
+	rbuf = memalign(ARCH_DMA_MINALIGN, size + 512);
+	ut_assertnonnull(wbuf);
+	ut_assertnonnull(rbuf);
+	for (i = 0; i < size; i++)
+		wbuf[i] = i * 7 + (i >> 9);
+
+	/* The commands for 1000 blocks all go out before any is reaped */
+	memset(stats, '\0', sizeof(*stats));
+	ut_asserteq(1000, blk_dwrite(desc, 10, 1000, wbuf));
+	ut_asserteq(DIV_ROUND_UP(1000, NVME_TEST_MAX_BLOCKS), stats->io_cmds);
+	ut_asserteq(NVME_TEST_MAX_BLOCKS, stats->max_blocks);
+	ut_asserteq(stats->io_cmds, stats->max_queued);
+
+	/* More commands than the queue holds, the rest follow as slots free */
+	ut_asserteq(NVME_TEST_BLOCKS,
+		    blk_dwrite(desc, 1100, NVME_TEST_BLOCKS, wbuf));
+	memset(stats, '\0', sizeof(*stats));
+	memset(rbuf, '\0', size);
+	ut_asserteq(NVME_TEST_BLOCKS,
+		    blk_dread(desc, 1100, NVME_TEST_BLOCKS, rbuf));
+	ut_asserteq(DIV_ROUND_UP(NVME_TEST_BLOCKS, NVME_TEST_MAX_BLOCKS),
+		    stats->io_cmds);
+	ut_asserteq(CONFIG_NVME_QUEUE_DEPTH - 1, stats->max_queued);
+	ut_asserteq_mem(wbuf, rbuf, size);
+
+	/* A buffer starting inside a page, so each command straddles pages */
+	memset(rbuf, '\0', size + 512);
+	ut_asserteq(1000, blk_dread(desc, 10, 1000, rbuf + 512));
+	ut_asserteq_mem(wbuf, rbuf + 512, 1000 * 512);
+
+	free(rbuf);
+	free(wbuf);
+
+	return nvme_test_remove(uts, dev);
+}
+DM_TEST(dm_test_nvme_rw, 0);
+
+/* Test asynchronous requests, completed only when polled */
+static int dm_test_nvme_submit(struct unit_test_state *uts)
+{
+	struct blk_req req[2], *reqs[2];
+	struct blk_desc *desc;
+	struct blk_sg sg[3];
+	struct udevice *dev;
+	char *wbuf, *rbuf;
+	int i;
+
+	ut_assertok(nvme_test_probe(uts, &dev, &desc));
+	wbuf = memalign(ARCH_DMA_MINALIGN, 300 * 512);
+	rbuf = memalign(ARCH_DMA_MINALIGN, 300 * 512);
+	ut_assertnonnull(wbuf);
+	ut_assertnonnull(rbuf);
+	for (i = 0; i < 300 * 512; i++)
+		wbuf[i] = i * 3 + (i >> 9);
+	ut_asserteq(300, blk_dwrite(desc, 0, 300, wbuf));
+
+	/* Read it back with two requests, the first into two segments */
+	memset(rbuf, '\0', 300 * 512);
+	sg[0].buf = rbuf + 100 * 512;
+	sg[0].blkcnt = 100;
+	sg[1].buf = rbuf;
+	sg[1].blkcnt = 100;
+	sg[2].buf = rbuf + 200 * 512;
+	sg[2].blkcnt = 100;
+	memset(req, '\0', sizeof(req));
+	req[0].op = BLK_REQ_READ;
+	req[0].start = 0;
+	req[0].sg = sg;
+	req[0].nr_sg = 2;
+	req[1].op = BLK_REQ_READ;
+	req[1].start = 200;
+	req[1].sg = &sg[2];
+	req[1].nr_sg = 1;
+	reqs[0] = &req[0];
+	reqs[1] = &req[1];
+	ut_asserteq(2, blk_submit(desc->bdev, reqs, 2));
+	ut_asserteq(false, req[0].done);
+	ut_asserteq(false, req[1].done);
+
+	ut_asserteq(0, blk_poll(desc->bdev));
+	ut_asserteq(true, req[0].done);
+	ut_asserteq(200, req[0].result);
+	ut_asserteq(true, req[1].done);
+	ut_asserteq(100, req[1].result);
+	ut_asserteq_mem(wbuf, rbuf + 100 * 512, 100 * 512);
+	ut_asserteq_mem(wbuf + 100 * 512, rbuf, 100 * 512);
+	ut_asserteq_mem(wbuf + 200 * 512, rbuf + 200 * 512, 100 * 512);
+
+	free(rbuf);
+	free(wbuf);
+
+	return nvme_test_remove(uts, dev);
+}
+DM_TEST(dm_test_nvme_submit, 0);
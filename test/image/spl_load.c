@@ -14,6 +14,7 @@
 #include <test/spl.h>
 #include <test/ut.h>
 #include <u-boot/crc.h>
+#include <u-boot/sha256.h>
 
 int board_fit_config_name_match(const char *name)
 {
@@ -164,7 +165,7 @@ static size_t start_fit(void *dst, size_t fit_size, size_t data_size,
 static size_t create_fit(void *dst, struct spl_image_info *spl_image,
 			 size_t *data_offset, bool external)
 {
-	size_t prop_size = 596, total_size = prop_size + spl_image->size;
+	size_t prop_size = 704, total_size = prop_size + spl_image->size;
 	size_t off, size;
 
 	if (external) {
@@ -192,7 +193,9 @@ static size_t create_fit(void *dst, struct spl_image_info *spl_image,
 		return 0;
 	if (fdt_property_string(dst, FIT_TYPE_PROP, "firmware"))
 		return 0;
-	if (fdt_property_string(dst, FIT_COMP_PROP, "none"))
+	if (fdt_property_string(dst, FIT_COMP_PROP,
+				spl_image->flags & SPL_COMP_LZMA ? "lzma" :
+								   "none"))
 		return 0;
 	if (fdt_property_u32(dst, FIT_DATA_SIZE_PROP, spl_image->size))
 		return 0;
@@ -206,6 +209,21 @@ static size_t create_fit(void *dst, struct spl_image_info *spl_image,
 		return 0;
 	if (fdt_property_addr(dst, FIT_LOAD_PROP, spl_image->load_addr))
 		return 0;
+	if (CONFIG_IS_ENABLED(FIT_SIGNATURE)) {
+		u8 hash[SHA256_SUM_LEN];
+
+		/* The data has already been put in place */
+		sha256_csum_wd(dst + off, spl_image->size, hash,
+			       CHUNKSZ_SHA256);
+		if (fdt_begin_node(dst, "hash-1"))
+			return 0;
+		if (fdt_property_string(dst, FIT_ALGO_PROP, "sha256"))
+			return 0;
+		if (fdt_property(dst, FIT_VALUE_PROP, hash, sizeof(hash)))
+			return 0;
+		if (fdt_end_node(dst)) /* hash-1 */
+			return 0;
+	}
 	if (fdt_end_node(dst)) /* u-boot */
 		return 0;
 	if (fdt_end_node(dst)) /* images */
@@ -259,6 +277,8 @@ size_t create_image(void *dst, enum spl_test_image type,
 	case IMX8:
 		info->flags = SPL_IMX_CONTAINER;
 		return create_imx8(dst, info, data_offset);
+	case FIT_EXTERNAL_LZMA:
+		info->flags = SPL_COMP_LZMA;
 	case FIT_EXTERNAL:
 		/*
 		 * spl_fit_append_fdt will clobber external images with U-Boot's
@@ -269,7 +289,7 @@ size_t create_image(void *dst, enum spl_test_image type,
 			info->os = IH_OS_TEE;
 		external = true;
 	case FIT_INTERNAL:
-		info->flags = SPL_FIT_FOUND;
+		info->flags |= SPL_FIT_FOUND;
 		return create_fit(dst, info, data_offset, external);
 	}
 
@@ -616,11 +636,11 @@ int do_spl_test_load(struct unit_test_state *uts, const char *test_name,
 		     enum spl_test_image type, struct spl_image_loader *loader,
 		     int (*write_image)(struct unit_test_state *, void *, size_t))
 {
+	bool lzma = type == LEGACY_LZMA || type == FIT_EXTERNAL_LZMA;
 	size_t img_size, img_data, plain_size = SPL_TEST_DATA_SIZE;
 	struct spl_image_info info_write = {
 		.name = test_name,
-		.size = type == LEGACY_LZMA ? sizeof(lzma_compressed) :
-					      plain_size,
+		.size = lzma ? sizeof(lzma_compressed) : plain_size,
 	}, info_read = { };
 	struct spl_boot_device bootdev = {
 		.boot_device = loader->boot_device,
@@ -634,7 +654,7 @@ int do_spl_test_load(struct unit_test_state *uts, const char *test_name,
 	ut_assertnonnull(img);
 
 	data = img + img_data;
-	if (type == LEGACY_LZMA) {
+	if (lzma) {
 		plain = malloc(plain_size);
 		ut_assertnonnull(plain);
 		generate_data(plain, plain_size, "lzma");
@@ -651,11 +671,11 @@ int do_spl_test_load(struct unit_test_state *uts, const char *test_name,
 	ut_assertok(loader->load_image(&info_read, &bootdev));
 	if (check_image_info(uts, &info_write, &info_read))
 		return CMD_RET_FAILURE;
-	if (type == LEGACY_LZMA)
+	if (lzma)
 		ut_asserteq(plain_size, info_read.size);
 	ut_asserteq_mem(plain, phys_to_virt(info_write.load_addr), plain_size);
 
-	if (type == LEGACY_LZMA)
+	if (lzma)
 		free(plain);
 	free(img);
 	return 0;
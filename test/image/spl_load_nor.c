@@ -38,4 +38,5 @@ SPL_IMG_TEST(spl_test_nor, IMX8, 0);
 SPL_IMG_TEST(spl_test_nor, FIT_INTERNAL, 0);
 #if !IS_ENABLED(CONFIG_SPL_LOAD_FIT_FULL)
 SPL_IMG_TEST(spl_test_nor, FIT_EXTERNAL, 0);
+SPL_IMG_TEST(spl_test_nor, FIT_EXTERNAL_LZMA, 0);
 #endif
@@ -39,4 +39,5 @@ SPL_IMG_TEST(spl_test_spi, IMX8, DM_FLAGS);
 SPL_IMG_TEST(spl_test_spi, FIT_INTERNAL, DM_FLAGS);
 #if !IS_ENABLED(CONFIG_SPL_LOAD_FIT_FULL)
 SPL_IMG_TEST(spl_test_spi, FIT_EXTERNAL, DM_FLAGS);
+SPL_IMG_TEST(spl_test_spi, FIT_EXTERNAL_LZMA, DM_FLAGS);
 #endif
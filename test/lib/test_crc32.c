@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Unit tests and benchmark for crc32 and crc32c
+ */
+
+#include <malloc.h>
+#include <time.h>
+#include <test/lib.h>
+#include <test/ut.h>
+#include <u-boot/crc.h>
+#include <linux/errno.h>
+#include <linux/sizes.h>
+
+#define CRC32_POLY_LE	0xedb88320
+#define CRC32C_POLY_LE	0x82f63b78
+
+/* One bit at a time, to check the faster versions against */
+static u32 crc_bitwise(u32 crc, const u8 *buf, size_t len, u32 poly)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+	}
+
+	return crc;
+}
+
+static void fill_buf(u8 *buf, size_t len)
+{
+	u32 seed = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+static int lib_crc32(struct unit_test_state *uts)
+{
+	static const u8 check[] = "123456789";
+	size_t start, len;
+	u8 buf[300];
+	u32 crc;
+
+	ut_asserteq(0xcbf43926, crc32(0, check, 9));
+	ut_asserteq(0, crc32(0, check, 0));
+	ut_asserteq(0x2dfd2d88, crc32_no_comp(0, check, 9));
+
+	/* Every alignment, and lengths either side of the eight-byte steps */
+	fill_buf(buf, sizeof(buf));
+	for (start = 0; start < 8; start++) {
+		for (len = 0; len < sizeof(buf) - start; len += 1 + len / 8) {
+			crc = ~crc_bitwise(~0, buf + start, len, CRC32_POLY_LE);
+			ut_asserteq(crc, crc32(0, buf + start, len));
+			ut_asserteq(crc_bitwise(0, buf + start, len,
+						CRC32_POLY_LE),
+				    crc32_no_comp(0, buf + start, len));
+		}
+	}
+
+	/* Continuing from an earlier CRC */
+	crc = crc32(0, buf, 13);
+	ut_asserteq(crc32(0, buf, sizeof(buf)),
+		    crc32(crc, buf + 13, sizeof(buf) - 13));
+
+	return 0;
+}
+LIB_TEST(lib_crc32, 0);
+
+static int lib_crc32c(struct unit_test_state *uts)
+{
+	static const u8 check[] = "123456789";
+	size_t start, len;
+	u8 buf[300];
+	u32 crc;
+
+	if (!IS_ENABLED(CONFIG_CRC32C))
+		return -EAGAIN;
+
+	ut_asserteq(0xe3069283, ~crc32c(~0, check, 9));
+
+	fill_buf(buf, sizeof(buf));
+	for (start = 0; start < 8; start++) {
+		for (len = 0; len < sizeof(buf) - start; len += 1 + len / 8) {
+			crc = crc_bitwise(~0, buf + start, len, CRC32C_POLY_LE);
+			ut_asserteq(crc, crc32c(~0, buf + start, len));
+		}
+	}
+
+	crc = crc32c(~0, buf, 13);
+	ut_asserteq(crc32c(~0, buf, sizeof(buf)),
+		    crc32c(crc, buf + 13, sizeof(buf) - 13));
+
+	return 0;
+}
+LIB_TEST(lib_crc32c, 0);
+
+/* Show MiB/s for @len bytes taking @us microseconds */
+static void crc_show_speed(const char *name, size_t len, ulong us)
+{
+	printf("%-20s %6lu MiB/s\n", name,
+	       us ? (ulong)((u64)len * 1000000 / SZ_1M / us) : 0);
+}
+
+/* Compare the speed of the CRCs with one byte at a time; run with ut -f */
+static int lib_crc32_speed_norun(struct unit_test_state *uts)
+{
+	const size_t size = SZ_1M, loops = 64;
+	u32 table[256];
+	ulong start;
+	u8 *buf;
+	int i;
+
+	buf = malloc(size);
+	ut_assertnonnull(buf);
+	fill_buf(buf, size);
+
+	start = timer_get_us();
+	for (i = 0; i < loops; i++)
+		crc32(0, buf, size);
+	crc_show_speed("crc32", size * loops, timer_get_us() - start);
+
+	if (IS_ENABLED(CONFIG_CRC32C)) {
+		start = timer_get_us();
+		for (i = 0; i < loops; i++)
+			crc32c(~0, buf, size);
+		crc_show_speed("crc32c", size * loops, timer_get_us() - start);
+
+		crc32c_init(table, CRC32C_POLY_LE);
+		start = timer_get_us();
+		for (i = 0; i < loops; i++)
+			crc32c_cal(~0, (char *)buf, size, table);
+		crc_show_speed("byte at a time", size * loops,
+			       timer_get_us() - start);
+	}
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_crc32_speed_norun, UT_TESTF_MANUAL);
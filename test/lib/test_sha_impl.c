@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Unit tests for choosing between SHA block function implementations
+ */
+
+#include <test/lib.h>
+#include <test/ut.h>
+#include <u-boot/sha256.h>
+#include <u-boot/sha512.h>
+#include <u-boot/sha_impl.h>
+#include <linux/errno.h>
+
+static int sha_test_calls;
+
+/* Hand over to the generic code, counting the calls */
+static void sha_test_generic(enum sha_impl_algo algo, void *state,
+			     const uint8_t *data, unsigned int blocks)
+{
+	struct sha_impl *start = ll_entry_start(struct sha_impl, sha_impl);
+	const int count = ll_entry_count(struct sha_impl, sha_impl);
+	struct sha_impl *impl;
+
+	sha_test_calls++;
+	for (impl = start; impl != start + count; impl++) {
+		if (impl->algo == algo && !strcmp(impl->name, "generic"))
+			impl->process(state, data, blocks);
+	}
+}
+
+static void sha256_test_process(void *state, const uint8_t *data,
+				unsigned int blocks)
+{
+	sha_test_generic(SHA_IMPL_SHA256, state, data, blocks);
+}
+
+static void sha512_test_process(void *state, const uint8_t *data,
+				unsigned int blocks)
+{
+	sha_test_generic(SHA_IMPL_SHA512, state, data, blocks);
+}
+
+static bool sha_test_probe_fail(void)
+{
+	return false;
+}
+
+U_BOOT_SHA_IMPL(sha256_test) = {
+	.name		= "test",
+	.algo		= SHA_IMPL_SHA256,
+	.priority	= -1,
+	.process	= sha256_test_process,
+};
+
+U_BOOT_SHA_IMPL(sha512_test) = {
+	.name		= "test",
+	.algo		= SHA_IMPL_SHA512,
+	.priority	= -1,
+	.process	= sha512_test_process,
+};
+
+U_BOOT_SHA_IMPL(sha256_test_missing) = {
+	.name		= "test-missing",
+	.algo		= SHA_IMPL_SHA256,
+	.priority	= 1000,
+	.probe		= sha_test_probe_fail,
+	.process	= sha256_test_process,
+};
+
+static const uint8_t sha256_abc[SHA256_SUM_LEN] = {
+	0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+	0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+	0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+	0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+
+static const uint8_t sha512_abc[SHA512_SUM_LEN] = {
+	0xdd, 0xaf, 0x35, 0xa1, 0x93, 0x61, 0x7a, 0xba,
+	0xcc, 0x41, 0x73, 0x49, 0xae, 0x20, 0x41, 0x31,
+	0x12, 0xe6, 0xfa, 0x4e, 0x89, 0xa9, 0x7e, 0xa2,
+	0x0a, 0x9e, 0xee, 0xe6, 0x4b, 0x55, 0xd3, 0x9a,
+	0x21, 0x92, 0x99, 0x2a, 0x27, 0x4f, 0xc1, 0xa8,
+	0x36, 0xba, 0x3c, 0x23, 0xa3, 0xfe, 0xeb, 0xbd,
+	0x45, 0x4d, 0x44, 0x23, 0x64, 0x3c, 0xe8, 0x0e,
+	0x2a, 0x9a, 0xc9, 0x4f, 0xa5, 0x4c, 0xa4, 0x9f,
+};
+
+/* The best usable implementation is chosen, and others can be selected */
+static int lib_sha_impl_select(struct unit_test_state *uts)
+{
+	uint8_t out[SHA512_SUM_LEN];
+
+	/* Sandbox has no hash instructions, and test-missing is unusable */
+	ut_asserteq_str("generic", sha_impl_get(SHA_IMPL_SHA256)->name);
+	ut_asserteq_str("generic", sha_impl_get(SHA_IMPL_SHA512)->name);
+
+	ut_asserteq(-ENOENT, sha_impl_set(SHA_IMPL_SHA256, "nothing"));
+	ut_asserteq(-EOPNOTSUPP, sha_impl_set(SHA_IMPL_SHA256, "test-missing"));
+	ut_asserteq_str("generic", sha_impl_get(SHA_IMPL_SHA256)->name);
+
+	sha_test_calls = 0;
+	ut_assertok(sha_impl_set(SHA_IMPL_SHA256, "test"));
+	ut_asserteq_str("test", sha_impl_get(SHA_IMPL_SHA256)->name);
+	sha256_csum_wd((const uint8_t *)"abc", 3, out, CHUNKSZ_SHA256);
+	ut_asserteq_mem(sha256_abc, out, SHA256_SUM_LEN);
+	ut_asserteq(1, sha_test_calls);
+
+	/* Only SHA-256 was changed */
+	sha512_csum_wd((const uint8_t *)"abc", 3, out, CHUNKSZ_SHA512);
+	ut_asserteq_mem(sha512_abc, out, SHA512_SUM_LEN);
+	ut_asserteq(1, sha_test_calls);
+
+	ut_assertok(sha_impl_set(SHA_IMPL_SHA256, NULL));
+	ut_asserteq_str("generic", sha_impl_get(SHA_IMPL_SHA256)->name);
+
+	ut_assertok(sha_impl_set(SHA_IMPL_SHA512, "test"));
+	sha512_csum_wd((const uint8_t *)"abc", 3, out, CHUNKSZ_SHA512);
+	ut_asserteq_mem(sha512_abc, out, SHA512_SUM_LEN);
+	ut_asserteq(2, sha_test_calls);
+	ut_assertok(sha_impl_set(SHA_IMPL_SHA512, NULL));
+
+	return 0;
+}
+LIB_TEST(lib_sha_impl_select, 0);
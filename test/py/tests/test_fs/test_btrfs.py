@@ -0,0 +1,163 @@
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Test reading files from a btrfs image with compressed extents
+
+import hashlib
+import os
+import pytest
+import shutil
+import subprocess
+
+BTRFS_SRC_DIR = 'btrfs_src_dir'
+BTRFS_IMAGE_NAME = 'btrfs.img'
+# Ten compressed extents of 128KiB and a short one
+BTRFS_BIG_SIZE = 10 * 128 * 1024 + 5000
+# Enough small files that their tree blocks do not all fit in the cache
+BTRFS_SMALL_FILES = 6000
+BTRFS_SMALL_SIZE = 200
+BTRFS_SMALL_STEP = 6
+
+def generate_content(size, seed):
+    """
+    Generates text that compresses well but differs along the file.
+    """
+    content = bytearray()
+    i = 0
+    while len(content) < size:
+        content += b'%d: line %d of the file\n' % (seed, i)
+        i += 1
+    return bytes(content[:size])
+
+def make_btrfs_image(build_dir):
+    """
+    Makes a btrfs image with large compressed files and many small ones.
+
+    The image is generated at build_dir with the following structure:
+    btrfs_src_dir/
+    ├── big
+    ├── big2
+    └── small/
+        ├── f0
+        ├── ...
+        └── f5999
+
+    Tree blocks are 4KiB, so that the small files need thousands of them.
+
+    Returns the content of each file, by path.
+    """
+    out = subprocess.run(['mkfs.btrfs', '--help'], capture_output=True,
+                         text=True)
+    if '--compress' not in out.stdout + out.stderr:
+        pytest.skip('mkfs.btrfs cannot compress the files it adds')
+
+    root = os.path.join(build_dir, BTRFS_SRC_DIR)
+    os.makedirs(os.path.join(root, 'small'))
+    files = {'big' : generate_content(BTRFS_BIG_SIZE, 0),
+             'big2' : generate_content(BTRFS_BIG_SIZE // 2, 1)}
+    for i in range(BTRFS_SMALL_FILES):
+        files['small/f%d' % i] = generate_content(BTRFS_SMALL_SIZE, i + 2)
+    for (name, content) in files.items():
+        with open(os.path.join(root, name), 'wb') as f:
+            f.write(content)
+
+    image_path = os.path.join(build_dir, BTRFS_IMAGE_NAME)
+    with open(image_path, 'wb') as f:
+        f.truncate(128 * 1024 * 1024)
+    subprocess.run(['mkfs.btrfs', '-q', '-f', '-n', '4096', '--rootdir', root,
+                    '--compress', 'zstd', image_path],
+                   check=True, stdout=subprocess.DEVNULL)
+    return files
+
+def clean_btrfs_image(build_dir):
+    """
+    Deletes the image and src_dir at build_dir.
+    """
+    shutil.rmtree(os.path.join(build_dir, BTRFS_SRC_DIR), ignore_errors=True)
+    image_path = os.path.join(build_dir, BTRFS_IMAGE_NAME)
+    if os.path.exists(image_path):
+        os.remove(image_path)
+
+def btrfs_load_part(u_boot_console, files, name, offset, length):
+    """
+    Loads part of a file and asserts its checksum.
+    """
+    expected = files[name][offset:offset + length]
+    out = u_boot_console.run_command(
+        'load host 0 $kernel_addr_r /{} {:x} {:x}'.format(name, length,
+                                                          offset))
+    assert '{} bytes read'.format(len(expected)) in out
+
+    out = u_boot_console.run_command(
+        'md5sum $kernel_addr_r {:x}'.format(len(expected)))
+    assert out.split()[-1] == hashlib.md5(expected).hexdigest()
+
+def btrfs_load_at_offsets(u_boot_console, files):
+    """
+    Test loading parts of the file which start inside an extent.
+
+    Only what is left of the first extent past the offset may be taken from
+    it, the rest comes from the following extents.
+    """
+    size = len(files['big'])
+    for offset in (4096, 1, 128 * 1024 - 4096, 200000, 9 * 128 * 1024 + 4096):
+        btrfs_load_part(u_boot_console, files, 'big', offset, size - offset)
+        btrfs_load_part(u_boot_console, files, 'big', offset, 150000)
+
+def btrfs_load_whole(u_boot_console, files):
+    """
+    Test loading whole files, whose compressed extents are read in batches,
+    and parts ending inside an extent, which is then read on its own.
+    """
+    for name in ('big', 'big2', 'big'):
+        btrfs_load_part(u_boot_console, files, name, 0, len(files[name]))
+    for length in (4096, 128 * 1024, 300000, BTRFS_BIG_SIZE - 5000):
+        btrfs_load_part(u_boot_console, files, 'big', 0, length)
+
+def btrfs_load_small(u_boot_console, files):
+    """
+    Test loading small files spread over more tree blocks than are cached.
+
+    The files are loaded side by side and checked together, once in order
+    and once backwards, when the blocks read first have been dropped.
+    """
+    out = u_boot_console.run_command('printenv kernel_addr_r')
+    base = int(out.split('=')[-1], 16)
+    indexes = range(0, BTRFS_SMALL_FILES, BTRFS_SMALL_STEP)
+    slot = 0x100
+    expected = bytearray(len(indexes) * slot)
+    for (n, i) in enumerate(indexes):
+        content = files['small/f%d' % i]
+        expected[n * slot:n * slot + len(content)] = content
+
+    for order in (indexes, reversed(indexes)):
+        u_boot_console.run_command(
+            'mw.b {:x} 0 {:x}'.format(base, len(expected)))
+        for i in order:
+            n = i // BTRFS_SMALL_STEP
+            out = u_boot_console.run_command(
+                'load host 0 {:x} /small/f{}'.format(base + n * slot, i))
+            assert '{} bytes read'.format(BTRFS_SMALL_SIZE) in out
+        out = u_boot_console.run_command(
+            'md5sum {:x} {:x}'.format(base, len(expected)))
+        assert out.split()[-1] == hashlib.md5(expected).hexdigest()
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('fs_btrfs')
+@pytest.mark.requiredtool('mkfs.btrfs')
+def test_btrfs(u_boot_console):
+    """
+    Executes the btrfs test suite.
+    """
+    build_dir = u_boot_console.config.build_dir
+
+    try:
+        files = make_btrfs_image(build_dir)
+        image_path = os.path.join(build_dir, BTRFS_IMAGE_NAME)
+        u_boot_console.run_command('host bind 0 {}'.format(image_path))
+        btrfs_load_at_offsets(u_boot_console, files)
+        btrfs_load_whole(u_boot_console, files)
+        btrfs_load_small(u_boot_console, files)
+        btrfs_load_at_offsets(u_boot_console, files)
+    finally:
+        clean_btrfs_image(build_dir)
@@ -0,0 +1,125 @@
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Test reading compressed EROFS files spread over many physical clusters
+
+import hashlib
+import os
+import pytest
+import random
+import shutil
+import subprocess
+
+PCLUSTER_SRC_DIR = 'erofs_pcluster_src_dir'
+PCLUSTER_IMAGE_NAME = 'erofs_pcluster.img'
+
+def generate_content(size):
+    """
+    Generates text that compresses well, broken up by random bytes which
+    do not compress at all, so that the file has both kinds of pcluster.
+    """
+    rng = random.Random(1234)
+    content = bytearray()
+    i = 0
+    while len(content) < size:
+        while len(content) % 26000 < 20000:
+            content += b'line %d of the text\n' % i
+            i += 1
+        content += bytes(rng.getrandbits(8) for _ in range(6000))
+    return bytes(content[:size])
+
+def make_pcluster_image(build_dir):
+    """
+    Makes an image holding a single compressed file.
+
+    Physical clusters are at most 4KiB, so the file is split into dozens
+    of them.
+    """
+    root = os.path.join(build_dir, PCLUSTER_SRC_DIR)
+    os.makedirs(root)
+    content = generate_content(300000)
+    with open(os.path.join(root, 'big'), 'wb') as f:
+        f.write(content)
+
+    image_path = os.path.join(build_dir, PCLUSTER_IMAGE_NAME)
+    subprocess.run(['mkfs.erofs', '-zlz4', '-C4096', image_path, root],
+                   check=True, stdout=subprocess.DEVNULL)
+    return content
+
+def clean_pcluster_image(build_dir):
+    """
+    Deletes the image and src_dir at build_dir.
+    """
+    shutil.rmtree(os.path.join(build_dir, PCLUSTER_SRC_DIR),
+                  ignore_errors=True)
+    image_path = os.path.join(build_dir, PCLUSTER_IMAGE_NAME)
+    if os.path.exists(image_path):
+        os.remove(image_path)
+
+def erofs_load_part(u_boot_console, content, address, offset, length):
+    """
+    Loads part of the file and asserts its checksum.
+    """
+    expected = content[offset:offset + length]
+    out = u_boot_console.run_command(
+        'erofsload host 0 {} /big {:x} {:x}'.format(address, length, offset))
+    assert '{} bytes read'.format(len(expected)) in out
+
+    out = u_boot_console.run_command(
+        'md5sum {} {:x}'.format(address, len(expected)))
+    assert out.split()[-1] == hashlib.md5(expected).hexdigest()
+
+def erofs_load_whole(u_boot_console, content):
+    """
+    Test loading the whole file, to an aligned and an unaligned address.
+    """
+    for address in ('$kernel_addr_r', '$unaligned'):
+        erofs_load_part(u_boot_console, content, address, 0, len(content))
+
+def erofs_load_unaligned(u_boot_console, content):
+    """
+    Test loading parts which start and end inside pclusters.
+    """
+    size = len(content)
+    for offset in (1, 511, 4097, 20001, 33333, 65537, 100001, 200003):
+        for length in (1, 3000, 70000):
+            erofs_load_part(u_boot_console, content, '$kernel_addr_r', offset,
+                            min(length, size - offset))
+    erofs_load_part(u_boot_console, content, '$unaligned', 12345, 54321)
+    erofs_load_part(u_boot_console, content, '$kernel_addr_r', size - 777,
+                    777)
+
+def erofs_load_in_chunks(u_boot_console, content):
+    """
+    Test loading the file in a row of parts, each one starting where the
+    previous one ended, then the same parts again backwards.
+    """
+    chunks = [(offset, min(9999, len(content) - offset))
+              for offset in range(0, len(content), 9999)]
+    for (offset, length) in chunks + list(reversed(chunks)):
+        erofs_load_part(u_boot_console, content, '$kernel_addr_r', offset,
+                        length)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_erofs')
+@pytest.mark.buildconfigspec('fs_erofs')
+@pytest.mark.requiredtool('mkfs.erofs')
+def test_erofs_pcluster(u_boot_console):
+    """
+    Executes the erofs pcluster test suite.
+    """
+    build_dir = u_boot_console.config.build_dir
+
+    # Restart U-Boot to clear the EFI state, as test_erofs does
+    u_boot_console.restart_uboot()
+
+    try:
+        content = make_pcluster_image(build_dir)
+        image_path = os.path.join(build_dir, PCLUSTER_IMAGE_NAME)
+        u_boot_console.run_command('host bind 0 {}'.format(image_path))
+        u_boot_console.run_command('setexpr unaligned $kernel_addr_r + 3')
+        erofs_load_whole(u_boot_console, content)
+        erofs_load_unaligned(u_boot_console, content)
+        erofs_load_in_chunks(u_boot_console, content)
+    finally:
+        clean_pcluster_image(build_dir)
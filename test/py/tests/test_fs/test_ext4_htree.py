@@ -0,0 +1,125 @@
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Test looking up files in ext4 directories indexed by a hash tree
+
+import os
+import pytest
+import shutil
+import subprocess
+
+HTREE_SRC_DIR = 'htree_src_dir'
+HTREE_IMAGE_NAME = 'htree.img'
+HTREE_FILES = 600
+
+def make_htree_image(build_dir):
+    """
+    Makes an ext4 image with a directory big enough to get a hash tree.
+
+    The image is generated at build_dir with the following structure:
+    htree_src_dir/
+    ├── big/
+    │   ├── longer_file_name_number_0
+    │   ├── ...
+    │   └── longer_file_name_number_599
+    └── top.txt
+
+    Small blocks make the directory span many leaves, and e2fsck -D builds
+    the index, as mkfs.ext4 -d does not.
+    """
+    root = os.path.join(build_dir, HTREE_SRC_DIR)
+    big = os.path.join(root, 'big')
+    os.makedirs(big)
+    for i in range(HTREE_FILES):
+        with open(os.path.join(big, 'longer_file_name_number_%d' % i),
+                  'w') as f:
+            f.write('file %d' % i)
+    with open(os.path.join(root, 'top.txt'), 'w') as f:
+        f.write('hello')
+
+    image_path = os.path.join(build_dir, HTREE_IMAGE_NAME)
+    subprocess.run(['mkfs.ext4', '-q', '-F', '-b', '1024', '-O',
+                    'dir_index,^metadata_csum', '-d', root, image_path, '8M'],
+                   check=True, stdout=subprocess.DEVNULL)
+    # e2fsck returns 1 when it has changed the filesystem
+    ret = subprocess.run(['e2fsck', '-fDy', image_path],
+                         stdout=subprocess.DEVNULL).returncode
+    assert ret in (0, 1)
+
+    # Check that the directory really is indexed now
+    out = subprocess.run(['debugfs', '-R', 'htree /big', image_path],
+                         check=True, capture_output=True, text=True).stdout
+    assert 'Root node dump' in out
+
+def clean_htree_image(build_dir):
+    """
+    Deletes the image and src_dir at build_dir.
+    """
+    shutil.rmtree(os.path.join(build_dir, HTREE_SRC_DIR))
+    os.remove(os.path.join(build_dir, HTREE_IMAGE_NAME))
+
+def htree_load_files(u_boot_console):
+    """
+    Test that files spread over the leaves of the tree are all found.
+    """
+    for i in (0, 1, 77, 298, 599):
+        content = 'file %d' % i
+        out = u_boot_console.run_command(
+            'ext4load host 0 $kernel_addr_r /big/longer_file_name_number_%d' %
+            i)
+        assert '%d bytes read' % len(content) in out
+        out = u_boot_console.run_command(
+            'ext4size host 0 /big/longer_file_name_number_%d; printenv filesize'
+            % i)
+        assert 'filesize=%x' % len(content) in out
+
+def htree_load_missing_files(u_boot_console):
+    """
+    Test that names which are not in the tree are reported as missing.
+    """
+    for name in ('longer_file_name_number_600', 'missing',
+                 'longer_file_name_number_7x'):
+        out = u_boot_console.run_command(
+            'ext4load host 0 $kernel_addr_r /big/%s; echo rc=$?' % name)
+        assert 'rc=1' in out
+
+def htree_dot_entries(u_boot_console):
+    """
+    Test that "." and "..", which are not in the leaves, are still found.
+    """
+    out = u_boot_console.run_command(
+        'ext4load host 0 $kernel_addr_r /big/../top.txt')
+    assert '5 bytes read' in out
+    out = u_boot_console.run_command(
+        'ext4load host 0 $kernel_addr_r /big/./longer_file_name_number_5')
+    assert '6 bytes read' in out
+
+def htree_ls(u_boot_console):
+    """
+    Test that listing the indexed directory shows every file.
+    """
+    out = u_boot_console.run_command('ext4ls host 0 /big')
+    assert 'longer_file_name_number_0' in out
+    assert 'longer_file_name_number_599' in out
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_ext4')
+@pytest.mark.buildconfigspec('fs_ext4')
+@pytest.mark.requiredtool('mkfs.ext4')
+@pytest.mark.requiredtool('e2fsck')
+@pytest.mark.requiredtool('debugfs')
+def test_ext4_htree(u_boot_console):
+    """
+    Executes the ext4 hash tree test suite.
+    """
+    build_dir = u_boot_console.config.build_dir
+
+    try:
+        make_htree_image(build_dir)
+        image_path = os.path.join(build_dir, HTREE_IMAGE_NAME)
+        u_boot_console.run_command('host bind 0 {}'.format(image_path))
+        htree_load_files(u_boot_console)
+        htree_load_missing_files(u_boot_console)
+        htree_dot_entries(u_boot_console)
+        htree_ls(u_boot_console)
+    finally:
+        clean_htree_image(build_dir)
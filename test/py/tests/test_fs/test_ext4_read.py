@@ -0,0 +1,187 @@
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Test reading fragmented and sparse files from ext4, whole and in part
+
+import hashlib
+import os
+import pytest
+import shutil
+import subprocess
+
+READ_SRC_DIR = 'ext4_read_src_dir'
+# Images, by the number of blocks in their fill files, so that they differ
+READ_IMAGES = {'ext4_read_a.img' : 4, 'ext4_read_b.img' : 6}
+READ_BLOCK_SIZE = 1024
+FILL_FILES = 64
+BIG_SIZE = 300 * READ_BLOCK_SIZE + 123
+# Ranges of blocks of the big file made into holes, the last one at its end
+BIG_HOLES = ((0, 1), (40, 59), (250, 255), (290, 300))
+
+def make_read_image(build_dir, image, fill_blocks):
+    """
+    Makes an ext4 image with a fragmented, sparse file.
+
+    The image is generated at build_dir with the following structure:
+    ext4_read_src_dir/
+    ├── big
+    └── fill/
+        ├── f1
+        ├── f3
+        ├── ...
+        └── f63
+
+    Every other fill file is deleted before big is written, so that big
+    takes the gaps and needs an extent tree with an index block. Few
+    inodes per group spread the fill files over all the groups.
+
+    Returns the content of each file, by path.
+    """
+    root = os.path.join(build_dir, READ_SRC_DIR)
+    os.makedirs(os.path.join(root, 'fill'))
+    files = {}
+    for i in range(FILL_FILES):
+        files['fill/f%d' % i] = os.urandom((fill_blocks - 1) *
+                                           READ_BLOCK_SIZE + 100)
+    for (name, content) in files.items():
+        with open(os.path.join(root, name), 'wb') as f:
+            f.write(content)
+
+    image_path = os.path.join(build_dir, image)
+    subprocess.run(['mkfs.ext4', '-q', '-F', '-b', str(READ_BLOCK_SIZE),
+                    '-N', '128', '-O', '^metadata_csum', '-d', root,
+                    image_path, '32M'],
+                   check=True, stdout=subprocess.DEVNULL)
+
+    big = bytearray(os.urandom(BIG_SIZE))
+    big_path = os.path.join(root, 'big')
+    with open(big_path, 'wb') as f:
+        f.write(big)
+    cmds = ['rm /fill/f%d' % i for i in range(0, FILL_FILES, 2)]
+    cmds.append('write %s big' % big_path)
+    for (start, end) in BIG_HOLES:
+        cmds.append('punch /big %d %d' % (start, end))
+        big[start * READ_BLOCK_SIZE:(end + 1) * READ_BLOCK_SIZE] = \
+            bytes((end + 1 - start) * READ_BLOCK_SIZE)
+    subprocess.run(['debugfs', '-w', '-f', '-', image_path],
+                   input='\n'.join(cmds) + '\n', text=True, check=True,
+                   capture_output=True)
+    ret = subprocess.run(['e2fsck', '-fn', image_path],
+                         stdout=subprocess.DEVNULL).returncode
+    assert ret == 0
+
+    for i in range(0, FILL_FILES, 2):
+        del files['fill/f%d' % i]
+    files['big'] = bytes(big[:BIG_SIZE])
+
+    # Check that big really is fragmented
+    out = subprocess.run(['debugfs', '-R', 'ex /big', image_path],
+                         check=True, capture_output=True, text=True).stdout
+    assert ' 1/ 1  20/' in out
+    shutil.rmtree(root)
+
+    return files
+
+def clean_read_images(build_dir):
+    """
+    Deletes the images and src_dir at build_dir.
+    """
+    shutil.rmtree(os.path.join(build_dir, READ_SRC_DIR), ignore_errors=True)
+    for image in READ_IMAGES:
+        image_path = os.path.join(build_dir, image)
+        if os.path.exists(image_path):
+            os.remove(image_path)
+
+def ext4_load_check(u_boot_console, files, name, offset=0, length=None):
+    """
+    Loads a file, or part of it, and asserts its checksum.
+    """
+    content = files[name]
+    if length is None:
+        length = len(content) - offset
+    expected = content[offset:offset + length]
+    out = u_boot_console.run_command(
+        'ext4load host 0 $kernel_addr_r /{} {:x} {:x}'.format(name, length,
+                                                              offset))
+    assert '{} bytes read'.format(len(expected)) in out
+
+    out = u_boot_console.run_command(
+        'md5sum $kernel_addr_r {:x}'.format(len(expected)))
+    assert out.split()[-1] == hashlib.md5(expected).hexdigest()
+
+def ext4_read_whole(u_boot_console, files):
+    """
+    Test loading whole files, spread over extents, holes and groups.
+    """
+    for name in sorted(files):
+        ext4_load_check(u_boot_console, files, name)
+    ext4_load_check(u_boot_console, files, 'big')
+
+def ext4_read_parts(u_boot_console, files):
+    """
+    Test loading parts of the big file which start and end inside extents
+    and holes, in any order.
+    """
+    blksz = READ_BLOCK_SIZE
+    for (offset, length) in ((1, 5000), (3 * blksz + 7, 20 * blksz),
+                             (45 * blksz, 30 * blksz + 1),
+                             (39 * blksz + 1000, 100), (16 * blksz, blksz),
+                             (100 * blksz, 180 * blksz + 3),
+                             (289 * blksz + 500, 2000),
+                             (BIG_SIZE - 1, 1), (0, blksz - 1)):
+        ext4_load_check(u_boot_console, files, 'big', offset, length)
+    ext4_load_check(u_boot_console, files, 'big', 251 * blksz)
+    ext4_load_check(u_boot_console, files, 'fill/f5', 1000, 2000)
+
+def ext4_read_after_write(u_boot_console, files):
+    """
+    Test that what was kept from earlier reads does not hide a write.
+    """
+    size = len(files['fill/f63'])
+    ext4_load_check(u_boot_console, files, 'fill/f63')
+    out = u_boot_console.run_command(
+        'ext4write host 0 $kernel_addr_r /fill/new {:x}'.format(size))
+    assert '{} bytes written'.format(size) in out
+    files['fill/new'] = files['fill/f63']
+    ext4_load_check(u_boot_console, files, 'fill/new')
+    ext4_load_check(u_boot_console, files, 'fill/f61')
+
+    # Replace a file, whose inode is read before and after it is rewritten
+    ext4_load_check(u_boot_console, files, 'fill/f1')
+    out = u_boot_console.run_command(
+        'ext4write host 0 $kernel_addr_r /fill/f61 {:x}'.format(size))
+    assert '{} bytes written'.format(size) in out
+    files['fill/f61'] = files['fill/f1']
+    ext4_load_check(u_boot_console, files, 'fill/f61')
+    ext4_load_check(u_boot_console, files, 'fill/new')
+    ext4_load_check(u_boot_console, files, 'big', 60 * READ_BLOCK_SIZE, 5000)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_ext4')
+@pytest.mark.buildconfigspec('cmd_ext4_write')
+@pytest.mark.buildconfigspec('fs_ext4')
+@pytest.mark.requiredtool('mkfs.ext4')
+@pytest.mark.requiredtool('e2fsck')
+@pytest.mark.requiredtool('debugfs')
+def test_ext4_read(u_boot_console):
+    """
+    Executes the ext4 read test suite.
+
+    Each image is checked, then the first one again, so that what was kept
+    from an image is not used for the next one.
+    """
+    build_dir = u_boot_console.config.build_dir
+
+    try:
+        contents = {}
+        for (image, fill_blocks) in READ_IMAGES.items():
+            contents[image] = make_read_image(build_dir, image, fill_blocks)
+
+        for image in list(READ_IMAGES) + [next(iter(READ_IMAGES))]:
+            files = contents[image]
+            image_path = os.path.join(build_dir, image)
+            u_boot_console.run_command('host bind 0 {}'.format(image_path))
+            ext4_read_whole(u_boot_console, files)
+            ext4_read_parts(u_boot_console, files)
+        ext4_read_after_write(u_boot_console, files)
+    finally:
+        clean_read_images(build_dir)
@@ -79,6 +79,17 @@ def generate_file(file_name, file_size):
     file.write(content)
     file.close()
 
+def generate_pattern(size, seed):
+    """ Generates content that differs with the position and the seed.
+
+    Args:
+        size: the content's length.
+        seed: changes the content, so that files of the same size differ.
+    Returns:
+        The content as bytes.
+    """
+    return bytes((i * 7 + i // 251 + seed) % 256 for i in range(size))
+
 def generate_sqfs_src_dir(build_dir):
     """ Generates the source directory used to make the SquashFS images.
 
@@ -0,0 +1,171 @@
+# SPDX-License-Identifier: GPL-2.0
+#
+# Test that what squashfs keeps between reads gives the right data
+
+import hashlib
+import os
+import shutil
+import pytest
+
+from sqfs_common import check_mksquashfs_version, generate_pattern, mksquashfs
+
+CACHE_SRC_DIR = 'sqfs_cache_src_dir'
+CACHE_IMAGES = {'sqfs_cache_a' : 0, 'sqfs_cache_b' : 100}
+# Four of them fill a fragment block, so they need more blocks than are cached
+SMALL_FILES = 40
+SMALL_SIZE = 1000
+# Three data blocks and a fragment
+BIG_SIZE = 3 * 4096 + 500
+
+def make_cache_image(build_dir, image, seed):
+    """ Makes a SquashFS image with many files sharing fragment blocks.
+
+    The image is generated at build_dir with the following structure:
+    sqfs_cache_src_dir/
+    ├── big
+    └── small/
+        ├── s0
+        ├── ...
+        └── s39
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+        image: the image's name.
+        seed: changes the content of every file, so images differ.
+    Returns:
+        A dictionary with the content of each file, by path.
+    """
+    root = os.path.join(build_dir, CACHE_SRC_DIR)
+    os.makedirs(os.path.join(root, 'small'))
+
+    files = {}
+    for i in range(SMALL_FILES):
+        files['small/s%d' % i] = generate_pattern(SMALL_SIZE, seed + i)
+    files['big'] = generate_pattern(BIG_SIZE, seed + SMALL_FILES)
+    for (name, content) in files.items():
+        with open(os.path.join(root, name), 'wb') as f:
+            f.write(content)
+
+    mksquashfs(' '.join([root, os.path.join(build_dir, image),
+                         '-b 4096 -always-use-fragments -noappend']))
+    shutil.rmtree(root)
+
+    return files
+
+def clean_cache_images(build_dir):
+    """ Deletes the images and the source directory at build_dir.
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+    """
+    shutil.rmtree(os.path.join(build_dir, CACHE_SRC_DIR), ignore_errors=True)
+    for image in CACHE_IMAGES:
+        image_path = os.path.join(build_dir, image)
+        if os.path.exists(image_path):
+            os.remove(image_path)
+
+def sqfs_cache_load(u_boot_console, files, name):
+    """ Loads a file and compares its checksum with the original one.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: the content of each file in the image, by path.
+        name: the file to be loaded.
+    """
+    content = files[name]
+    out = u_boot_console.run_command(
+        'sqfsload host 0 $kernel_addr_r /{}'.format(name))
+    assert '{} bytes read'.format(len(content)) in out
+
+    out = u_boot_console.run_command(
+        'md5sum $kernel_addr_r {:x}'.format(len(content)))
+    assert out.split()[-1] == hashlib.md5(content).hexdigest()
+
+def sqfs_cache_repeated_reads(u_boot_console, files):
+    """ Loads the same file several times in a row.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: the content of each file in the image, by path.
+    """
+    for _ in range(3):
+        sqfs_cache_load(u_boot_console, files, 'big')
+    for _ in range(3):
+        sqfs_cache_load(u_boot_console, files, 'small/s1')
+
+def sqfs_cache_shared_fragments(u_boot_console, files):
+    """ Loads files sharing fragment blocks, in different orders.
+
+    In order, neighbours share the fragment block kept from the previous
+    load. In reverse and scattered order, blocks are dropped from the cache
+    and read again.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: the content of each file in the image, by path.
+    """
+    order = list(range(SMALL_FILES))
+    order += reversed(range(SMALL_FILES))
+    order += [i * 7 % SMALL_FILES for i in range(SMALL_FILES)]
+    for i in order:
+        sqfs_cache_load(u_boot_console, files, 'small/s%d' % i)
+    sqfs_cache_load(u_boot_console, files, 'big')
+
+def sqfs_cache_mixed_commands(u_boot_console, files):
+    """ Loads files between listings and size queries.
+
+    These all use the inode and directory tables kept after the first one.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: the content of each file in the image, by path.
+    """
+    out = u_boot_console.run_command('sqfsls host 0 /small')
+    assert '{}   s39'.format(SMALL_SIZE) in out
+    assert '{} file(s), 0 dir(s)'.format(SMALL_FILES) in out
+
+    out = u_boot_console.run_command('size host 0 /small/s5; printenv filesize')
+    assert 'filesize={:x}'.format(SMALL_SIZE) in out
+    sqfs_cache_load(u_boot_console, files, 'small/s5')
+
+    out = u_boot_console.run_command('sqfsls host 0 /')
+    assert '{}   big'.format(BIG_SIZE) in out
+    sqfs_cache_load(u_boot_console, files, 'big')
+
+    out = u_boot_console.run_command('size host 0 /big; printenv filesize')
+    assert 'filesize={:x}'.format(BIG_SIZE) in out
+    out = u_boot_console.run_command('sqfsls host 0 /small')
+    assert '{}   s0'.format(SMALL_SIZE) in out
+    sqfs_cache_load(u_boot_console, files, 'small/s38')
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_squashfs')
+@pytest.mark.buildconfigspec('fs_squashfs')
+@pytest.mark.requiredtool('mksquashfs')
+def test_sqfs_cache(u_boot_console):
+    """ Executes the SquashFS cache test suite.
+
+    Each image is checked, then the first one again, so that what was kept
+    from an image is not used for the next one.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+    """
+    build_dir = u_boot_console.config.build_dir
+
+    check_mksquashfs_version()
+    try:
+        contents = {}
+        for (image, seed) in CACHE_IMAGES.items():
+            contents[image] = make_cache_image(build_dir, image, seed)
+
+        for image in list(CACHE_IMAGES) + [next(iter(CACHE_IMAGES))]:
+            files = contents[image]
+            image_path = os.path.join(build_dir, image)
+            u_boot_console.run_command('host bind 0 {}'.format(image_path))
+            sqfs_cache_repeated_reads(u_boot_console, files)
+            sqfs_cache_shared_fragments(u_boot_console, files)
+            sqfs_cache_mixed_commands(u_boot_console, files)
+    finally:
+        clean_cache_images(build_dir)
@@ -0,0 +1,160 @@
+# SPDX-License-Identifier: GPL-2.0
+#
+# Test loading the data blocks of squashfs files, whole or in part
+
+import hashlib
+import os
+import shutil
+import struct
+import pytest
+
+from sqfs_common import check_mksquashfs_version, generate_pattern, mksquashfs
+
+READ_SRC_DIR = 'sqfs_read_src_dir'
+READ_IMAGES = {
+        # Uncompressed data blocks and inodes, so that the block list is easy
+        # to find
+        'sqfs_read_raw' : '-noI -noD',
+        'sqfs_read_comp' : '',
+}
+READ_BAD_IMAGE = 'sqfs_read_bad'
+READ_BLOCK_SIZE = 4096
+# Three full data blocks and a short one
+READ_SIZE = 3 * READ_BLOCK_SIZE + 700
+
+def make_read_images(build_dir):
+    """ Makes the SquashFS images, holding a single file without fragments.
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+    Returns:
+        The content of the file.
+    """
+    root = os.path.join(build_dir, READ_SRC_DIR)
+    os.makedirs(root)
+    content = generate_pattern(READ_SIZE, 0)
+    with open(os.path.join(root, 'file'), 'wb') as f:
+        f.write(content)
+
+    for (image, opts) in READ_IMAGES.items():
+        mksquashfs(' '.join([root, os.path.join(build_dir, image),
+                             '-b {} -no-fragments -noappend'.format(
+                                 READ_BLOCK_SIZE), opts]))
+    shutil.rmtree(root)
+
+    return content
+
+def make_bad_image(build_dir):
+    """ Copies the uncompressed image with the first data block too large.
+
+    The first entry of the block list says the block holds twice the block
+    size, which no valid image does.
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+    """
+    with open(os.path.join(build_dir, 'sqfs_read_raw'), 'rb') as f:
+        image = bytearray(f.read())
+
+    # inode_table_start and directory_table_start, in the superblock
+    (inode_start, dir_start) = struct.unpack_from('<QQ', image, 64)
+    # An uncompressed block of READ_BLOCK_SIZE bytes
+    entry = struct.pack('<I', (1 << 24) | READ_BLOCK_SIZE)
+    pos = image.find(entry, inode_start, dir_start)
+    assert pos >= 0
+    struct.pack_into('<I', image, pos, (1 << 24) | 2 * READ_BLOCK_SIZE)
+
+    with open(os.path.join(build_dir, READ_BAD_IMAGE), 'wb') as f:
+        f.write(image)
+
+def clean_read_images(build_dir):
+    """ Deletes the images and the source directory at build_dir.
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+    """
+    shutil.rmtree(os.path.join(build_dir, READ_SRC_DIR), ignore_errors=True)
+    for image in list(READ_IMAGES) + [READ_BAD_IMAGE]:
+        image_path = os.path.join(build_dir, image)
+        if os.path.exists(image_path):
+            os.remove(image_path)
+
+def sqfs_read_check(u_boot_console, content, address, count):
+    """ Loads the first bytes of the file and checks them.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        content: the content of the file.
+        address: the address where the file should be loaded.
+        count: how many bytes to load, 0 for the whole file.
+    """
+    expected = content[:count] if count else content
+    out = u_boot_console.run_command(
+        'sqfsload host 0 {} /file {:x}'.format(address, count))
+    assert '{} bytes read'.format(len(expected)) in out
+
+    out = u_boot_console.run_command(
+        'md5sum {} {:x}'.format(address, len(expected)))
+    assert out.split()[-1] == hashlib.md5(expected).hexdigest()
+
+def sqfs_read_whole_and_part(u_boot_console, content):
+    """ Loads the file whole and cut at various places.
+
+    Whole blocks go straight to the destination when it is aligned, and
+    through a bounce buffer when it is not. A block cut short by the length
+    goes through a bounce buffer.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        content: the content of the file.
+    """
+    u_boot_console.run_command('setexpr unaligned $kernel_addr_r + 1')
+    for address in ('$kernel_addr_r', '$unaligned'):
+        for count in (0, 100, READ_BLOCK_SIZE, READ_BLOCK_SIZE + 1000,
+                      READ_SIZE - 1):
+            sqfs_read_check(u_boot_console, content, address, count)
+
+def sqfs_read_at_offset(u_boot_console):
+    """ Tries to load the file from an offset, which is not supported.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+    """
+    out = u_boot_console.run_command(
+        'sqfsload host 0 $kernel_addr_r /file 100 10; echo rc=$?')
+    assert 'not supported' in out
+    assert 'rc=1' in out
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_squashfs')
+@pytest.mark.buildconfigspec('fs_squashfs')
+@pytest.mark.requiredtool('mksquashfs')
+def test_sqfs_read(u_boot_console):
+    """ Executes the SquashFS data block test suite.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+    """
+    build_dir = u_boot_console.config.build_dir
+
+    check_mksquashfs_version()
+    try:
+        content = make_read_images(build_dir)
+        make_bad_image(build_dir)
+
+        for image in READ_IMAGES:
+            image_path = os.path.join(build_dir, image)
+            u_boot_console.run_command('host bind 0 {}'.format(image_path))
+            sqfs_read_whole_and_part(u_boot_console, content)
+            sqfs_read_at_offset(u_boot_console)
+
+        # A block larger than the block size is refused, not read
+        image_path = os.path.join(build_dir, READ_BAD_IMAGE)
+        u_boot_console.run_command('host bind 0 {}'.format(image_path))
+        out = u_boot_console.run_command(
+            'sqfsload host 0 $kernel_addr_r /file; echo rc=$?')
+        assert 'too many data blocks' in out
+        assert 'rc=1' in out
+    finally:
+        clean_read_images(build_dir)